@@ -30,6 +30,7 @@ import (
 	"strings"
 	"time"
 
+	api_pb "github.com/googlegsa/sfdb/api_go_proto"
 	sfdb_pb "github.com/googlegsa/sfdb/grpc_sfdb_service_go_proto"
 	"google.golang.org/grpc"
 	"google.golang.org/grpc/connectivity"
@@ -58,6 +59,8 @@ type DBParams struct {
 	// TTL for RPC request.
 	// This should be <= `deadline` protobuf field if it's set.
 	ttl int
+	// How the server should encode result rows: rows=any|packed|columnar.
+	rowEncoding api_pb.RowEncoding
 }
 
 // Parse dbParams part of connection string
@@ -79,6 +82,17 @@ func (p *DBParams) Parse(dbParams string) error {
 			}
 			// convert int64 to int
 			p.ttl = int(ttl)
+		case "rows":
+			switch v {
+			case "any":
+				p.rowEncoding = api_pb.RowEncoding_ANY_ROWS
+			case "packed":
+				p.rowEncoding = api_pb.RowEncoding_PACKED_ROWS
+			case "columnar":
+				p.rowEncoding = api_pb.RowEncoding_COLUMNAR_ROWS
+			default:
+				return fmt.Errorf("invalid rows param: %s", v)
+			}
 		}
 	}
 
@@ -104,6 +118,15 @@ func (c *Connection) PrepareContext(ctx context.Context, query string) (driver.S
 		conn:  c,
 		query: query,
 	}
+	// Servers without prepared statements get the values spliced into the
+	// query instead.
+	resp, err := PrepareRPC(ctx, terminate(query), c)
+	if err == nil {
+		s.query = terminate(query)
+		s.prepared = true
+		s.id = resp.GetStatementId()
+		s.paramCount = int(resp.GetParamCount())
+	}
 	return s, nil
 }
 
@@ -25,6 +25,8 @@ import (
 	"fmt"
 	"reflect"
 	"testing"
+
+	api_pb "github.com/googlegsa/sfdb/api_go_proto"
 )
 
 func assertEqual(t *testing.T, want, have interface{}) {
@@ -116,3 +118,16 @@ func TestParseConnStringWrongDBParams(t *testing.T) {
 	assertEqual(t, err, nil)
 	assertEqual(t, conn.params.ttl, 1337)
 }
+
+func TestParseConnStringRowEncoding(t *testing.T) {
+	conn := newConnection()
+
+	connString := "localhost:27910/testdb?rows=columnar&ttl=3"
+	err := ParseConnString(conn, connString)
+	assertEqual(t, err, nil)
+	assertEqual(t, conn.params.rowEncoding, api_pb.RowEncoding_COLUMNAR_ROWS)
+
+	connString = "localhost:27910/testdb?rows=sideways"
+	err = ParseConnString(conn, connString)
+	assertEqual(t, err.Error(), "invalid rows param: sideways")
+}
@@ -31,8 +31,9 @@ import (
 	"strings"
 
 	log "github.com/golang/glog"
+	"github.com/golang/protobuf/proto"
 	"github.com/golang/protobuf/protoc-gen-go/descriptor"
-	"github.com/golang/protobuf/ptypes/any"
+	api_pb "github.com/googlegsa/sfdb/api_go_proto"
 	"github.com/jhump/protoreflect/desc"
 	"github.com/jhump/protoreflect/dynamic"
 )
@@ -40,8 +41,12 @@ import (
 type rows struct {
 	// client side cursor pointing to current record
 	current_row int
-	// rows as byte-encoded protobufs (byte stream)
-	raw_rows []*any.Any
+	// number of rows in the result
+	num_rows int
+	// rows as byte-encoded protobufs (byte stream), unless columnar
+	raw_rows [][]byte
+	// all rows as one protobuf with repeated fields, if columnar
+	columns *dynamic.Message
 	// contains cached column names or column indexes
 	column_names []string
 	// contains cached column types
@@ -51,21 +56,8 @@ type rows struct {
 	message      *dynamic.Message
 }
 
-func NewRows(row_msgs []*any.Any, file_desc_set *descriptor.FileDescriptorSet) (*rows, error) {
-	if len(row_msgs) == 0 {
-		return &rows{
-			current_row:  0,
-			raw_rows:     row_msgs,
-			column_names: []string {},
-			column_types: []*ColumnType {},
-			message:      nil,
-		}, nil
-	}
-
-	if file_desc_set == nil {
-		return nil, errors.New("Parsing message without descriptor is not implemented")
-	}
-
+// parseRowDescriptor finds the message msgTypeId in file_desc_set.
+func parseRowDescriptor(msgTypeId string, file_desc_set *descriptor.FileDescriptorSet) (*desc.MessageDescriptor, error) {
 	var importResolver desc.ImportResolver
 	fileDescriptor, err := importResolver.CreateFileDescriptorFromSet(file_desc_set)
 	if err != nil {
@@ -73,8 +65,6 @@ func NewRows(row_msgs []*any.Any, file_desc_set *descriptor.FileDescriptorSet) (
 		return nil, err
 	}
 
-	msgTypeUrl := row_msgs[0].GetTypeUrl()
-	msgTypeId := msgTypeUrl[strings.LastIndex(msgTypeUrl, "/")+1:]
 	if len(msgTypeId) == 0 {
 		return nil, errors.New("Invalid message id in proto response")
 	}
@@ -83,6 +73,79 @@ func NewRows(row_msgs []*any.Any, file_desc_set *descriptor.FileDescriptorSet) (
 		log.Error("Cannot find descriptor for message in proto response.")
 		return nil, errors.New("Cannot find descriptor for message in proto response.")
 	}
+	return msgDescriptor, nil
+}
+
+// rowTypeName returns the full name of the type of the rows in resp.
+func rowTypeName(resp *api_pb.ExecSqlResponse) string {
+	if resp.RowEncoding != nil {
+		return resp.GetRowType()
+	}
+	msgTypeUrl := resp.Rows[0].GetTypeUrl()
+	return msgTypeUrl[strings.LastIndex(msgTypeUrl, "/")+1:]
+}
+
+// numRows returns the number of rows in resp, whatever their encoding.
+func numRows(resp *api_pb.ExecSqlResponse) int {
+	if resp.RowEncoding != nil {
+		return int(resp.GetPackedRowCount())
+	}
+	return len(resp.Rows)
+}
+
+// splitPackedRows splits a PACKED_ROWS block into rows.
+func splitPackedRows(data []byte, count int) ([][]byte, error) {
+	rows := make([][]byte, 0, count)
+	for len(data) > 0 {
+		size, n := proto.DecodeVarint(data)
+		if n == 0 || uint64(len(data)-n) < size {
+			return nil, errors.New("Malformed packed rows in proto response")
+		}
+		rows = append(rows, data[n:n+int(size)])
+		data = data[n+int(size):]
+	}
+	if len(rows) != count {
+		return nil, errors.New("Wrong number of packed rows in proto response")
+	}
+	return rows, nil
+}
+
+// columnsDescriptor returns the type of a COLUMNAR_ROWS block of rows of
+// type md: md with every field made repeated.
+func columnsDescriptor(md *desc.MessageDescriptor) (*desc.MessageDescriptor, error) {
+	file := proto.Clone(md.GetFile().AsFileDescriptorProto()).(*descriptor.FileDescriptorProto)
+	fileName := file.GetName() + ".columns"
+	file.Name = &fileName
+
+	columns := proto.Clone(md.AsDescriptorProto()).(*descriptor.DescriptorProto)
+	name := columns.GetName() + "Columns"
+	columns.Name = &name
+	repeated := descriptor.FieldDescriptorProto_LABEL_REPEATED
+	for _, f := range columns.Field {
+		f.Label = &repeated
+	}
+	file.MessageType = append(file.MessageType, columns)
+
+	fd, err := desc.CreateFileDescriptor(file, md.GetFile().GetDependencies()...)
+	if err != nil {
+		return nil, err
+	}
+	return fd.FindMessage(md.GetFullyQualifiedName() + "Columns"), nil
+}
+
+// NewRows makes rows out of the result in resp, whose rows are all of type
+// msgDescriptor. msgDescriptor may be nil if there are no rows.
+func NewRows(resp *api_pb.ExecSqlResponse, msgDescriptor *desc.MessageDescriptor) (*rows, error) {
+	num_rows := numRows(resp)
+	if num_rows == 0 {
+		return &rows{
+			current_row:  0,
+			num_rows:     0,
+			column_names: []string {},
+			column_types: []*ColumnType {},
+			message:      nil,
+		}, nil
+	}
 
 	dmsg := dynamic.NewMessage(msgDescriptor)
 	column_names := make([]string, len(dmsg.GetKnownFields()))
@@ -97,13 +160,37 @@ func NewRows(row_msgs []*any.Any, file_desc_set *descriptor.FileDescriptorSet) (
 		column_types[i] = ct
 	}
 
-	return &rows{
+	r := &rows{
 		current_row:  0,
-		raw_rows:     row_msgs,
+		num_rows:     num_rows,
 		column_names: column_names,
 		column_types: column_types,
 		message:      dmsg,
-	}, nil
+	}
+
+	switch resp.GetRowEncoding() {
+	case api_pb.RowEncoding_COLUMNAR_ROWS:
+		columnsType, err := columnsDescriptor(msgDescriptor)
+		if err != nil {
+			return nil, err
+		}
+		r.columns = dynamic.NewMessage(columnsType)
+		if err := r.columns.Unmarshal(resp.PackedRows); err != nil {
+			return nil, err
+		}
+	case api_pb.RowEncoding_PACKED_ROWS:
+		raw_rows, err := splitPackedRows(resp.PackedRows, num_rows)
+		if err != nil {
+			return nil, err
+		}
+		r.raw_rows = raw_rows
+	default:
+		r.raw_rows = make([][]byte, len(resp.Rows))
+		for i, row := range resp.Rows {
+			r.raw_rows[i] = row.GetValue()
+		}
+	}
+	return r, nil
 }
 
 func (r *rows) Close() error {
@@ -113,20 +200,29 @@ func (r *rows) Close() error {
 
 func (r *rows) Next(values []driver.Value) error {
 	log.V(debugLevel).Info("ROWS Next")
-	if r.current_row >= len(r.raw_rows) {
+	if r.current_row >= r.num_rows {
 		log.V(debugLevel).Info("ROWS Next - EOF")
 		return io.EOF
 	}
 
-	err := r.message.Unmarshal(r.raw_rows[r.current_row].GetValue())
-	if err != nil {
-		return err
-	}
-
 	if len(values) != len(r.message.GetKnownFields()) {
 		return errors.New("Internal error: num fields in rows differs from expected")
 	}
 
+	if r.columns != nil {
+		for i, fd := range r.message.GetKnownFields() {
+			values[i] = r.columns.GetRepeatedFieldByNumber(int(fd.GetNumber()), r.current_row)
+			log.V(debugLevel).Info("ROWS Next - Value[", i, "]: '", values[i], "'")
+		}
+		r.current_row += 1
+		return nil
+	}
+
+	err := r.message.Unmarshal(r.raw_rows[r.current_row])
+	if err != nil {
+		return err
+	}
+
 	for i, fd := range r.message.GetKnownFields() {
 		values[i] = r.message.GetField(fd)
 		log.V(debugLevel).Info("ROWS Next - Value[", i, "]: '", values[i], "'")
@@ -33,6 +33,12 @@ import (
 // SendRPC constructs the Protobuf request
 // and execute the RPC ExecSql in SFDB target.
 func SendRPC(ctx context.Context, query string, conn *Connection) (*sfdb_pb.ExecSqlResponse, error) {
+	return SendRequest(ctx, &sfdb_pb.ExecSqlRequest{Sql: &query}, conn)
+}
+
+// SendRequest fills in the connection-wide fields of protoreq
+// and executes the RPC ExecSql in SFDB target.
+func SendRequest(ctx context.Context, protoreq *sfdb_pb.ExecSqlRequest, conn *Connection) (*sfdb_pb.ExecSqlResponse, error) {
 	if conn.params == nil {
 		log.Fatalln("Null pointer to DBParams")
 	}
@@ -50,11 +56,11 @@ func SendRPC(ctx context.Context, query string, conn *Connection) (*sfdb_pb.Exec
 	respCh := make(chan *sfdb_pb.ExecSqlResponse)
 	errCh := make(chan error)
 	go func() {
-		protoreq := sfdb_pb.ExecSqlRequest{
-			Sql:                 &query,
+		if params.rowEncoding != sfdb_pb.RowEncoding_ANY_ROWS {
+			protoreq.RowEncoding = params.rowEncoding.Enum()
 		}
 
-		protoresp, err := (*conn.stub).ExecSql(context.TODO(), &protoreq)
+		protoresp, err := (*conn.stub).ExecSql(context.TODO(), protoreq)
 		if err != nil {
 			errCh <- err
 			return
@@ -75,3 +81,15 @@ func SendRPC(ctx context.Context, query string, conn *Connection) (*sfdb_pb.Exec
 		return nil, err
 	}
 }
+
+// PrepareRPC executes the RPC Prepare in SFDB target, so that query
+// can later be run with bound values by its statement id.
+func PrepareRPC(ctx context.Context, query string, conn *Connection) (*sfdb_pb.PrepareResponse, error) {
+	if conn.params == nil {
+		log.Fatalln("Null pointer to DBParams")
+	}
+	ttl := time.Duration(conn.params.ttl) * time.Second
+	ctx, cancel := context.WithTimeout(ctx, ttl)
+	defer cancel()
+	return (*conn.stub).Prepare(ctx, &sfdb_pb.PrepareRequest{Sql: &query})
+}
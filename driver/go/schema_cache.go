@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Package sfdb: Cache row descriptors by schema fingerprint
+package sfdb
+
+import (
+	"errors"
+	"sync"
+
+	api_pb "github.com/googlegsa/sfdb/api_go_proto"
+	"github.com/jhump/protoreflect/desc"
+)
+
+const (
+	// Most row descriptors the driver keeps.
+	maxCachedSchemas = 256
+	// Most schema fingerprints sent with each request. The server only
+	// leaves the descriptors out of responses with one of these.
+	maxKnownSchemas = 8
+)
+
+// schemaCache keeps the row descriptors of earlier results by schema
+// fingerprint. Fingerprints only depend on the columns, so one cache serves
+// all connections, whichever replica they talk to.
+type schemaCache struct {
+	mu          sync.Mutex
+	descriptors map[uint64]*desc.MessageDescriptor
+	// fingerprints in descriptors, most recently used first
+	recent []uint64
+	// number of requests in flight that listed each fingerprint
+	pinned map[uint64]int
+}
+
+var schemas = newSchemaCache()
+
+func newSchemaCache() *schemaCache {
+	return &schemaCache{
+		descriptors: map[uint64]*desc.MessageDescriptor{},
+		pinned:      map[uint64]int{},
+	}
+}
+
+// Pin returns the fingerprints to send as ExecSqlRequest.known_schemas. Their
+// descriptors are kept until Unpin is called with them, after the response
+// has been handled, since the server leaves them out of the response.
+func (c *schemaCache) Pin() []uint64 {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	known := make([]uint64, len(c.recent))
+	copy(known, c.recent)
+	for _, f := range known {
+		c.pinned[f]++
+	}
+	return known
+}
+
+// Unpin releases the fingerprints returned by Pin.
+func (c *schemaCache) Unpin(known []uint64) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	for _, f := range known {
+		if c.pinned[f]--; c.pinned[f] == 0 {
+			delete(c.pinned, f)
+		}
+	}
+}
+
+// RowDescriptor returns the descriptor of the rows in resp, which is either
+// in resp or was in an earlier response with the same schema. Returns nil if
+// there are no rows.
+func (c *schemaCache) RowDescriptor(resp *api_pb.ExecSqlResponse) (*desc.MessageDescriptor, error) {
+	if numRows(resp) == 0 {
+		return nil, nil
+	}
+
+	if resp.Descriptors == nil {
+		if resp.SchemaFingerprint == nil {
+			return nil, errors.New("Parsing message without descriptor is not implemented")
+		}
+		c.mu.Lock()
+		defer c.mu.Unlock()
+		md, ok := c.descriptors[*resp.SchemaFingerprint]
+		if !ok {
+			return nil, errors.New("Unknown schema fingerprint in proto response")
+		}
+		c.use(*resp.SchemaFingerprint)
+		return md, nil
+	}
+
+	md, err := parseRowDescriptor(rowTypeName(resp), resp.Descriptors)
+	if err != nil {
+		return nil, err
+	}
+	if resp.SchemaFingerprint != nil {
+		c.mu.Lock()
+		defer c.mu.Unlock()
+		if _, ok := c.descriptors[*resp.SchemaFingerprint]; !ok {
+			if len(c.descriptors) >= maxCachedSchemas {
+				c.evict()
+			}
+			c.descriptors[*resp.SchemaFingerprint] = md
+		}
+		c.use(*resp.SchemaFingerprint)
+	}
+	return md, nil
+}
+
+// use moves fingerprint to the front of c.recent. Requires c.mu.
+func (c *schemaCache) use(fingerprint uint64) {
+	for i, f := range c.recent {
+		if f == fingerprint {
+			c.recent = append(c.recent[:i], c.recent[i+1:]...)
+			break
+		}
+	}
+	c.recent = append([]uint64{fingerprint}, c.recent...)
+	if len(c.recent) > maxKnownSchemas {
+		c.recent = c.recent[:maxKnownSchemas]
+	}
+}
+
+// evict drops every descriptor that is neither in c.recent nor pinned.
+// Requires c.mu.
+func (c *schemaCache) evict() {
+	kept := make(map[uint64]*desc.MessageDescriptor, len(c.recent)+len(c.pinned))
+	for _, f := range c.recent {
+		kept[f] = c.descriptors[f]
+	}
+	for f := range c.pinned {
+		if md, ok := c.descriptors[f]; ok {
+			kept[f] = md
+		}
+	}
+	c.descriptors = kept
+}
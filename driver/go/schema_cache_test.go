@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+package sfdb
+
+import (
+	"fmt"
+	"testing"
+
+	"github.com/golang/protobuf/proto"
+	"github.com/golang/protobuf/protoc-gen-go/descriptor"
+	api_pb "github.com/googlegsa/sfdb/api_go_proto"
+)
+
+// schemaResponse returns a result of one packed row of a type named after
+// fingerprint, with the descriptor of that type if withDescriptors.
+func schemaResponse(fingerprint uint64, withDescriptors bool) *api_pb.ExecSqlResponse {
+	name := fmt.Sprintf("Row%d", fingerprint)
+	resp := &api_pb.ExecSqlResponse{
+		SchemaFingerprint: proto.Uint64(fingerprint),
+		RowEncoding:       api_pb.RowEncoding_PACKED_ROWS.Enum(),
+		RowType:           proto.String(name),
+		PackedRows:        []byte{0},
+		PackedRowCount:    proto.Int32(1),
+	}
+	if withDescriptors {
+		resp.Descriptors = &descriptor.FileDescriptorSet{
+			File: []*descriptor.FileDescriptorProto{{
+				Name: proto.String(name + ".proto"),
+				MessageType: []*descriptor.DescriptorProto{{
+					Name: proto.String(name),
+					Field: []*descriptor.FieldDescriptorProto{{
+						Name:   proto.String("a"),
+						Number: proto.Int32(1),
+						Label:  descriptor.FieldDescriptorProto_LABEL_OPTIONAL.Enum(),
+						Type:   descriptor.FieldDescriptorProto_TYPE_INT64.Enum(),
+					}},
+				}},
+			}},
+		}
+	}
+	return resp
+}
+
+// fillCache has the cache learn enough other schemas to evict everything
+// that is neither recent nor pinned.
+func fillCache(t *testing.T, c *schemaCache, first uint64) {
+	for f := first; f < first+2*maxCachedSchemas; f++ {
+		if _, err := c.RowDescriptor(schemaResponse(f, true)); err != nil {
+			t.Fatalf("ERROR: %v", err)
+		}
+	}
+}
+
+func TestSchemaCacheKeepsPinnedDescriptors(t *testing.T) {
+	c := newSchemaCache()
+	if _, err := c.RowDescriptor(schemaResponse(1, true)); err != nil {
+		t.Fatalf("ERROR: %v", err)
+	}
+
+	// A request lists fingerprint 1, then concurrent queries push it out of
+	// the recent ones before the response arrives.
+	known := c.Pin()
+	assertEqual(t, 1, len(known))
+	assertEqual(t, uint64(1), known[0])
+	fillCache(t, c, 100)
+
+	md, err := c.RowDescriptor(schemaResponse(1, false))
+	if err != nil {
+		t.Fatalf("ERROR: %v", err)
+	}
+	assertEqual(t, "Row1", md.GetFullyQualifiedName())
+	c.Unpin(known)
+	assertEqual(t, 0, len(c.pinned))
+
+	// Once unpinned, it can be evicted again.
+	fillCache(t, c, 1000)
+	_, err = c.RowDescriptor(schemaResponse(1, false))
+	if err == nil {
+		t.Fatalf("want error for an evicted fingerprint")
+	}
+	assertEqual(t, "Unknown schema fingerprint in proto response", err.Error())
+}
@@ -27,6 +27,7 @@ import (
 	"errors"
 	"fmt"
 	"strings"
+	"time"
 
 	api_pb "github.com/googlegsa/sfdb/api_go_proto"
 )
@@ -34,6 +35,11 @@ import (
 type stmt struct {
 	conn  *Connection
 	query string
+	// Set if the server prepared the statement; its values are then sent
+	// separately, typed, instead of being spliced into the query.
+	prepared   bool
+	id         uint64
+	paramCount int
 }
 
 func (s *stmt) Close() error {
@@ -42,6 +48,9 @@ func (s *stmt) Close() error {
 
 // NumInput returns the number of placeholder parameters.
 func (s *stmt) NumInput() int {
+	if s.prepared {
+		return s.paramCount
+	}
 	return strings.Count(s.query, "?")
 }
 
@@ -76,6 +85,13 @@ func (s *stmt) Query(args []driver.Value) (driver.Rows, error) {
 // QueryContext executes a prepared query statement with the given arguments
 // and returns the query results as a *Rows.
 func (s *stmt) QueryContext(ctx context.Context, args []driver.NamedValue) (driver.Rows, error) {
+	if s.prepared {
+		req, err := s.request(args)
+		if err != nil {
+			return nil, err
+		}
+		return queryRequest(ctx, req, s.conn)
+	}
 	processedQuery, err := interpolate(s.query, args)
 	if err != nil {
 		return nil, err
@@ -100,6 +116,13 @@ func (s *stmt) Exec(args []driver.Value) (driver.Result, error) {
 
 // ExecContext must honor the context timeout and return when it is canceled.
 func (s *stmt) ExecContext(ctx context.Context, args []driver.NamedValue) (driver.Result, error) {
+	if s.prepared {
+		req, err := s.request(args)
+		if err != nil {
+			return nil, err
+		}
+		return execRequest(ctx, req, s.conn)
+	}
 	processedQuery, err := interpolate(s.query, args)
 	if err != nil {
 		return nil, err
@@ -107,6 +130,53 @@ func (s *stmt) ExecContext(ctx context.Context, args []driver.NamedValue) (drive
 	return ExecRPC(ctx, processedQuery, s.conn)
 }
 
+// request builds the request that runs the prepared statement with args.
+// It carries the query as well, so that a server that does not have the
+// statement, after a restart or a redirect, can prepare it again.
+func (s *stmt) request(args []driver.NamedValue) (*api_pb.ExecSqlRequest, error) {
+	if len(args) != s.paramCount {
+		return nil, fmt.Errorf("statement takes %d parameters, got %d", s.paramCount, len(args))
+	}
+	params := make([]*api_pb.SqlValue, len(args))
+	for _, arg := range args {
+		if arg.Name != "" {
+			return nil, fmt.Errorf("named parameter @%s is not supported, use $%d", arg.Name, arg.Ordinal)
+		}
+		v, err := sqlValue(arg.Value)
+		if err != nil {
+			return nil, fmt.Errorf("parameter $%d: %v", arg.Ordinal, err)
+		}
+		params[arg.Ordinal-1] = v
+	}
+	return &api_pb.ExecSqlRequest{
+		Sql:         &s.query,
+		StatementId: &s.id,
+		Params:      params,
+	}, nil
+}
+
+// sqlValue converts a driver.Value to the typed value the server binds.
+func sqlValue(v driver.Value) (*api_pb.SqlValue, error) {
+	switch v := v.(type) {
+	case bool:
+		return &api_pb.SqlValue{Value: &api_pb.SqlValue_BoolValue{BoolValue: v}}, nil
+	case int64:
+		return &api_pb.SqlValue{Value: &api_pb.SqlValue_Int64Value{Int64Value: v}}, nil
+	case float64:
+		return &api_pb.SqlValue{Value: &api_pb.SqlValue_DoubleValue{DoubleValue: v}}, nil
+	case string:
+		return &api_pb.SqlValue{Value: &api_pb.SqlValue_StringValue{StringValue: v}}, nil
+	case []byte:
+		return &api_pb.SqlValue{Value: &api_pb.SqlValue_StringValue{StringValue: string(v)}}, nil
+	case time.Time:
+		return &api_pb.SqlValue{Value: &api_pb.SqlValue_StringValue{StringValue: v.Format(time.RFC3339Nano)}}, nil
+	case nil:
+		return nil, errors.New("NULL is not supported")
+	default:
+		return nil, fmt.Errorf("unsupported type %T", v)
+	}
+}
+
 // TODO: Add sanitization here
 // for SQLi like 'OR 1=1', 'AND 1=2' etc.
 func sanitizeQuery(query string) error {
@@ -144,19 +214,26 @@ func interpolate(query string, args []driver.NamedValue) (string, error) {
 	r := strings.NewReplacer(replacements...)
 	query = r.Replace(tmp)
 
-	// make sure we have a semicolon at the end of query
+	return terminate(query), nil
+}
+
+// terminate makes sure we have a semicolon at the end of query.
+func terminate(query string) string {
 	if query[len(query)-1:] != ";" {
 		query += ";"
 	}
-
-	return query, nil
+	return query
 }
 
 func DoRPC(ctx context.Context, query string, conn *Connection) (*api_pb.ExecSqlResponse, error) {
+	return doRequest(ctx, &api_pb.ExecSqlRequest{Sql: &query}, conn)
+}
+
+func doRequest(ctx context.Context, req *api_pb.ExecSqlRequest, conn *Connection) (*api_pb.ExecSqlResponse, error) {
 	var resp *api_pb.ExecSqlResponse = nil
 
 	for num_retries := 3; num_retries > 0; {
-		pbResp, pbErr := SendRPC(ctx, query, conn)
+		pbResp, pbErr := SendRequest(ctx, req, conn)
 		if pbErr != nil {
 			return nil, pbErr
 		}
@@ -192,18 +269,33 @@ func DoRPC(ctx context.Context, query string, conn *Connection) (*api_pb.ExecSql
 // queryRPC sends a preprocessed query in statement to SFDB via RPC,
 // then converts the Protobuf response to rows.
 func QueryRPC(ctx context.Context, query string, conn *Connection) (driver.Rows, error) {
-	resp, err := DoRPC(ctx, query, conn)
+	return queryRequest(ctx, &api_pb.ExecSqlRequest{Sql: &query}, conn)
+}
+
+func queryRequest(ctx context.Context, req *api_pb.ExecSqlRequest, conn *Connection) (driver.Rows, error) {
+	req.KnownSchemas = schemas.Pin()
+	defer schemas.Unpin(req.KnownSchemas)
+
+	resp, err := doRequest(ctx, req, conn)
 	if err != nil {
 		return nil, err
 	}
 
-	rows, err := NewRows(resp.Rows, resp.Descriptors)
+	msgDescriptor, err := schemas.RowDescriptor(resp)
+	if err != nil {
+		return nil, err
+	}
+	rows, err := NewRows(resp, msgDescriptor)
 	return rows, err
 }
 
 // execRPC sends a preprocessed query in statement to SFDB via RPC.
 func ExecRPC(ctx context.Context, query string, conn *Connection) (driver.Result, error) {
-	resp, err := DoRPC(ctx, query, conn)
+	return execRequest(ctx, &api_pb.ExecSqlRequest{Sql: &query}, conn)
+}
+
+func execRequest(ctx context.Context, req *api_pb.ExecSqlRequest, conn *Connection) (driver.Result, error) {
+	resp, err := doRequest(ctx, req, conn)
 	if err != nil {
 		return nil, err
 	}
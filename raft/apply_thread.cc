@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "raft/apply_thread.h"
+
+#include <functional>
+
+namespace raft {
+namespace {
+
+using ::absl::Condition;
+using ::absl::MutexLock;
+using ::util::thread::Options;
+
+Options MakeApplyThreadOptions() {
+  Options opts;
+  opts.set_joinable(true);
+  return opts;
+}
+
+}  // namespace
+
+ApplyThread::ApplyThread(std::function<void()> on_commit)
+    : Thread(MakeApplyThreadOptions(), "raft_apply"), on_commit_(on_commit) {}
+
+void ApplyThread::Stop() {
+  {
+    MutexLock lock(&mu_);
+    stopped_ = true;
+  }
+  Join();
+}
+
+void ApplyThread::Poke() {
+  MutexLock lock(&mu_);
+  poked_ = true;
+}
+
+void ApplyThread::Run() {
+  while (true) {
+    {
+      MutexLock lock(&mu_);
+      mu_.Await(Condition(
+          +[](ApplyThread *t) {
+            return t->poked_ || t->stopped_;
+          },
+          this));
+      if (stopped_) break;
+      poked_ = false;
+    }
+    on_commit_();
+  }
+}
+
+}  // namespace raft
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#ifndef RAFT_APPLY_THREAD_H_
+#define RAFT_APPLY_THREAD_H_
+
+#include <functional>
+
+#include "absl/synchronization/mutex.h"
+#include "util/thread/thread.h"
+
+namespace raft {
+
+// The thread that applies committed log entries to the state machine.
+//
+// Sleeps until Poke() is called, then calls ServiceImpl's
+// ApplyCommittedEntries(). Several Poke() calls that arrive while an apply
+// pass is running are coalesced into a single extra pass.
+//
+// Thread-safe.
+class ApplyThread : public Thread {
+ public:
+  explicit ApplyThread(std::function<void()> on_commit);
+
+  ~ApplyThread() override = default;
+  ApplyThread(const ApplyThread &) = delete;
+  ApplyThread &operator=(const ApplyThread &) = delete;
+
+  void Poke();
+  void Stop();  // if you call Start(), call Stop().
+
+ protected:
+  void Run() override;
+
+ private:
+  const std::function<void()> on_commit_;
+
+  absl::Mutex mu_;
+  bool poked_ GUARDED_BY(mu_) = false;
+  bool stopped_ GUARDED_BY(mu_) = false;
+};
+
+}  // namespace raft
+
+#endif  // RAFT_APPLY_THREAD_H_
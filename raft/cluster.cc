@@ -40,10 +40,10 @@ using ::absl::Duration;
 
 std::unique_ptr<RaftServiceStubWrapper> MakeStub(const std::string &target,
                                                  const Options &opts) {
-  return absl::make_unique<RaftServiceStubWrapper>(
-      RaftService::NewStub(
-          grpc::CreateChannel(target, grpc::InsecureChannelCredentials())),
-      opts);
+  std::shared_ptr<grpc::Channel> channel =
+      grpc::CreateChannel(target, grpc::InsecureChannelCredentials());
+  return absl::make_unique<RaftServiceStubWrapper>(RaftService::NewStub(channel),
+                                                   opts, channel);
 }
 
 std::map<std::string, std::unique_ptr<RaftServiceStubWrapper>> MakeStubs(
@@ -91,14 +91,14 @@ struct RequestVoteRpc {
   std::function<void(absl::string_view voter, const RequestVoteResponse &)> on_vote;
   std::unique_ptr<::util::CompletionCallbackIntf> rpc;
 
-  // TODO: implement timeout
   RequestVoteRpc(
       const std::string &member, RaftServiceStubWrapper *stub, Duration timeout,
       const RequestVoteRequest &source_request,
       std::function<void(absl::string_view voter, const RequestVoteResponse &)>
           on_vote)
       : member(member), request(source_request), on_vote(on_vote) {
-    // rpc->set_deadline(timeout);
+    ::util::RequestOptions opts;
+    opts.deadline = timeout;
     rpc = stub->RequestVote(
         request,
         [this](grpc::Status status,
@@ -108,7 +108,8 @@ struct RequestVoteRpc {
                 this->member,
                 *reinterpret_cast<const RequestVoteResponse *>(response));
           delete this;
-        });
+        },
+        opts);
   }
 
   void OnResponse() {}
@@ -118,16 +119,18 @@ struct RequestVoteRpc {
 struct AppendEntriesRpc {
   std::string member;
   std::unique_ptr<::util::CompletionCallbackIntf> rpc;
-  AppendEntriesRequest request;
   std::function<void(const AppendEntriesResponse &)> on_response;
+  std::function<void()> on_failure;
 
-  // TODO: implement timeout
   AppendEntriesRpc(
       const std::string &member, RaftServiceStubWrapper *stub, Duration timeout,
-      const AppendEntriesRequest &source_request,
-      std::function<void(const AppendEntriesResponse &)> on_response)
-      : member(member), request(source_request), on_response(on_response) {
-    // rpc->set_deadline(timeout);
+      const AppendEntriesRequest &request,
+      std::function<void(const AppendEntriesResponse &)> on_response,
+      std::function<void()> on_failure)
+      : member(member), on_response(on_response), on_failure(on_failure) {
+    ::util::RequestOptions opts;
+    opts.deadline = timeout;
+    // The request is serialized before the call returns, so it is not kept.
     rpc = stub->AppendEntries(
         request,
         [this](grpc::Status status,
@@ -135,9 +138,47 @@ struct AppendEntriesRpc {
           if (status.ok()) {
             this->on_response(
                 *reinterpret_cast<const AppendEntriesResponse *>(response));
+          } else if (this->on_failure) {
+            this->on_failure();
           }
           delete this;
-        });
+        },
+        opts);
+  }
+};
+
+// A non-blocking InstallSnapshot RPC that deletes itself on response.
+struct InstallSnapshotRpc {
+  std::string member;
+  std::unique_ptr<::util::CompletionCallbackIntf> rpc;
+  InstallSnapshotRequest request;
+  std::function<void(const InstallSnapshotResponse &)> on_response;
+  std::function<void()> on_failure;
+
+  InstallSnapshotRpc(
+      const std::string &member, RaftServiceStubWrapper *stub, Duration timeout,
+      const InstallSnapshotRequest &source_request,
+      std::function<void(const InstallSnapshotResponse &)> on_response,
+      std::function<void()> on_failure)
+      : member(member),
+        request(source_request),
+        on_response(on_response),
+        on_failure(on_failure) {
+    ::util::RequestOptions opts;
+    opts.deadline = timeout;
+    rpc = stub->InstallSnapshot(
+        request,
+        [this](grpc::Status status,
+               const ::google::protobuf::Message *response) -> void {
+          if (status.ok()) {
+            this->on_response(
+                *reinterpret_cast<const InstallSnapshotResponse *>(response));
+          } else if (this->on_failure) {
+            this->on_failure();
+          }
+          delete this;
+        },
+        opts);
   }
 };
 
@@ -156,18 +197,35 @@ Cluster::Cluster(const Options &opts)
     : my_target_(opts.my_target),
       request_vote_rpc_timeout_(opts.request_vote_rpc_timeout),
       append_entries_rpc_timeout_(opts.append_entries_rpc_timeout),
+      install_snapshot_rpc_timeout_(opts.install_snapshot_rpc_timeout),
       stubs_(MakeStubs(opts)),
       others_(GetOthers(my_target_, stubs_)),
-      my_index_(ComputeKeyIndexIn(my_target_, stubs_)) {}
+      my_index_(ComputeKeyIndexIn(my_target_, stubs_)),
+      stream_append_entries_(opts.stream_append_entries) {}
 
 Cluster::Cluster(std::vector<std::string> &&names,
                  std::vector<std::unique_ptr<RaftServiceStubWrapper>> &&stubs)
     : my_target_(names[0]),
       request_vote_rpc_timeout_(::absl::Seconds(1)),
       append_entries_rpc_timeout_(::absl::Seconds(1)),
+      install_snapshot_rpc_timeout_(::absl::Seconds(1)),
       stubs_(Zip(std::move(names), std::move(stubs))),
       others_(GetOthers(my_target_, stubs_)),
-      my_index_(ComputeKeyIndexIn(my_target_, stubs_)) {}
+      my_index_(ComputeKeyIndexIn(my_target_, stubs_)),
+      stream_append_entries_(false) {}
+
+Cluster::~Cluster() { Shutdown(); }
+
+void Cluster::Shutdown() {
+  {
+    // The streams delete themselves while the stubs drain their completion
+    // queues.
+    absl::MutexLock lock(&mu_);
+    for (const auto &i : streams_) i.second->Close();
+    streams_.clear();
+  }
+  for (const auto &i : stubs_) i.second->Shutdown();
+}
 
 void Cluster::BroadcastRequestVote(
     const RequestVoteRequest &request,
@@ -184,28 +242,79 @@ void Cluster::BroadcastRequestVote(
 
 void Cluster::SendAppendEntries(
     const std::string &member, const AppendEntriesRequest &request,
-    std::function<void(const AppendEntriesResponse &)> on_response) const {
+    std::function<void(const AppendEntriesResponse &)> on_response,
+    std::function<void()> on_failure) const {
   DCHECK(member != me());
+  if (stream_append_entries_ &&
+      StreamAppendEntries(member, request, on_response, on_failure)) {
+    return;
+  }
   RaftServiceStubWrapper *const stub = stubs_.at(std::string(member)).get();
   new AppendEntriesRpc(  // uh-huh!
-      member, stub, append_entries_rpc_timeout_, request, on_response);
+      member, stub, append_entries_rpc_timeout_, request, on_response,
+      on_failure);
+}
+
+bool Cluster::StreamAppendEntries(
+    const std::string &member, const AppendEntriesRequest &request,
+    std::function<void(const AppendEntriesResponse &)> on_response,
+    std::function<void()> on_failure) const {
+  absl::MutexLock lock(&mu_);
+  if (unary_only_.count(member)) return false;
+  auto it = streams_.find(member);
+  if (it != streams_.end() && it->second->failed()) {
+    if (it->second->status().error_code() == grpc::StatusCode::UNIMPLEMENTED) {
+      LOG(INFO) << member << " doesn't support AppendEntries streams";
+      unary_only_.insert(member);
+    }
+    it->second->Close();
+    streams_.erase(it);
+    if (unary_only_.count(member)) return false;
+  }
+  AppendEntriesStream *&stream = streams_[member];
+  if (!stream) {
+    VLOG(1) << me() << " opens an AppendEntries stream to " << member;
+    stream = stubs_.at(member)->AppendEntriesStream(append_entries_rpc_timeout_);
+    if (!stream) {
+      streams_.erase(member);
+      unary_only_.insert(member);
+      return false;
+    }
+  }
+  return stream->Send(request, std::move(on_response), std::move(on_failure));
 }
 
 bool Cluster::SendAppendOnLeader(const std::string &leader,
                                  const LogEntry &e) const {
   AppendOnLeaderRequest request;
-  *request.mutable_entry() = e;
-  AppendOnLeaderResponse response;
+  *request.add_entry() = e;
+  return SendAppendOnLeader(leader, request);
+}
+
+bool Cluster::SendAppendOnLeader(const std::string &leader,
+                                 const AppendOnLeaderRequest &request,
+                                 AppendOnLeaderResponse *response) const {
   RaftServiceStubWrapper *const stub = stubs_.at(leader).get();
 
   auto rpc = stub->AppendOnLeader(request);
 
   if (rpc->Await() && rpc->Status().ok()) {
-    response = rpc->Message();
+    if (response) *response = rpc->Message();
     return true;
   }
 
   return false;
 }
 
+void Cluster::SendInstallSnapshot(
+    const std::string &member, const InstallSnapshotRequest &request,
+    std::function<void(const InstallSnapshotResponse &)> on_response,
+    std::function<void()> on_failure) const {
+  DCHECK(member != me());
+  RaftServiceStubWrapper *const stub = stubs_.at(member).get();
+  new InstallSnapshotRpc(  // sure!
+      member, stub, install_snapshot_rpc_timeout_, request, on_response,
+      on_failure);
+}
+
 }  // namespace raft
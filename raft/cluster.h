@@ -25,12 +25,16 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
+#include "absl/base/thread_annotations.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "raft/options.h"
 #include "raft/raft.grpc.pb.h"
+#include "util/grpc/async_stream.h"
 #include "util/grpc/async_stub_wrapper.h"
 #include "util/types/integral_types.h"
 
@@ -38,19 +42,25 @@ namespace raft {
 class RaftServiceStubWrapper
     : public util::AsyncStubWrapper<RaftService::StubInterface> {
  public:
-  // This method is for testing only
+  // AppendEntries streams are opened on |channel|, which must be the one
+  // |stub| uses. Without it, AppendEntriesStream() returns null.
   RaftServiceStubWrapper(std::unique_ptr<RaftService::StubInterface> &&stub,
-                         const Options &opts)
+                         const Options &opts,
+                         std::shared_ptr<grpc::Channel> channel = nullptr)
       : util::AsyncStubWrapper<RaftService::StubInterface>(
-            std::move(stub), opts.num_dispatch_threads) {}
+            std::move(stub), opts.num_dispatch_threads, std::move(channel)) {}
 
   DEFINE_ASYNC_GRPC_CALL(RequestVote, RequestVoteRequest, RequestVoteResponse);
   DEFINE_ASYNC_GRPC_CALL(AppendEntries, AppendEntriesRequest,
                          AppendEntriesResponse);
+  DEFINE_ASYNC_GRPC_STREAM(RaftService, AppendEntriesStream,
+                           AppendEntriesRequest, AppendEntriesResponse);
   DEFINE_ASYNC_GRPC_CALL(AppendOnLeader, AppendOnLeaderRequest,
                          AppendOnLeaderResponse);
   DEFINE_SYNC_GRPC_CALL(AppendOnLeader, AppendOnLeaderRequest,
                         AppendOnLeaderResponse);
+  DEFINE_ASYNC_GRPC_CALL(InstallSnapshot, InstallSnapshotRequest,
+                         InstallSnapshotResponse);
 
  protected:
   // This constructor is only for testing
@@ -61,10 +71,11 @@ class RaftServiceStubWrapper
 
 // Represents the whole RAFT cluster and lets a member communicate with others.
 //
-// Thread-safe because immutable and pointing to thread-safe Stubby2 stubs.
+// Thread-safe.
 class Cluster {
  public:
   explicit Cluster(const Options &opts);
+  ~Cluster();
 
   // for testing
   Cluster(std::vector<std::string> &&names,
@@ -73,6 +84,10 @@ class Cluster {
   Cluster(const Cluster &) = delete;
   Cluster &operator=(const Cluster &) = delete;
 
+  // Closes the AppendEntries streams and blocks until the callbacks of all
+  // RPCs in flight have run. No RPCs may be sent afterwards.
+  void Shutdown();
+
   size_t size() const { return stubs_.size(); }
   const std::string &me() const { return my_target_; }
   const std::vector<std::string> &others() const { return others_; }
@@ -87,26 +102,58 @@ class Cluster {
           on_vote) const;
 
   // Sends a non-blocking AppendEntries RPC to another RAFT member.
-  // Failed RPCs are ignored; successful responses are returned to the
-  // |on_response| callback.
+  // Successful responses are returned to the |on_response| callback. Failed
+  // or timed out RPCs call |on_failure| instead, if it is set. |request| is
+  // serialized before this returns, and no longer needed then.
+  //
+  // With Options.stream_append_entries, requests to a member travel over one
+  // long-lived stream and are delivered in order. When the stream fails, so
+  // do all requests waiting on it, and the next request opens a new one.
   void SendAppendEntries(
       const std::string &member, const AppendEntriesRequest &request,
-      std::function<void(const AppendEntriesResponse &)> on_response) const;
+      std::function<void(const AppendEntriesResponse &)> on_response,
+      std::function<void()> on_failure = nullptr) const;
 
   // Sends a blocking Append RPC to |leader|, who is the leader, as far as we
   // know. Returns true if the leader has committed the entry; false on leader
   // change.
   bool SendAppendOnLeader(const std::string &leader, const LogEntry &e) const;
 
+  // Same as above, but for a batch of entries. Returns true once the leader
+  // has committed all of them. If |response| is non-null, it receives the
+  // log indices of the entries.
+  bool SendAppendOnLeader(const std::string &leader,
+                          const AppendOnLeaderRequest &request,
+                          AppendOnLeaderResponse *response = nullptr) const;
+
+  // Sends a non-blocking InstallSnapshot RPC with one chunk of a snapshot to
+  // another RAFT member. Callbacks work as in SendAppendEntries().
+  void SendInstallSnapshot(
+      const std::string &member, const InstallSnapshotRequest &request,
+      std::function<void(const InstallSnapshotResponse &)> on_response,
+      std::function<void()> on_failure = nullptr) const;
+
   // Creates a unique message ID.
   uint64 MakeUniqueId() const;
 
  private:
+  using AppendEntriesStream =
+      ::util::GRPCAsyncStream<AppendEntriesRequest, AppendEntriesResponse>;
+
+  // Sends |request| over the stream to |member|, opening one if needed.
+  // Returns false, without calling either callback, if the request has to go
+  // as a separate RPC instead.
+  bool StreamAppendEntries(
+      const std::string &member, const AppendEntriesRequest &request,
+      std::function<void(const AppendEntriesResponse &)> on_response,
+      std::function<void()> on_failure) const;
+
   // Name of this member.
   const std::string my_target_;
 
   const absl::Duration request_vote_rpc_timeout_;
   const absl::Duration append_entries_rpc_timeout_;
+  const absl::Duration install_snapshot_rpc_timeout_;
 
   // Stubby handles to all members, including |my_target|.
   const std::map<std::string, std::unique_ptr<RaftServiceStubWrapper>> stubs_;
@@ -116,6 +163,16 @@ class Cluster {
 
   // Index of this member in the sorted list of all members.
   const int my_index_;
+
+  const bool stream_append_entries_;
+
+  mutable absl::Mutex mu_;
+
+  // The latest AppendEntries stream to each member.
+  mutable std::map<std::string, AppendEntriesStream *> streams_ GUARDED_BY(mu_);
+
+  // Members that don't support AppendEntries streams.
+  mutable std::set<std::string> unary_only_ GUARDED_BY(mu_);
 };
 
 }  // namespace raft
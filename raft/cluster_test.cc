@@ -210,4 +210,28 @@ TEST(ClusterTest, SendAppendOnLeader) {
   EXPECT_TRUE(c.SendAppendOnLeader("a", e));
 }
 
+TEST(ClusterTest, SendAppendOnLeaderBatch) {
+  AppendOnLeaderRequest request = PARSE_TEST_PROTO(R"(
+    entry: { term: 2 id: 12345 msg: "hello" }
+    entry: { term: 2 id: 12346 msg: "world" })");
+
+  AppendOnLeaderResponse response = PARSE_TEST_PROTO(R"()");
+
+  std::vector<std::unique_ptr<RaftServiceStubWrapper>> stubs;
+  auto stub_a = absl::make_unique<RaftServiceStubMock>();
+  EXPECT_ASYNC_RPC1(*stub_a->stub(), AppendOnLeader).Times(0);
+  stubs.push_back(std::move(stub_a));
+
+  auto stub_b = absl::make_unique<RaftServiceStubMock>();
+  EXPECT_ASYNC_RPC1(*stub_b->stub(), AppendOnLeader)
+      .Times(1)
+      .WithRequest(request)
+      .WithResponseError(grpc::Status::CANCELLED);
+  stubs.push_back(std::move(stub_b));
+
+  Cluster c({"b", "a"}, std::move(stubs));
+
+  EXPECT_FALSE(c.SendAppendOnLeader("a", request));
+}
+
 }  // namespace raft
@@ -0,0 +1,507 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "raft/log_storage.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "glog/logging.h"
+#include "util/hash/crc32c.h"
+#include "util/task/canonical_errors.h"
+
+namespace raft {
+namespace {
+
+using ::absl::MutexLock;
+using ::absl::string_view;
+using ::absl::StrCat;
+using ::util::Crc32c;
+using ::util::DataLossError;
+using ::util::InternalError;
+using ::util::OkStatus;
+using ::util::Status;
+using ::util::StatusOr;
+
+constexpr char kSegmentPrefix[] = "log-";
+constexpr char kHardStateFile[] = "hard_state";
+constexpr char kSnapshotFile[] = "snapshot";
+constexpr size_t kHeaderSize = 8;
+constexpr size_t kBlobHeaderSize = 12;
+
+Status ErrnoError(string_view what, string_view path) {
+  return InternalError(StrCat(what, " ", path, ": ", strerror(errno)));
+}
+
+void PutFixed32(uint32 v, char *out) {
+  for (int i = 0; i < 4; ++i) out[i] = static_cast<char>(v >> (8 * i));
+}
+
+void PutFixed64(uint64 v, char *out) {
+  for (int i = 0; i < 8; ++i) out[i] = static_cast<char>(v >> (8 * i));
+}
+
+uint32 GetFixed32(const char *in) {
+  uint32 v = 0;
+  for (int i = 0; i < 4; ++i) v |= uint32{static_cast<uint8>(in[i])} << (8 * i);
+  return v;
+}
+
+uint64 GetFixed64(const char *in) {
+  uint64 v = 0;
+  for (int i = 0; i < 8; ++i) v |= uint64{static_cast<uint8>(in[i])} << (8 * i);
+  return v;
+}
+
+// Appends |msg| to |out| as a record. Records must stay below 4 GiB; bulk
+// data goes into a blob instead.
+void AppendRecord(const google::protobuf::MessageLite &msg, std::string *out) {
+  const size_t start = out->size();
+  out->resize(start + kHeaderSize);
+  const bool serialized = msg.AppendToString(out);
+  const string_view payload(out->data() + start + kHeaderSize,
+                            out->size() - start - kHeaderSize);
+  CHECK(serialized && payload.size() <= std::numeric_limits<uint32>::max())
+      << "RAFT log record of " << msg.ByteSizeLong() << " bytes is too large";
+  PutFixed32(payload.size(), &(*out)[start]);
+  PutFixed32(Crc32c(payload), &(*out)[start + 4]);
+}
+
+// Returns the header of a blob holding |data|: its size as fixed64 and its
+// checksum as fixed32. The data follows.
+std::string BlobHeader(string_view data) {
+  std::string header(kBlobHeaderSize, '\0');
+  PutFixed64(data.size(), &header[0]);
+  PutFixed32(Crc32c(data), &header[8]);
+  return header;
+}
+
+// Parses the record at the start of |data| into |msg|. Returns the size of
+// the record, or 0 if it is torn or corrupt.
+size_t ReadRecord(string_view data, google::protobuf::MessageLite *msg) {
+  if (data.size() < kHeaderSize) return 0;
+  const uint32 size = GetFixed32(data.data());
+  if (data.size() - kHeaderSize < size) return 0;
+  const string_view payload = data.substr(kHeaderSize, size);
+  if (GetFixed32(data.data() + 4) != Crc32c(payload)) return 0;
+  if (!msg->ParseFromArray(payload.data(), payload.size())) return 0;
+  return kHeaderSize + size;
+}
+
+// Copies the data of the blob that makes up all of |data| into |out|.
+// Returns false if it is torn or corrupt.
+bool ReadBlob(string_view data, std::string *out) {
+  if (data.size() < kBlobHeaderSize) return false;
+  const uint64 size = GetFixed64(data.data());
+  if (data.size() - kBlobHeaderSize != size) return false;
+  const string_view blob = data.substr(kBlobHeaderSize);
+  if (GetFixed32(data.data() + 8) != Crc32c(blob)) return false;
+  out->assign(blob.data(), blob.size());
+  return true;
+}
+
+Status WriteFully(int fd, string_view data, string_view path) {
+  while (!data.empty()) {
+    const ssize_t n = write(fd, data.data(), data.size());
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return ErrnoError("Failed to write", path);
+    }
+    data.remove_prefix(n);
+  }
+  return OkStatus();
+}
+
+Status ReadFully(const std::string &path, std::string *out) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return ErrnoError("Failed to open", path);
+  out->clear();
+  char buf[1 << 16];
+  for (;;) {
+    const ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      const Status s = ErrnoError("Failed to read", path);
+      close(fd);
+      return s;
+    }
+    if (n == 0) break;
+    out->append(buf, n);
+  }
+  close(fd);
+  return OkStatus();
+}
+
+}  // namespace
+
+// A segment file.
+struct LogStorage::Segment {
+  ~Segment() {
+    if (fd >= 0) close(fd);
+  }
+
+  // Index of the last entry in this segment.
+  uint64 last_index() const { return first_index + offsets.size() - 1; }
+
+  std::string path;
+  int fd = -1;
+  uint64 first_index = 0;
+  uint64 size = 0;
+  // File offset of each record.
+  std::vector<uint64> offsets;
+};
+
+LogStorage::LogStorage(const Options &opts)
+    : dir_(opts.log_dir),
+      fsync_policy_(opts.fsync_policy),
+      segment_bytes_(opts.log_segment_bytes) {}
+
+LogStorage::~LogStorage() = default;
+
+StatusOr<std::unique_ptr<LogStorage>> LogStorage::Open(
+    const Options &opts, HardState *hard_state, Snapshot *snapshot,
+    std::vector<LogEntry> *entries) {
+  std::unique_ptr<LogStorage> storage(new LogStorage(opts));
+  if (mkdir(storage->dir_.c_str(), 0755) < 0 && errno != EEXIST) {
+    return ErrnoError("Failed to create", storage->dir_);
+  }
+  MutexLock lock(&storage->mu_);
+  const Status s = storage->Recover(hard_state, snapshot, entries);
+  if (!s.ok()) return s;
+  return std::move(storage);
+}
+
+Status LogStorage::Recover(HardState *hard_state, Snapshot *snapshot,
+                           std::vector<LogEntry> *entries) {
+  hard_state->Clear();
+  snapshot->Clear();
+  entries->clear();
+
+  std::vector<std::pair<uint64, std::string>> files;
+  bool has_hard_state = false;
+  bool has_snapshot = false;
+  DIR *dir = opendir(dir_.c_str());
+  if (!dir) return ErrnoError("Failed to list", dir_);
+  while (const struct dirent *d = readdir(dir)) {
+    const string_view name = d->d_name;
+    uint64 first_index;
+    if (name == kHardStateFile) {
+      has_hard_state = true;
+    } else if (name == kSnapshotFile) {
+      has_snapshot = true;
+    } else if (absl::StartsWith(name, kSegmentPrefix) &&
+               absl::SimpleAtoi(name.substr(strlen(kSegmentPrefix)),
+                                &first_index)) {
+      files.emplace_back(first_index, StrCat(dir_, "/", name));
+    }
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end());
+
+  if (has_hard_state) {
+    const std::string path = StrCat(dir_, "/", kHardStateFile);
+    std::string data;
+    Status s = ReadFully(path, &data);
+    if (!s.ok()) return s;
+    if (!ReadRecord(data, hard_state)) {
+      return DataLossError(StrCat("Corrupt RAFT hard state in ", path));
+    }
+    MutexLock lock(&hard_state_mu_);
+    hard_state_ = *hard_state;
+  }
+
+  if (has_snapshot) {
+    const std::string path = StrCat(dir_, "/", kSnapshotFile);
+    std::string data;
+    Status s = ReadFully(path, &data);
+    if (!s.ok()) return s;
+    // Snapshots saved as a single record carry their data in it.
+    const size_t n = ReadRecord(data, snapshot);
+    if (!n || (n < data.size() &&
+               !ReadBlob(string_view(data).substr(n),
+                         snapshot->mutable_data()))) {
+      return DataLossError(StrCat("Corrupt RAFT snapshot in ", path));
+    }
+    MutexLock lock(&snapshot_mu_);
+    snapshot_index_ = snapshot->last_included_index();
+  }
+
+  // The log continues after the snapshot. The first segment may still hold
+  // some entries the snapshot covers; those are skipped.
+  const uint64 base = snapshot->last_included_index();
+  last_index_ = base;
+  std::string data;
+  bool damaged = false;
+  for (const auto &file : files) {
+    // Everything after a damaged record is unusable: it might not follow on
+    // from the entries we have.
+    if (damaged || (segments_.empty() ? file.first > base + 1
+                                      : file.first != last_index_ + 1)) {
+      LOG(WARNING) << "Deleting RAFT log segment " << file.second
+                   << " that doesn't follow entry " << last_index_;
+      damaged = true;
+      if (unlink(file.second.c_str()) < 0) {
+        return ErrnoError("Failed to delete", file.second);
+      }
+      continue;
+    }
+
+    auto seg = std::make_shared<Segment>();
+    seg->path = file.second;
+    seg->first_index = file.first;
+    seg->fd = open(seg->path.c_str(), O_WRONLY | O_APPEND);
+    if (seg->fd < 0) return ErrnoError("Failed to open", seg->path);
+    Status s = ReadFully(seg->path, &data);
+    if (!s.ok()) return s;
+
+    string_view rest = data;
+    LogEntry e;
+    while (!rest.empty()) {
+      const size_t n = ReadRecord(rest, &e);
+      if (!n) {
+        LOG(WARNING) << "Dropping " << rest.size() << " damaged bytes at the "
+                     << "end of RAFT log segment " << seg->path;
+        if (ftruncate(seg->fd, seg->size) < 0) {
+          return ErrnoError("Failed to truncate", seg->path);
+        }
+        damaged = true;
+        break;
+      }
+      seg->offsets.push_back(seg->size);
+      seg->size += n;
+      if (seg->last_index() > base) entries->push_back(std::move(e));
+      rest.remove_prefix(n);
+    }
+    if (seg->last_index() <= base) {
+      // Left over from a compaction interrupted by a crash.
+      if (unlink(seg->path.c_str()) < 0) {
+        return ErrnoError("Failed to delete", seg->path);
+      }
+      continue;
+    }
+    last_index_ = seg->last_index();
+    segments_.push_back(std::move(seg));
+  }
+
+  // Whatever we have read may still be only in the page cache.
+  if (!segments_.empty() && fsync_policy_ == Options::FSYNC_ALWAYS &&
+      fdatasync(segments_.back()->fd) < 0) {
+    return ErrnoError("Failed to sync", segments_.back()->path);
+  }
+  synced_index_ = last_index_;
+  return OkStatus();
+}
+
+Status LogStorage::StartSegment(uint64 first_index) {
+  auto seg = std::make_shared<Segment>();
+  seg->path = absl::StrFormat("%s/%s%020u", dir_, kSegmentPrefix, first_index);
+  seg->first_index = first_index;
+  seg->fd = open(seg->path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_TRUNC,
+                 0644);
+  if (seg->fd < 0) return ErrnoError("Failed to create", seg->path);
+  segments_.push_back(std::move(seg));
+  if (fsync_policy_ == Options::FSYNC_ALWAYS) return SyncDir();
+  return OkStatus();
+}
+
+Status LogStorage::Append(const LogEntry *entries, size_t n) {
+  std::vector<const LogEntry *> pointers(n);
+  for (size_t i = 0; i < n; ++i) pointers[i] = &entries[i];
+  return Append(pointers.data(), n);
+}
+
+Status LogStorage::Append(const LogEntry *const *entries, size_t n) {
+  MutexLock lock(&mu_);
+  std::string buf;
+  for (size_t i = 0; i < n; ++i) {
+    if (segments_.empty() || segments_.back()->size >= segment_bytes_) {
+      if (!segments_.empty()) {
+        Status s = WriteFully(segments_.back()->fd, buf, segments_.back()->path);
+        if (!s.ok()) return s;
+        buf.clear();
+      }
+      Status s = StartSegment(last_index_ + 1);
+      if (!s.ok()) return s;
+    }
+    Segment *seg = segments_.back().get();
+    const size_t start = buf.size();
+    AppendRecord(*entries[i], &buf);
+    seg->offsets.push_back(seg->size);
+    seg->size += buf.size() - start;
+    ++last_index_;
+  }
+  if (buf.empty()) return OkStatus();
+  return WriteFully(segments_.back()->fd, buf, segments_.back()->path);
+}
+
+Status LogStorage::TruncateFrom(uint64 index) {
+  MutexLock lock(&mu_);
+  if (index > last_index_) return OkStatus();
+  bool deleted = false;
+  while (!segments_.empty() && segments_.back()->first_index >= index) {
+    if (unlink(segments_.back()->path.c_str()) < 0) {
+      return ErrnoError("Failed to delete", segments_.back()->path);
+    }
+    segments_.pop_back();
+    deleted = true;
+  }
+  if (!segments_.empty()) {
+    Segment *seg = segments_.back().get();
+    const uint64 k = index - seg->first_index;
+    if (k < seg->offsets.size()) {
+      if (ftruncate(seg->fd, seg->offsets[k]) < 0) {
+        return ErrnoError("Failed to truncate", seg->path);
+      }
+      seg->size = seg->offsets[k];
+      seg->offsets.resize(k);
+    }
+  }
+  last_index_ = index - 1;
+  ++num_truncations_;
+  if (synced_index_ > last_index_) synced_index_ = last_index_;
+  if (deleted && fsync_policy_ == Options::FSYNC_ALWAYS) return SyncDir();
+  return OkStatus();
+}
+
+Status LogStorage::Sync(uint64 index) {
+  MutexLock sync_lock(&sync_mu_);
+  while (synced_index_ < index) {
+    std::vector<std::shared_ptr<Segment>> dirty;
+    uint64 last_index, num_truncations;
+    {
+      MutexLock lock(&mu_);
+      last_index = last_index_;
+      num_truncations = num_truncations_;
+      index = std::min(index, last_index);
+      for (auto it = segments_.rbegin(); it != segments_.rend(); ++it) {
+        dirty.push_back(*it);
+        if ((*it)->first_index <= synced_index_ + 1) break;
+      }
+    }
+    if (fsync_policy_ == Options::FSYNC_ALWAYS) {
+      for (const auto &seg : dirty) {
+        if (fdatasync(seg->fd) < 0) return ErrnoError("Failed to sync", seg->path);
+      }
+    }
+    MutexLock lock(&mu_);
+    // If the log was truncated meanwhile, what we have synced may have been
+    // replaced by entries we haven't; try again.
+    if (num_truncations == num_truncations_) synced_index_ = last_index;
+  }
+  return OkStatus();
+}
+
+Status LogStorage::SaveHardState(const HardState &hard_state) {
+  MutexLock lock(&hard_state_mu_);
+  hard_state_.set_term(hard_state.term());
+  hard_state_.set_voted_for(hard_state.voted_for());
+  return WriteHardState(/*sync=*/true);
+}
+
+Status LogStorage::SaveCommitIndex(uint64 commit_index) {
+  MutexLock lock(&hard_state_mu_);
+  hard_state_.set_commit_index(commit_index);
+  return WriteHardState(/*sync=*/false);
+}
+
+Status LogStorage::SaveSnapshot(const Snapshot &snapshot) {
+  MutexLock snapshot_lock(&snapshot_mu_);
+  const uint64 index = snapshot.last_included_index();
+  if (index <= snapshot_index_) return OkStatus();
+  // The data may not fit into a record, so it follows as a blob.
+  Snapshot header;
+  header.set_last_included_index(index);
+  header.set_last_included_term(snapshot.last_included_term());
+  Status s = ReplaceFile(kSnapshotFile, header, &snapshot.data(),
+                         /*sync=*/true);
+  if (!s.ok()) return s;
+  snapshot_index_ = index;
+
+  MutexLock lock(&mu_);
+  bool deleted = false;
+  while (!segments_.empty() && segments_.front()->last_index() <= index) {
+    if (unlink(segments_.front()->path.c_str()) < 0) {
+      return ErrnoError("Failed to delete", segments_.front()->path);
+    }
+    segments_.erase(segments_.begin());
+    deleted = true;
+  }
+  // Entries up to |index| are as good as durable now.
+  if (last_index_ < index) last_index_ = index;
+  if (synced_index_ < index) synced_index_ = index;
+  if (deleted && fsync_policy_ == Options::FSYNC_ALWAYS) return SyncDir();
+  return OkStatus();
+}
+
+Status LogStorage::WriteHardState(bool sync) {
+  return ReplaceFile(kHardStateFile, hard_state_, nullptr, sync);
+}
+
+Status LogStorage::ReplaceFile(const char *name,
+                               const google::protobuf::MessageLite &msg,
+                               const std::string *blob, bool sync) const {
+  const std::string path = StrCat(dir_, "/", name);
+  const std::string tmp_path = StrCat(path, ".tmp");
+  std::string buf;
+  AppendRecord(msg, &buf);
+  if (blob) buf += BlobHeader(*blob);
+
+  // The new file must be complete before it replaces the old one, even if
+  // the replacement itself needn't be durable yet.
+  const int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return ErrnoError("Failed to create", tmp_path);
+  Status s = WriteFully(fd, buf, tmp_path);
+  if (s.ok() && blob) s = WriteFully(fd, *blob, tmp_path);
+  if (s.ok() && fsync_policy_ == Options::FSYNC_ALWAYS && fdatasync(fd) < 0) {
+    s = ErrnoError("Failed to sync", tmp_path);
+  }
+  close(fd);
+  if (!s.ok()) return s;
+
+  if (rename(tmp_path.c_str(), path.c_str()) < 0) {
+    return ErrnoError("Failed to rename", tmp_path);
+  }
+  if (sync && fsync_policy_ == Options::FSYNC_ALWAYS) return SyncDir();
+  return OkStatus();
+}
+
+Status LogStorage::SyncDir() const {
+  const int fd = open(dir_.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) return ErrnoError("Failed to open", dir_);
+  Status s;
+  if (fsync(fd) < 0) s = ErrnoError("Failed to sync", dir_);
+  close(fd);
+  return s;
+}
+
+}  // namespace raft
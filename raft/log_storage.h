@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#ifndef RAFT_LOG_STORAGE_H_
+#define RAFT_LOG_STORAGE_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "raft/options.h"
+#include "raft/raft.pb.h"
+#include "util/task/status.h"
+#include "util/task/statusor.h"
+#include "util/types/integral_types.h"
+
+namespace raft {
+
+// Persists the log and the HardState of a RAFT member in a directory.
+//
+// The log is split into segment files named "log-<index of first entry>".
+// Each is a sequence of records:
+//
+//   fixed32 payload size | fixed32 CRC-32C of payload | LogEntry payload
+//
+// A record torn by a crash in the middle of a write fails its checksum; on
+// recovery it is dropped, together with everything after it. The HardState is
+// a single record in the file "hard_state", which is replaced atomically.
+//
+// The latest Snapshot is in the file "snapshot", also replaced atomically. Its
+// data may be too large for a record, so the file holds a record of the
+// Snapshot without its data, followed by the data as a blob:
+//
+//   fixed64 data size | fixed32 CRC-32C of data | data
+//
+// Files with the data in the record, and no blob, can still be read. Once a
+// snapshot is saved, the segments that only hold entries it covers are
+// deleted, so the log starts somewhere after its last included index.
+//
+// Append() and TruncateFrom() must not be called concurrently with each other.
+// The other methods are thread-safe.
+class LogStorage {
+ public:
+  // Opens the storage in opts.log_dir, creating the directory if needed.
+  // Fills |hard_state|, |snapshot| and |entries| with the recovered state;
+  // (*entries)[i] is the log entry at index
+  // snapshot->last_included_index() + i + 1.
+  static ::util::StatusOr<std::unique_ptr<LogStorage>> Open(
+      const Options &opts, HardState *hard_state, Snapshot *snapshot,
+      std::vector<LogEntry> *entries);
+
+  ~LogStorage();
+
+  LogStorage(const LogStorage &) = delete;
+  LogStorage &operator=(const LogStorage &) = delete;
+
+  // Writes |n| entries starting at |entries| after the last stored one.
+  // Doesn't wait for them to become durable; see Sync().
+  ::util::Status Append(const LogEntry *entries, size_t n);
+
+  // Like above, but for the |n| entries pointed to by |entries|.
+  ::util::Status Append(const LogEntry *const *entries, size_t n);
+
+  // Removes the entries at |index| and above.
+  ::util::Status TruncateFrom(uint64 index);
+
+  // Blocks until the entries up to |index| (or up to the last one, if there
+  // are fewer) are durable. Callers that arrive while another Sync() is
+  // fsyncing share the next fsync.
+  ::util::Status Sync(uint64 index);
+
+  // Index of the latest entry known to be durable.
+  uint64 synced_index() const { return synced_index_; }
+
+  // Durably replaces the stored term and vote with those in |hard_state|.
+  ::util::Status SaveHardState(const HardState &hard_state);
+
+  // Replaces the stored commit index, without waiting for the replacement
+  // to become durable. After a crash, an older commit index may come back.
+  ::util::Status SaveCommitIndex(uint64 commit_index);
+
+  // Durably replaces the stored snapshot with |snapshot|, unless the stored
+  // one is at least as recent, and deletes the segments it makes redundant.
+  // If the log ends before snapshot.last_included_index(), the next Append()
+  // continues right after it.
+  ::util::Status SaveSnapshot(const Snapshot &snapshot);
+
+ private:
+  struct Segment;
+
+  LogStorage(const Options &opts);
+
+  // Reads the segments, the HardState and the Snapshot from dir_.
+  ::util::Status Recover(HardState *hard_state, Snapshot *snapshot,
+                         std::vector<LogEntry> *entries)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Starts a new segment whose first entry will be at |first_index|.
+  ::util::Status StartSegment(uint64 first_index)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Writes hard_state_ to disk. If |sync|, waits until it's durable.
+  ::util::Status WriteHardState(bool sync)
+      EXCLUSIVE_LOCKS_REQUIRED(hard_state_mu_);
+
+  // Atomically replaces the file |name| in dir_ with |msg| as a single
+  // record, followed by |blob| as a blob unless it is null. If |sync|, waits
+  // until the replacement is durable.
+  ::util::Status ReplaceFile(const char *name,
+                             const google::protobuf::MessageLite &msg,
+                             const std::string *blob, bool sync) const;
+
+  // fsyncs dir_, making file creations, renames and deletions durable.
+  ::util::Status SyncDir() const;
+
+  const std::string dir_;
+  const Options::FsyncPolicy fsync_policy_;
+  const size_t segment_bytes_;
+
+  // Serializes Sync() calls, so that there is at most one fsync of the log
+  // in progress. Acquired before mu_.
+  absl::Mutex sync_mu_;
+
+  absl::Mutex mu_;
+
+  // All segments, in log order. Shared with an ongoing Sync().
+  std::vector<std::shared_ptr<Segment>> segments_ GUARDED_BY(mu_);
+
+  // Index of the last stored entry.
+  uint64 last_index_ GUARDED_BY(mu_) = 0;
+
+  // Number of TruncateFrom() calls so far. Lets Sync() detect that the
+  // entries it has fsynced might have been replaced in the meantime.
+  uint64 num_truncations_ GUARDED_BY(mu_) = 0;
+
+  // Only raised by Sync() under sync_mu_ and mu_; lowered by TruncateFrom().
+  std::atomic<uint64> synced_index_{0};
+
+  absl::Mutex hard_state_mu_;
+
+  // The latest saved HardState.
+  HardState hard_state_ GUARDED_BY(hard_state_mu_);
+
+  // Serializes SaveSnapshot() calls. Acquired before mu_.
+  absl::Mutex snapshot_mu_;
+
+  // Last included index of the stored snapshot.
+  uint64 snapshot_index_ GUARDED_BY(snapshot_mu_) = 0;
+};
+
+}  // namespace raft
+
+#endif  // RAFT_LOG_STORAGE_H_
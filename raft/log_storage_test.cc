@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "raft/log_storage.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+#include "raft/options.h"
+#include "raft/raft.pb.h"
+#include "util/hash/crc32c.h"
+#include "util/task/status.h"
+
+namespace raft {
+namespace {
+
+using ::absl::StrCat;
+
+class LogStorageTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    opts_.log_dir = StrCat(::testing::TempDir(), "/log_storage_test_",
+                           getpid(), "_",
+                           ::testing::UnitTest::GetInstance()
+                               ->current_test_info()
+                               ->name());
+    opts_.log_segment_bytes = 256;
+    RemoveDir();
+  }
+
+  void TearDown() override { RemoveDir(); }
+
+  void RemoveDir() {
+    DIR *dir = opendir(opts_.log_dir.c_str());
+    if (!dir) return;
+    while (const struct dirent *d = readdir(dir)) {
+      unlink(StrCat(opts_.log_dir, "/", d->d_name).c_str());
+    }
+    closedir(dir);
+    rmdir(opts_.log_dir.c_str());
+  }
+
+  // Reopens the storage, filling hard_state_, snapshot_ and entries_.
+  std::unique_ptr<LogStorage> Open() {
+    auto storage = LogStorage::Open(opts_, &hard_state_, &snapshot_, &entries_);
+    EXPECT_TRUE(storage.ok()) << storage.status();
+    return std::move(storage.ValueOrDie());
+  }
+
+  static std::vector<LogEntry> MakeEntries(uint64 term, int first_id, int n) {
+    std::vector<LogEntry> entries(n);
+    for (int i = 0; i < n; ++i) {
+      entries[i].set_term(term);
+      entries[i].set_id(first_id + i);
+      entries[i].set_msg(StrCat("message #", first_id + i));
+    }
+    return entries;
+  }
+
+  // Returns the IDs of entries_.
+  std::vector<uint64> Ids() const {
+    std::vector<uint64> ids;
+    for (const LogEntry &e : entries_) ids.push_back(e.id());
+    return ids;
+  }
+
+  static std::vector<uint64> Range(uint64 from, uint64 to) {
+    std::vector<uint64> ids;
+    for (uint64 i = from; i <= to; ++i) ids.push_back(i);
+    return ids;
+  }
+
+  Options opts_;
+  HardState hard_state_;
+  Snapshot snapshot_;
+  std::vector<LogEntry> entries_;
+};
+
+TEST_F(LogStorageTest, StartsEmpty) {
+  auto storage = Open();
+  EXPECT_EQ(0, hard_state_.term());
+  EXPECT_EQ(0, snapshot_.last_included_index());
+  EXPECT_TRUE(entries_.empty());
+  EXPECT_EQ(0, storage->synced_index());
+}
+
+TEST_F(LogStorageTest, RecoversAppendedEntries) {
+  {
+    auto storage = Open();
+    const auto entries = MakeEntries(1, 1, 30);
+    ASSERT_EQ(::util::OkStatus(), storage->Append(&entries[0], 10));
+    ASSERT_EQ(::util::OkStatus(), storage->Append(&entries[10], 20));
+    ASSERT_EQ(::util::OkStatus(), storage->Sync(30));
+    EXPECT_EQ(30, storage->synced_index());
+  }
+  auto storage = Open();
+  EXPECT_EQ(Range(1, 30), Ids());
+  EXPECT_EQ("message #17", entries_[16].msg());
+  EXPECT_EQ(30, storage->synced_index());
+}
+
+TEST_F(LogStorageTest, RecoversHardState) {
+  {
+    auto storage = Open();
+    HardState hard_state;
+    hard_state.set_term(7);
+    hard_state.set_voted_for("b");
+    ASSERT_EQ(::util::OkStatus(), storage->SaveHardState(hard_state));
+    ASSERT_EQ(::util::OkStatus(), storage->SaveCommitIndex(5));
+  }
+  Open();
+  EXPECT_EQ(7, hard_state_.term());
+  EXPECT_EQ("b", hard_state_.voted_for());
+  EXPECT_EQ(5, hard_state_.commit_index());
+}
+
+TEST_F(LogStorageTest, TruncatesAcrossSegments) {
+  {
+    auto storage = Open();
+    const auto old_entries = MakeEntries(1, 1, 40);
+    ASSERT_EQ(::util::OkStatus(), storage->Append(&old_entries[0], 40));
+    ASSERT_EQ(::util::OkStatus(), storage->Sync(40));
+    ASSERT_EQ(::util::OkStatus(), storage->TruncateFrom(6));
+    EXPECT_EQ(5, storage->synced_index());
+    const auto new_entries = MakeEntries(2, 106, 3);
+    ASSERT_EQ(::util::OkStatus(), storage->Append(&new_entries[0], 3));
+    ASSERT_EQ(::util::OkStatus(), storage->Sync(8));
+  }
+  Open();
+  std::vector<uint64> expected = Range(1, 5);
+  for (uint64 id : Range(106, 108)) expected.push_back(id);
+  EXPECT_EQ(expected, Ids());
+  EXPECT_EQ(2, entries_.back().term());
+}
+
+TEST_F(LogStorageTest, DropsTornTail) {
+  {
+    auto storage = Open();
+    const auto entries = MakeEntries(1, 1, 3);
+    ASSERT_EQ(::util::OkStatus(), storage->Append(&entries[0], 3));
+    ASSERT_EQ(::util::OkStatus(), storage->Sync(3));
+  }
+  // Tear the last record in half.
+  const std::string segment = StrCat(opts_.log_dir, "/log-00000000000000000001");
+  struct stat st;
+  ASSERT_EQ(0, stat(segment.c_str(), &st));
+  ASSERT_EQ(0, truncate(segment.c_str(), st.st_size - 5));
+
+  {
+    auto storage = Open();
+    EXPECT_EQ(Range(1, 2), Ids());
+    const auto entries = MakeEntries(1, 4, 1);
+    ASSERT_EQ(::util::OkStatus(), storage->Append(&entries[0], 1));
+    ASSERT_EQ(::util::OkStatus(), storage->Sync(3));
+  }
+  Open();
+  EXPECT_EQ(std::vector<uint64>({1, 2, 4}), Ids());
+}
+
+TEST_F(LogStorageTest, SnapshotCompactsThePrefix) {
+  {
+    auto storage = Open();
+    const auto entries = MakeEntries(1, 1, 40);
+    ASSERT_EQ(::util::OkStatus(), storage->Append(&entries[0], 40));
+    ASSERT_EQ(::util::OkStatus(), storage->Sync(40));
+    Snapshot snapshot;
+    snapshot.set_last_included_index(25);
+    snapshot.set_last_included_term(1);
+    snapshot.set_data("state as of 25");
+    ASSERT_EQ(::util::OkStatus(), storage->SaveSnapshot(snapshot));
+    // An older snapshot doesn't replace it.
+    snapshot.set_last_included_index(10);
+    ASSERT_EQ(::util::OkStatus(), storage->SaveSnapshot(snapshot));
+  }
+  // Segments that only hold compacted entries are gone.
+  EXPECT_NE(0, access(StrCat(opts_.log_dir, "/log-00000000000000000001").c_str(),
+                      F_OK));
+
+  auto storage = Open();
+  EXPECT_EQ(25, snapshot_.last_included_index());
+  EXPECT_EQ("state as of 25", snapshot_.data());
+  EXPECT_EQ(Range(26, 40), Ids());
+  const auto entries = MakeEntries(1, 41, 1);
+  ASSERT_EQ(::util::OkStatus(), storage->Append(&entries[0], 1));
+  ASSERT_EQ(::util::OkStatus(), storage->Sync(41));
+  EXPECT_EQ(41, storage->synced_index());
+}
+
+TEST_F(LogStorageTest, SnapshotBeyondTheLogRestartsIt) {
+  {
+    auto storage = Open();
+    const auto entries = MakeEntries(1, 1, 5);
+    ASSERT_EQ(::util::OkStatus(), storage->Append(&entries[0], 5));
+    ASSERT_EQ(::util::OkStatus(), storage->TruncateFrom(3));
+    Snapshot snapshot;
+    snapshot.set_last_included_index(100);
+    snapshot.set_last_included_term(4);
+    ASSERT_EQ(::util::OkStatus(), storage->SaveSnapshot(snapshot));
+    EXPECT_EQ(100, storage->synced_index());
+    const auto new_entries = MakeEntries(4, 101, 2);
+    ASSERT_EQ(::util::OkStatus(), storage->Append(&new_entries[0], 2));
+    ASSERT_EQ(::util::OkStatus(), storage->Sync(102));
+  }
+  Open();
+  EXPECT_EQ(100, snapshot_.last_included_index());
+  EXPECT_EQ(4, snapshot_.last_included_term());
+  EXPECT_EQ(Range(101, 102), Ids());
+}
+
+TEST_F(LogStorageTest, DetectsATornSnapshot) {
+  {
+    auto storage = Open();
+    Snapshot snapshot;
+    snapshot.set_last_included_index(10);
+    snapshot.set_last_included_term(1);
+    snapshot.set_data("state as of 10");
+    ASSERT_EQ(::util::OkStatus(), storage->SaveSnapshot(snapshot));
+  }
+  // The data follows the record; cut it short.
+  const std::string path = StrCat(opts_.log_dir, "/snapshot");
+  struct stat st;
+  ASSERT_EQ(0, stat(path.c_str(), &st));
+  ASSERT_EQ(0, truncate(path.c_str(), st.st_size - 1));
+
+  auto storage = LogStorage::Open(opts_, &hard_state_, &snapshot_, &entries_);
+  EXPECT_EQ(::util::error::DATA_LOSS, storage.status().CanonicalCode());
+}
+
+TEST_F(LogStorageTest, ReadsSnapshotsSavedAsOneRecord) {
+  Open();
+  Snapshot snapshot;
+  snapshot.set_last_included_index(10);
+  snapshot.set_last_included_term(1);
+  snapshot.set_data("state as of 10");
+  const std::string payload = snapshot.SerializeAsString();
+  const uint32 crc = ::util::Crc32c(payload);
+  std::string record;
+  for (int i = 0; i < 4; ++i) {
+    record += static_cast<char>(payload.size() >> (8 * i));
+  }
+  for (int i = 0; i < 4; ++i) record += static_cast<char>(crc >> (8 * i));
+  record += payload;
+  FILE *f = fopen(StrCat(opts_.log_dir, "/snapshot").c_str(), "w");
+  ASSERT_NE(nullptr, f);
+  ASSERT_EQ(record.size(), fwrite(record.data(), 1, record.size(), f));
+  fclose(f);
+
+  Open();
+  EXPECT_EQ(10, snapshot_.last_included_index());
+  EXPECT_EQ("state as of 10", snapshot_.data());
+}
+
+TEST_F(LogStorageTest, FsyncNeverStillRecoversAfterCleanShutdown) {
+  opts_.fsync_policy = Options::FSYNC_NEVER;
+  {
+    auto storage = Open();
+    const auto entries = MakeEntries(1, 1, 5);
+    ASSERT_EQ(::util::OkStatus(), storage->Append(&entries[0], 5));
+    ASSERT_EQ(::util::OkStatus(), storage->Sync(5));
+    EXPECT_EQ(5, storage->synced_index());
+  }
+  Open();
+  EXPECT_EQ(Range(1, 5), Ids());
+}
+
+}  // namespace
+}  // namespace raft
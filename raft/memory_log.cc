@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "raft/memory_log.h"
+
+#include "glog/logging.h"
+
+namespace raft {
+
+void MemoryLog::TruncateFrom(uint64 index) {
+  CHECK_GT(index, offset_);
+  while (LastIndex() >= index) entries_.pop_back();
+}
+
+void MemoryLog::CompactTo(uint64 index) {
+  CHECK_GE(index, offset_);
+  CHECK_LE(index, LastIndex());
+  const uint64 term = At(index).term();
+  entries_.erase(entries_.begin(), entries_.begin() + (index - offset_));
+  entries_.front() = Sentinel(term);
+  offset_ = index;
+}
+
+void MemoryLog::Reset(uint64 index, uint64 term) {
+  entries_.clear();
+  entries_.push_back(Sentinel(term));
+  offset_ = index;
+}
+
+MemoryLog::EntryRef MemoryLog::Sentinel(uint64 term) {
+  auto sentinel = std::make_shared<LogEntry>();
+  sentinel->set_term(term);
+  return sentinel;
+}
+
+}  // namespace raft
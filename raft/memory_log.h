@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#ifndef RAFT_MEMORY_LOG_H_
+#define RAFT_MEMORY_LOG_H_
+
+#include <deque>
+#include <memory>
+
+#include "raft/raft.pb.h"
+#include "util/types/integral_types.h"
+
+namespace raft {
+
+// The in-memory part of a member's log: the entries after the latest
+// compaction point.
+//
+// Entries are immutable once appended and reference-counted, so they can be
+// handed to RPCs and to the apply thread without being copied. They are kept
+// in a deque, which stores them in fixed-size segments: appending never moves
+// existing entries, lookups by index take constant time, and dropping entries
+// from either end only touches the entries dropped.
+//
+// The first entry is a sentinel that only carries the term of the entry at
+// offset(). Not thread-safe.
+class MemoryLog {
+ public:
+  using EntryRef = std::shared_ptr<const LogEntry>;
+
+  // Starts out with just the sentinel for index 0, of term 0.
+  MemoryLog() { Reset(0, 0); }
+
+  MemoryLog(const MemoryLog &) = delete;
+  MemoryLog &operator=(const MemoryLog &) = delete;
+
+  // Index of the sentinel; the last entry compacted away, or 0.
+  uint64 offset() const { return offset_; }
+
+  // Index of the last entry, or offset() if there are none after it.
+  uint64 LastIndex() const { return offset_ + entries_.size() - 1; }
+
+  // Returns the entry at |index|, which must be in [offset(), LastIndex()].
+  const LogEntry &At(uint64 index) const { return *Ref(index); }
+  const EntryRef &Ref(uint64 index) const {
+    return entries_[index - offset_];
+  }
+
+  // Appends |entry| at LastIndex() + 1.
+  void Append(EntryRef entry) { entries_.push_back(std::move(entry)); }
+
+  // Removes the entries at |index| and above. |index| must be after offset().
+  void TruncateFrom(uint64 index);
+
+  // Removes the entries before |index|, which becomes the new offset(). The
+  // entry at |index| is replaced by a sentinel with its term. |index| must be
+  // in [offset(), LastIndex()].
+  void CompactTo(uint64 index);
+
+  // Removes all entries, leaving a sentinel of |term| at |index|.
+  void Reset(uint64 index, uint64 term);
+
+ private:
+  static EntryRef Sentinel(uint64 term);
+
+  std::deque<EntryRef> entries_;
+  uint64 offset_ = 0;
+};
+
+}  // namespace raft
+
+#endif  // RAFT_MEMORY_LOG_H_
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "raft/memory_log.h"
+
+#include <memory>
+
+#include "gtest/gtest.h"
+#include "raft/raft.pb.h"
+
+namespace raft {
+namespace {
+
+MemoryLog::EntryRef Entry(uint64 term, uint64 id) {
+  auto e = std::make_shared<LogEntry>();
+  e->set_term(term);
+  e->set_id(id);
+  return e;
+}
+
+TEST(MemoryLogTest, StartsWithSentinel) {
+  MemoryLog log;
+  EXPECT_EQ(0, log.offset());
+  EXPECT_EQ(0, log.LastIndex());
+  EXPECT_EQ(0, log.At(0).term());
+}
+
+TEST(MemoryLogTest, AppendAndTruncate) {
+  MemoryLog log;
+  for (uint64 i = 1; i <= 10; ++i) log.Append(Entry(i < 6 ? 1 : 2, i));
+  EXPECT_EQ(10, log.LastIndex());
+  EXPECT_EQ(7, log.At(7).id());
+  EXPECT_EQ(2, log.At(7).term());
+
+  // Entries are shared, not copied.
+  MemoryLog::EntryRef ref = log.Ref(7);
+  EXPECT_EQ(&log.At(7), ref.get());
+
+  log.TruncateFrom(6);
+  EXPECT_EQ(5, log.LastIndex());
+  EXPECT_EQ(7, ref->id());
+  log.Append(Entry(3, 60));
+  EXPECT_EQ(60, log.At(6).id());
+}
+
+TEST(MemoryLogTest, CompactAndReset) {
+  MemoryLog log;
+  for (uint64 i = 1; i <= 10; ++i) log.Append(Entry(i, i));
+  log.CompactTo(4);
+  EXPECT_EQ(4, log.offset());
+  EXPECT_EQ(10, log.LastIndex());
+  EXPECT_EQ(4, log.At(4).term());
+  EXPECT_FALSE(log.At(4).has_id());
+  EXPECT_EQ(5, log.At(5).id());
+
+  log.CompactTo(10);
+  EXPECT_EQ(10, log.offset());
+  EXPECT_EQ(10, log.LastIndex());
+
+  log.Reset(20, 7);
+  EXPECT_EQ(20, log.offset());
+  EXPECT_EQ(20, log.LastIndex());
+  EXPECT_EQ(7, log.At(20).term());
+  log.Append(Entry(8, 21));
+  EXPECT_EQ(21, log.At(21).id());
+}
+
+}  // namespace
+}  // namespace raft
@@ -31,9 +31,22 @@
 #include "grpcpp/server_builder.h"
 #include "util/task/status.h"
 #include "util/time/clock.h"
+#include "util/types/integral_types.h"
 
 namespace raft {
 
+// A committed log entry handed to Options.on_append_batch.
+struct AppendedEntry {
+  // The entry's position in the log.
+  uint64 index;
+  // The log message passed to Append() or Write().
+  absl::string_view msg;
+  // As for Options.on_append.
+  void *arg;
+  // Set by on_append_batch; as the return value of Options.on_append.
+  ::util::Status status;
+};
+
 // Options for configuring a RAFT cluster member.
 struct Options {
   // ---------------------------------------------------------------------------
@@ -61,6 +74,12 @@ struct Options {
   //           on this member. On other members, this return value is ignored.
   std::function<::util::Status(absl::string_view, void *)> on_append;
 
+  // If set, called instead of on_append with runs of consecutive committed
+  // entries, in log order, so that the state machine can apply them together.
+  // Must leave the state machine as if on_append had run for each entry in
+  // turn, and set each entry's status.
+  std::function<void(std::vector<AppendedEntry> *)> on_append_batch;
+
   // ---------------------------------------------------------------------------
   // Optional fields for performance tweaking and testing.
   // ---------------------------------------------------------------------------
@@ -71,18 +90,90 @@ struct Options {
   // How long to wait for leader's heartbeat before calling a new election.
   absl::Duration election_timeout = absl::Milliseconds(160);
 
+  // The most by which a member's clock may run faster than the leader's over
+  // one election timeout. The leader's read lease is shortened by this much.
+  absl::Duration max_clock_drift = absl::Milliseconds(10);
+
   // How long a candidate will wait for a RequestVote RPC to complete.
   absl::Duration request_vote_rpc_timeout = absl::Milliseconds(100);
 
   // How long a leader will wait for an AppendEntries RPC to complete.
   absl::Duration append_entries_rpc_timeout = absl::Milliseconds(100);
 
+  // How long a leader will wait for an InstallSnapshot RPC to complete.
+  absl::Duration install_snapshot_rpc_timeout = absl::Seconds(1);
+
+  // Caps on the log entries a leader sends in one AppendEntries RPC. A
+  // request always carries at least one entry if the follower is missing any.
+  size_t max_append_entries_bytes = 1 << 20;
+  int max_append_entries_count = 1024;
+
+  // How many AppendEntries RPCs a leader keeps outstanding to a follower that
+  // is keeping up. Followers whose log position is unknown get one at a time.
+  int max_append_entries_in_flight = 4;
+
+  // The most entries passed to one on_append_batch call.
+  int max_apply_batch_entries = 256;
+
   // The clock to use for everything except alarm timing.
   // Must outlive the ::raft::Member object.
   util::Clock *clock = util::Clock::RealClock();
 
+  // Whether a leader sends AppendEntries to each follower over one long-lived
+  // stream, rather than as separate RPCs. Followers that don't support the
+  // stream get separate RPCs anyway.
+  bool stream_append_entries = true;
+
   // Number of threads usually allocated for dispatching RPC requests
   size_t num_dispatch_threads = 1;
+
+  // ---------------------------------------------------------------------------
+  // Optional fields for durability.
+  // ---------------------------------------------------------------------------
+
+  // Directory where the log and the hard state are persisted. Created if
+  // missing. If empty, all state is kept in memory and lost on restart.
+  std::string log_dir;
+
+  // When to fsync the log.
+  enum FsyncPolicy {
+    // Before an entry counts as stored on this member. Concurrent appends
+    // share an fsync.
+    FSYNC_ALWAYS,
+    // Never; leaves flushing to the OS. Survives process crashes but not
+    // machine crashes. Meant for benchmarking.
+    FSYNC_NEVER,
+  };
+  FsyncPolicy fsync_policy = FSYNC_ALWAYS;
+
+  // The log is split into files of roughly this size.
+  size_t log_segment_bytes = 64 << 20;
+
+  // ---------------------------------------------------------------------------
+  // Optional fields for snapshots and log compaction.
+  // ---------------------------------------------------------------------------
+
+  // Serializes the state machine into |data|. Called on the thread that runs
+  // on_append, so the image reflects exactly the entries applied so far.
+  std::function<::util::Status(std::string *data)> on_snapshot_save;
+
+  // Replaces the state machine with the image in |data|, as produced by
+  // on_snapshot_save on any member. Called on the thread that runs on_append.
+  std::function<::util::Status(absl::string_view data)> on_snapshot_load;
+
+  // Take a snapshot, and drop the log entries it covers, every time this many
+  // entries have been applied since the last one. 0 disables snapshots.
+  // Requires on_snapshot_save and on_snapshot_load. Members that don't take
+  // snapshots themselves still need on_snapshot_load to catch up from a
+  // leader's snapshot.
+  uint64 snapshot_interval_entries = 0;
+
+  // How many log entries before a snapshot to keep anyway, so that followers
+  // that are only a little behind can still catch up from the log.
+  uint64 snapshot_trailing_entries = 1000;
+
+  // Snapshots are sent to lagging followers in chunks of this size.
+  size_t snapshot_chunk_bytes = 1 << 20;
 };
 
 }  // namespace raft
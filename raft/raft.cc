@@ -36,8 +36,20 @@ void Member::Stop() { impl_.Stop(); }
 
 void Member::Append(string_view msg) { impl_.Append(msg); }
 
-Status Member::Write(string_view msg, void *arg) {
-  return impl_.Write(msg, arg);
+Status Member::Write(string_view msg, void *arg, uint64 *index) {
+  return impl_.Write(msg, arg, index);
 }
 
+Status Member::ReadBarrier() { return impl_.ReadBarrier(); }
+
+Status Member::StaleReadBarrier(absl::Duration max_staleness, uint64 max_lag) {
+  return impl_.StaleReadBarrier(max_staleness, max_lag);
+}
+
+Status Member::AppliedBarrier(uint64 index, absl::Duration timeout) {
+  return impl_.AppliedBarrier(index, timeout);
+}
+
+uint64 Member::AppliedIndex() const { return impl_.AppliedIndex(); }
+
 }  // namespace raft
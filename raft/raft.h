@@ -25,9 +25,11 @@
 #include <string>
 
 #include "absl/strings/string_view.h"
+#include "absl/time/time.h"
 #include "raft/options.h"
 #include "raft/service_impl.h"
 #include "util/task/status.h"
+#include "util/types/integral_types.h"
 
 namespace raft {
 
@@ -55,7 +57,25 @@ class Member {
   // Executes a write operation. Returns the result of calling
   // Options.on_append(op) after it executes on this replica.
   // This may take slightly longer than Append().
-  ::util::Status Write(absl::string_view msg, void *arg);
+  // If |index| is non-null, it receives the log index of the operation.
+  ::util::Status Write(absl::string_view msg, void *arg,
+                       uint64 *index = nullptr);
+
+  // Blocks until this member may serve a linearizable read from its local
+  // state, without going through the replicated log. Fails unless this member
+  // is the leader; callers should then fall back to Write().
+  ::util::Status ReadBarrier();
+
+  // Succeeds if the local state of this member is at most |max_staleness|
+  // old and at most |max_lag| committed entries behind. Works on followers.
+  ::util::Status StaleReadBarrier(absl::Duration max_staleness, uint64 max_lag);
+
+  // Waits up to |timeout| until the log entry at |index| has been applied on
+  // this member.
+  ::util::Status AppliedBarrier(uint64 index, absl::Duration timeout);
+
+  // Returns the log index of the latest operation applied on this member.
+  uint64 AppliedIndex() const;
 
  private:
   ServiceImpl impl_;
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "raft/raft.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "grpcpp/security/server_credentials.h"
+#include "grpcpp/server.h"
+#include "grpcpp/server_builder.h"
+#include "raft/options.h"
+#include "util/net/port.h"
+#include "util/task/status.h"
+#include "gtest/gtest.h"
+
+namespace raft {
+namespace {
+
+using ::absl::StrCat;
+using ::absl::StrFormat;
+
+constexpr int kMembers = 3;
+
+// Runs a cluster of members in this process, talking over localhost.
+class RaftTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    for (int i = 0; i < kMembers; ++i) {
+      targets_.push_back(StrFormat("127.0.0.1:%d", PickUpFreeLocalPort()));
+      log_dirs_.push_back(StrCat(::testing::TempDir(), "/raft_test_", getpid(),
+                                 "_",
+                                 ::testing::UnitTest::GetInstance()
+                                     ->current_test_info()
+                                     ->name(),
+                                 "_", i));
+      RemoveDir(log_dirs_[i]);
+    }
+    builders_.resize(kMembers);
+    members_.resize(kMembers);
+    servers_.resize(kMembers);
+    applied_.resize(kMembers);
+  }
+
+  void TearDown() override {
+    for (int i = 0; i < kMembers; ++i) {
+      if (members_[i]) StopMember(i);
+      RemoveDir(log_dirs_[i]);
+    }
+  }
+
+  static void RemoveDir(const std::string &path) {
+    DIR *dir = opendir(path.c_str());
+    if (!dir) return;
+    while (const struct dirent *d = readdir(dir)) {
+      unlink(StrCat(path, "/", d->d_name).c_str());
+    }
+    closedir(dir);
+    rmdir(path.c_str());
+  }
+
+  // Starts member |i| with a fresh state machine, which records the messages
+  // it applies in applied_[i].
+  void StartMember(int i) {
+    {
+      absl::MutexLock lock(&mu_);
+      applied_[i].clear();
+    }
+    builders_[i] = absl::make_unique<::grpc::ServerBuilder>();
+    builders_[i]->AddListeningPort(targets_[i],
+                                   ::grpc::InsecureServerCredentials());
+    Options opts = opts_;
+    opts.my_target = targets_[i];
+    opts.targets = targets_;
+    opts.server_builder = builders_[i].get();
+    opts.on_append = [this, i](absl::string_view msg, void *) {
+      absl::MutexLock lock(&mu_);
+      applied_[i].emplace_back(msg);
+      return ::util::OkStatus();
+    };
+    if (durable_) opts.log_dir = log_dirs_[i];
+    members_[i] = absl::make_unique<Member>(opts);
+    // Start() registers the RAFT service, which must precede BuildAndStart().
+    members_[i]->Start();
+    servers_[i] = builders_[i]->BuildAndStart();
+  }
+
+  void StartCluster() {
+    for (int i = 0; i < kMembers; ++i) StartMember(i);
+  }
+
+  void StopMember(int i) {
+    // AppendEntries streams stay open until the server cancels them.
+    servers_[i]->Shutdown(absl::ToChronoTime(absl::Now()));
+    members_[i]->Stop();
+    servers_[i].reset();
+    members_[i].reset();
+    builders_[i].reset();
+  }
+
+  // Commits a write, then returns the member that can serve reads.
+  int FindLeader() {
+    EXPECT_TRUE(members_[0]->Write("elected", nullptr).ok());
+    for (;;) {
+      for (int i = 0; i < kMembers; ++i) {
+        if (members_[i] && members_[i]->ReadBarrier().ok()) return i;
+      }
+      absl::SleepFor(absl::Milliseconds(10));
+    }
+  }
+
+  // Has several clients write concurrently, then checks that every member
+  // applied every write once, in one order that respects the order of each
+  // client's writes.
+  void CheckConcurrentWrites() {
+    // Small requests and a deep window keep several AppendEntries in flight
+    // to each follower.
+    opts_.max_append_entries_count = 2;
+    opts_.max_append_entries_in_flight = 8;
+    StartCluster();
+    FindLeader();
+
+    // Each client writes through its own member, one write at a time.
+    constexpr int kClients = 6;
+    constexpr int kWrites = 50;
+    std::vector<std::vector<uint64>> indexes(kClients);
+    std::vector<std::thread> clients;
+    for (int c = 0; c < kClients; ++c) {
+      clients.emplace_back([this, c, &indexes]() {
+        for (int k = 0; k < kWrites; ++k) {
+          uint64 index = 0;
+          EXPECT_TRUE(
+              members_[c % kMembers]->Write(Msg(c, k), nullptr, &index).ok());
+          indexes[c].push_back(index);
+        }
+      });
+    }
+    for (auto &client : clients) client.join();
+
+    uint64 last_index = 0;
+    for (int c = 0; c < kClients; ++c) {
+      for (int k = 1; k < kWrites; ++k) {
+        EXPECT_LT(indexes[c][k - 1], indexes[c][k]);
+      }
+      last_index = std::max(last_index, indexes[c].back());
+    }
+    for (int i = 0; i < kMembers; ++i) {
+      ASSERT_TRUE(
+          members_[i]->AppliedBarrier(last_index, absl::Seconds(10)).ok());
+    }
+
+    const std::vector<std::string> applied = Applied(0);
+    EXPECT_EQ(1 + kClients * kWrites, applied.size());
+    std::vector<int> next(kClients);
+    for (size_t j = 1; j < applied.size(); ++j) {
+      const int c = applied[j][0] - '0';
+      ASSERT_LT(c, kClients);
+      EXPECT_EQ(Msg(c, next[c]++), applied[j]);
+    }
+    for (int i = 1; i < kMembers; ++i) EXPECT_EQ(applied, Applied(i));
+  }
+
+  // The |k|th write of client |c|. Long enough for the log entries to have
+  // their own buffers.
+  static std::string Msg(int c, int k) {
+    return StrCat(c, ":", k, ":", std::string(100, 'a' + k % 26));
+  }
+
+  std::vector<std::string> Applied(int i) {
+    absl::MutexLock lock(&mu_);
+    return applied_[i];
+  }
+
+  Options opts_;
+  bool durable_ = false;
+  std::vector<std::string> targets_;
+  std::vector<std::string> log_dirs_;
+  std::vector<std::unique_ptr<::grpc::ServerBuilder>> builders_;
+  std::vector<std::unique_ptr<Member>> members_;
+  std::vector<std::unique_ptr<::grpc::Server>> servers_;
+
+  absl::Mutex mu_;
+  std::vector<std::vector<std::string>> applied_ GUARDED_BY(mu_);
+};
+
+TEST_F(RaftTest, AppliesWritesInTheSameOrderOverStreams) {
+  opts_.stream_append_entries = true;
+  CheckConcurrentWrites();
+}
+
+TEST_F(RaftTest, AppliesWritesInTheSameOrderOverSeparateRpcs) {
+  opts_.stream_append_entries = false;
+  CheckConcurrentWrites();
+}
+
+TEST_F(RaftTest, ReadBarrierNeedsLeadership) {
+  StartCluster();
+  const int leader = FindLeader();
+  for (int i = 0; i < kMembers; ++i) {
+    if (i == leader) continue;
+    EXPECT_EQ(::util::error::FAILED_PRECONDITION,
+              members_[i]->ReadBarrier().CanonicalCode());
+  }
+
+  // Without followers, the leader's lease runs out and can't be renewed.
+  for (int i = 0; i < kMembers; ++i) {
+    if (i != leader) StopMember(i);
+  }
+  absl::SleepFor(opts_.election_timeout);
+  EXPECT_EQ(::util::error::UNAVAILABLE,
+            members_[leader]->ReadBarrier().CanonicalCode());
+}
+
+TEST_F(RaftTest, RecoversTheLogAfterRestart) {
+  durable_ = true;
+  StartCluster();
+  FindLeader();
+  uint64 index = 0;
+  for (int k = 0; k < 20; ++k) {
+    ASSERT_TRUE(members_[k % kMembers]->Write(StrCat(k), nullptr, &index).ok());
+  }
+  ASSERT_TRUE(members_[0]->AppliedBarrier(index, absl::Seconds(10)).ok());
+  const std::vector<std::string> before = Applied(0);
+  for (int i = 0; i < kMembers; ++i) StopMember(i);
+
+  // Restarted members replay their logs into empty state machines.
+  StartCluster();
+  ASSERT_TRUE(members_[0]->Write("after", nullptr, &index).ok());
+  std::vector<std::string> expected = before;
+  expected.push_back("after");
+  for (int i = 0; i < kMembers; ++i) {
+    ASSERT_TRUE(members_[i]->AppliedBarrier(index, absl::Seconds(10)).ok());
+    EXPECT_EQ(expected, Applied(i));
+  }
+}
+
+}  // namespace
+}  // namespace raft
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Measures how fast a three-member cluster on localhost commits writes, with
+// AppendEntries sent as separate RPCs and over streams.
+// Run with:
+//   bazel test -c opt //raft:replication_benchmark --test_output=all
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "glog/logging.h"
+#include "grpcpp/security/server_credentials.h"
+#include "grpcpp/server.h"
+#include "grpcpp/server_builder.h"
+#include "raft/options.h"
+#include "raft/raft.h"
+#include "util/net/port.h"
+#include "util/task/status.h"
+#include "gtest/gtest.h"
+
+ABSL_FLAG(int32, replication_benchmark_writes, 200000,
+          "Writes to commit in each run of the benchmark.");
+
+ABSL_FLAG(int32, replication_benchmark_clients, 64,
+          "Threads issuing writes concurrently.");
+
+ABSL_FLAG(int32, replication_benchmark_entry_bytes, 100,
+          "The size of each write.");
+
+namespace raft {
+namespace {
+
+using ::absl::GetFlag;
+using ::absl::Now;
+using ::absl::StrFormat;
+
+constexpr int kMembers = 3;
+
+class ReplicationBenchmark : public ::testing::Test {
+ protected:
+  void TearDown() override {
+    // AppendEntries streams stay open until the server cancels them.
+    for (auto &server : servers_) server->Shutdown(absl::ToChronoTime(Now()));
+    for (auto &member : members_) member->Stop();
+  }
+
+  // Starts the cluster, then times writes on its leader.
+  void Run(bool stream_append_entries) {
+    std::vector<std::string> targets;
+    for (int i = 0; i < kMembers; ++i) {
+      targets.push_back(StrFormat("127.0.0.1:%d", PickUpFreeLocalPort()));
+    }
+    for (int i = 0; i < kMembers; ++i) {
+      builders_[i].AddListeningPort(targets[i],
+                                    ::grpc::InsecureServerCredentials());
+      Options opts;
+      opts.my_target = targets[i];
+      opts.targets = targets;
+      opts.server_builder = &builders_[i];
+      opts.on_append = [](absl::string_view, void *) {
+        return ::util::OkStatus();
+      };
+      opts.stream_append_entries = stream_append_entries;
+      members_.push_back(absl::make_unique<Member>(opts));
+    }
+    // Start() registers the RAFT service, which must precede BuildAndStart().
+    for (int i = 0; i < kMembers; ++i) {
+      members_[i]->Start();
+      servers_.push_back(builders_[i].BuildAndStart());
+    }
+
+    // The leader serves reads once it has committed an entry of its term.
+    members_[0]->Append("");
+    Member *leader = nullptr;
+    while (!leader) {
+      for (auto &member : members_) {
+        if (member->ReadBarrier().ok()) leader = member.get();
+      }
+      absl::SleepFor(absl::Milliseconds(10));
+    }
+
+    const int n = GetFlag(FLAGS_replication_benchmark_writes);
+    const std::string msg(GetFlag(FLAGS_replication_benchmark_entry_bytes),
+                          'x');
+    std::atomic<int> next{0};
+    std::atomic<int> failed{0};
+    const absl::Time start = Now();
+    std::vector<std::thread> clients;
+    for (int i = 0; i < GetFlag(FLAGS_replication_benchmark_clients); ++i) {
+      clients.emplace_back([leader, n, &msg, &next, &failed]() {
+        while (next++ < n) {
+          if (!leader->Write(msg, nullptr).ok()) ++failed;
+        }
+      });
+    }
+    for (auto &client : clients) client.join();
+    const absl::Duration elapsed = Now() - start;
+
+    LOG(INFO) << (stream_append_entries ? "Streams" : "Separate RPCs")
+              << ": committed " << n << " writes in " << elapsed << ", "
+              << n / absl::ToDoubleSeconds(elapsed) << " writes/s";
+    EXPECT_EQ(0, failed);
+  }
+
+  ::grpc::ServerBuilder builders_[kMembers];
+  std::vector<std::unique_ptr<Member>> members_;
+  std::vector<std::unique_ptr<::grpc::Server>> servers_;
+};
+
+TEST_F(ReplicationBenchmark, SeparateRpcs) { Run(false); }
+
+TEST_F(ReplicationBenchmark, Streams) { Run(true); }
+
+}  // namespace
+}  // namespace raft
@@ -38,30 +38,103 @@ namespace {
 
 using ::absl::Condition;
 using ::absl::Duration;
-using ::absl::make_unique;
 using ::absl::MutexLock;
+using ::absl::ReaderMutexLock;
 using ::absl::string_view;
 using ::absl::Time;
 using ::util::CancelledError;
+using ::util::DeadlineExceededError;
+using ::util::FailedPreconditionError;
+using ::util::OkStatus;
 using ::util::Status;
+using ::util::UnavailableError;
+using ::util::UnknownError;
+
+// The status of a Write() whose entry this member never applied itself,
+// because it has loaded a snapshot that includes it instead.
+Status SkippedWriteError(const std::string &me) {
+  return UnknownError(me + " caught up through a snapshot that includes the "
+                           "write; its outcome is unknown");
+}
 }  // namespace
 
 ServiceImpl::ServiceImpl(const Options &opts)
     : server_builder_(opts.server_builder),
       on_append_(opts.on_append),
+      on_append_batch_(opts.on_append_batch),
+      max_apply_batch_entries_(opts.max_apply_batch_entries),
+      on_snapshot_save_(opts.on_snapshot_save),
+      on_snapshot_load_(opts.on_snapshot_load),
+      snapshot_interval_entries_(opts.snapshot_interval_entries),
+      snapshot_trailing_entries_(opts.snapshot_trailing_entries),
+      snapshot_chunk_bytes_(opts.snapshot_chunk_bytes),
+      max_append_entries_bytes_(opts.max_append_entries_bytes),
+      max_append_entries_count_(opts.max_append_entries_count),
+      max_append_entries_in_flight_(opts.max_append_entries_in_flight),
       clock_(opts.clock),
       election_timeout_(opts.election_timeout),
       alarm_timeout_(opts.alarm_timeout),
+      lease_duration_(opts.election_timeout - opts.max_clock_drift),
       cluster_(opts),
       alarm_thread_(opts.alarm_timeout, [this]() { OnAlarm(); }),
+      apply_thread_([this]() { ApplyCommittedEntries(); }),
       msg_id_gen_(cluster_.size(), cluster_.my_index()) {
   CHECK(server_builder_) << "::raft::Options.serverBuilder must be non-null";
   CHECK(clock_) << "::raft::Options.clock must be non-null";
+  CHECK(!snapshot_interval_entries_ || (on_snapshot_save_ && on_snapshot_load_))
+      << "::raft::Options.snapshot_interval_entries requires on_snapshot_save "
+         "and on_snapshot_load";
+  CHECK_GT(snapshot_chunk_bytes_, 0);
+  CHECK_GT(max_append_entries_count_, 0);
+  CHECK_GT(max_append_entries_in_flight_, 0);
+  CHECK(on_append_ || on_append_batch_)
+      << "::raft::Options.on_append or on_append_batch must be set";
+  CHECK_GT(max_apply_batch_entries_, 0);
+  if (!opts.log_dir.empty()) Recover(opts);
+}
+
+void ServiceImpl::Recover(const Options &opts) {
+  MutexLock lock(&mu_);
+  HardState hard_state;
+  auto snapshot = std::make_shared<Snapshot>();
+  std::vector<LogEntry> entries;
+  auto storage = LogStorage::Open(opts, &hard_state, snapshot.get(), &entries);
+  CHECK(storage.ok()) << "Failed to open the RAFT log: " << storage.status();
+  storage_ = std::move(storage.ValueOrDie());
+
+  term_ = hard_state.term();
+  voted_for_ = hard_state.voted_for();
+  if (snapshot->last_included_index()) {
+    log_.Reset(snapshot->last_included_index(),
+               snapshot->last_included_term());
+    snapshot_ = snapshot;
+    // The apply thread starts from the snapshot.
+    snapshot_to_load_ = snapshot;
+  }
+  for (LogEntry &e : entries) {
+    log_.Append(std::make_shared<const LogEntry>(std::move(e)));
+  }
+  commit_index_ = std::max<uint64>(
+      log_.offset(), std::min<uint64>(hard_state.commit_index(), LastIndex()));
+  saved_commit_index_ = commit_index_;
+  LOG(INFO) << cluster_.me() << " recovered a snapshot up to index "
+            << log_.offset() << " and " << entries.size()
+            << " log entries in term " << term_ << ", committed up to "
+            << commit_index_;
 }
 
 void ServiceImpl::Start() {
+  {
+    MutexLock lock(&mu_);
+    start_time_ = clock_->TimeNow();
+    // Give an existing leader a chance to reach us before calling an election.
+    last_heartbeat_time_ = start_time_;
+  }
   server_builder_->RegisterService(this);
   alarm_thread_.Start();
+  apply_thread_.Start();
+  // Catch up with the entries recovered from disk.
+  if (commit_index_ > 0) apply_thread_.Poke();
   if (!varz::StartVarZService()) {
     LOG(ERROR) << "Failed to start varz service";
   }
@@ -70,6 +143,15 @@ void ServiceImpl::Start() {
 void ServiceImpl::Stop() {
   varz::StopVarZService();
   alarm_thread_.Stop();
+  apply_thread_.Stop();
+  {
+    // Keep the callbacks of RPCs still in flight from sending more of them.
+    MutexLock lock(&mu_);
+    state_ = FOLLOWER;
+  }
+  // Those callbacks refer to this ServiceImpl, so they must all have run
+  // before it goes away.
+  cluster_.Shutdown();
 }
 
 void ServiceImpl::Append(string_view msg) {
@@ -79,47 +161,170 @@ void ServiceImpl::Append(string_view msg) {
   AppendAndWait(&e);
 }
 
-void ServiceImpl::AppendAndWait(LogEntry *e) {
+uint64 ServiceImpl::AppendAndWait(LogEntry *e) {
   VLOG(2) << cluster_.me() << " starts trying to commit "
           << e->ShortDebugString();
-  // const Time start_time = clock_->TimeNow();
 
+  PendingAppend p;
+  p.e = e;
+  bool my_turn;
+  {
+    MutexLock lock(&batch_mu_);
+    pending_appends_.push_back(&p);
+    my_turn = !forwarding_;
+    forwarding_ = true;
+  }
+  if (!my_turn) {
+    // Somebody else is talking to the leader; our entry will go out with the
+    // next batch, which we may be asked to send ourselves.
+    p.wakeup.WaitForNotification();
+    if (p.done) return p.index;
+  }
+
+  std::vector<PendingAppend *> batch;
+  {
+    MutexLock lock(&batch_mu_);
+    batch.swap(pending_appends_);
+  }
+  ForwardToLeader(batch);
+
+  // Hand the next batch over to one of its owners.
+  PendingAppend *next = nullptr;
+  {
+    MutexLock lock(&batch_mu_);
+    if (pending_appends_.empty()) {
+      forwarding_ = false;
+    } else {
+      next = pending_appends_.front();
+    }
+  }
+  for (PendingAppend *b : batch) {
+    if (b == &p) continue;
+    b->done = true;
+    b->wakeup.Notify();
+  }
+  if (next) next->wakeup.Notify();
+  return p.index;
+}
+
+void ServiceImpl::ForwardToLeader(const std::vector<PendingAppend *> &batch) {
+  AppendOnLeaderRequest request;
+  AppendOnLeaderResponse response;
   std::string leader;
-  int num_attempts = 0;
+  // The request borrows the entries from their owners instead of copying
+  // them, and gives them back before it goes away.
+  for (PendingAppend *p : batch) request.mutable_entry()->AddAllocated(p->e);
   do {
-    ++num_attempts;
     MutexLock lock(&mu_);
     mu_.Await(Condition(
         +[](std::string *l) { return !l->empty(); }, &leader_));
     leader = leader_;
-    e->set_term(term_);
-    VLOG(2) << cluster_.me() << " forwards Append(id=" << e->id()
-            << ") to leader " << leader;
-  } while (!cluster_.SendAppendOnLeader(leader, *e));
+    for (PendingAppend *p : batch) p->e->set_term(term_);
+    VLOG(2) << cluster_.me() << " forwards " << batch.size()
+            << " entries to leader " << leader;
+  } while (!cluster_.SendAppendOnLeader(leader, request, &response));
+  while (request.entry_size()) request.mutable_entry()->ReleaseLast();
   // This sends self-RPCs when leader_==cluster_.me().
+
+  if (response.index_size() == static_cast<int>(batch.size())) {
+    for (size_t i = 0; i < batch.size(); ++i) {
+      batch[i]->index = response.index(i);
+    }
+  }
 }
 
-Status ServiceImpl::Write(string_view msg, void *arg) {
+Status ServiceImpl::Write(string_view msg, void *arg, uint64 *index) {
   LogEntry e;
   e.set_msg(std::string(msg));
   e.set_id(msg_id_gen_.Make());
 
+  PendingWrite w;
+  w.arg = arg;
+  {
+    MutexLock lock(&apply_mu_);
+    pending_writes_[e.id()] = &w;
+  }
+
+  const uint64 log_index = AppendAndWait(&e);
+  {
+    // If the entry is still pending although the apply thread is past it, it
+    // has been skipped over by a snapshot and on_append won't run for it.
+    MutexLock lock(&apply_mu_);
+    auto it = pending_writes_.find(e.id());
+    if (it != pending_writes_.end() && log_index) {
+      w.index = log_index;
+      if (log_index <= last_applied_) {
+        pending_writes_.erase(it);
+        w.status = SkippedWriteError(cluster_.me());
+        w.done.Notify();
+      }
+    }
+  }
+
+  w.done.WaitForNotification();
+  if (index) *index = w.index;
+  return w.status;
+}
+
+Status ServiceImpl::ReadBarrier() {
+  ReadWaiter waiter;
+  uint64 read_index;
+  bool have_lease;
   {
     MutexLock lock(&mu_);
-    write_args_[e.id()] = arg;
-    write_statuses_[e.id()] = nullptr;
+    if (state_ != LEADER) {
+      return FailedPreconditionError(cluster_.me() + " is not the leader");
+    }
+    // Until the leader has committed an entry of its own term, it doesn't
+    // know which of the entries it inherited are committed.
+    read_index = commit_index_;
+    if (EntryAt(read_index).term() != term_) {
+      return UnavailableError("no entry committed in the current term yet");
+    }
+    const Time now = clock_->TimeNow();
+    have_lease = now < LeaseExpiry();
+    if (!have_lease) {
+      waiter.start = now;
+      read_waiters_.push_back(&waiter);
+      BroadcastAppendEntries(now);
+    }
   }
 
-  AppendAndWait(&e);
+  if (!have_lease) {
+    waiter.done.WaitForNotification();
+    if (!waiter.confirmed) {
+      return UnavailableError("could not confirm leadership");
+    }
+  }
+  WaitForApplied(read_index, absl::InfiniteDuration());
+  return OkStatus();
+}
 
-  MutexLock lock(&mu_);
-  mu_.Await(Condition(
-      +[](std::unique_ptr<Status> *s) { return !!s->get(); },
-      &write_statuses_[e.id()]));
-  const Status s = *write_statuses_[e.id()];
-  write_statuses_.erase(e.id());
-  write_args_.erase(e.id());
-  return s;
+Status ServiceImpl::StaleReadBarrier(Duration max_staleness, uint64 max_lag) {
+  {
+    MutexLock lock(&mu_);
+    if (state_ != LEADER) {
+      const Time now = clock_->TimeNow();
+      if (leader_.empty() || now - last_heartbeat_time_ >= election_timeout_) {
+        return UnavailableError(cluster_.me() + " has lost its leader");
+      }
+      if (now - fresh_as_of_ > max_staleness) {
+        return UnavailableError(cluster_.me() + " is too stale");
+      }
+      if (commit_index_ - last_applied_ > max_lag) {
+        return UnavailableError(cluster_.me() + " lags too far behind");
+      }
+      return OkStatus();
+    }
+  }
+  return ReadBarrier();
+}
+
+Status ServiceImpl::AppliedBarrier(uint64 index, Duration timeout) {
+  if (!WaitForApplied(index, timeout)) {
+    return DeadlineExceededError(cluster_.me() + " hasn't caught up in time");
+  }
+  return OkStatus();
 }
 
 grpc::Status ServiceImpl::RequestVote(grpc::ServerContext *context,
@@ -127,6 +332,29 @@ grpc::Status ServiceImpl::RequestVote(grpc::ServerContext *context,
                                       RequestVoteResponse *response) {
   MutexLock lock(&mu_);
 
+  // Leader leases rely on nobody getting elected while the leader may still
+  // be serving reads, so ignore candidates while we hear from a live leader.
+  // Right after a restart, we can't tell whether we do.
+  const Time now = clock_->TimeNow();
+  if ((state_ == LEADER && now < LeaseExpiry()) ||
+      (state_ == FOLLOWER && !leader_.empty() &&
+       leader_ != request->candidate_id() &&
+       now - last_heartbeat_time_ < election_timeout_)) {
+    VLOG(2) << "Rejecting RequestVote() from " << request->candidate_id()
+            << " because " << cluster_.me() << " has a live leader "
+            << leader_;
+    response->set_term(term_);
+    response->set_vote_granted(false);
+    return grpc::Status::OK;
+  }
+  if (now - start_time_ < election_timeout_) {
+    VLOG(2) << "Rejecting RequestVote() from " << request->candidate_id()
+            << " because " << cluster_.me() << " has only just started";
+    response->set_term(term_);
+    response->set_vote_granted(false);
+    return grpc::Status::OK;
+  }
+
   if (request->term() > term_) AdvanceTermTo(request->term());
   response->set_term(term_);
 
@@ -146,9 +374,10 @@ grpc::Status ServiceImpl::RequestVote(grpc::ServerContext *context,
     return grpc::Status::OK;
   }
 
+  const uint64 commit_index = commit_index_;
   const std::pair<uint64, uint64> candidate_log(request->last_log_term(),
                                                 request->last_log_index()),
-      my_log(log_[commit_index_].term(), commit_index_);
+      my_log(EntryAt(commit_index).term(), commit_index);
   if (candidate_log < my_log) {
     VLOG(2) << "Rejecting RequestVote() from " << request->candidate_id()
             << " because the candidate's log is not up to date with "
@@ -162,7 +391,8 @@ grpc::Status ServiceImpl::RequestVote(grpc::ServerContext *context,
   response->set_vote_granted(true);
 
   voted_for_ = request->candidate_id();
-  last_heartbeat_time_ = clock_->TimeNow();
+  last_heartbeat_time_ = now;
+  PersistHardState();
 
   return grpc::Status::OK;
 }
@@ -170,124 +400,572 @@ grpc::Status ServiceImpl::RequestVote(grpc::ServerContext *context,
 grpc::Status ServiceImpl::AppendEntries(grpc::ServerContext *context,
                                         const AppendEntriesRequest *request,
                                         AppendEntriesResponse *response) {
+  {
+    MutexLock lock(&mu_);
+    AppendEntriesLocked(*request, response);
+    if (!response->success() || !storage_) return grpc::Status::OK;
+  }
+
+  // Entries only count as stored on this member once they are durable.
+  const uint64 last_index = request->prev_log_index() + request->entry_size();
+  SyncLog(last_index);
+
+  // Meanwhile, a newer leader may have replaced them.
   MutexLock lock(&mu_);
+  const uint64 last_term =
+      request->entry_size()
+          ? request->entry(request->entry_size() - 1).term()
+          : request->prev_log_term();
+  if (term_ != request->term() || last_index > LastIndex() ||
+      (last_index >= log_.offset() &&
+       EntryAt(last_index).term() != last_term)) {
+    response->set_term(term_);
+    response->set_success(false);
+    return grpc::Status::OK;
+  }
+  FollowLeaderCommit(std::min<uint64>(request->leader_commit(), last_index));
+  return grpc::Status::OK;
+}
 
-  if (request->term() >= term_) AdvanceTermTo(request->term());
+void ServiceImpl::AppendEntriesLocked(const AppendEntriesRequest &request,
+                                      AppendEntriesResponse *response) {
+  mu_.AssertHeld();
+  if (request.term() >= term_) AdvanceTermTo(request.term());
   response->set_term(term_);
 
-  if (request->term() < term_) {
-    VLOG(2) << cluster_.me() << " rejects " << request->leader_id()
+  if (request.term() < term_) {
+    VLOG(2) << cluster_.me() << " rejects " << request.leader_id()
             << "'s AppendEntries() because the claimed leader's term ("
-            << request->term() << ") is smaller than " << term_;
+            << request.term() << ") is smaller than " << term_;
     response->set_success(false);
-    return grpc::Status::OK;
+    return;
   }
 
-  leader_ = request->leader_id();
+  leader_ = request.leader_id();
+  last_heartbeat_time_ = clock_->TimeNow();
 
-  if (request->prev_log_index() >= log_.size() ||
-      log_[request->prev_log_index()].term() != request->prev_log_term()) {
-    VLOG(2) << cluster_.me() << " rejects " << request->leader_id()
+  // Entries covered by our snapshot are committed, so they match the leader's.
+  if (request.prev_log_index() > LastIndex() ||
+      (request.prev_log_index() >= log_.offset() &&
+       EntryAt(request.prev_log_index()).term() != request.prev_log_term())) {
+    VLOG(2) << cluster_.me() << " rejects " << request.leader_id()
             << "'s AppendEntries() because of log mismatch at index "
-            << request->prev_log_index();
+            << request.prev_log_index();
     response->set_success(false);
-    return grpc::Status::OK;
+    if (request.prev_log_index() > LastIndex()) {
+      response->set_conflict_index(LastIndex() + 1);
+    } else {
+      const uint64 conflict_term = EntryAt(request.prev_log_index()).term();
+      uint64 first = request.prev_log_index();
+      while (first > log_.offset() + 1 &&
+             EntryAt(first - 1).term() == conflict_term) {
+        --first;
+      }
+      response->set_conflict_term(conflict_term);
+      response->set_conflict_index(first);
+    }
+    return;
   }
 
-  if (request->entry_size()) {
-    VLOG(2) << cluster_.me() << " starts gluing " << request->entry_size()
-            << " entries after index " << request->prev_log_index();
+  if (request.entry_size()) {
+    VLOG(2) << cluster_.me() << " starts gluing " << request.entry_size()
+            << " entries after index " << request.prev_log_index();
   }
 
-  CHECK(request->entry_size() >= 0);
-  uint64 entry_size = static_cast<uint64_t>(request->entry_size());
+  CHECK(request.entry_size() >= 0);
+  uint64 entry_size = static_cast<uint64_t>(request.entry_size());
+  uint64 first_new_index = 0;
   for (size_t i = 0; i < entry_size; ++i) {
-    const auto j = request->prev_log_index() + 1 + i;
-    if (j < log_.size() && log_[j].term() != request->entry(i).term()) {
-      VLOG(2) << cluster_.me() << " removes the last " << log_.size() - j
+    const auto j = request.prev_log_index() + 1 + i;
+    if (j <= log_.offset()) continue;
+    if (j <= LastIndex() && EntryAt(j).term() != request.entry(i).term()) {
+      VLOG(2) << cluster_.me() << " removes the last " << LastIndex() + 1 - j
               << " entries from its log";
-      while (log_.size() > j) log_.pop_back();
+      log_.TruncateFrom(j);
+      if (storage_) CHECK_OK(storage_->TruncateFrom(j));
     }
-    if (j < log_.size()) {
-      DCHECK_EQ(request->entry(i).msg(), log_[j].msg());
+    if (j <= LastIndex()) {
+      DCHECK_EQ(request.entry(i).msg(), EntryAt(j).msg());
     } else {
-      DCHECK(j == log_.size());
+      DCHECK(j == LastIndex() + 1);
       VLOG(2) << cluster_.me() << " appends log entry at index " << j;
-      log_.push_back(request->entry(i));
+      if (!first_new_index) first_new_index = j;
+      log_.Append(std::make_shared<const LogEntry>(request.entry(i)));
       if ((i + 1ULL) == entry_size) {
-        VLOG(2) << cluster_.me() << " grew the log to size " << log_.size();
+        VLOG(2) << cluster_.me() << " grew the log up to index "
+                << LastIndex();
       }
     }
   }
 
-  if (request->leader_commit() > commit_index_) {
-    commit_index_ =
-        std::min<uint64>(request->leader_commit(), log_.size() - 1ULL);
-    alarm_thread_.Poke();
+  if (first_new_index) PersistEntries(first_new_index);
+
+  // Anything after the new entries may be left over from an older leader.
+  FollowLeaderCommit(std::min<uint64>(request.leader_commit(),
+                                      request.prev_log_index() + entry_size));
+
+  // Once we have applied everything the leader had committed by now, our
+  // state is as fresh as this heartbeat.
+  const Time now = clock_->TimeNow();
+  if (last_applied_ >= request.leader_commit()) {
+    fresh_as_of_ = now;
+  } else if (!freshness_marks_.empty() &&
+             freshness_marks_.back().first == request.leader_commit()) {
+    freshness_marks_.back().second = now;
+  } else {
+    freshness_marks_.emplace_back(request.leader_commit(), now);
   }
 
-  last_heartbeat_time_ = clock_->TimeNow();
   response->set_success(true);
+}
+
+void ServiceImpl::FollowLeaderCommit(uint64 leader_commit) {
+  mu_.AssertHeld();
+  const uint64 commit_index = std::min(leader_commit, DurableIndex());
+  if (commit_index > commit_index_) {
+    commit_index_ = commit_index;
+    apply_thread_.Poke();
+  }
+}
 
+grpc::Status ServiceImpl::AppendEntriesStream(
+    grpc::ServerContext *context,
+    grpc::ServerReaderWriter<AppendEntriesResponse, AppendEntriesRequest>
+        *stream) {
+  AppendEntriesRequest request;
+  AppendEntriesResponse response;
+  while (stream->Read(&request)) {
+    response.Clear();
+    const grpc::Status status = AppendEntries(context, &request, &response);
+    if (!status.ok()) return status;
+    if (!stream->Write(response)) break;
+  }
   return grpc::Status::OK;
 }
 
 grpc::Status ServiceImpl::AppendOnLeader(grpc::ServerContext *context,
                                          const AppendOnLeaderRequest *request,
                                          AppendOnLeaderResponse *response) {
-  const LogEntry &e = request->entry();
-  MutexLock lock(&mu_);
+  CommitWaiter waiter;
+  {
+    MutexLock lock(&mu_);
 
-  if (state_ != LEADER || e.term() != term_) {
+    for (const LogEntry &e : request->entry()) {
+      if (state_ != LEADER || e.term() != term_) {
+        // rpc->set_util_status(CancelledError("leader change"));
+        return grpc::Status::CANCELLED;
+      }
+    }
+    if (!request->entry_size()) return grpc::Status::OK;
+    AppendAsLeader(*request, &waiter);
+  }
+  for (const auto &i : waiter.entries) response->add_index(i.first);
+
+  // The leader's own copy only counts towards a majority once it is durable.
+  // Followers are replicating meanwhile.
+  if (storage_) {
+    uint64 last_index = 0;
+    for (const auto &i : waiter.entries) {
+      last_index = std::max(last_index, i.first);
+    }
+    SyncLog(last_index);
+    MutexLock lock(&mu_);
+    if (state_ == LEADER) CommitEntries();
+  }
+
+  // Wait for all of the entries to get committed.
+  waiter.done.WaitForNotification();
+  if (!waiter.committed) {
     // rpc->set_util_status(CancelledError("leader change"));
     return grpc::Status::CANCELLED;
   }
-  VLOG(2) << cluster_.me() << " gets AppendOnLeader(id=" << e.id() << ")";
+  return grpc::Status::OK;
+}
+
+grpc::Status ServiceImpl::InstallSnapshot(grpc::ServerContext *context,
+                                          const InstallSnapshotRequest *request,
+                                          InstallSnapshotResponse *response) {
+  MutexLock lock(&mu_);
+  InstallSnapshotLocked(*request, response);
+  return grpc::Status::OK;
+}
 
-  // Find this entry in the log, or append it if it's not there.
-  size_t i;
-  for (i = log_.size() - 1; log_[i].term() >= e.term(); --i) {
-    if (log_[i].id() == e.id()) break;
+void ServiceImpl::InstallSnapshotLocked(const InstallSnapshotRequest &request,
+                                        InstallSnapshotResponse *response) {
+  mu_.AssertHeld();
+  if (request.term() >= term_) AdvanceTermTo(request.term());
+  response->set_term(term_);
+  if (request.term() < term_) return;
+
+  leader_ = request.leader_id();
+  last_heartbeat_time_ = clock_->TimeNow();
+
+  const uint64 index = request.last_included_index();
+  if (index <= commit_index_) {
+    // Our log has caught up with the snapshot in the meantime.
+    incoming_snapshot_.clear();
+    response->set_done(true);
+    return;
   }
-  if (log_[i].term() < e.term()) {
-    i = log_.size();
-    log_.push_back(e);
-    hanging_appends_[e.id()] = false;
+
+  if (request.offset() == 0 || index != incoming_snapshot_index_ ||
+      request.last_included_term() != incoming_snapshot_term_) {
+    incoming_snapshot_.clear();
+    incoming_snapshot_index_ = index;
+    incoming_snapshot_term_ = request.last_included_term();
+  }
+  if (request.offset() != incoming_snapshot_.size()) {
+    // A chunk got lost; have the leader resend from where we are.
+    response->set_bytes_received(incoming_snapshot_.size());
+    return;
   }
+  incoming_snapshot_.append(request.data());
+  response->set_bytes_received(incoming_snapshot_.size());
+  if (!request.done()) return;
+
+  VLOG(1) << cluster_.me() << " received a snapshot of "
+          << incoming_snapshot_.size() << " bytes up to index " << index;
+  auto snapshot = std::make_shared<Snapshot>();
+  snapshot->set_last_included_index(index);
+  snapshot->set_last_included_term(request.last_included_term());
+  snapshot->mutable_data()->swap(incoming_snapshot_);
+  incoming_snapshot_index_ = 0;
+
+  // If the log has the snapshot's last entry, the entries after it may still
+  // be good. Otherwise, the whole log goes.
+  const bool keep_suffix = index <= LastIndex() &&
+                           EntryAt(index).term() == snapshot->last_included_term();
+  if (!keep_suffix) {
+    log_.Reset(log_.offset(), EntryAt(log_.offset()).term());
+    if (storage_) CHECK_OK(storage_->TruncateFrom(log_.offset() + 1));
+  }
+  // This happens under mu_, but only on a member too far behind to be of use
+  // to anybody anyway.
+  if (storage_) CHECK_OK(storage_->SaveSnapshot(*snapshot));
+  commit_index_ = index;
+  CompactLog(snapshot, 0);
+  snapshot_to_load_ = std::move(snapshot);
+  apply_thread_.Poke();
+  response->set_done(true);
+}
+
+void ServiceImpl::AppendAsLeader(const AppendOnLeaderRequest &request,
+                                 CommitWaiter *waiter) {
+  mu_.AssertHeld();
+  const uint64 term = term_;
+  VLOG(2) << cluster_.me() << " gets AppendOnLeader() with "
+          << request.entry_size() << " entries";
 
-  grpc::Status status = grpc::Status::OK;
-  // Wait for it to get committed.
-  while (1) {
-    mu_.Await(Condition(&hanging_appends_[e.id()]));
-    if (commit_index_ >= i && log_[i].id() == e.id()) break;
-    if (term_ > e.term() || i >= log_.size() || log_[i].id() != e.id()) {
-      // rpc->set_util_status(CancelledError("leader change"));
-      status = grpc::Status::CANCELLED;
-      break;
+  // Find these entries in the log; a retried request may have some of them
+  // there already. Append the rest as one contiguous extension.
+  std::map<uint64, uint64> index_of;
+  const uint64 first_new_index = LastIndex() + 1;
+  for (const LogEntry &e : request.entry()) index_of[e.id()] = 0;
+  size_t num_found = 0;
+  for (uint64 i = LastIndex(); num_found < index_of.size() &&
+                               i > log_.offset() && EntryAt(i).term() >= term;
+       --i) {
+    auto it = index_of.find(EntryAt(i).id());
+    if (it != index_of.end() && !it->second) {
+      it->second = i;
+      ++num_found;
     }
-    hanging_appends_[e.id()] = false;
   }
-  hanging_appends_.erase(e.id());
+  uint64 last_index = 0;
+  for (const LogEntry &e : request.entry()) {
+    uint64 &i = index_of[e.id()];
+    if (!i) {
+      i = LastIndex() + 1;
+      log_.Append(std::make_shared<const LogEntry>(e));
+    }
+    last_index = std::max(last_index, i);
+    waiter->entries.emplace_back(i, e.id());
+  }
+
+  if (LastIndex() >= first_new_index) PersistEntries(first_new_index);
+
+  // Entries are committed in log order, so the waiter only needs to be looked
+  // at once the last of its entries is committed.
+  commit_waiters_.emplace(last_index, waiter);
 
-  return status;
+  // Start replicating right away instead of waiting for the alarm.
+  BroadcastAppendEntries(clock_->TimeNow());
+  CommitEntries();
+  NotifyCommitWaiters();
 }
 
-void ServiceImpl::OnAlarm() {
+void ServiceImpl::NotifyCommitWaiters() {
+  mu_.AssertHeld();
+  while (!commit_waiters_.empty() &&
+         commit_waiters_.begin()->first <= commit_index_) {
+    CommitWaiter *waiter = commit_waiters_.begin()->second;
+    commit_waiters_.erase(commit_waiters_.begin());
+    waiter->committed = true;
+    // Entries of the current term that have been compacted away can't have
+    // been replaced.
+    for (const auto &i : waiter->entries) {
+      if (i.first > log_.offset() && EntryAt(i.first).id() != i.second) {
+        waiter->committed = false;
+      }
+    }
+    waiter->done.Notify();
+  }
+}
+
+void ServiceImpl::ApplyCommittedEntries() {
+  while (last_applied_ < commit_index_) {
+    // Committed entries never change, so it is safe to hold on to them and
+    // let go of mu_ before running on_append_.
+    std::shared_ptr<const Snapshot> snapshot;
+    std::vector<MemoryLog::EntryRef> entries;
+    {
+      MutexLock lock(&mu_);
+      snapshot.swap(snapshot_to_load_);
+      if (!snapshot) {
+        const uint64 commit_index = commit_index_;
+        VLOG(2) << cluster_.me() << " is about to apply "
+                << commit_index - last_applied_ << " log entries locally";
+        for (uint64 i = last_applied_ + 1; i <= commit_index; ++i)
+          entries.push_back(log_.Ref(i));
+      }
+    }
+
+    if (snapshot) LoadSnapshot(*snapshot);
+    if (on_append_batch_) {
+      for (size_t i = 0; i < entries.size(); i += max_apply_batch_entries_) {
+        ApplyBatch(entries.data() + i,
+                   std::min<size_t>(entries.size() - i,
+                                    max_apply_batch_entries_));
+      }
+    } else {
+      for (const MemoryLog::EntryRef &ref : entries) {
+        const LogEntry &e = *ref;
+        PendingWrite *w = TakePendingWrite(e.id());
+        const Status s = on_append_(e.msg(), w ? w->arg : nullptr);
+        ++last_applied_;
+        last_applied_term_ = e.term();
+        if (w) {
+          w->index = last_applied_;
+          w->status = s;
+          w->done.Notify();
+        }
+      }
+    }
+
+    {
+      MutexLock lock(&mu_);
+      while (!freshness_marks_.empty() &&
+             freshness_marks_.front().first <= last_applied_) {
+        fresh_as_of_ = freshness_marks_.front().second;
+        freshness_marks_.pop_front();
+      }
+    }
+
+    {
+      MutexLock lock(&apply_mu_);
+      while (!applied_waiters_.empty() &&
+             applied_waiters_.begin()->first <= last_applied_) {
+        applied_waiters_.begin()->second->Notify();
+        applied_waiters_.erase(applied_waiters_.begin());
+      }
+    }
+
+    MaybeTakeSnapshot();
+  }
+}
+
+ServiceImpl::PendingWrite *ServiceImpl::TakePendingWrite(uint64 id) {
+  MutexLock lock(&apply_mu_);
+  auto it = pending_writes_.find(id);
+  if (it == pending_writes_.end()) return nullptr;
+  PendingWrite *w = it->second;
+  pending_writes_.erase(it);
+  return w;
+}
+
+void ServiceImpl::ApplyBatch(const MemoryLog::EntryRef *entries, size_t n) {
+  std::vector<PendingWrite *> writes(n);
+  std::vector<AppendedEntry> batch(n);
+  for (size_t i = 0; i < n; ++i) {
+    const LogEntry &e = *entries[i];
+    writes[i] = TakePendingWrite(e.id());
+    batch[i].index = last_applied_ + 1 + i;
+    batch[i].msg = e.msg();
+    batch[i].arg = writes[i] ? writes[i]->arg : nullptr;
+  }
+  on_append_batch_(&batch);
+  for (size_t i = 0; i < n; ++i) {
+    ++last_applied_;
+    last_applied_term_ = entries[i]->term();
+    if (PendingWrite *w = writes[i]) {
+      w->index = last_applied_;
+      w->status = batch[i].status;
+      w->done.Notify();
+    }
+  }
+}
+
+void ServiceImpl::LoadSnapshot(const Snapshot &snapshot) {
+  CHECK(on_snapshot_load_) << cluster_.me() << " got a snapshot, but "
+                           << "::raft::Options.on_snapshot_load isn't set";
+  LOG(INFO) << cluster_.me() << " loads a snapshot up to index "
+            << snapshot.last_included_index();
+  const Status s = on_snapshot_load_(snapshot.data());
+  CHECK(s.ok()) << "Failed to load a RAFT snapshot: " << s;
+  last_applied_ = snapshot.last_included_index();
+  last_applied_term_ = snapshot.last_included_term();
+
+  // Writes that the snapshot has skipped over; see Write().
+  MutexLock lock(&apply_mu_);
+  for (auto it = pending_writes_.begin(); it != pending_writes_.end();) {
+    PendingWrite *w = it->second;
+    if (w->index && w->index <= last_applied_) {
+      w->status = SkippedWriteError(cluster_.me());
+      w->done.Notify();
+      it = pending_writes_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void ServiceImpl::MaybeTakeSnapshot() {
+  if (!snapshot_interval_entries_) return;
+  {
+    MutexLock lock(&mu_);
+    const uint64 snapshot_index =
+        snapshot_ ? snapshot_->last_included_index() : 0;
+    if (last_applied_ < snapshot_index + snapshot_interval_entries_) return;
+  }
+
+  // Nothing else touches the state machine while the apply thread is here,
+  // so the snapshot reflects exactly the entries up to last_applied_.
+  auto snapshot = std::make_shared<Snapshot>();
+  snapshot->set_last_included_index(last_applied_);
+  snapshot->set_last_included_term(last_applied_term_);
+  const Status s = on_snapshot_save_(snapshot->mutable_data());
+  if (!s.ok()) {
+    LOG(ERROR) << cluster_.me() << " failed to take a snapshot: " << s;
+    return;
+  }
+  VLOG(1) << cluster_.me() << " took a snapshot of "
+          << snapshot->data().size() << " bytes up to index "
+          << snapshot->last_included_index();
+
+  // The log entries may only go once the snapshot would survive a restart.
+  if (storage_) CHECK_OK(storage_->SaveSnapshot(*snapshot));
   MutexLock lock(&mu_);
+  CompactLog(std::move(snapshot), snapshot_trailing_entries_);
+}
+
+void ServiceImpl::CompactLog(std::shared_ptr<const Snapshot> snapshot,
+                             uint64 keep) {
+  mu_.AssertHeld();
+  const uint64 index = snapshot->last_included_index();
+  // A snapshot from the leader may have overtaken ours.
+  if (snapshot_ && index <= snapshot_->last_included_index()) return;
+  DCHECK_LE(index, commit_index_);
+  snapshot_ = std::move(snapshot);
+  // Followers in the middle of an older snapshot need to start over.
+  snapshot_offset_.clear();
 
-  // Apply log entries that are safe to apply.
-  if (last_applied_ < commit_index_) {
-    VLOG(2) << cluster_.me() << " is about to apply "
-            << commit_index_ - last_applied_ << " log entries locally";
+  const uint64 offset = index - std::min(index, keep);
+  if (offset <= log_.offset()) return;
+  if (offset <= LastIndex()) {
+    log_.CompactTo(offset);
+  } else {
+    // Only for a snapshot from the leader that is ahead of our whole log.
+    DCHECK_EQ(offset, index);
+    log_.Reset(offset, snapshot_->last_included_term());
   }
-  while (last_applied_ < commit_index_) {
-    const LogEntry &e = log_[++last_applied_];
-    void *arg = (write_args_.count(e.id()) ? write_args_[e.id()] : nullptr);
-    const Status s = on_append_(e.msg(), arg);
-    if (write_statuses_.count(e.id()))
-      write_statuses_[e.id()] = make_unique<Status>(s);
+}
+
+bool ServiceImpl::WaitForApplied(uint64 index, Duration timeout) {
+  absl::Notification applied;
+  {
+    MutexLock lock(&apply_mu_);
+    if (last_applied_ >= index) return true;
+    applied_waiters_.emplace(index, &applied);
   }
+  if (applied.WaitForNotificationWithTimeout(timeout)) return true;
 
+  // Unregister, unless the apply thread got to us in the meantime.
+  MutexLock lock(&apply_mu_);
+  for (auto it = applied_waiters_.lower_bound(index);
+       it != applied_waiters_.end() && it->first == index; ++it) {
+    if (it->second == &applied) {
+      applied_waiters_.erase(it);
+      return false;
+    }
+  }
+  return true;
+}
+
+Time ServiceImpl::LeaseExpiry() const {
+  mu_.AssertHeld();
+  // Besides ourselves, we need acks from this many other members.
+  const size_t needed = cluster_.size() / 2;
+  if (!needed) return absl::InfiniteFuture();
+  std::vector<Time> acks;
+  for (const auto &i : last_ack_time_) acks.push_back(i.second);
+  if (acks.size() < needed) return absl::InfinitePast();
+  std::nth_element(acks.begin(), acks.begin() + (needed - 1), acks.end(),
+                   std::greater<Time>());
+  return acks[needed - 1] + lease_duration_;
+}
+
+void ServiceImpl::NotifyReadWaiters(Time cancel_before) {
+  mu_.AssertHeld();
+  std::vector<ReadWaiter *> waiting;
+  for (ReadWaiter *waiter : read_waiters_) {
+    size_t k = 1;
+    for (const auto &i : last_ack_time_) {
+      if (i.second >= waiter->start) ++k;
+    }
+    if (k * 2 > cluster_.size()) {
+      waiter->confirmed = true;
+      waiter->done.Notify();
+    } else if (waiter->start < cancel_before) {
+      waiter->done.Notify();
+    } else {
+      waiting.push_back(waiter);
+    }
+  }
+  read_waiters_.swap(waiting);
+}
+
+void ServiceImpl::OnAlarm() {
+  {
+    MutexLock lock(&mu_);
+    OnAlarmLocked();
+  }
+
+  // Save the commit index now and then, so that a restarted member can apply
+  // most of its log before it hears from a leader. It must not cover entries
+  // that a crash could take back: they might come back as different ones.
+  uint64 commit_index = commit_index_;
+  if (storage_ && commit_index > saved_commit_index_) {
+    uint64 durable_index;
+    {
+      MutexLock lock(&mu_);
+      durable_index = DurableIndex();
+    }
+    // Only a leader commits entries that aren't durable here yet.
+    if (commit_index > durable_index) {
+      SyncLog(commit_index);
+      MutexLock lock(&mu_);
+      durable_index = DurableIndex();
+    }
+    commit_index = std::min(commit_index, durable_index);
+    if (commit_index > saved_commit_index_) {
+      CHECK_OK(storage_->SaveCommitIndex(commit_index));
+      saved_commit_index_ = commit_index;
+    }
+  }
+}
+
+void ServiceImpl::OnAlarmLocked() {
+  mu_.AssertHeld();
   const Time now = clock_->TimeNow();
 
   if (state_ == FOLLOWER) {
@@ -299,19 +977,28 @@ void ServiceImpl::OnAlarm() {
       state_ = LEADER;
       leader_ = cluster_.me();
       for (const std::string &member : cluster_.others()) {
-        next_index_[member] = log_.size();
+        next_index_[member] = LastIndex() + 1;
         match_index_[member] = 0;
         last_sync_time_[member] = absl::UnixEpoch();
+        appends_in_flight_[member] = 0;
+        replicating_[member] = false;
+        sent_commit_index_[member] = 0;
       }
+      snapshot_offset_.clear();
+      last_ack_time_.clear();
+      last_send_time_.clear();
+      freshness_marks_.clear();
       LOG(INFO) << cluster_.me() << " is now RAFT leader for term " << term_;
     } else if (now - last_heartbeat_time_ >= election_timeout_) {
       StartElection(now);
     }
   }
 
+  // Replication and commits are driven by appends and AppendEntries
+  // responses; the alarm only needs to keep the heartbeats going.
   if (state_ == LEADER) {
     BroadcastAppendEntries(now);
-    CommitEntries();
+    NotifyReadWaiters(now - election_timeout_);
   }
 
   // Track current leader state
@@ -321,12 +1008,22 @@ void ServiceImpl::OnAlarm() {
 
 void ServiceImpl::AdvanceTermTo(uint64 term) {
   mu_.AssertHeld();
-  if (term > term_) VLOG(2) << cluster_.me() << " advances to term " << term;
+  if (term > term_) {
+    VLOG(2) << cluster_.me() << " advances to term " << term;
+    // Whoever led the old term doesn't lead the new one. A leader we no
+    // longer follow must not keep us from voting in the new term's elections.
+    leader_ = "";
+  }
+  const bool changed = term != term_ || !voted_for_.empty();
   term_ = term;
   state_ = FOLLOWER;
   voted_for_ = "";
+  if (changed) PersistHardState();
   votes_for_me_.clear();
-  for (auto &i : hanging_appends_) i.second = true;
+  for (const auto &i : commit_waiters_) i.second->done.Notify();
+  commit_waiters_.clear();
+  for (ReadWaiter *waiter : read_waiters_) waiter->done.Notify();
+  read_waiters_.clear();
 }
 
 void ServiceImpl::StartElection(Time now) {
@@ -337,6 +1034,7 @@ void ServiceImpl::StartElection(Time now) {
   voted_for_ = cluster_.me();
   votes_for_me_ = {voted_for_};
   last_heartbeat_time_ = now;
+  PersistHardState();
   VLOG(2) << voted_for_ << " starts a new election: term " << term_;
   BroadcastRequestVote();
 }
@@ -346,8 +1044,8 @@ void ServiceImpl::BroadcastRequestVote() {
   RequestVoteRequest request;
   request.set_term(term_);
   request.set_candidate_id(cluster_.me());
-  request.set_last_log_index(log_.size() - 1);
-  request.set_last_log_term(log_.back().term());
+  request.set_last_log_index(LastIndex());
+  request.set_last_log_term(EntryAt(LastIndex()).term());
   const uint64 election_term = term_;
   cluster_.BroadcastRequestVote(
       request, [this, election_term](string_view voter,
@@ -371,80 +1069,288 @@ void ServiceImpl::OnVoteReceived(uint64 election_term, string_view voter,
 
 void ServiceImpl::BroadcastAppendEntries(Time now) {
   mu_.AssertHeld();
+  if (state_ != LEADER) return;
+  for (const std::string &member : cluster_.others()) {
+    // Snapshot chunks go one at a time.
+    const int window =
+        replicating_[member] && next_index_[member] > log_.offset()
+            ? max_append_entries_in_flight_
+            : 1;
+    while (appends_in_flight_[member] < window) {
+      if (next_index_[member] > LastIndex() &&
+          (read_waiters_.empty() ||
+           last_send_time_[member] >= read_waiters_.back()->start)) {
+        // Heartbeats and commit index updates wait for the pipeline to
+        // drain; its responses will trigger another round anyway.
+        if (appends_in_flight_[member]) break;
+        if (sent_commit_index_[member] >= commit_index_ &&
+            now - last_sync_time_[member] < alarm_timeout_)
+          break;
+      }
+      SendAppendEntries(member, now);
+    }
+    // A slow pipeline must not hold up heartbeats for so long that the
+    // member calls an election.
+    if (now - last_send_time_[member] >= alarm_timeout_) {
+      SendHeartbeat(member, now);
+    }
+  }
+}
+
+void ServiceImpl::SendAppendEntries(const std::string &member, Time now) {
+  mu_.AssertHeld();
+  const uint64 i = next_index_[member];
+  if (i <= log_.offset()) {
+    SendSnapshotChunk(member, now);
+    return;
+  }
+
   const uint64 leader_term = term_;
   AppendEntriesRequest request;
   request.set_term(leader_term);
   request.set_leader_id(cluster_.me());
   request.set_leader_commit(commit_index_);
-  for (const std::string &member : cluster_.others()) {
-    const uint64 i = next_index_[member];
-    if (i >= log_.size() && now - last_sync_time_[member] < alarm_timeout_)
-      continue;
-    request.set_prev_log_index(i - 1);
-    request.set_prev_log_term(log_[i - 1].term());
-    request.clear_entry();
-    uint64 j;
-    for (j = i; j < log_.size(); ++j) *request.add_entry() = log_[j];
+  request.set_prev_log_index(i - 1);
+  request.set_prev_log_term(EntryAt(i - 1).term());
+  // The request borrows the entries from log_ instead of copying them, and
+  // gives them back once Cluster::SendAppendEntries() returns. That is safe:
+  // log_ never modifies its entries, it can't drop them while we hold mu_,
+  // and the request is serialized before that call returns, whether it goes
+  // out as an RPC or over a stream, which only queues the serialized bytes.
+  uint64 j;
+  size_t bytes = 0;
+  for (j = i; j <= LastIndex(); ++j) {
+    if (request.entry_size() >= max_append_entries_count_) break;
+    const LogEntry &entry = EntryAt(j);
+    bytes += entry.ByteSizeLong();
+    if (request.entry_size() && bytes > max_append_entries_bytes_) break;
+    request.mutable_entry()->AddAllocated(const_cast<LogEntry *>(&entry));
+  }
 
-    if (request.entry_size()) {
-      VLOG(2) << cluster_.me() << " as leader sends " << request.entry_size()
-              << " log entries to " << member;
-    }
+  if (request.entry_size()) {
+    VLOG(2) << cluster_.me() << " as leader sends " << request.entry_size()
+            << " log entries to " << member;
+  }
+
+  ++appends_in_flight_[member];
+  next_index_[member] = j;
+  sent_commit_index_[member] = commit_index_;
+  last_send_time_[member] = now;
+  cluster_.SendAppendEntries(
+      member, request,
+      [this, leader_term, member, i, j,
+       now](const AppendEntriesResponse &response) {
+        OnAppendEntriesResponse(leader_term, member, i - 1, j, now, response);
+      },
+      [this, leader_term, member, i]() {
+        OnAppendEntriesFailure(leader_term, member, i);
+      });
+  while (request.entry_size()) request.mutable_entry()->ReleaseLast();
+}
+
+void ServiceImpl::SendHeartbeat(const std::string &member, Time now) {
+  mu_.AssertHeld();
+  const uint64 i = std::max(match_index_[member], log_.offset()) + 1;
+  const uint64 leader_term = term_;
+  AppendEntriesRequest request;
+  request.set_term(leader_term);
+  request.set_leader_id(cluster_.me());
+  request.set_leader_commit(commit_index_);
+  request.set_prev_log_index(i - 1);
+  request.set_prev_log_term(EntryAt(i - 1).term());
+
+  ++appends_in_flight_[member];
+  last_send_time_[member] = now;
+  cluster_.SendAppendEntries(
+      member, request,
+      [this, leader_term, member, i,
+       now](const AppendEntriesResponse &response) {
+        OnAppendEntriesResponse(leader_term, member, i - 1, i, now, response);
+      },
+      [this, leader_term, member, i]() {
+        OnAppendEntriesFailure(leader_term, member, i);
+      });
+}
+
+void ServiceImpl::SendSnapshotChunk(const std::string &member, Time now) {
+  mu_.AssertHeld();
+  const uint64 leader_term = term_;
+  const uint64 snapshot_index = snapshot_->last_included_index();
+  const std::string &data = snapshot_->data();
+  const uint64 offset = std::min<uint64>(snapshot_offset_[member], data.size());
+
+  InstallSnapshotRequest request;
+  request.set_term(leader_term);
+  request.set_leader_id(cluster_.me());
+  request.set_last_included_index(snapshot_index);
+  request.set_last_included_term(snapshot_->last_included_term());
+  request.set_offset(offset);
+  request.set_data(data.substr(offset, snapshot_chunk_bytes_));
+  request.set_done(offset + request.data().size() == data.size());
+  VLOG(2) << cluster_.me() << " as leader sends " << member << " "
+          << request.data().size() << " bytes of its snapshot at offset "
+          << offset;
 
-    cluster_.SendAppendEntries(member, request,
-                               [this, leader_term, member, j,
-                                now](const AppendEntriesResponse &response) {
-                                 OnAppendEntriesResponse(leader_term,
-                                                         std::string(member), j, now,
-                                                         response);
-                               });
+  ++appends_in_flight_[member];
+  last_send_time_[member] = now;
+  const uint64 next_index = next_index_[member];
+  cluster_.SendInstallSnapshot(
+      member, request,
+      [this, leader_term, member, snapshot_index,
+       now](const InstallSnapshotResponse &response) {
+        OnInstallSnapshotResponse(leader_term, member, snapshot_index, now,
+                                  response);
+      },
+      [this, leader_term, member, next_index]() {
+        OnAppendEntriesFailure(leader_term, member, next_index);
+      });
+}
+
+void ServiceImpl::OnInstallSnapshotResponse(
+    uint64 leader_term, const std::string &member, uint64 snapshot_index,
+    Time request_time, const InstallSnapshotResponse &response) {
+  MutexLock lock(&mu_);
+  if (response.term() > term_) {
+    AdvanceTermTo(response.term());
+    return;
+  }
+  if (leader_term < term_ || state_ != LEADER) return;
+  --appends_in_flight_[member];
+  last_ack_time_[member] = std::max(last_ack_time_[member], request_time);
+  NotifyReadWaiters(absl::InfinitePast());
+  if (response.done()) {
+    VLOG(1) << member << " has caught up with " << cluster_.me()
+            << "'s snapshot up to index " << snapshot_index;
+    snapshot_offset_.erase(member);
+    next_index_[member] = std::max(next_index_[member], snapshot_index + 1);
+    match_index_[member] = std::max(match_index_[member], snapshot_index);
+    CommitEntries();
+  } else if (snapshot_index == snapshot_->last_included_index()) {
+    snapshot_offset_[member] = response.bytes_received();
   }
+  BroadcastAppendEntries(clock_->TimeNow());
 }
 
 void ServiceImpl::OnAppendEntriesResponse(
-    uint64 leader_term, const std::string &member, uint64 log_size,
-    Time request_time, const AppendEntriesResponse &response) {
+    uint64 leader_term, const std::string &member, uint64 prev_log_index,
+    uint64 next_index, Time request_time,
+    const AppendEntriesResponse &response) {
   MutexLock lock(&mu_);
   if (response.term() > term_) {
     AdvanceTermTo(response.term());
     return;
   }
-  if (leader_term < term_) return;
+  if (leader_term < term_ || state_ != LEADER) return;
+  --appends_in_flight_[member];
+  // Even a rejection means that the member still follows us.
+  last_ack_time_[member] = std::max(last_ack_time_[member], request_time);
+  NotifyReadWaiters(absl::InfinitePast());
   if (response.success()) {
-    if (match_index_[member] < log_size - 1) alarm_thread_.Poke();
-    next_index_[member] = log_size;
-    match_index_[member] = log_size - 1;
+    // Responses to pipelined requests may arrive out of order.
+    next_index_[member] = std::max(next_index_[member], next_index);
+    match_index_[member] = std::max(match_index_[member], next_index - 1);
     last_sync_time_[member] = request_time;
-  } else if (next_index_[member] > 1) {
-    --next_index_[member];
-    alarm_thread_.Poke();
+    replicating_[member] = true;
+    CommitEntries();
+  } else if (prev_log_index >= match_index_[member]) {
+    // If we have entries from the follower's conflicting term, its log
+    // matches ours up to the last of them. Otherwise, none of the follower's
+    // entries from that term can match. Without hints, back up by one.
+    uint64 next = prev_log_index;
+    if (response.has_conflict_index()) {
+      next = response.conflict_index();
+      if (response.has_conflict_term()) {
+        for (uint64 j = std::min(prev_log_index, LastIndex());
+             j > log_.offset() && j >= response.conflict_index(); --j) {
+          const uint64 term = EntryAt(j).term();
+          if (term == response.conflict_term()) {
+            next = j + 1;
+            break;
+          }
+          if (term < response.conflict_term()) break;
+        }
+      }
+    }
+    // Whatever else is in flight was sent from a position that is now known
+    // to be wrong; send one request at a time until one succeeds.
+    next = std::min(next, prev_log_index);
+    next_index_[member] =
+        std::max<uint64>(1, std::min(next_index_[member], next));
+    replicating_[member] = false;
+    VLOG(2) << cluster_.me() << " as leader backs " << member
+            << " up to index " << next_index_[member];
   }
+  // Keep the follower busy while it is behind, and let everybody know about
+  // a new commit index as soon as there is one.
+  BroadcastAppendEntries(clock_->TimeNow());
+}
+
+void ServiceImpl::OnAppendEntriesFailure(uint64 leader_term,
+                                         const std::string &member,
+                                         uint64 next_index) {
+  MutexLock lock(&mu_);
+  if (leader_term < term_ || state_ != LEADER) return;
+  // The entries may not have arrived, so they must be sent again. The alarm
+  // thread will retry on the next heartbeat.
+  --appends_in_flight_[member];
+  next_index_[member] = std::min(next_index_[member], next_index);
+  replicating_[member] = false;
 }
 
 void ServiceImpl::CommitEntries() {
   mu_.AssertHeld();
+  const uint64 old_commit_index = commit_index_;
   uint64 new_commit_index_ = commit_index_;
-  while (++new_commit_index_ < log_.size()) {
-    if (log_[new_commit_index_].term() < term_) continue;
-    if (log_[new_commit_index_].term() > term_) break;
-    size_t k = 1;
+  while (++new_commit_index_ <= LastIndex()) {
+    if (EntryAt(new_commit_index_).term() < term_) continue;
+    if (EntryAt(new_commit_index_).term() > term_) break;
+    size_t k = DurableIndex() >= new_commit_index_ ? 1 : 0;
     for (const auto &i : match_index_) {
       if (i.second >= new_commit_index_) ++k;
     }
     if (k * 2 <= cluster_.size()) break;
-    while (commit_index_ < new_commit_index_) {
-      const uint64 id = log_[++commit_index_].id();
-      if (hanging_appends_.count(id)) hanging_appends_[id] = true;
-    }
+    commit_index_ = new_commit_index_;
+  }
+  if (commit_index_ > old_commit_index) {
+    NotifyCommitWaiters();
+    apply_thread_.Poke();
   }
 }
 
+void ServiceImpl::PersistHardState() {
+  mu_.AssertHeld();
+  if (!storage_) return;
+  HardState hard_state;
+  hard_state.set_term(term_);
+  hard_state.set_voted_for(voted_for_);
+  CHECK_OK(storage_->SaveHardState(hard_state));
+}
+
+void ServiceImpl::PersistEntries(uint64 first_index) {
+  mu_.AssertHeld();
+  if (!storage_) return;
+  std::vector<const LogEntry *> entries;
+  for (uint64 i = first_index; i <= LastIndex(); ++i) {
+    entries.push_back(&EntryAt(i));
+  }
+  CHECK_OK(storage_->Append(entries.data(), entries.size()));
+}
+
+uint64 ServiceImpl::DurableIndex() const {
+  mu_.AssertHeld();
+  return storage_ ? storage_->synced_index() : LastIndex();
+}
+
+void ServiceImpl::SyncLog(uint64 index) {
+  if (storage_) CHECK_OK(storage_->Sync(index));
+}
+
 void ServiceImpl::DumpState() const {
   mu_.AssertHeld();
   std::ostringstream log;
-  log << " sz=" << log_.size();
-  for (size_t i = 0; i < log_.size(); ++i) {
-    log << " T" << log_[i].term() << ":" << log_[i].msg();
+  log << " offset=" << log_.offset() << " last=" << LastIndex();
+  for (uint64 i = log_.offset(); i <= LastIndex(); ++i) {
+    log << " T" << EntryAt(i).term() << ":" << EntryAt(i).msg();
     if (i == last_applied_) log << " a";
     if (i == commit_index_) log << " c";
   }
@@ -22,17 +22,24 @@
 #ifndef RAFT_SERVICE_IMPL_H_
 #define RAFT_SERVICE_IMPL_H_
 
+#include <atomic>
+#include <deque>
 #include <functional>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
 
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
 #include "grpcpp/grpcpp.h"
 #include "raft/alarm_thread.h"
+#include "raft/apply_thread.h"
 #include "raft/cluster.h"
+#include "raft/log_storage.h"
+#include "raft/memory_log.h"
 #include "raft/msg_ids.h"
 #include "raft/options.h"
 #include "raft/raft.grpc.pb.h"
@@ -52,7 +59,7 @@ class ServiceImpl final : public RaftService::Service {
   ServiceImpl(const ServiceImpl &) = delete;
   ServiceImpl &operator=(const ServiceImpl &) = delete;
 
-  // Registers the gRPC handler and starts the AlarmThread.
+  // Registers the gRPC handler and starts the AlarmThread and ApplyThread.
   void Start();
 
   // Undoes Start(). Make sure to call it before destroying the ServiceImpl.
@@ -62,7 +69,40 @@ class ServiceImpl final : public RaftService::Service {
   void Append(absl::string_view msg);
 
   // Blocks until on_append(msg, arg) on this member has returned.
-  ::util::Status Write(absl::string_view msg, void *arg);
+  // If |index| is non-null, it receives the log index of |msg|.
+  ::util::Status Write(absl::string_view msg, void *arg, uint64 *index);
+
+  // Blocks until it is safe to serve a linearizable read on this member.
+  //
+  // Only the leader can do that. It holds a lease while a majority of members
+  // has acknowledged its heartbeats within the last election timeout (minus
+  // clock drift), during which no other member can get elected. Without a
+  // lease, the leader confirms its leadership with a round of heartbeats
+  // first. Either way, it then waits until it has applied all entries that
+  // were committed when the read arrived.
+  //
+  // Returns FAILED_PRECONDITION on non-leaders and UNAVAILABLE if leadership
+  // can't be confirmed.
+  ::util::Status ReadBarrier();
+
+  // Succeeds if reads on this member may be served from its local state when
+  // they can tolerate missing up to |max_staleness| worth of writes and up to
+  // |max_lag| committed entries.
+  //
+  // A follower's state is as fresh as the latest heartbeat whose leader
+  // commit index it has applied; the lag is measured against the commit index
+  // it has heard of. Followers that haven't heard from a leader within an
+  // election timeout always fail with UNAVAILABLE. The leader just calls
+  // ReadBarrier().
+  ::util::Status StaleReadBarrier(absl::Duration max_staleness,
+                                  uint64 max_lag);
+
+  // Waits up to |timeout| until the log entry at |index| has been applied.
+  // Returns DEADLINE_EXCEEDED if it hasn't.
+  ::util::Status AppliedBarrier(uint64 index, absl::Duration timeout);
+
+  // Returns the index of the latest log entry applied on this member.
+  uint64 AppliedIndex() const { return last_applied_; }
 
  private:
   grpc::Status RequestVote(::grpc::ServerContext *rpc,
@@ -73,22 +113,153 @@ class ServiceImpl final : public RaftService::Service {
                              const AppendEntriesRequest *request,
                              AppendEntriesResponse *response) override;
 
+  grpc::Status AppendEntriesStream(
+      ::grpc::ServerContext *rpc,
+      ::grpc::ServerReaderWriter<AppendEntriesResponse, AppendEntriesRequest>
+          *stream) override;
+
   grpc::Status AppendOnLeader(::grpc::ServerContext *rpc,
                               const AppendOnLeaderRequest *request,
                               AppendOnLeaderResponse *response) override;
 
+  grpc::Status InstallSnapshot(::grpc::ServerContext *rpc,
+                               const InstallSnapshotRequest *request,
+                               InstallSnapshotResponse *response) override;
+
  private:
+  // An entry waiting in AppendAndWait(). |wakeup| is notified exactly once:
+  // either when the entry has been committed (|done| is then true), or when
+  // it's the caller's turn to forward the next batch to the leader.
+  struct PendingAppend {
+    LogEntry *e;
+    uint64 index = 0;  // Where the leader has put |e|, if it has told us.
+    bool done = false;
+    absl::Notification wakeup;
+  };
+
+  // A Write() waiting for its entry to be applied on this member. |index| is
+  // set once the entry is committed, or when it is applied.
+  struct PendingWrite {
+    void *arg;
+    uint64 index = 0;
+    ::util::Status status;
+    absl::Notification done;
+  };
+
+  // A ReadBarrier() call waiting for a majority to confirm its leadership.
+  struct ReadWaiter {
+    absl::Time start;
+    bool confirmed = false;
+    absl::Notification done;
+  };
+
+  // An AppendOnLeader() call waiting for its entries to be committed.
+  struct CommitWaiter {
+    // (log index, entry ID) of each entry the call is waiting for.
+    std::vector<std::pair<uint64, uint64>> entries;
+    bool committed = false;
+    absl::Notification done;
+  };
+
+  // Loads the log and hard state persisted in opts.log_dir.
+  void Recover(const Options &opts);
+
+  // The part of AppendEntries() that runs under mu_; everything except for
+  // waiting for the new entries to become durable.
+  void AppendEntriesLocked(const AppendEntriesRequest &request,
+                           AppendEntriesResponse *response)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Advances a follower's commit index to |leader_commit|, but not past the
+  // entries that are durable here. The commit index this member saves then
+  // never covers entries that a crash could take back.
+  void FollowLeaderCommit(uint64 leader_commit) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
   // Called periodically by the alarm thread.
-  void OnAlarm();
+  void OnAlarm() LOCKS_EXCLUDED(mu_);
+  void OnAlarmLocked() EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Called by the apply thread whenever commit_index_ may have advanced.
+  // Runs on_append_ (or on_append_batch_) for every committed, not yet
+  // applied log entry without holding mu_, so that long-running state machine
+  // operations don't block heartbeats, votes, or log replication.
+  void ApplyCommittedEntries() LOCKS_EXCLUDED(mu_, apply_mu_);
+
+  // Passes the |n| entries after last_applied_ to on_append_batch_ at once.
+  void ApplyBatch(const MemoryLog::EntryRef *entries, size_t n)
+      LOCKS_EXCLUDED(mu_, apply_mu_);
+
+  // Removes and returns the local Write() waiting for entry |id|, if any.
+  PendingWrite *TakePendingWrite(uint64 id) LOCKS_EXCLUDED(apply_mu_);
+
+  // Replaces the state machine with |snapshot| on the apply thread. Fails the
+  // Write() calls whose entries it has skipped over.
+  void LoadSnapshot(const Snapshot &snapshot) LOCKS_EXCLUDED(mu_, apply_mu_);
+
+  // Takes a snapshot on the apply thread if snapshot_interval_entries_ have
+  // been applied since the last one, and compacts the log up to it.
+  void MaybeTakeSnapshot() LOCKS_EXCLUDED(mu_, apply_mu_);
+
+  // Makes |snapshot|, which must be committed, the one sent to lagging
+  // followers, and drops the log entries it covers except for the last
+  // |keep| of them.
+  void CompactLog(std::shared_ptr<const Snapshot> snapshot, uint64 keep)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // The part of InstallSnapshot() that runs under mu_.
+  void InstallSnapshotLocked(const InstallSnapshotRequest &request,
+                             InstallSnapshotResponse *response)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Index of the last entry in the log.
+  uint64 LastIndex() const EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return log_.LastIndex();
+  }
+
+  // The log entry at |index|. For log_.offset(), only its term is known.
+  const LogEntry &EntryAt(uint64 index) const EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return log_.At(index);
+  }
 
   void AdvanceTermTo(uint64 term) EXCLUSIVE_LOCKS_REQUIRED(mu_);
   void StartElection(absl::Time now) EXCLUSIVE_LOCKS_REQUIRED(mu_);
   void CommitEntries() EXCLUSIVE_LOCKS_REQUIRED(mu_);
-  void AppendAsLeader() EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Appends the entries of |request| that aren't in the log yet, and
+  // registers |waiter| to be notified when all of them are committed.
+  void AppendAsLeader(const AppendOnLeaderRequest &request,
+                      CommitWaiter *waiter) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Completes the commit_waiters_ whose entries are all committed.
+  void NotifyCommitWaiters() EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Returns the time until which no other member can become the leader, based
+  // on the heartbeats acknowledged by a majority.
+  absl::Time LeaseExpiry() const EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Completes the read_waiters_ whose heartbeat rounds a majority has
+  // acknowledged, and cancels the ones older than |cancel_before|.
+  void NotifyReadWaiters(absl::Time cancel_before)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Blocks for up to |timeout| until the log entry at |index| has been
+  // applied. Returns whether it has.
+  bool WaitForApplied(uint64 index, absl::Duration timeout)
+      LOCKS_EXCLUDED(mu_, apply_mu_);
 
   // Sends the AppendOnLeader() RPC and waits for it to finish.
-  // Sets e->term() to the RAFT term in which it is committed.
-  void AppendAndWait(LogEntry *e);
+  // Sets e->term() to the RAFT term in which it is committed, and returns its
+  // log index (or 0 if the leader didn't say).
+  //
+  // Entries submitted concurrently are grouped: while one AppendOnLeader()
+  // RPC is in flight, new entries queue up and are all sent together in the
+  // next one.
+  uint64 AppendAndWait(LogEntry *e) LOCKS_EXCLUDED(mu_, batch_mu_);
+
+  // Forwards |batch| to the leader in a single AppendOnLeader() RPC, retrying
+  // on leader change until all of its entries are committed.
+  void ForwardToLeader(const std::vector<PendingAppend *> &batch)
+      LOCKS_EXCLUDED(mu_, batch_mu_);
 
   // Sends out a RequestVote RPC broadcast and expects responses to arrive
   // through OnVoteReceived().
@@ -98,29 +269,97 @@ class ServiceImpl final : public RaftService::Service {
   void OnVoteReceived(uint64 election_term, absl::string_view voter,
                       const RequestVoteResponse &response);
 
-  // Sends out an AppendEntries RPC broadcast and expects responses to arrive
-  // through OnAppendEntriesResponse().
+  // Sends AppendEntries RPCs to every member that is missing log entries,
+  // hasn't heard of the latest commit index, or is due a heartbeat, as far as
+  // its window of RPCs in flight allows. Members that haven't been sent
+  // anything for alarm_timeout_ get a heartbeat even if the window is full.
+  // Responses arrive through OnAppendEntriesResponse().
+  //
+  // Called whenever the leader's log or commit index changes, so replication
+  // doesn't have to wait for the next alarm tick.
   void BroadcastAppendEntries(absl::Time now) EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
+  // Sends a single AppendEntries RPC to |member|, starting at its next_index_,
+  // and advances next_index_ past the entries sent without waiting for the
+  // response. If that entry has been compacted away, sends the next chunk of
+  // the snapshot instead.
+  void SendAppendEntries(const std::string &member, absl::Time now)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Sends |member| an AppendEntries RPC without entries that follows the
+  // entries it is known to have, so that it matches whatever happens to the
+  // RPCs in flight. Leaves next_index_ alone.
+  void SendHeartbeat(const std::string &member, absl::Time now)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Sends |member| the chunk of snapshot_ at its snapshot_offset_.
+  void SendSnapshotChunk(const std::string &member, absl::Time now)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
   // Called when another member has responded to this member's AppendEntries.
-  // |log_size| is log_.size() at the time of the request.
+  // |prev_log_index| is that of the request, and |next_index| is one past the
+  // last entry it carried.
   // |request_time| is the |now| passed to BroadcastAppendEntries().
   void OnAppendEntriesResponse(uint64 leader_term, const std::string &member,
-                               uint64 log_size, absl::Time request_time,
+                               uint64 prev_log_index, uint64 next_index,
+                               absl::Time request_time,
                                const AppendEntriesResponse &response);
 
+  // Called when an AppendEntries or InstallSnapshot RPC to |member| has
+  // failed or timed out. |next_index| is the first log entry the request was
+  // meant to deliver; next_index_ is rolled back to it.
+  void OnAppendEntriesFailure(uint64 leader_term, const std::string &member,
+                              uint64 next_index);
+
+  // Called when another member has responded to a snapshot chunk.
+  // |snapshot_index| is the last index included in the snapshot it was from.
+  void OnInstallSnapshotResponse(uint64 leader_term, const std::string &member,
+                                 uint64 snapshot_index, absl::Time request_time,
+                                 const InstallSnapshotResponse &response);
+
+  // Saves term_ and voted_for_ to storage_, if any. Must be called whenever
+  // they change, before anybody else can find out about the change.
+  void PersistHardState() EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Writes log_[first_index...] to storage_, if any.
+  void PersistEntries(uint64 first_index) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Index of the latest log entry that would survive a restart.
+  uint64 DurableIndex() const EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  // Waits until the log entries up to |index| are durable.
+  void SyncLog(uint64 index) LOCKS_EXCLUDED(mu_);
+
   // Writes internal state to DLOG(INFO).
   void DumpState() const EXCLUSIVE_LOCKS_REQUIRED(mu_);  // DEBUG
 
   ::grpc::ServerBuilder *server_builder_;
   const std::function<::util::Status(absl::string_view, void *)> on_append_;
+  const std::function<void(std::vector<AppendedEntry> *)> on_append_batch_;
+  const int max_apply_batch_entries_;
+  const std::function<::util::Status(std::string *)> on_snapshot_save_;
+  const std::function<::util::Status(absl::string_view)> on_snapshot_load_;
+  const uint64 snapshot_interval_entries_;
+  const uint64 snapshot_trailing_entries_;
+  const size_t snapshot_chunk_bytes_;
+  const size_t max_append_entries_bytes_;
+  const int max_append_entries_count_;
+  const int max_append_entries_in_flight_;
   util::Clock *const clock_;
   const absl::Duration election_timeout_;
   const absl::Duration alarm_timeout_;
+  const absl::Duration lease_duration_;
   Cluster cluster_;
   AlarmThread alarm_thread_;
+  ApplyThread apply_thread_;
   MsgIds msg_id_gen_;
 
+  // Where the log and hard state are persisted; null if they aren't.
+  std::unique_ptr<LogStorage> storage_;
+
+  // The commit index last saved to storage_. Only used by the alarm thread.
+  uint64 saved_commit_index_ = 0;
+
   absl::Mutex mu_;
 
   enum State { FOLLOWER, CANDIDATE, LEADER };
@@ -135,16 +374,28 @@ class ServiceImpl final : public RaftService::Service {
   // Candidate that has received our vote in the current term.
   std::string voted_for_ GUARDED_BY(mu_) = "";
 
-  // The list of log entries, starting with an empty sentinel.
-  std::vector<LogEntry> log_ GUARDED_BY(mu_) = {{}};
+  // The log entries from the last one compacted away on.
+  MemoryLog log_ GUARDED_BY(mu_);
 
-  // Index of the latest known-to-be-committed log entry.
-  uint64 commit_index_ GUARDED_BY(mu_) = 0;
+  // The latest snapshot. Covers at least the log entries up to log_.offset(),
+  // and is sent to followers that need any of those.
+  std::shared_ptr<const Snapshot> snapshot_ GUARDED_BY(mu_);
 
-  // Index of the latest log entry applied to the state machine.
-  uint64 last_applied_ GUARDED_BY(mu_) = 0;
+  // A snapshot that the apply thread has yet to load into the state machine.
+  std::shared_ptr<const Snapshot> snapshot_to_load_ GUARDED_BY(mu_);
+
+  // On followers, the snapshot being received from the leader: the chunks
+  // so far and the last log entry it includes.
+  std::string incoming_snapshot_ GUARDED_BY(mu_);
+  uint64 incoming_snapshot_index_ GUARDED_BY(mu_) = 0;
+  uint64 incoming_snapshot_term_ GUARDED_BY(mu_) = 0;
+
+  // Index of the latest known-to-be-committed log entry.
+  // Only modified under mu_, but read by the apply thread without it.
+  std::atomic<uint64> commit_index_{0};
 
   // For each member, index of the next log entry to send to that member.
+  // Advanced as entries are sent, and rolled back if they don't arrive.
   std::map<std::string, uint64> next_index_ GUARDED_BY(mu_);
 
   // For each member, index of the highest log entry known to be replicated.
@@ -153,22 +404,79 @@ class ServiceImpl final : public RaftService::Service {
   // For each member, the time of the most recent AppendEntries RPC we went.
   std::map<std::string, absl::Time> last_sync_time_ GUARDED_BY(mu_);
 
+  // For each member, when we sent the latest AppendEntries RPC that it has
+  // acknowledged in the current term, successfully or not.
+  std::map<std::string, absl::Time> last_ack_time_ GUARDED_BY(mu_);
+
+  // For each member, when we sent it the latest AppendEntries RPC.
+  std::map<std::string, absl::Time> last_send_time_ GUARDED_BY(mu_);
+
+  // ReadBarrier() calls waiting for a heartbeat round, oldest first.
+  std::vector<ReadWaiter *> read_waiters_ GUARDED_BY(mu_);
+
+  // For each member, how many AppendEntries or InstallSnapshot RPCs to it
+  // are outstanding.
+  std::map<std::string, int> appends_in_flight_ GUARDED_BY(mu_);
+
+  // For each member, whether its last AppendEntries response was a success,
+  // so that more than one RPC may be in flight to it.
+  std::map<std::string, bool> replicating_ GUARDED_BY(mu_);
+
+  // For each member, the leader commit index we last sent to it.
+  std::map<std::string, uint64> sent_commit_index_ GUARDED_BY(mu_);
+
+  // For each member that is being sent snapshot_, how much of it it has.
+  std::map<std::string, uint64> snapshot_offset_ GUARDED_BY(mu_);
+
   // The time of the most recent leader heartbeat or this member's vote.
   absl::Time last_heartbeat_time_ GUARDED_BY(mu_) = absl::UnixEpoch();
 
+  // When Start() was called. For an election timeout after that, this member
+  // may not know of a leader that it has helped to a lease before a restart,
+  // so it doesn't vote.
+  absl::Time start_time_ GUARDED_BY(mu_) = absl::UnixEpoch();
+
+  // On followers, (leader commit index, time) of heartbeats whose commit
+  // index hasn't been applied yet, in increasing order.
+  std::deque<std::pair<uint64, absl::Time>> freshness_marks_ GUARDED_BY(mu_);
+
+  // On followers, the time of the latest heartbeat whose leader commit index
+  // has been applied. The local state includes every write committed before.
+  absl::Time fresh_as_of_ GUARDED_BY(mu_) = absl::InfinitePast();
+
   // The set of voters who have voted for us in an ongoing election.
   std::set<std::string> votes_for_me_ GUARDED_BY(mu_);
 
-  // Maps log entry IDs appended, but not yet committed by this leader, to
-  // whether they are ready to be reexamined.
-  std::map<uint64, bool> hanging_appends_ GUARDED_BY(mu_);
+  // AppendOnLeader() calls waiting for a commit, keyed by the highest log
+  // index they are waiting for. Cancelled on term change.
+  std::multimap<uint64, CommitWaiter *> commit_waiters_ GUARDED_BY(mu_);
+
+  // Protects the state machine side of this member. Never held together with
+  // mu_.
+  absl::Mutex apply_mu_;
+
+  // Index of the latest log entry applied to the state machine.
+  // Only modified by the apply thread.
+  std::atomic<uint64> last_applied_{0};
+
+  // The term of that entry. Only used by the apply thread.
+  uint64 last_applied_term_ = 0;
+
+  // Maps log entry IDs created in Write() calls to their waiters.
+  std::map<uint64, PendingWrite *> pending_writes_ GUARDED_BY(apply_mu_);
+
+  // WaitForApplied() calls, keyed by the log index they are waiting for.
+  std::multimap<uint64, absl::Notification *> applied_waiters_
+      GUARDED_BY(apply_mu_);
+
+  // Protects the queue of entries waiting to be forwarded to the leader.
+  absl::Mutex batch_mu_;
 
-  // Maps log entry IDs created in Write() calls to their |arg| values.
-  std::map<uint64, void *> write_args_ GUARDED_BY(mu_);
+  // Entries submitted to AppendAndWait() that haven't been sent yet.
+  std::vector<PendingAppend *> pending_appends_ GUARDED_BY(batch_mu_);
 
-  // Maps log entry IDs created in Write() calls to their statuses.
-  std::map<uint64, std::unique_ptr<::util::Status>> write_statuses_
-      GUARDED_BY(mu_);
+  // Whether some AppendAndWait() caller is currently forwarding a batch.
+  bool forwarding_ GUARDED_BY(batch_mu_) = false;
 };
 
 }  // namespace raft
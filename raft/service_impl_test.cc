@@ -0,0 +1,621 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "raft/service_impl.h"
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "grpcpp/grpcpp.h"
+#include "grpcpp/server_builder.h"
+#include "gtest/gtest.h"
+#include "raft/options.h"
+#include "raft/raft.grpc.pb.h"
+#include "raft/raft.pb.h"
+#include "util/net/port.h"
+#include "util/task/status.h"
+
+namespace raft {
+namespace {
+
+using ::absl::StrCat;
+using ::absl::StrFormat;
+
+// Stands in for another member. It votes for every candidate and answers
+// AppendEntries like a follower whose log has entries of the given terms,
+// but only keeps their terms. Records every AppendEntries request it gets.
+class FakeMember final : public RaftService::Service {
+ public:
+  enum Outcome { ACCEPTED, REJECTED, FAILED };
+
+  struct Received {
+    AppendEntriesRequest request;
+    Outcome outcome;
+  };
+
+  explicit FakeMember(const std::vector<uint64> &terms) {
+    terms_.push_back(0);
+    terms_.insert(terms_.end(), terms.begin(), terms.end());
+  }
+
+  // Makes the |n|th request with entries from now on (counting from 0) fail
+  // as if it got lost, or be rejected without a hint as if the previous
+  // entry didn't match.
+  void FailRequest(int n) {
+    absl::MutexLock lock(&mu_);
+    fail_at_ = n;
+  }
+  void RejectRequest(int n) {
+    absl::MutexLock lock(&mu_);
+    reject_at_ = n;
+  }
+
+  std::vector<Received> Requests() {
+    absl::MutexLock lock(&mu_);
+    return received_;
+  }
+
+  // Waits up to |timeout| until the log has the entries of |terms|.
+  bool AwaitTerms(const std::vector<uint64> &terms, absl::Duration timeout) {
+    std::vector<uint64> want = {0};
+    want.insert(want.end(), terms.begin(), terms.end());
+    auto done = [this, &want]() { return terms_ == want; };
+    absl::MutexLock lock(&mu_);
+    return mu_.AwaitWithTimeout(absl::Condition(&done), timeout);
+  }
+
+  grpc::Status RequestVote(::grpc::ServerContext *rpc,
+                           const RequestVoteRequest *request,
+                           RequestVoteResponse *response) override {
+    response->set_term(request->term());
+    response->set_vote_granted(true);
+    return grpc::Status::OK;
+  }
+
+  grpc::Status AppendEntries(::grpc::ServerContext *rpc,
+                             const AppendEntriesRequest *request,
+                             AppendEntriesResponse *response) override {
+    return Handle(*request, response);
+  }
+
+  grpc::Status AppendEntriesStream(
+      ::grpc::ServerContext *rpc,
+      ::grpc::ServerReaderWriter<AppendEntriesResponse, AppendEntriesRequest>
+          *stream) override {
+    AppendEntriesRequest request;
+    AppendEntriesResponse response;
+    while (stream->Read(&request)) {
+      response.Clear();
+      const grpc::Status status = Handle(request, &response);
+      if (!status.ok()) return status;
+      if (!stream->Write(response)) break;
+    }
+    return grpc::Status::OK;
+  }
+
+ private:
+  grpc::Status Handle(const AppendEntriesRequest &request,
+                      AppendEntriesResponse *response) {
+    absl::MutexLock lock(&mu_);
+    received_.push_back({request, REJECTED});
+    Outcome *outcome = &received_.back().outcome;
+    const int n = request.entry_size() ? with_entries_++ : -1;
+    if (n >= 0 && n == fail_at_) {
+      *outcome = FAILED;
+      return grpc::Status(grpc::StatusCode::UNAVAILABLE, "lost");
+    }
+
+    response->set_term(request.term());
+    response->set_success(false);
+    const uint64 prev = request.prev_log_index();
+    if (prev >= terms_.size()) {
+      response->set_conflict_index(terms_.size());
+      return grpc::Status::OK;
+    }
+    if (terms_[prev] != request.prev_log_term()) {
+      uint64 first = prev;
+      while (first > 1 && terms_[first - 1] == terms_[prev]) --first;
+      response->set_conflict_term(terms_[prev]);
+      response->set_conflict_index(first);
+      return grpc::Status::OK;
+    }
+    if (n >= 0 && n == reject_at_) return grpc::Status::OK;
+
+    for (int i = 0; i < request.entry_size(); ++i) {
+      const uint64 j = prev + 1 + i;
+      if (j < terms_.size() && terms_[j] != request.entry(i).term()) {
+        terms_.resize(j);
+      }
+      if (j == terms_.size()) terms_.push_back(request.entry(i).term());
+    }
+    response->set_success(true);
+    *outcome = ACCEPTED;
+    return grpc::Status::OK;
+  }
+
+  absl::Mutex mu_;
+  std::vector<uint64> terms_ GUARDED_BY(mu_);
+  std::vector<Received> received_ GUARDED_BY(mu_);
+  int with_entries_ GUARDED_BY(mu_) = 0;
+  int fail_at_ GUARDED_BY(mu_) = -1;
+  int reject_at_ GUARDED_BY(mu_) = -1;
+};
+
+// Drives a single member through its RPC handlers. The other members don't
+// exist, so it never hears from anybody else.
+class ServiceImplTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    for (int i = 0; i < 3; ++i) {
+      opts_.targets.push_back(
+          StrFormat("127.0.0.1:%d", PickUpFreeLocalPort()));
+    }
+    opts_.my_target = opts_.targets[0];
+    opts_.on_append = [this](absl::string_view msg, void *) {
+      absl::MutexLock lock(&mu_);
+      mu_.Await(absl::Condition(
+          +[](bool *paused) { return !*paused; }, &paused_));
+      applied_.emplace_back(msg);
+      return ::util::OkStatus();
+    };
+    log_dir_ = StrCat(::testing::TempDir(), "/service_impl_test_", getpid(),
+                      "_",
+                      ::testing::UnitTest::GetInstance()
+                          ->current_test_info()
+                          ->name());
+    RemoveDir();
+  }
+
+  void TearDown() override {
+    PauseApplying(false);
+    if (impl_) impl_->Stop();
+    for (auto &server : fake_servers_) {
+      server->Shutdown(absl::ToChronoTime(absl::Now()));
+    }
+    RemoveDir();
+  }
+
+  void RemoveDir() {
+    DIR *dir = opendir(log_dir_.c_str());
+    if (!dir) return;
+    while (const struct dirent *d = readdir(dir)) {
+      unlink(StrCat(log_dir_, "/", d->d_name).c_str());
+    }
+    closedir(dir);
+    rmdir(log_dir_.c_str());
+  }
+
+  // Starts the member, or restarts it with an empty state machine, and
+  // returns its RPC handlers.
+  RaftService::Service *Start() {
+    if (impl_) impl_->Stop();
+    impl_.reset();
+    {
+      absl::MutexLock lock(&mu_);
+      applied_.clear();
+    }
+    builder_ = absl::make_unique<::grpc::ServerBuilder>();
+    opts_.server_builder = builder_.get();
+    impl_ = absl::make_unique<ServiceImpl>(opts_);
+    impl_->Start();
+    return impl_.get();
+  }
+
+  // Runs a FakeMember with a log of |terms| at opts_.targets[i].
+  FakeMember *StartFake(int i, const std::vector<uint64> &terms) {
+    fakes_.push_back(absl::make_unique<FakeMember>(terms));
+    ::grpc::ServerBuilder builder;
+    builder.AddListeningPort(opts_.targets[i],
+                             ::grpc::InsecureServerCredentials());
+    builder.RegisterService(fakes_.back().get());
+    fake_servers_.push_back(builder.BuildAndStart());
+    return fakes_.back().get();
+  }
+
+  std::vector<std::string> Applied() {
+    absl::MutexLock lock(&mu_);
+    return applied_;
+  }
+
+  // Holds up applying entries while |paused|.
+  void PauseApplying(bool paused) {
+    absl::MutexLock lock(&mu_);
+    paused_ = paused;
+  }
+
+  // An AppendEntries request from the member at opts_.targets[leader].
+  AppendEntriesRequest Leader(int leader, uint64 term, uint64 prev_log_index,
+                              uint64 prev_log_term, uint64 leader_commit) {
+    AppendEntriesRequest request;
+    request.set_term(term);
+    request.set_leader_id(opts_.targets[leader]);
+    request.set_prev_log_index(prev_log_index);
+    request.set_prev_log_term(prev_log_term);
+    request.set_leader_commit(leader_commit);
+    return request;
+  }
+
+  static void AddEntry(uint64 term, uint64 id, const std::string &msg,
+                       AppendEntriesRequest *request) {
+    LogEntry *e = request->add_entry();
+    e->set_term(term);
+    e->set_id(id);
+    e->set_msg(msg);
+  }
+
+  static RequestVoteRequest Candidate(uint64 term) {
+    RequestVoteRequest request;
+    request.set_term(term);
+    request.set_candidate_id("candidate");
+    return request;
+  }
+
+  Options opts_;
+  std::string log_dir_;
+  std::unique_ptr<::grpc::ServerBuilder> builder_;
+  std::unique_ptr<ServiceImpl> impl_;
+  std::vector<std::unique_ptr<FakeMember>> fakes_;
+  std::vector<std::unique_ptr<::grpc::Server>> fake_servers_;
+
+  absl::Mutex mu_;
+  std::vector<std::string> applied_ GUARDED_BY(mu_);
+  bool paused_ GUARDED_BY(mu_) = false;
+};
+
+TEST_F(ServiceImplTest, DoesNotVoteRightAfterStarting) {
+  opts_.election_timeout = absl::Milliseconds(200);
+  RaftService::Service *service = Start();
+
+  RequestVoteResponse response;
+  RequestVoteRequest request = Candidate(10);
+  ASSERT_TRUE(service->RequestVote(nullptr, &request, &response).ok());
+  EXPECT_FALSE(response.vote_granted());
+
+  // Past one election timeout, it may have called elections of its own, but
+  // it votes for a candidate with a newer term.
+  absl::SleepFor(opts_.election_timeout);
+  request = Candidate(100);
+  ASSERT_TRUE(service->RequestVote(nullptr, &request, &response).ok());
+  EXPECT_TRUE(response.vote_granted());
+  EXPECT_EQ(100, response.term());
+}
+
+TEST_F(ServiceImplTest, VotesAgainAfterASplitVote) {
+  opts_.election_timeout = absl::Milliseconds(200);
+  // The member never calls an election of its own.
+  opts_.alarm_timeout = absl::Hours(1);
+  RaftService::Service *service = Start();
+
+  // It hears from the leader of term 1, which then goes away.
+  AppendEntriesRequest append = Leader(1, 1, 0, 0, 0);
+  AppendEntriesResponse append_response;
+  ASSERT_TRUE(
+      service->AppendEntries(nullptr, &append, &append_response).ok());
+  EXPECT_TRUE(append_response.success());
+  absl::SleepFor(opts_.election_timeout);
+
+  // It votes for a candidate of term 2, which doesn't win.
+  RequestVoteResponse response;
+  RequestVoteRequest request = Candidate(2);
+  ASSERT_TRUE(service->RequestVote(nullptr, &request, &response).ok());
+  EXPECT_TRUE(response.vote_granted());
+
+  // Nobody leads term 2, so a candidate of term 3 gets its vote right away.
+  request = Candidate(3);
+  request.set_candidate_id("other candidate");
+  ASSERT_TRUE(service->RequestVote(nullptr, &request, &response).ok());
+  EXPECT_TRUE(response.vote_granted());
+  EXPECT_EQ(3, response.term());
+}
+
+TEST_F(ServiceImplTest, RecoversAfterTruncatingItsLog) {
+  opts_.log_dir = log_dir_;
+  // Nobody calls an election.
+  opts_.election_timeout = absl::Seconds(10);
+  RaftService::Service *service = Start();
+
+  // The leader of term 1 sends three entries, and commits the first.
+  AppendEntriesRequest request = Leader(1, 1, 0, 0, 1);
+  AddEntry(1, 1, "x", &request);
+  AddEntry(1, 2, "y", &request);
+  AddEntry(1, 3, "z", &request);
+  AppendEntriesResponse response;
+  ASSERT_TRUE(service->AppendEntries(nullptr, &request, &response).ok());
+  EXPECT_TRUE(response.success());
+
+  // The leader of term 2 never got the last two; it replaces them.
+  request = Leader(2, 2, 1, 1, 2);
+  AddEntry(2, 4, "w", &request);
+  ASSERT_TRUE(service->AppendEntries(nullptr, &request, &response).ok());
+  EXPECT_TRUE(response.success());
+  ASSERT_TRUE(impl_->AppliedBarrier(2, absl::Seconds(5)).ok());
+  EXPECT_EQ(std::vector<std::string>({"x", "w"}), Applied());
+
+  // Give the alarm a chance to save the commit index, then restart. The
+  // member applies what it knows to be committed before hearing from anybody.
+  absl::SleepFor(3 * opts_.alarm_timeout);
+  service = Start();
+  ASSERT_TRUE(impl_->AppliedBarrier(2, absl::Seconds(5)).ok());
+  EXPECT_EQ(std::vector<std::string>({"x", "w"}), Applied());
+
+  // The log ends with the entry from term 2.
+  request = Leader(2, 2, 2, 2, 2);
+  ASSERT_TRUE(service->AppendEntries(nullptr, &request, &response).ok());
+  EXPECT_TRUE(response.success());
+  request = Leader(2, 2, 3, 1, 2);
+  ASSERT_TRUE(service->AppendEntries(nullptr, &request, &response).ok());
+  EXPECT_FALSE(response.success());
+  EXPECT_EQ(3, response.conflict_index());
+}
+
+TEST_F(ServiceImplTest, HintsAtTheStartOfAConflictingTerm) {
+  opts_.election_timeout = absl::Seconds(10);
+  RaftService::Service *service = Start();
+
+  // Its log has one entry from term 1, then three from term 2.
+  AppendEntriesRequest request = Leader(1, 2, 0, 0, 1);
+  AddEntry(1, 1, "x", &request);
+  AddEntry(2, 2, "y", &request);
+  AddEntry(2, 3, "z", &request);
+  AddEntry(2, 4, "w", &request);
+  AppendEntriesResponse response;
+  ASSERT_TRUE(service->AppendEntries(nullptr, &request, &response).ok());
+  EXPECT_TRUE(response.success());
+
+  // The leader of term 3 has a different entry at index 4.
+  request = Leader(2, 3, 4, 3, 1);
+  response.Clear();
+  ASSERT_TRUE(service->AppendEntries(nullptr, &request, &response).ok());
+  EXPECT_FALSE(response.success());
+  EXPECT_EQ(2, response.conflict_term());
+  EXPECT_EQ(2, response.conflict_index());
+
+  // Past the end of the log, there's no term to skip.
+  request = Leader(2, 3, 7, 3, 1);
+  response.Clear();
+  ASSERT_TRUE(service->AppendEntries(nullptr, &request, &response).ok());
+  EXPECT_FALSE(response.success());
+  EXPECT_FALSE(response.has_conflict_term());
+  EXPECT_EQ(5, response.conflict_index());
+}
+
+TEST_F(ServiceImplTest, LeaderSkipsAConflictingTermInOneRoundTrip) {
+  opts_.election_timeout = absl::Milliseconds(300);
+  RaftService::Service *service = Start();
+
+  // The member gets one entry from term 1 and four from term 3.
+  AppendEntriesRequest request = Leader(1, 3, 0, 0, 1);
+  AddEntry(1, 1, "x", &request);
+  for (uint64 i = 2; i <= 5; ++i) AddEntry(3, i, "y", &request);
+  AppendEntriesResponse response;
+  ASSERT_TRUE(service->AppendEntries(nullptr, &request, &response).ok());
+  EXPECT_TRUE(response.success());
+
+  // The others have four entries from term 2 instead. The member gets their
+  // votes once it stops hearing from the leader of term 3.
+  std::vector<FakeMember *> followers = {StartFake(1, {1, 2, 2, 2, 2}),
+                                         StartFake(2, {1, 2, 2, 2, 2})};
+  for (FakeMember *follower : followers) {
+    ASSERT_TRUE(follower->AwaitTerms({1, 3, 3, 3, 3}, absl::Seconds(10)));
+
+    // The first rejection tells the leader that all of term 2 goes, and the
+    // next request replaces it.
+    std::vector<uint64> prev_indices;
+    for (const FakeMember::Received &r : follower->Requests()) {
+      if (r.outcome == FakeMember::REJECTED) {
+        EXPECT_EQ(5, r.request.prev_log_index());
+        EXPECT_EQ(3, r.request.prev_log_term());
+      }
+      if (r.request.entry_size()) {
+        prev_indices.push_back(r.request.prev_log_index());
+      }
+    }
+    EXPECT_EQ(std::vector<uint64>({1}), prev_indices);
+  }
+}
+
+TEST_F(ServiceImplTest, CapsEachAppendEntriesRequest) {
+  opts_.election_timeout = absl::Milliseconds(300);
+  opts_.max_append_entries_count = 3;
+  opts_.max_append_entries_bytes = 100;
+  RaftService::Service *service = Start();
+
+  // Ten entries of a few bytes each, then ten of over 40 bytes.
+  AppendEntriesRequest request = Leader(1, 1, 0, 0, 0);
+  for (uint64 i = 1; i <= 20; ++i) {
+    AddEntry(1, i, i <= 10 ? "s" : std::string(40, 'l'), &request);
+  }
+  AppendEntriesResponse response;
+  ASSERT_TRUE(service->AppendEntries(nullptr, &request, &response).ok());
+  EXPECT_TRUE(response.success());
+
+  // The member gets elected once it stops hearing from the leader of term 1.
+  FakeMember *follower = StartFake(1, {});
+  StartFake(2, {});
+  ASSERT_TRUE(follower->AwaitTerms(std::vector<uint64>(20, 1),
+                                   absl::Seconds(10)));
+
+  bool count_capped = false;
+  bool bytes_capped = false;
+  for (const FakeMember::Received &r : follower->Requests()) {
+    const int n = r.request.entry_size();
+    if (!n) continue;
+    size_t bytes = 0;
+    for (const LogEntry &e : r.request.entry()) bytes += e.ByteSizeLong();
+    EXPECT_LE(n, opts_.max_append_entries_count);
+    EXPECT_LE(bytes, opts_.max_append_entries_bytes);
+    if (n == 3) count_capped = true;
+    // Three of the large entries would be too many.
+    if (n == 2 && r.request.prev_log_index() + n < 20) bytes_capped = true;
+  }
+  EXPECT_TRUE(count_capped);
+  EXPECT_TRUE(bytes_capped);
+}
+
+TEST_F(ServiceImplTest, BoundsStaleReadsOnFollowers) {
+  // Nobody calls an election.
+  opts_.election_timeout = absl::Seconds(10);
+  RaftService::Service *service = Start();
+  PauseApplying(true);
+
+  // Three entries are committed, but none is applied.
+  AppendEntriesRequest request = Leader(1, 1, 0, 0, 3);
+  AddEntry(1, 1, "x", &request);
+  AddEntry(1, 2, "y", &request);
+  AddEntry(1, 3, "z", &request);
+  AppendEntriesResponse response;
+  ASSERT_TRUE(service->AppendEntries(nullptr, &request, &response).ok());
+  EXPECT_TRUE(response.success());
+  EXPECT_TRUE(impl_->StaleReadBarrier(absl::InfiniteDuration(), 3).ok());
+  EXPECT_EQ(::util::error::UNAVAILABLE,
+            impl_->StaleReadBarrier(absl::InfiniteDuration(), 2)
+                .CanonicalCode());
+  // Its state isn't as fresh as any heartbeat yet.
+  EXPECT_EQ(::util::error::UNAVAILABLE,
+            impl_->StaleReadBarrier(absl::Seconds(10), 3).CanonicalCode());
+
+  // Once it has caught up, it is as fresh as the latest heartbeat.
+  PauseApplying(false);
+  ASSERT_TRUE(impl_->AppliedBarrier(3, absl::Seconds(5)).ok());
+  request = Leader(1, 1, 3, 1, 3);
+  ASSERT_TRUE(service->AppendEntries(nullptr, &request, &response).ok());
+  EXPECT_TRUE(response.success());
+  EXPECT_TRUE(impl_->StaleReadBarrier(absl::Seconds(10), 0).ok());
+  absl::SleepFor(absl::Milliseconds(100));
+  EXPECT_EQ(::util::error::UNAVAILABLE,
+            impl_->StaleReadBarrier(absl::Milliseconds(50), 0)
+                .CanonicalCode());
+  EXPECT_TRUE(impl_->StaleReadBarrier(absl::Seconds(10), 0).ok());
+}
+
+TEST_F(ServiceImplTest, WaitsForAppliedIndex) {
+  opts_.election_timeout = absl::Seconds(10);
+  RaftService::Service *service = Start();
+  PauseApplying(true);
+
+  AppendEntriesRequest request = Leader(1, 1, 0, 0, 2);
+  AddEntry(1, 1, "x", &request);
+  AddEntry(1, 2, "y", &request);
+  AppendEntriesResponse response;
+  ASSERT_TRUE(service->AppendEntries(nullptr, &request, &response).ok());
+  EXPECT_TRUE(response.success());
+
+  const absl::Time start = absl::Now();
+  EXPECT_EQ(::util::error::DEADLINE_EXCEEDED,
+            impl_->AppliedBarrier(2, absl::Milliseconds(100)).CanonicalCode());
+  EXPECT_GE(absl::Now() - start, absl::Milliseconds(100));
+
+  // A barrier that is already waiting returns once the entry is applied.
+  ::util::Status status;
+  std::thread waiter([this, &status]() {
+    status = impl_->AppliedBarrier(2, absl::Seconds(10));
+  });
+  absl::SleepFor(absl::Milliseconds(50));
+  PauseApplying(false);
+  waiter.join();
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(std::vector<std::string>({"x", "y"}), Applied());
+}
+
+// Returns the requests with entries that |follower| got after the |n|th one.
+std::vector<FakeMember::Received> RequestsAfter(FakeMember *follower, int n) {
+  std::vector<FakeMember::Received> after;
+  for (const FakeMember::Received &r : follower->Requests()) {
+    if (!r.request.entry_size()) continue;
+    if (n-- < 0) after.push_back(r);
+  }
+  return after;
+}
+
+TEST_F(ServiceImplTest, ResendsAfterAFailedPipelinedRequest) {
+  opts_.election_timeout = absl::Milliseconds(300);
+  opts_.max_append_entries_count = 2;
+  RaftService::Service *service = Start();
+
+  AppendEntriesRequest request = Leader(1, 1, 0, 0, 0);
+  for (uint64 i = 1; i <= 20; ++i) AddEntry(1, i, "x", &request);
+  AppendEntriesResponse response;
+  ASSERT_TRUE(service->AppendEntries(nullptr, &request, &response).ok());
+  EXPECT_TRUE(response.success());
+
+  // The third request gets lost, along with those sent after it.
+  FakeMember *follower = StartFake(1, {});
+  follower->FailRequest(2);
+  StartFake(2, {});
+  ASSERT_TRUE(follower->AwaitTerms(std::vector<uint64>(20, 1),
+                                   absl::Seconds(10)));
+
+  // The leader starts over from the lost request.
+  std::vector<FakeMember::Received> after = RequestsAfter(follower, 1);
+  ASSERT_GE(after.size(), 2);
+  EXPECT_EQ(FakeMember::FAILED, after[0].outcome);
+  EXPECT_EQ(4, after[0].request.prev_log_index());
+  EXPECT_EQ(FakeMember::ACCEPTED, after[1].outcome);
+  EXPECT_EQ(4, after[1].request.prev_log_index());
+}
+
+TEST_F(ServiceImplTest, BacksUpAfterARejectedPipelinedRequest) {
+  opts_.election_timeout = absl::Milliseconds(300);
+  opts_.max_append_entries_count = 2;
+  RaftService::Service *service = Start();
+
+  AppendEntriesRequest request = Leader(1, 1, 0, 0, 0);
+  for (uint64 i = 1; i <= 20; ++i) AddEntry(1, i, "x", &request);
+  AppendEntriesResponse response;
+  ASSERT_TRUE(service->AppendEntries(nullptr, &request, &response).ok());
+  EXPECT_TRUE(response.success());
+
+  // The third request is rejected without a hint. The ones sent after it
+  // then don't match the follower's log either.
+  FakeMember *follower = StartFake(1, {});
+  follower->RejectRequest(2);
+  StartFake(2, {});
+  ASSERT_TRUE(follower->AwaitTerms(std::vector<uint64>(20, 1),
+                                   absl::Seconds(10)));
+
+  // The leader backs up by one entry from the rejected request.
+  std::vector<FakeMember::Received> after = RequestsAfter(follower, 1);
+  ASSERT_GE(after.size(), 2);
+  EXPECT_EQ(FakeMember::REJECTED, after[0].outcome);
+  EXPECT_EQ(4, after[0].request.prev_log_index());
+  size_t i = 1;
+  while (i < after.size() && after[i].outcome == FakeMember::REJECTED) {
+    EXPECT_GT(after[i].request.prev_log_index(), 4);
+    ++i;
+  }
+  ASSERT_LT(i, after.size());
+  EXPECT_EQ(FakeMember::ACCEPTED, after[i].outcome);
+  EXPECT_EQ(3, after[i].request.prev_log_index());
+}
+
+}  // namespace
+}  // namespace raft
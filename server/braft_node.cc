@@ -22,6 +22,7 @@
 
 #include "server/braft_node.h"
 
+#include <algorithm>
 #include <atomic>
 #include <string>
 
@@ -29,30 +30,56 @@
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
+#include "absl/time/time.h"
 #include "braft/configuration_manager.h"
 #include "braft/node.h"
 #include "braft/raft.h"
 #include "braft/util.h"
 #include "brpc/closure_guard.h"
+#include "bthread/countdown_event.h"
 #include "butil/endpoint.h"
+#include "gflags/gflags.h"
 #include "glog/logging.h"
 #include "server/braft_state_machine_impl.h"
+#include "sfdb/base/row_encoding.h"
 
 namespace sfdb {
+namespace {
+
+// A closure that a bthread can wait for.
+class WaitableClosure : public google::protobuf::Closure {
+ public:
+  void Run() override { event_.signal(); }
+  void Wait() { event_.wait(); }
+
+ private:
+  bthread::CountdownEvent event_{1};
+};
+
+}  // namespace
 
 BraftNode::~BraftNode() = default;
 
 // Because this class accesses external resources(network) it
 // may fail, so do lazy initialization via Start method.
 bool BraftNode::Start(const BraftNodeOptions &options,
-                      const BraftExecSqlHandler &exec_sql_handler) {
+                      const BraftExecSqlHandler &exec_sql_handler,
+                      const BraftApplyHandler &apply_handler,
+                      const BraftStreamReadHandler &stream_read_handler,
+                      const BraftPrepareHandler &prepare_handler,
+                      const BraftPrepareStatementHandler
+                          &prepare_statement_handler,
+                      const BraftPrepareBatchHandler &prepare_batch_handler,
+                      const BraftSnapshotSaveHandler &snapshot_save_handler,
+                      const BraftSnapshotLoadHandler &snapshot_load_handler) {
   CHECK(!node_) << "BraftNode already started";
   CHECK(!state_machine_) << "BraftNode already started";
 
   auto state_machine = absl::make_unique<BraftStateMachineImpl>(
-      exec_sql_handler, [this](::sfdb::ExecSqlResponse *response) {
+      apply_handler, [this](::sfdb::ExecSqlResponse *response) {
         this->FillRedirectResponse(response);
-      });
+      },
+      snapshot_save_handler, snapshot_load_handler);
 
   butil::EndPoint ep;
   if (hostname2endpoint(options.host.c_str(), options.port, &ep) != 0) {
@@ -97,13 +124,19 @@ bool BraftNode::Start(const BraftNodeOptions &options,
   node_options.election_timeout_ms = 5000;
   node_options.fsm = state_machine.get();
   node_options.node_owns_fsm = false;
-  node_options.snapshot_interval_s = 0;
+  node_options.snapshot_interval_s = std::max(0, options.snapshot_interval_s);
   std::string prefix = "local://tmp/" + std::to_string(options.port);
   node_options.log_uri = prefix + "/log";
   node_options.raft_meta_uri = prefix + "/raft_meta";
   node_options.snapshot_uri = prefix + "/snapshot";
   node_options.disable_cli = false;
 
+  // Reads are served locally by the leader only while it holds a lease.
+  if (google::SetCommandLineOption("raft_enable_leader_lease", "true")
+          .empty()) {
+    LOG(WARNING) << "BRAFT has no leader lease; all reads go through the log";
+  }
+
   auto node = absl::make_unique<::braft::Node>(options.group_name,
                                                ::braft::PeerId(ep));
 
@@ -112,6 +145,11 @@ bool BraftNode::Start(const BraftNodeOptions &options,
     return false;
   }
 
+  exec_sql_handler_ = exec_sql_handler;
+  stream_read_handler_ = stream_read_handler;
+  prepare_handler_ = prepare_handler;
+  prepare_statement_handler_ = prepare_statement_handler;
+  prepare_batch_handler_ = prepare_batch_handler;
   state_machine_.swap(state_machine);
   node_.swap(node);
 
@@ -163,13 +201,39 @@ void BraftNode::ExecSql(const ExecSqlRequest *request,
     return;
   }
 
-  butil::IOBuf log;
-  butil::IOBufAsZeroCopyOutputStream wrapper(&log);
-  if (!request->SerializeToZeroCopyStream(&wrapper)) {
-    LOG(ERROR) << "Failed to serialize request";
+  // Statements are parsed once, here, instead of on every replica.
+  std::string entry;
+  bool read_only = false;
+  auto prepared = prepare_handler_(*request, &entry, &read_only);
+  if (prepared.first != ::util::error::OK) {
+    LOG(ERROR) << "SQL failed: " << prepared.second;
     response->set_status(ExecSqlResponse::ERROR);
     return;
   }
+  ExecPrepared(term, entry, read_only, request, response,
+               done_guard.release());
+}
+
+void BraftNode::ExecPrepared(int64_t term, const std::string &entry,
+                             bool read_only, const ExecSqlRequest *request,
+                             ExecSqlResponse *response,
+                             google::protobuf::Closure *done) {
+  brpc::ClosureGuard done_guard(done);
+
+  // on_leader_start() has run, so the state machine has applied everything
+  // committed in earlier terms, and every write acknowledged in this term.
+  // While the lease holds, no other node can have accepted newer writes.
+  if (read_only && node_->is_leader_lease_valid()) {
+    auto result = exec_sql_handler_(entry, request, response);
+    if (result.first != ::util::error::OK) {
+      LOG(ERROR) << "SQL failed: " << result.second;
+      response->set_status(ExecSqlResponse::ERROR);
+    }
+    return;
+  }
+
+  butil::IOBuf log;
+  log.append(entry);
   // Apply this log as a braft::Task
   braft::Task task;
   task.data = &log;
@@ -184,4 +248,90 @@ void BraftNode::ExecSql(const ExecSqlRequest *request,
   return node_->apply(task);
 }
 
-}  // namespace sfdb
\ No newline at end of file
+void BraftNode::ExecSqlStream(const ExecSqlRequest &request,
+                              const BraftResponseCallback &on_response) {
+  CHECK(state_machine_);
+  const size_t chunk_rows = RowsPerResponse(request);
+
+  ExecSqlResponse response;
+  const int64_t term = state_machine_->CurrentTerm();
+  if (term < 0) {
+    FillRedirectResponse(&response);
+    on_response(response, absl::InfiniteFuture());
+    return;
+  }
+
+  std::string entry;
+  bool read_only = false;
+  auto prepared = prepare_handler_(request, &entry, &read_only);
+  if (prepared.first != ::util::error::OK) {
+    LOG(ERROR) << "SQL failed: " << prepared.second;
+    response.set_status(ExecSqlResponse::ERROR);
+    on_response(response, absl::InfiniteFuture());
+    return;
+  }
+
+  // See ExecPrepared() for when the leader may read locally.
+  if (read_only && node_->is_leader_lease_valid()) {
+    auto result = stream_read_handler_(request, entry, chunk_rows, on_response);
+    if (result.first != ::util::error::OK) {
+      LOG(ERROR) << "SQL failed: " << result.second;
+      response.set_status(ExecSqlResponse::ERROR);
+      on_response(response, absl::InfiniteFuture());
+    }
+    return;
+  }
+
+  // Everything else is applied all at once, and only split up on the way
+  // out.
+  WaitableClosure done;
+  ExecPrepared(term, entry, read_only, &request, &response, &done);
+  done.Wait();
+  SplitResponse(chunk_rows, &response, on_response);
+}
+
+BraftExecSqlResult BraftNode::Prepare(const PrepareRequest &request,
+                                      PrepareResponse *response) {
+  CHECK(prepare_statement_handler_);
+  return prepare_statement_handler_(request, response);
+}
+
+void BraftNode::ExecSqlBatch(const ExecSqlBatchRequest *request,
+                             ExecSqlBatchResponse *response,
+                             google::protobuf::Closure *done) {
+  CHECK(state_machine_);
+
+  brpc::ClosureGuard done_guard(done);
+
+  const int64_t term = state_machine_->CurrentTerm();
+
+  if (term < 0) {
+    ExecSqlResponse redirect;
+    FillRedirectResponse(&redirect);
+    response->set_status(redirect.status());
+    response->set_redirect(redirect.redirect());
+    return;
+  }
+
+  std::string entry;
+  auto prepared = prepare_batch_handler_(*request, &entry, response);
+  if (prepared.first != ::util::error::OK) {
+    LOG(ERROR) << "Batch failed: " << prepared.second;
+    response->clear_results();
+    response->set_status(ExecSqlResponse::ERROR);
+    return;
+  }
+  // Every statement failed already.
+  if (entry.empty()) return;
+
+  butil::IOBuf log;
+  log.append(entry);
+  braft::Task task;
+  task.data = &log;
+  task.done = new BraftSqlExecClosure(state_machine_.get(), response,
+                                      done_guard.release());
+  task.expected_term = term;
+  return node_->apply(task);
+}
+
+}  // namespace sfdb
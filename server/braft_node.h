@@ -23,6 +23,7 @@
 #ifndef SERVER_BRAFT_NODE_H_
 #define SERVER_BRAFT_NODE_H_
 
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <string>
@@ -45,6 +46,9 @@ class BraftNodeOptions {
   int port;
   std::string raft_members;
   std::string group_name;
+  // How often BRAFT snapshots the database and drops the log it covers.
+  // 0 or less keeps the whole log.
+  int snapshot_interval_s = 3600;
 };
 
 class BraftNode {
@@ -53,16 +57,53 @@ class BraftNode {
   void ExecSql(const ExecSqlRequest *request, ExecSqlResponse *response,
                google::protobuf::Closure *done);
 
+  // Same as ExecSql(), but passes the result to |on_response| over one or
+  // more responses of at most request.max_rows_per_response rows. Reads the
+  // leader serves locally are streamed as they are produced. Blocks, so it
+  // must run in its own bthread.
+  void ExecSqlStream(const ExecSqlRequest &request,
+                     const BraftResponseCallback &on_response);
+
+  // Prepares a statement on this node, leader or not. Every node keeps its
+  // own statements; requests that name one should carry its sql too, in case
+  // they end up on another node.
+  BraftExecSqlResult Prepare(const PrepareRequest &request,
+                             PrepareResponse *response);
+
+  // Applies the writes of |request| through the log as one entry, and fills
+  // |response| with their results.
+  void ExecSqlBatch(const ExecSqlBatchRequest *request,
+                    ExecSqlBatchResponse *response,
+                    google::protobuf::Closure *done);
+
   bool Start(const BraftNodeOptions &options,
-             const BraftExecSqlHandler &exec_sql_cb);
+             const BraftExecSqlHandler &exec_sql_cb,
+             const BraftApplyHandler &apply_cb,
+             const BraftStreamReadHandler &stream_read_cb,
+             const BraftPrepareHandler &prepare_cb,
+             const BraftPrepareStatementHandler &prepare_statement_cb,
+             const BraftPrepareBatchHandler &prepare_batch_cb,
+             const BraftSnapshotSaveHandler &snapshot_save_cb,
+             const BraftSnapshotLoadHandler &snapshot_load_cb);
   void Stop();
   void WaitTillStopped();
 
  private:
   void FillRedirectResponse(ExecSqlResponse *response) const;
 
+  // Runs |entry|, which prepare_handler_ made out of |request| in |term|:
+  // locally if it is a read and the leader lease holds, through the log
+  // otherwise. Runs |done| once |response| is ready.
+  void ExecPrepared(int64_t term, const std::string &entry, bool read_only,
+                    const ExecSqlRequest *request, ExecSqlResponse *response,
+                    google::protobuf::Closure *done);
+
  private:
   BraftExecSqlHandler exec_sql_handler_;
+  BraftStreamReadHandler stream_read_handler_;
+  BraftPrepareHandler prepare_handler_;
+  BraftPrepareStatementHandler prepare_statement_handler_;
+  BraftPrepareBatchHandler prepare_batch_handler_;
   std::unique_ptr<BraftStateMachineImpl> state_machine_;
   std::unique_ptr<::braft::Node> node_;
 };
@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "server/braft_node.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "braft/raft.h"
+#include "brpc/server.h"
+#include "bthread/countdown_event.h"
+#include "google/protobuf/wrappers.pb.h"
+#include "server/braft_state_machine_impl.h"
+#include "sfdb/api.pb.h"
+#include "util/net/port.h"
+#include "gtest/gtest.h"
+
+namespace sfdb {
+namespace {
+
+// A closure that the test can wait for.
+class WaitableClosure : public google::protobuf::Closure {
+ public:
+  void Run() override { event_.signal(); }
+  void Wait() { event_.wait(); }
+
+ private:
+  bthread::CountdownEvent event_{1};
+};
+
+// A key-value store standing in for the database. Log entries are the
+// statements themselves: "set <key> <value>", "get <key>", and "hold", which
+// blocks the state machine until Release(). Anything else fails.
+class FakeDb {
+ public:
+  BraftExecSqlResult Prepare(const ExecSqlRequest &request, std::string *entry,
+                             bool *read_only) {
+    *entry = request.sql();
+    *read_only = absl::StartsWith(request.sql(), "get ");
+    return {::util::error::OK, ""};
+  }
+
+  // Only runs reads that the leader serves locally.
+  BraftExecSqlResult ExecLocally(const std::string &entry,
+                                 const ExecSqlRequest *request,
+                                 ExecSqlResponse *response) {
+    absl::MutexLock lock(&mu_);
+    ++local_reads_;
+    Exec(entry, response);
+    return {::util::error::OK, ""};
+  }
+
+  void Apply(std::vector<BraftAppliedTask> *tasks) {
+    absl::MutexLock lock(&mu_);
+    batches_.emplace_back();
+    for (const auto &task : *tasks) batches_.back().push_back(task.entry);
+    for (auto &task : *tasks) {
+      task.code = Exec(task.entry, task.response);
+    }
+  }
+
+  // Waits for the state machine to apply "hold".
+  void AwaitHolding() {
+    absl::MutexLock lock(&mu_, absl::Condition(&holding_));
+  }
+
+  void Release() {
+    absl::MutexLock lock(&mu_);
+    released_ = true;
+  }
+
+  // The entries of each call to Apply(), in order.
+  std::vector<std::vector<std::string>> batches() {
+    absl::MutexLock lock(&mu_);
+    return batches_;
+  }
+
+  BraftSnapshotSerializer SaveSnapshot() {
+    absl::MutexLock lock(&mu_);
+    return [this, values = values_](std::string *data) {
+      for (const auto &value : values) {
+        absl::StrAppend(data, value.first, " ", value.second, "\n");
+      }
+      absl::MutexLock lock(&mu_);
+      saved_ = values;
+      return true;
+    };
+  }
+
+  // Waits for a snapshot that has the key to be serialized.
+  void AwaitSnapshotOf(const std::string &key) {
+    auto saved = [this, &key]() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+      return saved_.count(key) > 0;
+    };
+    absl::MutexLock lock(&mu_, absl::Condition(&saved));
+  }
+
+  bool LoadSnapshot(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) return false;
+    std::map<std::string, std::string> values;
+    std::string key, value;
+    while (file >> key >> value) values[key] = value;
+    absl::MutexLock lock(&mu_);
+    values_.swap(values);
+    ++snapshots_loaded_;
+    return true;
+  }
+
+  int snapshots_loaded() {
+    absl::MutexLock lock(&mu_);
+    return snapshots_loaded_;
+  }
+
+  int local_reads() {
+    absl::MutexLock lock(&mu_);
+    return local_reads_;
+  }
+
+ private:
+  ::util::error::Code Exec(const std::string &entry, ExecSqlResponse *response)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    const std::vector<std::string> words = absl::StrSplit(entry, ' ');
+    if (words[0] == "set" && words.size() == 3) {
+      values_[words[1]] = words[2];
+      return ::util::error::OK;
+    }
+    if (words[0] == "get" && words.size() == 2) {
+      if (response) {
+        ::google::protobuf::StringValue value;
+        value.set_value(values_[words[1]]);
+        response->add_rows()->PackFrom(value);
+      }
+      return ::util::error::OK;
+    }
+    if (words[0] == "hold") {
+      holding_ = true;
+      mu_.Await(absl::Condition(&released_));
+      return ::util::error::OK;
+    }
+    return ::util::error::INVALID_ARGUMENT;
+  }
+
+  absl::Mutex mu_;
+  std::map<std::string, std::string> values_ ABSL_GUARDED_BY(mu_);
+  int local_reads_ ABSL_GUARDED_BY(mu_) = 0;
+  bool holding_ ABSL_GUARDED_BY(mu_) = false;
+  bool released_ ABSL_GUARDED_BY(mu_) = false;
+  std::vector<std::vector<std::string>> batches_ ABSL_GUARDED_BY(mu_);
+  // The values in the last snapshot serialized.
+  std::map<std::string, std::string> saved_ ABSL_GUARDED_BY(mu_);
+  int snapshots_loaded_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+// Runs a single-member group, which elects itself.
+class BraftNodeTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // BRAFT keeps its log and snapshots under the working directory.
+    if (const char *dir = std::getenv("TEST_TMPDIR")) {
+      ASSERT_EQ(0, chdir(dir));
+    }
+    port_ = PickUpFreeLocalPort();
+    ASSERT_EQ(0, braft::add_service(&server_, port_));
+    ASSERT_EQ(0, server_.Start(port_, nullptr));
+    StartNode();
+  }
+
+  void TearDown() override {
+    StopNode();
+    server_.Stop(0);
+    server_.Join();
+  }
+
+  // Starts a node with a fresh database, which it restores from the latest
+  // snapshot and the log that follows, if any.
+  void StartNode() {
+    db_ = absl::make_unique<FakeDb>();
+    node_ = absl::make_unique<BraftNode>();
+    BraftNodeOptions options;
+    options.host = "127.0.0.1";
+    options.port = port_;
+    options.raft_members = absl::StrFormat("127.0.0.1:%d", port_);
+    options.group_name = "braft_node_test";
+    // As often as BRAFT allows, so that tests need not wait long for one.
+    options.snapshot_interval_s = 1;
+    FakeDb *db = db_.get();
+    ASSERT_TRUE(node_->Start(
+        options,
+        [db](const std::string &entry, const ExecSqlRequest *request,
+             ExecSqlResponse *response) {
+          return db->ExecLocally(entry, request, response);
+        },
+        [db](std::vector<BraftAppliedTask> *tasks) { db->Apply(tasks); },
+        [](const ExecSqlRequest &, const std::string &, size_t,
+           const BraftResponseCallback &) -> BraftExecSqlResult {
+          return {::util::error::UNIMPLEMENTED, "streaming"};
+        },
+        [db](const ExecSqlRequest &request, std::string *entry,
+             bool *read_only) {
+          return db->Prepare(request, entry, read_only);
+        },
+        [](const PrepareRequest &, PrepareResponse *) -> BraftExecSqlResult {
+          return {::util::error::UNIMPLEMENTED, "prepare"};
+        },
+        [](const ExecSqlBatchRequest &, std::string *,
+           ExecSqlBatchResponse *) -> BraftExecSqlResult {
+          return {::util::error::UNIMPLEMENTED, "batch"};
+        },
+        [db]() { return db->SaveSnapshot(); },
+        [db](const std::string &path) { return db->LoadSnapshot(path); }));
+  }
+
+  void StopNode() {
+    node_->Stop();
+    node_->WaitTillStopped();
+    node_ = nullptr;
+  }
+
+  ExecSqlResponse Exec(const std::string &sql) {
+    ExecSqlRequest request;
+    request.set_sql(sql);
+    ExecSqlResponse response;
+    WaitableClosure done;
+    node_->ExecSql(&request, &response, &done);
+    done.Wait();
+    return response;
+  }
+
+  // A request that has been sent, but may not have been answered yet.
+  struct Call {
+    ExecSqlRequest request;
+    ExecSqlResponse response;
+    WaitableClosure done;
+  };
+
+  void Send(const std::string &sql, Call *call) {
+    call->request.set_sql(sql);
+    node_->ExecSql(&call->request, &call->response, &call->done);
+  }
+
+  // Returns the response to a write, once there is a leader to accept it.
+  ExecSqlResponse ExecOnceElected(const std::string &sql) {
+    const absl::Time deadline = absl::Now() + absl::Seconds(30);
+    ExecSqlResponse response = Exec(sql);
+    while (response.status() != ExecSqlResponse::OK && absl::Now() < deadline) {
+      absl::SleepFor(absl::Milliseconds(100));
+      response = Exec(sql);
+    }
+    return response;
+  }
+
+  static std::string Value(const ExecSqlResponse &response) {
+    ::google::protobuf::StringValue value;
+    if (response.rows_size() != 1 || !response.rows(0).UnpackTo(&value)) {
+      return "<no value>";
+    }
+    return value.value();
+  }
+
+  int port_;
+  brpc::Server server_;
+  std::unique_ptr<FakeDb> db_;
+  std::unique_ptr<BraftNode> node_;
+};
+
+TEST_F(BraftNodeTest, LeaderReadsItsWritesLocally) {
+  ASSERT_EQ(ExecSqlResponse::OK, ExecOnceElected("set a 1").status());
+
+  const ExecSqlResponse response = Exec("get a");
+  EXPECT_EQ(ExecSqlResponse::OK, response.status());
+  EXPECT_EQ("1", Value(response));
+  // The read did not go through the log.
+  EXPECT_EQ(1, db_->local_reads());
+}
+
+TEST_F(BraftNodeTest, ReportsTheOutcomeOfEachTaskInABatch) {
+  ASSERT_EQ(ExecSqlResponse::OK, ExecOnceElected("set a 1").status());
+
+  // Writes committed while the state machine is busy are applied together.
+  Call hold, first, bad, second;
+  Send("hold", &hold);
+  db_->AwaitHolding();
+  Send("set b 2", &first);
+  Send("bad", &bad);
+  Send("set c 3", &second);
+  absl::SleepFor(absl::Milliseconds(500));
+  db_->Release();
+  for (Call *call : {&hold, &first, &bad, &second}) call->done.Wait();
+
+  EXPECT_EQ(ExecSqlResponse::OK, hold.response.status());
+  EXPECT_EQ(ExecSqlResponse::OK, first.response.status());
+  EXPECT_EQ(ExecSqlResponse::ERROR, bad.response.status());
+  EXPECT_EQ(ExecSqlResponse::OK, second.response.status());
+  // The failed task left the others in its batch applied.
+  EXPECT_EQ(std::vector<std::string>({"set b 2", "bad", "set c 3"}),
+            db_->batches().back());
+  EXPECT_EQ("2", Value(Exec("get b")));
+  EXPECT_EQ("3", Value(Exec("get c")));
+}
+
+TEST_F(BraftNodeTest, RestoresTheDatabaseFromASnapshot) {
+  ASSERT_EQ(ExecSqlResponse::OK, ExecOnceElected("set d 4").status());
+  db_->AwaitSnapshotOf("d");
+
+  // Shutting down waits for the snapshot to be written out.
+  StopNode();
+  StartNode();
+  ASSERT_EQ(ExecSqlResponse::OK, ExecOnceElected("set e 5").status());
+
+  EXPECT_EQ(1, db_->snapshots_loaded());
+  EXPECT_EQ("4", Value(Exec("get d")));
+  // The write came back with the snapshot, not by replaying the log.
+  for (const auto &batch : db_->batches()) {
+    EXPECT_EQ(batch.end(), std::find(batch.begin(), batch.end(), "set d 4"));
+  }
+}
+
+}  // namespace
+}  // namespace sfdb
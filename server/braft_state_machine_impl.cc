@@ -22,61 +22,141 @@
 
 #include "server/braft_state_machine_impl.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "braft/util.h"
 #include "brpc/closure_guard.h"
+#include "bthread/bthread.h"
+#include "butil/files/file.h"
+#include "butil/files/file_path.h"
 #include "glog/logging.h"
 
 namespace sfdb {
+namespace {
+
+// Name of the file holding the database inside a BRAFT snapshot directory.
+constexpr char kSnapshotFile[] = "db_snapshot";
+
+// Writes |data| to |path| and flushes it to disk.
+bool WriteSnapshotFile(const std::string &path, const std::string &data) {
+  ::butil::File file(::butil::FilePath(path),
+                     ::butil::File::FLAG_CREATE_ALWAYS |
+                         ::butil::File::FLAG_WRITE);
+  if (!file.IsValid()) return false;
+  // butil::File writes at most INT_MAX bytes at a time.
+  constexpr size_t kMaxWrite = 1 << 30;
+  for (size_t offset = 0; offset < data.size();) {
+    const int n = file.WriteAtCurrentPos(
+        data.data() + offset,
+        static_cast<int>(std::min(kMaxWrite, data.size() - offset)));
+    if (n <= 0) return false;
+    offset += n;
+  }
+  return file.Flush();
+}
+
+// A snapshot being written in the background.
+struct SnapshotSaveArg {
+  BraftSnapshotSerializer serializer;
+  ::braft::SnapshotWriter *writer;
+  ::braft::Closure *done;
+};
+
+void *SaveSnapshotInBackground(void *void_arg) {
+  std::unique_ptr<SnapshotSaveArg> arg(
+      static_cast<SnapshotSaveArg *>(void_arg));
+  ::brpc::ClosureGuard done_guard(arg->done);
+
+  std::string data;
+  if (!arg->serializer(&data)) {
+    arg->done->status().set_error(EIO, "Failed to serialize the database");
+    return nullptr;
+  }
+  const std::string path = arg->writer->get_path() + "/" + kSnapshotFile;
+  if (!WriteSnapshotFile(path, data)) {
+    arg->done->status().set_error(EIO, "Failed to write %s", path.c_str());
+    return nullptr;
+  }
+  if (arg->writer->add_file(kSnapshotFile) != 0) {
+    arg->done->status().set_error(EIO, "Failed to add %s to the snapshot",
+                                  kSnapshotFile);
+    return nullptr;
+  }
+  VLOG(2) << "Saved a " << data.size() << " byte snapshot to " << path;
+  return nullptr;
+}
+
+}  // namespace
 
 void BraftSqlExecClosure::Run() {
   ::brpc::ClosureGuard done_guard(done);
-  if (!status().ok()) {
+  if (!status().ok() && batch_response) {
+    // The batch did not make it into the log; none of it was applied.
+    ExecSqlResponse redirect;
+    state_machine->redirect_handler_(&redirect);
+    batch_response->clear_results();
+    batch_response->set_status(redirect.status());
+    batch_response->set_redirect(redirect.redirect());
+  } else if (!status().ok()) {
     state_machine->redirect_handler_(response);
   }
   delete this;
 }
 
 BraftStateMachineImpl::BraftStateMachineImpl(
-    const BraftExecSqlHandler &exec_sql_handler,
-    const BraftRedirectHandler &redirect_handler)
-    : exec_sql_handler_(exec_sql_handler),
-      redirect_handler_(redirect_handler) {}
+    const BraftApplyHandler &apply_handler,
+    const BraftRedirectHandler &redirect_handler,
+    const BraftSnapshotSaveHandler &snapshot_save_handler,
+    const BraftSnapshotLoadHandler &snapshot_load_handler)
+    : apply_handler_(apply_handler),
+      redirect_handler_(redirect_handler),
+      snapshot_save_handler_(snapshot_save_handler),
+      snapshot_load_handler_(snapshot_load_handler) {}
 
 int64_t BraftStateMachineImpl::CurrentTerm() const {
   return leader_term_.load(std::memory_order_relaxed);
 }
 
 void BraftStateMachineImpl::on_apply(::braft::Iterator &iter) {
-  // A batch of tasks are committed, which must be processed through
-  // |iter|
+  // A batch of tasks are committed, which must be processed through |iter|.
+  // They are handed over all at once, so that the database is locked once
+  // for the whole batch.
+  std::vector<BraftAppliedTask> tasks;
+  std::vector<::braft::Closure *> dones;
   for (; iter.valid(); iter.next()) {
-    std::string sql_query;
-    ExecSqlResponse *response = nullptr;
-    // CounterResponse* response = NULL;
-    // This guard helps invoke iter.done()->Run() asynchronously to
-    // avoid that callback blocks the StateMachine.
-    ::braft::AsyncClosureGuard closure_guard(iter.done());
+    BraftAppliedTask task;
+    task.entry = iter.data().to_string();
     if (iter.done()) {
-      // This task is applied by this node, get value from this
-      // closure to avoid additional parsing.
-      auto c = static_cast<BraftSqlExecClosure *>(iter.done());
-      response = c->response;
-      sql_query = c->request->sql();
-    } else {
-      // Have to parse FetchAddRequest from this log.
-      ::butil::IOBufAsZeroCopyInputStream wrapper(iter.data());
-      ExecSqlRequest request;
-      CHECK(request.ParseFromZeroCopyStream(&wrapper));
-      sql_query = request.sql();
+      // This task is applied by this node, which has a response to fill.
+      // Without one, the handler skips reads.
+      auto *closure = static_cast<BraftSqlExecClosure *>(iter.done());
+      task.request = closure->request;
+      task.response = closure->response;
+      task.batch_response = closure->batch_response;
     }
+    tasks.push_back(std::move(task));
+    dones.push_back(iter.done());
+  }
+  if (tasks.empty()) return;
+
+  apply_handler_(&tasks);
 
-    auto result = exec_sql_handler_(sql_query, response);
-    if (response) {
-      if (result.first != ::util::error::OK) {
-        LOG(ERROR) << "SQL failed: " << result.second;
-        response->set_status(ExecSqlResponse::ERROR);
-      }
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    if (tasks[i].response && tasks[i].code != ::util::error::OK) {
+      LOG(ERROR) << "SQL failed: " << tasks[i].error_message;
+      tasks[i].response->set_status(ExecSqlResponse::ERROR);
+    }
+    if (tasks[i].batch_response && tasks[i].code != ::util::error::OK) {
+      LOG(ERROR) << "Batch failed: " << tasks[i].error_message;
+      tasks[i].batch_response->clear_results();
+      tasks[i].batch_response->set_status(ExecSqlResponse::ERROR);
     }
+    // Run asynchronously, so that callbacks don't block the state machine.
+    if (dones[i]) ::braft::run_closure_in_bthread(dones[i]);
   }
 }
 
@@ -111,4 +191,27 @@ void BraftStateMachineImpl::on_start_following(
   VLOG(5) << "BraftStateMachineImpl::on_start_following";
 }
 
+void BraftStateMachineImpl::on_snapshot_save(::braft::SnapshotWriter *writer,
+                                             ::braft::Closure *done) {
+  // The state is captured here, between two calls to on_apply(), so that the
+  // snapshot matches the log index BRAFT records for it. Serializing and
+  // writing it out happens off the state machine thread.
+  auto *arg = new SnapshotSaveArg{snapshot_save_handler_(), writer, done};
+  bthread_t tid;
+  if (bthread_start_urgent(&tid, nullptr, SaveSnapshotInBackground, arg) !=
+      0) {
+    SaveSnapshotInBackground(arg);
+  }
+}
+
+int BraftStateMachineImpl::on_snapshot_load(::braft::SnapshotReader *reader) {
+  const std::string path = reader->get_path() + "/" + kSnapshotFile;
+  if (!snapshot_load_handler_(path)) {
+    LOG(ERROR) << "Failed to load the snapshot in " << path;
+    return -1;
+  }
+  VLOG(2) << "Loaded the snapshot in " << path;
+  return 0;
+}
+
 }  // namespace sfdb
\ No newline at end of file
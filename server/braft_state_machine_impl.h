@@ -43,6 +43,16 @@ struct BraftSqlExecClosure : public ::braft::Closure {
       : state_machine(state_machine),
         request(request),
         response(response),
+        batch_response(nullptr),
+        done(done) {}
+
+  BraftSqlExecClosure(BraftStateMachineImpl *state_machine,
+                      ExecSqlBatchResponse *batch_response,
+                      ::google::protobuf::Closure *done)
+      : state_machine(state_machine),
+        request(nullptr),
+        response(nullptr),
+        batch_response(batch_response),
         done(done) {}
 
   void Run() override;
@@ -50,13 +60,16 @@ struct BraftSqlExecClosure : public ::braft::Closure {
   const BraftStateMachineImpl *const state_machine;
   const ExecSqlRequest *const request;
   ExecSqlResponse *const response;
+  ExecSqlBatchResponse *const batch_response;
   ::google::protobuf::Closure *const done;
 };
 
 class BraftStateMachineImpl : public ::braft::StateMachine {
  public:
-  BraftStateMachineImpl(const BraftExecSqlHandler &exec_sql_cb,
-                        const BraftRedirectHandler &redirect_cb);
+  BraftStateMachineImpl(const BraftApplyHandler &apply_cb,
+                        const BraftRedirectHandler &redirect_cb,
+                        const BraftSnapshotSaveHandler &snapshot_save_cb,
+                        const BraftSnapshotLoadHandler &snapshot_load_cb);
 
   int64_t CurrentTerm() const;
 
@@ -68,12 +81,17 @@ class BraftStateMachineImpl : public ::braft::StateMachine {
   void on_configuration_committed(const ::braft::Configuration &conf) override;
   void on_stop_following(const ::braft::LeaderChangeContext &ctx) override;
   void on_start_following(const ::braft::LeaderChangeContext &ctx) override;
+  void on_snapshot_save(::braft::SnapshotWriter *writer,
+                        ::braft::Closure *done) override;
+  int on_snapshot_load(::braft::SnapshotReader *reader) override;
 
  private:
   std::atomic<int64_t> leader_term_;
 
-  BraftExecSqlHandler exec_sql_handler_;
+  BraftApplyHandler apply_handler_;
   BraftRedirectHandler redirect_handler_;
+  BraftSnapshotSaveHandler snapshot_save_handler_;
+  BraftSnapshotLoadHandler snapshot_load_handler_;
 
   friend BraftSqlExecClosure;
 };
@@ -22,24 +22,139 @@
 
 #include "server/brpc_sfdb_server.h"
 
+#include <algorithm>
+#include <memory>
+#include <vector>
+
 #include "absl/memory/memory.h"
+#include "absl/time/time.h"
+#include "glog/logging.h"
 #include "server/brpc_sfdb_server_impl.h"
 #include "server/common_types.h"
 #include "sfdb/base/ast.h"
+#include "sfdb/base/ast_proto.h"
 #include "sfdb/base/db.h"
+#include "sfdb/base/result_schema.h"
+#include "sfdb/base/row_encoding.h"
 #include "sfdb/base/vars.h"
+#include "sfdb/engine/batch.h"
 #include "sfdb/engine/engine.h"
+#include "sfdb/engine/prepared_statements.h"
+#include "sfdb/flags.h"
+#include "sfdb/raft/batch_mutation.h"
+#include "sfdb/raft/mutation.pb.h"
+#include "sfdb/snapshot/snapshot_file.h"
 #include "sfdb/sql/parser.h"
+#include "util/task/canonical_errors.h"
 
 namespace sfdb {
 using google::protobuf::Message;
 using util::Status;
 using util::StatusOr;
 
+namespace {
+
+// Decodes a log entry into |mut| and returns its statement. Entries written
+// before statements were replicated pre-parsed hold the client's
+// ExecSqlRequest instead of a Mutation. Batches come out as null, with their
+// statements left in |mut|.
+StatusOr<std::unique_ptr<Ast>> ParseEntry(const std::string &entry,
+                                          Mutation *mut) {
+  if (mut->ParseFromString(entry)) {
+    if (mut->has_ast()) return AstFromProto(mut->ast());
+    if (mut->batch_size() > 0) return std::unique_ptr<Ast>();
+  }
+  ExecSqlRequest request;
+  if (!request.ParseFromString(entry)) {
+    return ::util::InvalidArgumentError("Malformed log entry");
+  }
+  return Parse(request.sql());
+}
+
+// Same, for entries made for a single statement.
+StatusOr<std::unique_ptr<Ast>> ParseEntry(const std::string &entry) {
+  Mutation mut;
+  StatusOr<std::unique_ptr<Ast>> so = ParseEntry(entry, &mut);
+  if (so.ok() && !so.ValueOrDie()) {
+    return ::util::InvalidArgumentError("Unexpected batch entry");
+  }
+  return so;
+}
+
+BraftExecSqlResult ToResult(const Status &s) {
+  return BraftExecSqlResult(s.CanonicalCode(), s.error_message());
+}
+
+void SetOutcome(const BraftExecSqlResult &result, BraftAppliedTask *task) {
+  task->code = result.first;
+  task->error_message = result.second;
+}
+
+// Runs a read-only statement and fills |response| with its result, encoded
+// as |request| asks.
+BraftExecSqlResult ExecuteReadInto(const ExecSqlRequest &request,
+                                   std::unique_ptr<Ast> ast, Db *db,
+                                   ExecSqlResponse *response) {
+  std::unique_ptr<ProtoPool> tmp_pool = db->pool->Branch();
+  std::vector<std::unique_ptr<Message>> rows;
+  Status s = ExecuteRead(std::move(ast), tmp_pool.get(), db, &rows);
+  if (!s.ok()) return ToResult(s);
+
+  if (!rows.empty()) {
+    s = FillSchema(*tmp_pool, *rows[0], response);
+    if (!s.ok()) return ToResult(s);
+    StripKnownSchema(request, response);
+    EncodeRows(request.row_encoding(), rows, response);
+  }
+  return BraftExecSqlResult(::util::error::OK, "");
+}
+
+// Runs a read-only statement for |request| and passes its rows to
+// |on_response|, |chunk_rows| at a time, as they are produced.
+BraftExecSqlResult StreamRead(const ExecSqlRequest &request,
+                              std::unique_ptr<Ast> ast, Db *db,
+                              size_t chunk_rows,
+                              const BraftResponseCallback &on_response) {
+  std::unique_ptr<ProtoPool> tmp_pool = db->pool->Branch();
+  ExecSqlResponse response;
+  bool first = true;
+  Status error;
+  Status s = ExecuteReadStream(
+      std::move(ast), tmp_pool.get(), db, chunk_rows,
+      absl::Milliseconds(std::max(absl::GetFlag(FLAGS_stream_lock_ms), 0)),
+      [&](std::vector<std::unique_ptr<Message>> *rows, absl::Time deadline) {
+        if (first) {
+          error = FillSchema(*tmp_pool, *(*rows)[0], &response);
+          if (!error.ok()) return false;
+          StripKnownSchema(request, &response);
+          first = false;
+        }
+        EncodeRows(request.row_encoding(), *rows, &response);
+        const bool more = on_response(response, deadline);
+        response.Clear();
+        return more;
+      });
+  if (!error.ok()) return ToResult(error);
+  if (s.CanonicalCode() == ::util::error::CANCELLED) {
+    return BraftExecSqlResult(::util::error::OK, "");
+  }
+  if (!s.ok()) return ToResult(s);
+  // Empty results still get a response.
+  if (first) on_response(response, absl::InfiniteFuture());
+  return BraftExecSqlResult(::util::error::OK, "");
+}
+
+}  // namespace
+
 BrpcSfdbServer::BrpcSfdbServer()
     : pimpl_(absl::make_unique<BrpcSfdbServerImpl>()) {
   built_in_vars_ = absl::make_unique<BuiltIns>();
   db_ = absl::make_unique<Db>("MAIN", built_in_vars_.get());
+  executor_ = absl::make_unique<BatchExecutor>(
+      db_.get(), absl::GetFlag(FLAGS_raft_apply_threads));
+  statements_ = absl::make_unique<PreparedStatements>(
+      db_.get(), std::max(absl::GetFlag(FLAGS_prepared_statements), 1),
+      std::max(absl::GetFlag(FLAGS_plan_cache_size), 0));
 }
 
 BrpcSfdbServer::~BrpcSfdbServer() = default;
@@ -48,52 +163,141 @@ bool BrpcSfdbServer::StartAndWait(const std::string &host, int port,
                                   const std::string &raft_targets) {
   bool res = pimpl_->Start(
       host, port, raft_targets,
-      [this](const std::string &sql,
+      [this](const std::string &entry, const ExecSqlRequest *request,
              ::sfdb::ExecSqlResponse *response) -> BraftExecSqlResult {
-        StatusOr<std::unique_ptr<Ast>> ast_so = Parse(sql);
+        StatusOr<std::unique_ptr<Ast>> ast_so = ParseEntry(entry);
 
         if (!ast_so.ok())
           return BraftExecSqlResult(ast_so.status().CanonicalCode(),
                                     ast_so.status().error_message());
 
         std::unique_ptr<Ast> ast = std::move(ast_so.ValueOrDie());
-        std::unique_ptr<ProtoPool> tmp_pool = db_->pool->Branch();
         if (ast->IsMutation()) {
-          Status s = ExecuteWrite(std::move(ast), tmp_pool.get(), db_.get());
-          if (s.ok()) {
-            return BraftExecSqlResult(::util::error::OK, "");
-          } else {
-            return BraftExecSqlResult(s.CanonicalCode(), s.error_message());
+          std::unique_ptr<ProtoPool> tmp_pool = db_->pool->Branch();
+          return ToResult(
+              ExecuteWrite(std::move(ast), tmp_pool.get(), db_.get()));
+        }
+        // Reads only change the state of the replica that responds.
+        if (!response) return BraftExecSqlResult(::util::error::OK, "");
+        return ExecuteReadInto(*request, std::move(ast), db_.get(), response);
+      },
+      [this](std::vector<BraftAppliedTask> *tasks) {
+        // Writes are applied in runs, under one lock; reads see exactly the
+        // writes before them.
+        std::vector<BatchedWrite> writes;
+        std::vector<BraftAppliedTask *> writers;
+        auto flush = [&]() {
+          executor_->Execute(&writes);
+          for (size_t i = 0; i < writes.size(); ++i) {
+            SetOutcome(ToResult(writes[i].status), writers[i]);
           }
-        } else {
-          std::vector<std::unique_ptr<Message>> rows;
-          Status s =
-              ExecuteRead(std::move(ast), tmp_pool.get(), db_.get(), &rows);
-          if (!s.ok())
-            return BraftExecSqlResult(s.CanonicalCode(), s.error_message());
-
-          if (!!response && !rows.empty()) {
-            // Fill metadata info
-            auto file_descriptor =
-                tmp_pool->FindProtoFile(rows[0]->GetDescriptor()->name());
-
-            if (!file_descriptor)
-              return BraftExecSqlResult(::util::error::INTERNAL, "Descriptor not found");
-
-            google::protobuf::FileDescriptorSet *file_desc_set =
-                new google::protobuf::FileDescriptorSet();
-
-            if (!file_desc_set)
-              return BraftExecSqlResult(::util::error::INTERNAL, "Descriptor not found");
-
-            file_descriptor->CopyTo(file_desc_set->add_file());
-            response->set_allocated_descriptors(file_desc_set);
-            for (size_t i = 0; i < rows.size(); ++i) {
-              response->add_rows()->PackFrom(*rows[i], std::string());
+          writes.clear();
+          writers.clear();
+        };
+
+        for (BraftAppliedTask &task : *tasks) {
+          Mutation mut;
+          StatusOr<std::unique_ptr<Ast>> ast_so = ParseEntry(task.entry, &mut);
+          if (!ast_so.ok()) {
+            SetOutcome(ToResult(ast_so.status()), &task);
+            continue;
+          }
+          std::unique_ptr<Ast> ast = std::move(ast_so.ValueOrDie());
+          if (!ast) {
+            // A batch is applied on its own.
+            flush();
+            std::vector<BatchedWrite> batch;
+            Status s = DecodeBatchMutation(mut, &batch);
+            if (!s.ok()) {
+              SetOutcome(ToResult(s), &task);
+              continue;
             }
+            executor_->Execute(&batch);
+            if (task.batch_response) {
+              SetBatchResults(batch, task.batch_response);
+            }
+            continue;
+          }
+          if (ast->IsMutation()) {
+            BatchedWrite w;
+            w.ast = std::move(ast);
+            writes.push_back(std::move(w));
+            writers.push_back(&task);
+            continue;
           }
-          return BraftExecSqlResult(::util::error::OK, "");  // OkStatus();
+          if (!task.response) continue;
+          flush();
+          SetOutcome(ExecuteReadInto(*task.request, std::move(ast), db_.get(),
+                                     task.response),
+                     &task);
+        }
+        flush();
+      },
+      [this](const ExecSqlRequest &request, const std::string &entry,
+             size_t max_rows,
+             const BraftResponseCallback &on_response) -> BraftExecSqlResult {
+        StatusOr<std::unique_ptr<Ast>> ast_so = ParseEntry(entry);
+        if (!ast_so.ok()) return ToResult(ast_so.status());
+        std::unique_ptr<Ast> ast = std::move(ast_so.ValueOrDie());
+        if (ast->IsMutation()) {
+          return BraftExecSqlResult(::util::error::INVALID_ARGUMENT,
+                                    "Only reads can be streamed locally");
+        }
+        return StreamRead(request, std::move(ast), db_.get(), max_rows,
+                          on_response);
+      },
+      [this](const ExecSqlRequest &request, std::string *entry,
+             bool *read_only) -> BraftExecSqlResult {
+        // Values are bound here, so replicas never see placeholders.
+        StatusOr<std::unique_ptr<Ast>> ast_so = statements_->Resolve(request);
+        if (!ast_so.ok())
+          return BraftExecSqlResult(ast_so.status().CanonicalCode(),
+                                    ast_so.status().error_message());
+
+        const Ast &ast = *ast_so.ValueOrDie();
+        Mutation mut;
+        Status s = AstToProto(ast, mut.mutable_ast());
+        if (!s.ok())
+          return BraftExecSqlResult(s.CanonicalCode(), s.error_message());
+        if (!mut.SerializeToString(entry))
+          return BraftExecSqlResult(::util::error::INTERNAL,
+                                    "Failed to serialize log entry");
+
+        *read_only = !ast.IsMutation();
+        return BraftExecSqlResult(::util::error::OK, "");
+      },
+      [this](const PrepareRequest &request,
+             PrepareResponse *response) -> BraftExecSqlResult {
+        return ToResult(statements_->Prepare(request, response));
+      },
+      [this](const ExecSqlBatchRequest &request, std::string *entry,
+             ExecSqlBatchResponse *response) -> BraftExecSqlResult {
+        Mutation mut;
+        MakeBatchMutation(request, statements_.get(), &mut, response);
+        entry->clear();
+        if (mut.batch_size() > 0 && !mut.SerializeToString(entry))
+          return BraftExecSqlResult(::util::error::INTERNAL,
+                                    "Failed to serialize log entry");
+        return BraftExecSqlResult(::util::error::OK, "");
+      },
+      [this]() -> BraftSnapshotSerializer {
+        // Only capturing the rows needs a consistent view of the Db, so
+        // only that holds up the state machine thread. Checksumming and
+        // assembling the snapshot happen in the background.
+        auto capture = std::make_shared<DbCapture>();
+        CaptureDb(*db_, SnapshotFileOptions(), capture.get());
+        return [capture](std::string *out) {
+          EncodeDbCapture(SnapshotFileOptions(), capture.get(), out);
+          return true;
+        };
+      },
+      [this](const std::string &path) {
+        Status s = ReadDbSnapshotFile(path, SnapshotFileOptions(), db_.get());
+        if (!s.ok()) {
+          LOG(ERROR) << "Failed to load the database snapshot: " << s;
+          return false;
         }
+        return true;
       });
 
   if (res) {
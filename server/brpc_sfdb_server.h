@@ -31,6 +31,8 @@
 namespace sfdb {
 class Db;
 class BuiltIns;
+class BatchExecutor;
+class PreparedStatements;
 class BrpcSfdbServerImpl;
 
 class BrpcSfdbServer : public SfdbServer {
@@ -46,6 +48,10 @@ class BrpcSfdbServer : public SfdbServer {
  private:
   std::unique_ptr<Db> db_;
   std::unique_ptr<BuiltIns> built_in_vars_;
+  // Applies committed writes to db_.
+  std::unique_ptr<BatchExecutor> executor_;
+  // Statements prepared by clients of this node.
+  std::unique_ptr<PreparedStatements> statements_;
 
   std::unique_ptr<BrpcSfdbServerImpl> pimpl_;
 };
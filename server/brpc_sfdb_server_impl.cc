@@ -21,6 +21,7 @@
  */
 #include "server/brpc_sfdb_server_impl.h"
 
+#include "absl/flags/flag.h"
 #include "absl/memory/memory.h"
 #include "brpc/server.h"
 #include "braft/raft.h"
@@ -28,6 +29,7 @@
 #include "server/braft_node.h"
 #include "server/brpc_sfdb_service_impl.h"
 #include "server/braft_state_machine_impl.h"
+#include "sfdb/flags.h"
 
 namespace sfdb {
 
@@ -41,7 +43,14 @@ BrpcSfdbServerImpl::~BrpcSfdbServerImpl() = default;
 
 bool BrpcSfdbServerImpl::Start(const std::string &host, int port,
                                const std::string &raft_targets,
-                               const BraftExecSqlHandler &exec_sql_handler) {
+                               const BraftExecSqlHandler &exec_sql_handler,
+                               const BraftApplyHandler &apply_handler,
+                               const BraftStreamReadHandler &stream_read_handler,
+                               const BraftPrepareHandler &prepare_handler,
+                               const BraftPrepareStatementHandler &prepare_statement_handler,
+                               const BraftPrepareBatchHandler &prepare_batch_handler,
+                               const BraftSnapshotSaveHandler &snapshot_save_handler,
+                               const BraftSnapshotLoadHandler &snapshot_load_handler) {
   CHECK(!server_) << "Server already started";
 
   auto server = absl::make_unique<brpc::Server>();
@@ -66,8 +75,12 @@ bool BrpcSfdbServerImpl::Start(const std::string &host, int port,
   opts.host = host;
   opts.port = port;
   opts.raft_members = raft_targets;
+  opts.snapshot_interval_s = absl::GetFlag(FLAGS_braft_snapshot_interval_s);
 
-  if (!node_->Start(opts, exec_sql_handler)) {
+  if (!node_->Start(opts, exec_sql_handler, apply_handler,
+                    stream_read_handler, prepare_handler,
+                    prepare_statement_handler, prepare_batch_handler,
+                    snapshot_save_handler, snapshot_load_handler)) {
     LOG(ERROR) << "Failed to start BRAFT node";
     return false;
   }
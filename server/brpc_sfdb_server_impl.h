@@ -47,7 +47,14 @@ class BrpcSfdbServerImpl {
   ~BrpcSfdbServerImpl();
 
   bool Start(const std::string &host, int port, const std::string &raft_targets,
-             const BraftExecSqlHandler &exec_sql_handler);
+             const BraftExecSqlHandler &exec_sql_handler,
+             const BraftApplyHandler &apply_handler,
+             const BraftStreamReadHandler &stream_read_handler,
+             const BraftPrepareHandler &prepare_handler,
+             const BraftPrepareStatementHandler &prepare_statement_handler,
+             const BraftPrepareBatchHandler &prepare_batch_handler,
+             const BraftSnapshotSaveHandler &snapshot_save_handler,
+             const BraftSnapshotLoadHandler &snapshot_load_handler);
   void Stop();
   void WaitTillStopped();
 
@@ -22,10 +22,95 @@
 
 #include "server/brpc_sfdb_service_impl.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <deque>
+#include <memory>
+
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "brpc/closure_guard.h"
+#include "brpc/controller.h"
+#include "brpc/stream.h"
+#include "bthread/bthread.h"
+#include "butil/errno.h"
+#include "butil/iobuf.h"
 #include "glog/logging.h"
 #include "server/braft_node.h"
 
 namespace sfdb {
+namespace {
+
+struct StreamArg {
+  BraftNode *node;
+  ExecSqlRequest request;
+  brpc::StreamId stream;
+};
+
+// How long a client may leave a stream full before it is given up on.
+constexpr absl::Duration kStalledStreamTimeout = absl::Seconds(30);
+
+// Writes responses to a stream, waiting while it is full, but not past the
+// deadline of each write: responses that don't fit by then are kept, and go
+// out first on the next write.
+class ResponseWriter {
+ public:
+  explicit ResponseWriter(brpc::StreamId stream) : stream_(stream) {}
+
+  // Returns false if the stream failed, or stayed full for too long.
+  bool Write(const ExecSqlResponse &response, absl::Time deadline) {
+    pending_.emplace_back();
+    {
+      butil::IOBufAsZeroCopyOutputStream out(&pending_.back());
+      if (!response.SerializeToZeroCopyStream(&out)) return false;
+    }
+    return Flush(deadline);
+  }
+
+  bool Flush(absl::Time deadline) {
+    const absl::Time give_up = absl::Now() + kStalledStreamTimeout;
+    while (!pending_.empty()) {
+      const int rc = brpc::StreamWrite(stream_, pending_.front());
+      if (rc == 0) {
+        pending_.pop_front();
+        continue;
+      }
+      if (rc != EAGAIN) return false;
+      const absl::Time due = std::min(deadline, give_up);
+      const timespec due_time = absl::ToTimespec(due);
+      const int wait_rc = brpc::StreamWait(stream_, &due_time);
+      if (wait_rc == ETIMEDOUT && due < give_up) return true;
+      if (wait_rc != 0) {
+        LOG(WARNING) << "Giving up on a stream: " << berror(wait_rc);
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  const brpc::StreamId stream_;
+  std::deque<butil::IOBuf> pending_;
+};
+
+void *StreamResult(void *arg) {
+  std::unique_ptr<StreamArg> stream_arg(static_cast<StreamArg *>(arg));
+  const brpc::StreamId stream = stream_arg->stream;
+  ResponseWriter writer(stream);
+  bool ok = true;
+  stream_arg->node->ExecSqlStream(
+      stream_arg->request,
+      [&writer, &ok](const ExecSqlResponse &response, absl::Time deadline) {
+        ok = writer.Write(response, deadline);
+        return ok;
+      });
+  if (ok) writer.Flush(absl::InfiniteFuture());
+  brpc::StreamClose(stream);
+  return nullptr;
+}
+
+}  // namespace
+
 BrpcSfdbServiceImpl::BrpcSfdbServiceImpl(BraftNode* node) : node_(node) {}
 
 BrpcSfdbServiceImpl::~BrpcSfdbServiceImpl() = default;
@@ -38,4 +123,51 @@ void BrpcSfdbServiceImpl::ExecSql(::google::protobuf::RpcController* controller,
   node_->ExecSql(request, response, done);
 }
 
-}  // namespace sfdb
\ No newline at end of file
+void BrpcSfdbServiceImpl::ExecSqlStream(
+    ::google::protobuf::RpcController* controller,
+    const ::sfdb::ExecSqlRequest* request, ::sfdb::ExecSqlResponse* response,
+    ::google::protobuf::Closure* done) {
+  CHECK(node_);
+  brpc::ClosureGuard done_guard(done);
+  brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+  brpc::StreamId stream;
+  if (brpc::StreamAccept(&stream, *cntl, nullptr) != 0) {
+    cntl->SetFailed("Failed to accept stream");
+    return;
+  }
+
+  auto* arg = new StreamArg{node_, *request, stream};
+  // The stream is usable once the response is sent.
+  done_guard.reset(nullptr);
+
+  bthread_t tid;
+  if (bthread_start_background(&tid, nullptr, StreamResult, arg) != 0) {
+    LOG(ERROR) << "Failed to start bthread";
+    delete arg;
+    brpc::StreamClose(stream);
+  }
+}
+
+void BrpcSfdbServiceImpl::Prepare(::google::protobuf::RpcController* controller,
+                                  const ::sfdb::PrepareRequest* request,
+                                  ::sfdb::PrepareResponse* response,
+                                  ::google::protobuf::Closure* done) {
+  CHECK(node_);
+  brpc::ClosureGuard done_guard(done);
+  auto result = node_->Prepare(*request, response);
+  if (result.first != ::util::error::OK) {
+    brpc::Controller* cntl = static_cast<brpc::Controller*>(controller);
+    cntl->SetFailed("Failed to prepare statement: %s", result.second.c_str());
+  }
+}
+
+void BrpcSfdbServiceImpl::ExecSqlBatch(
+    ::google::protobuf::RpcController* controller,
+    const ::sfdb::ExecSqlBatchRequest* request,
+    ::sfdb::ExecSqlBatchResponse* response,
+    ::google::protobuf::Closure* done) {
+  CHECK(node_);
+  node_->ExecSqlBatch(request, response, done);
+}
+
+}  // namespace sfdb
@@ -48,6 +48,24 @@ class BrpcSfdbServiceImpl : public SfdbService {
                        const ::sfdb::ExecSqlRequest* request,
                        ::sfdb::ExecSqlResponse* response,
                        ::google::protobuf::Closure* done) override;
+
+  // Accepts the BRPC stream attached to the call and writes the result to
+  // it as serialized ExecSqlResponses, then closes it.
+  void ExecSqlStream(::google::protobuf::RpcController* controller,
+                     const ::sfdb::ExecSqlRequest* request,
+                     ::sfdb::ExecSqlResponse* response,
+                     ::google::protobuf::Closure* done) override;
+
+  // Fails the call if the statement does not parse.
+  void Prepare(::google::protobuf::RpcController* controller,
+               const ::sfdb::PrepareRequest* request,
+               ::sfdb::PrepareResponse* response,
+               ::google::protobuf::Closure* done) override;
+
+  void ExecSqlBatch(::google::protobuf::RpcController* controller,
+                    const ::sfdb::ExecSqlBatchRequest* request,
+                    ::sfdb::ExecSqlBatchResponse* response,
+                    ::google::protobuf::Closure* done) override;
  private:
   BraftNode * const node_;
 };
@@ -26,17 +26,92 @@
 #include <functional>
 #include <string>
 #include <utility>
+#include <vector>
 
+#include "absl/time/time.h"
 #include "sfdb/api.pb.h"
 #include "util/task/codes.pb.h"  // ::util::error::Code
 
 namespace sfdb {
 // Type to pass result back from sql query execution.
 using BraftExecSqlResult = std::pair<::util::error::Code, const std::string>;
+
+// Executes a log entry made by a BraftPrepareHandler for a request. Without a
+// request and response, reads are skipped, since they only matter to the
+// replica that responds.
 using BraftExecSqlHandler = std::function<BraftExecSqlResult(
-    const std::string &, ExecSqlResponse *)>;
+    const std::string &, const ExecSqlRequest *, ExecSqlResponse *)>;
+
+// A committed task, as handed to a BraftApplyHandler.
+struct BraftAppliedTask {
+  // The log entry made by a BraftPrepareHandler.
+  std::string entry;
+  // Null unless this replica responds to the request; see
+  // BraftExecSqlHandler.
+  const ExecSqlRequest *request = nullptr;
+  ExecSqlResponse *response = nullptr;
+  // Set instead of |request| and |response| for a batch that this replica
+  // responds to. Holds the results that MakeBatchMutation() left unset.
+  ExecSqlBatchResponse *batch_response = nullptr;
+  // The outcome, filled in by the handler.
+  ::util::error::Code code = ::util::error::OK;
+  std::string error_message;
+};
+
+// Executes a batch of committed log entries in order, as a
+// BraftExecSqlHandler would one at a time, and sets each task's outcome.
+using BraftApplyHandler =
+    std::function<void(std::vector<BraftAppliedTask> *)>;
+
+// Receives one response of a streamed result. Returns false to stop early.
+// Must return by the deadline, as the read may hold the database lock until
+// then; a response that couldn't be sent yet is kept for later.
+using BraftResponseCallback =
+    std::function<bool(const ExecSqlResponse &, absl::Time deadline)>;
+
+// Runs a read-only log entry made by a BraftPrepareHandler for the request
+// against the local state, and passes its result to the callback as it is
+// produced, over one or more responses with at most the given number of rows
+// each.
+using BraftStreamReadHandler = std::function<BraftExecSqlResult(
+    const ExecSqlRequest &request, const std::string &entry, size_t max_rows,
+    const BraftResponseCallback &on_response)>;
 
 using BraftRedirectHandler = std::function<void(ExecSqlResponse *)>;
+
+// Turns the SQL statement of a request, or the prepared statement it names,
+// into a log entry that replicas can execute without parsing the statement
+// again. Sets the bool to whether the statement leaves the database
+// unchanged, so that the leader may run it against its local state without
+// going through the log.
+using BraftPrepareHandler = std::function<BraftExecSqlResult(
+    const ExecSqlRequest &request, std::string *entry, bool *read_only)>;
+
+// Turns the statements of a batch into one log entry, and fills in the
+// results of those that cannot go into it, as MakeBatchMutation() does.
+// Leaves the entry empty if none can.
+using BraftPrepareBatchHandler = std::function<BraftExecSqlResult(
+    const ExecSqlBatchRequest &request, std::string *entry,
+    ExecSqlBatchResponse *response)>;
+
+// Parses a statement with placeholders and keeps it on this node, for later
+// requests to name by the statement id it puts in the response.
+using BraftPrepareStatementHandler = std::function<BraftExecSqlResult(
+    const PrepareRequest &request, PrepareResponse *response)>;
+
+// Serializes a database snapshot into its argument. Returns false on failure.
+using BraftSnapshotSerializer = std::function<bool(std::string *)>;
+
+// Captures the state of the database as of the last applied task, and returns
+// a serializer for it. Runs on the state machine thread; the serializer runs
+// in the background while later tasks are applied, so it must not look at the
+// live database.
+using BraftSnapshotSaveHandler = std::function<BraftSnapshotSerializer()>;
+
+// Replaces the state of the database with the snapshot in the file at the
+// given path. Returns false, leaving the database untouched, if the snapshot
+// is invalid.
+using BraftSnapshotLoadHandler = std::function<bool(const std::string &)>;
 }  // namespace sfdb
 
 #endif  // SERVER_COMMON_TYPES_H_
\ No newline at end of file
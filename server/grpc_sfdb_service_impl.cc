@@ -22,9 +22,13 @@
 
 #include "server/grpc_sfdb_service_impl.h"
 
+#include <deque>
 #include <memory>
+#include <thread>
 #include <vector>
 
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "glog/logging.h"
 #include "server/grpc_modules.h"
 
@@ -32,6 +36,81 @@ namespace sfdb {
 
 using ::google::protobuf::Message;
 
+namespace {
+
+// Responses queued for a client before a streamed read has to wait for it.
+constexpr size_t kMaxQueuedResponses = 4;
+
+// Writes the responses of a streamed read to its client on a thread of its
+// own, so that the read doesn't wait for a slow client while it holds the
+// database lock.
+class ResponseWriter {
+ public:
+  ResponseWriter(grpc::ServerContext *context,
+                 grpc::ServerWriter<ExecSqlResponse> *writer)
+      : context_(context),
+        writer_(writer),
+        thread_(&ResponseWriter::WriteResponses, this) {}
+
+  ~ResponseWriter() { Finish(); }
+
+  // Queues |response|, waiting until |deadline| while the queue is full.
+  // Queues it anyway after that. Returns false once the client has gone away.
+  bool Write(const ExecSqlResponse &response, absl::Time deadline) {
+    absl::MutexLock lock(&mu_);
+    auto room = [this]() {
+      return failed_ || queue_.size() < kMaxQueuedResponses;
+    };
+    mu_.AwaitWithDeadline(absl::Condition(&room), deadline);
+    if (failed_) return false;
+    queue_.push_back(response);
+    return true;
+  }
+
+  // Waits until every queued response has been written. Returns false if the
+  // client went away first.
+  bool Finish() {
+    {
+      absl::MutexLock lock(&mu_);
+      done_ = true;
+    }
+    if (thread_.joinable()) thread_.join();
+    absl::MutexLock lock(&mu_);
+    return !failed_;
+  }
+
+ private:
+  void WriteResponses() {
+    ExecSqlResponse response;
+    while (true) {
+      {
+        absl::MutexLock lock(&mu_);
+        auto ready = [this]() { return done_ || !queue_.empty(); };
+        mu_.Await(absl::Condition(&ready));
+        if (queue_.empty()) return;
+        response.Swap(&queue_.front());
+        queue_.pop_front();
+      }
+      if (context_->IsCancelled() || !writer_->Write(response)) {
+        absl::MutexLock lock(&mu_);
+        failed_ = true;
+        queue_.clear();
+        return;
+      }
+    }
+  }
+
+  grpc::ServerContext *const context_;
+  grpc::ServerWriter<ExecSqlResponse> *const writer_;
+  absl::Mutex mu_;
+  std::deque<ExecSqlResponse> queue_ GUARDED_BY(mu_);
+  bool done_ GUARDED_BY(mu_) = false;
+  bool failed_ GUARDED_BY(mu_) = false;
+  std::thread thread_;
+};
+
+}  // namespace
+
 GrpcSfdbServiceImpl::GrpcSfdbServiceImpl(GrpcModules *modules)
     : modules_(modules) {}
 
@@ -43,4 +122,34 @@ GrpcSfdbServiceImpl::GrpcSfdbServiceImpl(GrpcModules *modules)
   return ret;
 }
 
+::grpc::Status GrpcSfdbServiceImpl::ExecSqlStream(
+    grpc::ServerContext *context, const ExecSqlRequest *request,
+    grpc::ServerWriter<ExecSqlResponse> *writer) {
+  VLOG(2) << "Got SQL to stream: " << request->sql();
+  ResponseWriter response_writer(context, writer);
+  ::grpc::Status ret = modules_->db()->ExecSqlStream(
+      *request, [&response_writer](const ExecSqlResponse &response,
+                                   absl::Time deadline) {
+        return response_writer.Write(response, deadline);
+      });
+  if (!response_writer.Finish() && ret.ok()) {
+    return ::grpc::Status(::grpc::StatusCode::CANCELLED, "Client went away");
+  }
+  return ret;
+}
+
+::grpc::Status GrpcSfdbServiceImpl::Prepare(grpc::ServerContext *context,
+                                            const PrepareRequest *request,
+                                            PrepareResponse *response) {
+  VLOG(2) << "Got SQL to prepare: " << request->sql();
+  return modules_->db()->Prepare(*request, response);
+}
+
+::grpc::Status GrpcSfdbServiceImpl::ExecSqlBatch(
+    grpc::ServerContext *context, const ExecSqlBatchRequest *request,
+    ExecSqlBatchResponse *response) {
+  VLOG(2) << "Got a batch of " << request->statements_size() << " statements";
+  return modules_->db()->ExecSqlBatch(*request, response);
+}
+
 }  // namespace sfdb
@@ -45,6 +45,18 @@ class GrpcSfdbServiceImpl : public SfdbService::Service {
                          const ExecSqlRequest *request,
                          ExecSqlResponse *response) override;
 
+  ::grpc::Status ExecSqlStream(
+      grpc::ServerContext *context, const ExecSqlRequest *request,
+      grpc::ServerWriter<ExecSqlResponse> *writer) override;
+
+  ::grpc::Status Prepare(grpc::ServerContext *context,
+                         const PrepareRequest *request,
+                         PrepareResponse *response) override;
+
+  ::grpc::Status ExecSqlBatch(grpc::ServerContext *context,
+                              const ExecSqlBatchRequest *request,
+                              ExecSqlBatchResponse *response) override;
+
  private:
   GrpcModules *const modules_;
 };
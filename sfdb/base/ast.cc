@@ -21,10 +21,14 @@
  */
 #include "sfdb/base/ast.h"
 
+#include <algorithm>
 #include <iterator>
 #include <ostream>
 #include <string>
 
+#include "absl/strings/str_cat.h"
+#include "util/task/canonical_errors.h"
+
 namespace sfdb {
 
 bool Ast::IsMutation() const {
@@ -50,7 +54,7 @@ std::string Ast::TypeToString(Type t) {
   switch (t) {
 #define C(x) case x: return #x
     C(ERROR);
-    C(STAR);
+    C(STAR); C(PARAM);
     C(IF); C(EXISTS);
     C(SHOW_TABLES); C(DESCRIBE_TABLE);
     C(CREATE_TABLE); C(CREATE_INDEX); C(DROP_TABLE); C(DROP_INDEX);
@@ -147,4 +151,66 @@ std::unique_ptr<Ast> Ast::Clone(const Ast *ast) {
   ));
 }
 
+// static
+int32 Ast::CountParams(const Ast *ast) {
+  if (!ast) return 0;
+  if (ast->type == PARAM) return ast->column_indices_[0] + 1;
+  int32 n = std::max(CountParams(ast->lhs()), CountParams(ast->rhs()));
+  for (const auto &v : ast->values_) n = std::max(n, CountParams(v.get()));
+  return n;
+}
+
+// static
+::util::StatusOr<std::unique_ptr<Ast>> Ast::Bind(
+    const Ast *ast, const std::vector<Value> &params) {
+  if (ast->type == PARAM) {
+    const int32 index = ast->column_indices_[0];
+    if (index >= static_cast<int32>(params.size())) {
+      return ::util::InvalidArgumentError(
+          ::absl::StrCat("No value bound to parameter $", index + 1));
+    }
+    Value value = params[index];
+    return std::unique_ptr<Ast>(new Ast(
+        VALUE, "", "", nullptr, nullptr, std::move(value)));
+  }
+
+  std::unique_ptr<Ast> bound_lhs, bound_rhs;
+  if (ast->lhs()) {
+    ::util::StatusOr<std::unique_ptr<Ast>> so = Bind(ast->lhs(), params);
+    if (!so.ok()) return so.status();
+    bound_lhs = std::move(so.ValueOrDie());
+  }
+  if (ast->rhs()) {
+    ::util::StatusOr<std::unique_ptr<Ast>> so = Bind(ast->rhs(), params);
+    if (!so.ok()) return so.status();
+    bound_rhs = std::move(so.ValueOrDie());
+  }
+
+  std::vector<std::unique_ptr<Ast>> values;
+  for (const auto &v : ast->values_) {
+    ::util::StatusOr<std::unique_ptr<Ast>> so = Bind(v.get(), params);
+    if (!so.ok()) return so.status();
+    values.push_back(std::move(so.ValueOrDie()));
+  }
+
+  Value value = ast->value_;
+  std::vector<std::string> columns = ast->columns();
+  std::vector<std::string> column_types = ast->column_types();
+  std::vector<int> column_indices = ast->column_indices();
+
+  return std::unique_ptr<Ast>(new Ast(
+    ast->type,
+    ast->table_name_,
+    ast->index_name_,
+    std::move(bound_lhs),
+    std::move(bound_rhs),
+    std::move(value),
+    std::move(columns),
+    std::move(column_types),
+    std::move(values),
+    ast->var_,
+    std::move(column_indices)
+  ));
+}
+
 }  // namespace sfdb
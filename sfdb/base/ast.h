@@ -28,11 +28,13 @@
 
 #include "absl/strings/string_view.h"
 #include "sfdb/base/value.h"
+#include "util/task/statusor.h"
 #include "util/types/integral_types.h"
 
 namespace sfdb {
 
 // These are not dependencies; they are only used in friend declarations.
+class AstProto;
 class Db;
 class ProtoPool;
 class TableIndex;
@@ -74,6 +76,7 @@ class Ast {
     SHOW_TABLES, //  ["People", "Contacts"]
     DESCRIBE_TABLE,  //  ["id", "int64"]["name", "string"]]
     STAR,       // This special type is processed by Optimize(...)
+    PARAM,      // ? or $n, the parameter at column_indices[0]; see Bind()
 
     // Operators in increasing order of priority.
     OP_IN, OP_LIKE, OP_OR,
@@ -205,6 +208,11 @@ class Ast {
     return std::unique_ptr<Ast>(new Ast(
         VALUE, "", "", nullptr, nullptr, Value::Bool(v)));
   }
+  static std::unique_ptr<Ast> Param(int32 index) {
+    return std::unique_ptr<Ast>(new Ast(
+        PARAM, "", "", nullptr, nullptr, Value::Bool(false), {}, {}, {}, "",
+        {index}));
+  }
   static std::unique_ptr<Ast> Var(::absl::string_view var) {
     return std::unique_ptr<Ast>(new Ast(
         VAR, "", "", nullptr, nullptr, Value::Bool(false), {}, {}, {}, var));
@@ -242,6 +250,15 @@ class Ast {
 
   static std::unique_ptr<Ast> Clone(const Ast *ast);
 
+  // Returns the number of parameters |ast| takes: one more than the largest
+  // PARAM index in it, or 0 if it has none.
+  static int32 CountParams(const Ast *ast);
+
+  // Returns a copy of |ast| with each PARAM replaced by a VALUE holding the
+  // corresponding element of |params|.
+  static ::util::StatusOr<std::unique_ptr<Ast>> Bind(
+      const Ast *ast, const std::vector<Value> &params);
+
  protected:
   Ast(Type type = ERROR,
       ::absl::string_view table_name = "",
@@ -276,13 +293,17 @@ class Ast {
   std::vector<std::string> column_types_;  // for CREATE_TABLE
   std::vector<std::unique_ptr<Ast>> values_;  // INSERT, UPDATE, FUNC
   std::string var_;  // for VAR and FUNC
-  std::vector<int32> column_indices_;  // for GROUP_BY and ORDER_BY
+  std::vector<int32> column_indices_;  // for GROUP_BY, ORDER_BY and PARAM
 
   // in ../engine/infer_result_types.cc
   friend ::util::StatusOr<std::unique_ptr<TypedAst>> InferResultTypes(
       std::unique_ptr<Ast> &&ast, ProtoPool *pool, const Db *db,
       const Vars *vars);
 
+  // in ast_proto.cc
+  friend ::util::StatusOr<std::unique_ptr<Ast>> AstFromProto(
+      const AstProto &proto);
+
   // in ../opt/index_match.cc
   friend std::unique_ptr<TypedAst> RebuildAstUsingIndex(
       const TableIndex &index, std::unique_ptr<TypedAst> &&ast);
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/base/ast_proto.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "glog/logging.h"
+#include "google/protobuf/descriptor.h"
+#include "util/task/canonical_errors.h"
+
+namespace sfdb {
+namespace {
+
+using ::google::protobuf::FieldDescriptor;
+using ::util::InvalidArgumentError;
+using ::util::OkStatus;
+using ::util::Status;
+using ::util::StatusOr;
+
+#define AST_TYPES(C)                                                          \
+  C(ERROR) C(CREATE_TABLE) C(CREATE_INDEX) C(DROP_TABLE) C(DROP_INDEX)        \
+  C(INSERT) C(UPDATE) C(SINGLE_EMPTY_ROW) C(TABLE_SCAN) C(INDEX_SCAN)         \
+  C(INDEX_SCAN_BOUND_EXCLUSIVE) C(INDEX_SCAN_BOUND_INCLUSIVE) C(VALUE)        \
+  C(VAR) C(FUNC) C(FILTER) C(GROUP_BY) C(ORDER_BY) C(MAP) C(IF) C(EXISTS)     \
+  C(SHOW_TABLES) C(DESCRIBE_TABLE) C(STAR) C(OP_IN) C(OP_LIKE) C(OP_OR)       \
+  C(OP_AND) C(OP_NOT) C(OP_EQ) C(OP_LT) C(OP_GT) C(OP_LE) C(OP_GE) C(OP_NE)   \
+  C(OP_PLUS) C(OP_MINUS) C(OP_BITWISE_AND) C(OP_BITWISE_OR)                   \
+  C(OP_BITWISE_XOR) C(OP_MUL) C(OP_DIV) C(OP_MOD) C(OP_BITWISE_NOT) C(PARAM)
+
+AstProto::Type TypeToProto(Ast::Type t) {
+  switch (t) {
+#define C(x) case Ast::x: return AstProto::x;
+    AST_TYPES(C)
+#undef C
+  }
+  LOG(FATAL) << "Unknown type " << t << " in TypeToProto";
+  return AstProto::ERROR;
+}
+
+Ast::Type TypeFromProto(AstProto::Type t) {
+  switch (t) {
+#define C(x) case AstProto::x: return Ast::x;
+    AST_TYPES(C)
+#undef C
+  }
+  return Ast::ERROR;
+}
+
+#undef AST_TYPES
+
+Status ValueToProto(const Value &v, AstProto *proto) {
+  if (v.type.is_void || v.type.is_repeated) {
+    return InvalidArgumentError("Only scalar values can be serialized");
+  }
+  switch (v.type.type) {
+    case FieldDescriptor::TYPE_BOOL:
+      proto->set_bool_value(v.boo);
+      return OkStatus();
+    case FieldDescriptor::TYPE_INT64:
+      proto->set_int64_value(v.i64);
+      return OkStatus();
+    case FieldDescriptor::TYPE_DOUBLE:
+      proto->set_double_value(v.dbl);
+      return OkStatus();
+    case FieldDescriptor::TYPE_STRING:
+      proto->set_string_value(v.str);
+      return OkStatus();
+    default:
+      return InvalidArgumentError(
+          "Only scalar values can be serialized, not " + v.type.ToString());
+  }
+}
+
+StatusOr<Value> ValueFromProto(const AstProto &proto) {
+  if (proto.has_bool_value()) return Value::Bool(proto.bool_value());
+  if (proto.has_int64_value()) return Value::Int64(proto.int64_value());
+  if (proto.has_double_value()) return Value::Double(proto.double_value());
+  if (proto.has_string_value()) return Value::String(proto.string_value());
+  return InvalidArgumentError("Serialized VALUE has no value");
+}
+
+// Decodes |proto| into |ast|, unless it is unset.
+Status OptionalAstFromProto(bool has, const AstProto &proto,
+                            std::unique_ptr<Ast> *ast) {
+  if (!has) return OkStatus();
+  StatusOr<std::unique_ptr<Ast>> so = AstFromProto(proto);
+  if (!so.ok()) return so.status();
+  *ast = std::move(so.ValueOrDie());
+  return OkStatus();
+}
+
+}  // namespace
+
+Status AstToProto(const Ast &ast, AstProto *proto) {
+  proto->set_type(TypeToProto(ast.type));
+  if (!ast.table_name().empty()) proto->set_table_name(ast.table_name());
+  if (!ast.index_name().empty()) proto->set_index_name(ast.index_name());
+  if (ast.lhs()) {
+    Status s = AstToProto(*ast.lhs(), proto->mutable_lhs());
+    if (!s.ok()) return s;
+  }
+  if (ast.rhs()) {
+    Status s = AstToProto(*ast.rhs(), proto->mutable_rhs());
+    if (!s.ok()) return s;
+  }
+  if (ast.type == Ast::VALUE) {
+    Status s = ValueToProto(ast.value(), proto);
+    if (!s.ok()) return s;
+  }
+  for (const std::string &c : ast.columns()) proto->add_column(c);
+  for (const std::string &t : ast.column_types()) proto->add_column_type(t);
+  for (const auto &v : ast.values()) {
+    Status s = AstToProto(*v, proto->add_value());
+    if (!s.ok()) return s;
+  }
+  if (!ast.var().empty()) proto->set_var(ast.var());
+  for (int32 i : ast.column_indices()) proto->add_column_index(i);
+  return OkStatus();
+}
+
+StatusOr<std::unique_ptr<Ast>> AstFromProto(const AstProto &proto) {
+  const Ast::Type type = TypeFromProto(proto.type());
+  if (type == Ast::ERROR) {
+    return InvalidArgumentError("Serialized Ast has no valid type");
+  }
+  if (type == Ast::IF && (!proto.has_lhs() || !proto.has_rhs())) {
+    return InvalidArgumentError("Serialized IF needs a condition and a body");
+  }
+
+  std::unique_ptr<Ast> lhs, rhs;
+  Status s = OptionalAstFromProto(proto.has_lhs(), proto.lhs(), &lhs);
+  if (!s.ok()) return s;
+  s = OptionalAstFromProto(proto.has_rhs(), proto.rhs(), &rhs);
+  if (!s.ok()) return s;
+
+  StatusOr<Value> value = type == Ast::VALUE
+                              ? ValueFromProto(proto)
+                              : StatusOr<Value>(Value::Bool(false));
+  if (!value.ok()) return value.status();
+
+  std::vector<std::unique_ptr<Ast>> values;
+  for (const AstProto &v : proto.value()) {
+    StatusOr<std::unique_ptr<Ast>> so = AstFromProto(v);
+    if (!so.ok()) return so.status();
+    values.push_back(std::move(so.ValueOrDie()));
+  }
+
+  return std::unique_ptr<Ast>(new Ast(
+      type, proto.table_name(), proto.index_name(), std::move(lhs),
+      std::move(rhs), std::move(value.ValueOrDie()),
+      std::vector<std::string>(proto.column().begin(), proto.column().end()),
+      std::vector<std::string>(proto.column_type().begin(),
+                               proto.column_type().end()),
+      std::move(values), proto.var(),
+      std::vector<int32>(proto.column_index().begin(),
+                         proto.column_index().end())));
+}
+
+}  // namespace sfdb
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#ifndef SFDB_BASE_AST_PROTO_H_
+#define SFDB_BASE_AST_PROTO_H_
+
+#include <memory>
+
+#include "sfdb/base/ast.h"
+#include "sfdb/base/ast.pb.h"
+#include "util/task/status.h"
+#include "util/task/statusor.h"
+
+namespace sfdb {
+
+// Converts a parsed statement into an AstProto. Fails if the statement holds
+// a value that is not a scalar, which the parser never creates.
+::util::Status AstToProto(const Ast &ast, AstProto *proto);
+
+// The inverse of AstToProto().
+::util::StatusOr<std::unique_ptr<Ast>> AstFromProto(const AstProto &proto);
+
+}  // namespace sfdb
+
+#endif  // SFDB_BASE_AST_PROTO_H_
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/base/ast_proto.h"
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "sfdb/base/ast.h"
+#include "sfdb/base/ast.pb.h"
+#include "sfdb/sql/parser.h"
+#include "util/task/status.h"
+#include "util/task/statusor.h"
+
+namespace sfdb {
+namespace {
+
+// Parses |sql|, converts it to an AstProto and back, and checks that nothing
+// was lost on the way.
+void ExpectRoundTrip(const std::string &sql) {
+  SCOPED_TRACE(sql);
+  std::unique_ptr<Ast> ast = Parse(sql).ValueOrDie();
+  AstProto proto;
+  ASSERT_TRUE(AstToProto(*ast, &proto).ok());
+
+  AstProto wire;
+  ASSERT_TRUE(wire.ParseFromString(proto.SerializeAsString()));
+  ::util::StatusOr<std::unique_ptr<Ast>> so = AstFromProto(wire);
+  ASSERT_TRUE(so.ok()) << so.status();
+  const Ast &decoded = *so.ValueOrDie();
+  EXPECT_EQ(ast->type, decoded.type);
+  EXPECT_EQ(ast->IsMutation(), decoded.IsMutation());
+
+  AstProto again;
+  ASSERT_TRUE(AstToProto(decoded, &again).ok());
+  EXPECT_EQ(proto.DebugString(), again.DebugString());
+}
+
+TEST(AstProtoTest, RoundTrip) {
+  ExpectRoundTrip("SHOW TABLES;");
+  ExpectRoundTrip("DESCRIBE People;");
+  ExpectRoundTrip("DROP TABLE People;");
+  ExpectRoundTrip("DROP INDEX ByAge;");
+  ExpectRoundTrip(
+      "CREATE TABLE People (name string, age int64) IF NOT EXISTS;");
+  ExpectRoundTrip("CREATE INDEX ByAge ON People (age, name);");
+  ExpectRoundTrip(
+      "INSERT INTO People (name, age, height, cool) "
+      "VALUES ('joe', -13, 1.5, TRUE);");
+  ExpectRoundTrip("UPDATE People SET age = age + 1 WHERE name = 'joe';");
+  ExpectRoundTrip(
+      "SELECT name, age * 2 AS twice FROM People "
+      "WHERE age >= 3 AND name = 'bob';");
+  ExpectRoundTrip("SELECT LEN('hello');");
+}
+
+TEST(AstProtoTest, KeepsValues) {
+  std::unique_ptr<Ast> ast =
+      Parse("INSERT INTO T (a, b, c) VALUES ('x', 7, 2.5);").ValueOrDie();
+  AstProto proto;
+  ASSERT_TRUE(AstToProto(*ast, &proto).ok());
+  std::unique_ptr<Ast> decoded = AstFromProto(proto).ValueOrDie();
+  ASSERT_EQ(3, decoded->values().size());
+  EXPECT_EQ(Value::String("x"), decoded->value(0)->value());
+  EXPECT_EQ(Value::Int64(7), decoded->value(1)->value());
+  EXPECT_EQ(Value::Double(2.5), decoded->value(2)->value());
+  EXPECT_EQ("T", decoded->table_name());
+}
+
+TEST(AstProtoTest, RejectsBadProtos) {
+  EXPECT_FALSE(AstFromProto(AstProto()).ok());
+
+  AstProto value;
+  value.set_type(AstProto::VALUE);
+  EXPECT_FALSE(AstFromProto(value).ok());
+
+  AstProto cond;
+  cond.set_type(AstProto::IF);
+  *cond.mutable_rhs() = value;
+  EXPECT_FALSE(AstFromProto(cond).ok());
+}
+
+}  // namespace
+}  // namespace sfdb
@@ -97,6 +97,7 @@ Table *Db::PutTable(string_view name, std::unique_ptr<ProtoPool> &&pool,
   auto new_table_ptr = (tables[name_str] = make_unique<Table>(
       name, std::move(pool), type)).get();
   scheme_changed_ = true;
+  ++schema_version;
   UpdateTableDescritption(new_table_ptr);
   return new_table_ptr;
 }
@@ -207,6 +208,7 @@ bool Db::DropTable(string_view name) {
 
   CHECK(tables.erase(std::string(name)));
   scheme_changed_ = true;
+  ++schema_version;
   RemoveTableDescritption(name_str);
   return true;
 }
@@ -226,6 +228,7 @@ TableIndex *Db::PutIndex(
           t, index_name, std::move(columns)
       )).get();
   t->indices[index_name_str] = index;
+  ++schema_version;
 
   // Index the current contents of the table.
   for (size_t i = 0; i < t->rows.size(); ++i)
@@ -240,6 +243,7 @@ bool Db::DropIndex(::absl::string_view index_name) {
   if (!i) return false;
   CHECK(i->t->indices.erase(index_name_str));
   CHECK(table_indices.erase(index_name_str));
+  ++schema_version;
   return true;
 }
 
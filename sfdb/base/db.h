@@ -34,6 +34,7 @@
 #include "google/protobuf/message.h"
 #include "sfdb/base/vars.h"
 #include "sfdb/proto/pool.h"
+#include "util/types/integral_types.h"
 
 namespace sfdb {
 
@@ -108,6 +109,10 @@ struct Db {
   std::unique_ptr<Vars> vars GUARDED_BY(mu);
   std::map<std::string, std::unique_ptr<TableIndex>> table_indices GUARDED_BY(mu);
 
+  // Bumped whenever a table or an index is created or dropped, so that
+  // anything planned against the old schema can tell that it is stale.
+  uint64 schema_version GUARDED_BY(mu) = 0;
+
   Db(::absl::string_view name, Vars *root_vars);
 
   ~Db() = default;
@@ -22,6 +22,9 @@
 #ifndef SFDB_BASE_REPLICATED_DB_H_
 #define SFDB_BASE_REPLICATED_DB_H_
 
+#include <functional>
+
+#include "absl/time/time.h"
 #include "sfdb/api.pb.h"
 #include "util/task/status.h"
 
@@ -43,6 +46,30 @@ class ReplicatedDb {
   // Executes a SQL statement. Blocks.
   virtual ::util::Status ExecSql(
       const ExecSqlRequest &request, ExecSqlResponse *response) = 0;
+
+  // Receives the responses of ExecSqlStream(). Returns false to stop early.
+  // The read may hold the database lock until |deadline|, so the callback
+  // must return by then, and keep a response it couldn't send yet for later.
+  using ResponseCallback =
+      std::function<bool(const ExecSqlResponse &, absl::Time deadline)>;
+
+  // Executes a SQL statement, and passes its result to |on_response| over
+  // one or more responses, with at most request.max_rows_per_response rows
+  // each. Only the first response carries the descriptors and the applied
+  // index. Blocks.
+  virtual ::util::Status ExecSqlStream(
+      const ExecSqlRequest &request, const ResponseCallback &on_response) = 0;
+
+  // Parses a SQL statement with placeholders, and keeps it for ExecSql()
+  // and ExecSqlStream() to run with bound values. Does not block on other
+  // replicas: each one keeps its own statements.
+  virtual ::util::Status Prepare(
+      const PrepareRequest &request, PrepareResponse *response) = 0;
+
+  // Executes many writes, replicated and applied as one entry, and fills in
+  // a result for each. Blocks.
+  virtual ::util::Status ExecSqlBatch(
+      const ExecSqlBatchRequest &request, ExecSqlBatchResponse *response) = 0;
 };
 
 }  // namespace sfdb
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/base/result_schema.h"
+
+#include <algorithm>
+#include <string>
+
+#include "util/hash/fingerprint.h"
+#include "util/task/canonical_errors.h"
+
+namespace sfdb {
+
+using ::google::protobuf::FileDescriptorProto;
+using ::google::protobuf::FileDescriptorSet;
+using ::google::protobuf::Message;
+using ::util::InternalError;
+using ::util::OkStatus;
+using ::util::Status;
+
+uint64 SchemaFingerprint(const FileDescriptorProto &file) {
+  // ProtoPool files hold one type each, and are named after it.
+  FileDescriptorProto canonical(file);
+  canonical.clear_name();
+  if (canonical.message_type_size() > 0) {
+    canonical.mutable_message_type(0)->clear_name();
+  }
+  std::string data;
+  canonical.SerializeToString(&data);
+  return ::util::Fingerprint64(data);
+}
+
+Status FillSchema(const ProtoPool &pool, const Message &row,
+                  ExecSqlResponse *response) {
+  auto file_descriptor = pool.FindProtoFile(row.GetDescriptor()->name());
+  if (!file_descriptor) return InternalError("Descriptor not found");
+
+  FileDescriptorSet *file_desc_set = response->mutable_descriptors();
+  file_desc_set->Clear();
+  FileDescriptorProto *file = file_desc_set->add_file();
+  file_descriptor->CopyTo(file);
+  response->set_schema_fingerprint(SchemaFingerprint(*file));
+  return OkStatus();
+}
+
+void StripKnownSchema(const ExecSqlRequest &request,
+                      ExecSqlResponse *response) {
+  if (!response->has_schema_fingerprint()) return;
+  const auto &known = request.known_schemas();
+  if (std::find(known.begin(), known.end(),
+                response->schema_fingerprint()) != known.end()) {
+    response->clear_descriptors();
+  }
+}
+
+}  // namespace sfdb
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#ifndef SFDB_BASE_RESULT_SCHEMA_H_
+#define SFDB_BASE_RESULT_SCHEMA_H_
+
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/message.h"
+#include "sfdb/api.pb.h"
+#include "sfdb/proto/pool.h"
+#include "util/task/status.h"
+#include "util/types/integral_types.h"
+
+namespace sfdb {
+
+// Returns the fingerprint of the row type in |file|. Types with the same
+// fields get the same fingerprint whatever they are called, so the columns
+// of every "SELECT a, b FROM t" share one, although each query makes its
+// own type.
+uint64 SchemaFingerprint(const ::google::protobuf::FileDescriptorProto &file);
+
+// Sets the descriptors and the schema fingerprint in |response| to those of
+// the type of |row|, made in |pool|.
+::util::Status FillSchema(const ProtoPool &pool,
+                          const ::google::protobuf::Message &row,
+                          ExecSqlResponse *response);
+
+// Leaves the descriptors out of |response| if the client that sent
+// |request| has them already.
+void StripKnownSchema(const ExecSqlRequest &request,
+                      ExecSqlResponse *response);
+
+}  // namespace sfdb
+
+#endif  // SFDB_BASE_RESULT_SCHEMA_H_
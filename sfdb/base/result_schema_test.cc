@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/base/result_schema.h"
+
+#include <memory>
+
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+#include "gtest/gtest.h"
+#include "sfdb/api.pb.h"
+#include "sfdb/proto/pool.h"
+
+namespace sfdb {
+namespace {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::FieldDescriptor;
+using ::google::protobuf::Message;
+
+TEST(ResultSchemaTest, SameColumnsSameFingerprint) {
+  ProtoPool pool;
+  const Descriptor *a = pool.CreateProtoClass("Map1", {
+      {"name", FieldDescriptor::TYPE_STRING},
+      {"age", FieldDescriptor::TYPE_INT64}}).ValueOrDie();
+  const Descriptor *b = pool.CreateProtoClass("Map2", {
+      {"name", FieldDescriptor::TYPE_STRING},
+      {"age", FieldDescriptor::TYPE_INT64}}).ValueOrDie();
+  const Descriptor *c = pool.CreateProtoClass("Map3", {
+      {"name", FieldDescriptor::TYPE_STRING},
+      {"age", FieldDescriptor::TYPE_INT32}}).ValueOrDie();
+
+  ExecSqlResponse ra, rb, rc;
+  ASSERT_TRUE(FillSchema(pool, *pool.NewMessage(a), &ra).ok());
+  ASSERT_TRUE(FillSchema(pool, *pool.NewMessage(b), &rb).ok());
+  ASSERT_TRUE(FillSchema(pool, *pool.NewMessage(c), &rc).ok());
+  ASSERT_TRUE(ra.has_schema_fingerprint());
+  EXPECT_EQ(ra.schema_fingerprint(), rb.schema_fingerprint());
+  EXPECT_NE(ra.schema_fingerprint(), rc.schema_fingerprint());
+  ASSERT_EQ(1, ra.descriptors().file_size());
+  EXPECT_EQ("Map1", ra.descriptors().file(0).message_type(0).name());
+}
+
+TEST(ResultSchemaTest, StripKnownSchema) {
+  ProtoPool pool;
+  const Descriptor *d = pool.CreateProtoClass("Person", {
+      {"name", FieldDescriptor::TYPE_STRING}}).ValueOrDie();
+  ExecSqlResponse response;
+  ASSERT_TRUE(FillSchema(pool, *pool.NewMessage(d), &response).ok());
+
+  ExecSqlRequest request;
+  request.add_known_schemas(response.schema_fingerprint() + 1);
+  StripKnownSchema(request, &response);
+  EXPECT_TRUE(response.has_descriptors());
+
+  request.add_known_schemas(response.schema_fingerprint());
+  StripKnownSchema(request, &response);
+  EXPECT_FALSE(response.has_descriptors());
+  EXPECT_TRUE(response.has_schema_fingerprint());
+}
+
+}  // namespace
+}  // namespace sfdb
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/base/row_encoding.h"
+
+#include <string>
+
+#include "glog/logging.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "google/protobuf/wire_format_lite.h"
+
+namespace sfdb {
+namespace {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::FieldDescriptor;
+using ::google::protobuf::Message;
+using ::google::protobuf::Reflection;
+using ::google::protobuf::internal::WireFormatLite;
+using ::google::protobuf::io::CodedOutputStream;
+using ::google::protobuf::io::StringOutputStream;
+
+using Rows = std::vector<std::unique_ptr<Message>>;
+
+bool IsPackable(const FieldDescriptor *field) {
+  switch (field->type()) {
+    case FieldDescriptor::TYPE_STRING:
+    case FieldDescriptor::TYPE_BYTES:
+    case FieldDescriptor::TYPE_MESSAGE:
+    case FieldDescriptor::TYPE_GROUP:
+      return false;
+    default:
+      return true;
+  }
+}
+
+// Writes the value of |field| in |row| without a tag, as an element of a
+// packed repeated field.
+void WritePackedValue(const Message &row, const FieldDescriptor *field,
+                      CodedOutputStream *out) {
+  const Reflection *r = row.GetReflection();
+  switch (field->type()) {
+    case FieldDescriptor::TYPE_DOUBLE:
+      WireFormatLite::WriteDoubleNoTag(r->GetDouble(row, field), out);
+      break;
+    case FieldDescriptor::TYPE_FLOAT:
+      WireFormatLite::WriteFloatNoTag(r->GetFloat(row, field), out);
+      break;
+    case FieldDescriptor::TYPE_INT64:
+      WireFormatLite::WriteInt64NoTag(r->GetInt64(row, field), out);
+      break;
+    case FieldDescriptor::TYPE_UINT64:
+      WireFormatLite::WriteUInt64NoTag(r->GetUInt64(row, field), out);
+      break;
+    case FieldDescriptor::TYPE_INT32:
+      WireFormatLite::WriteInt32NoTag(r->GetInt32(row, field), out);
+      break;
+    case FieldDescriptor::TYPE_FIXED64:
+      WireFormatLite::WriteFixed64NoTag(r->GetUInt64(row, field), out);
+      break;
+    case FieldDescriptor::TYPE_FIXED32:
+      WireFormatLite::WriteFixed32NoTag(r->GetUInt32(row, field), out);
+      break;
+    case FieldDescriptor::TYPE_BOOL:
+      WireFormatLite::WriteBoolNoTag(r->GetBool(row, field), out);
+      break;
+    case FieldDescriptor::TYPE_UINT32:
+      WireFormatLite::WriteUInt32NoTag(r->GetUInt32(row, field), out);
+      break;
+    case FieldDescriptor::TYPE_ENUM:
+      WireFormatLite::WriteEnumNoTag(r->GetEnumValue(row, field), out);
+      break;
+    case FieldDescriptor::TYPE_SFIXED32:
+      WireFormatLite::WriteSFixed32NoTag(r->GetInt32(row, field), out);
+      break;
+    case FieldDescriptor::TYPE_SFIXED64:
+      WireFormatLite::WriteSFixed64NoTag(r->GetInt64(row, field), out);
+      break;
+    case FieldDescriptor::TYPE_SINT32:
+      WireFormatLite::WriteSInt32NoTag(r->GetInt32(row, field), out);
+      break;
+    case FieldDescriptor::TYPE_SINT64:
+      WireFormatLite::WriteSInt64NoTag(r->GetInt64(row, field), out);
+      break;
+    default:
+      LOG(FATAL) << "Cannot pack field " << field->full_name();
+  }
+}
+
+// Writes the value of |field| in |row| with its tag, as one element of a
+// repeated field.
+void WriteTaggedValue(const Message &row, const FieldDescriptor *field,
+                      CodedOutputStream *out) {
+  const Reflection *r = row.GetReflection();
+  std::string scratch;
+  switch (field->type()) {
+    case FieldDescriptor::TYPE_STRING:
+      WireFormatLite::WriteString(
+          field->number(), r->GetStringReference(row, field, &scratch), out);
+      break;
+    case FieldDescriptor::TYPE_BYTES:
+      WireFormatLite::WriteBytes(
+          field->number(), r->GetStringReference(row, field, &scratch), out);
+      break;
+    case FieldDescriptor::TYPE_MESSAGE: {
+      const Message &m = r->GetMessage(row, field);
+      WireFormatLite::WriteTag(field->number(),
+                               WireFormatLite::WIRETYPE_LENGTH_DELIMITED, out);
+      out->WriteVarint32(m.ByteSizeLong());
+      m.SerializeWithCachedSizes(out);
+      break;
+    }
+    case FieldDescriptor::TYPE_GROUP: {
+      const Message &m = r->GetMessage(row, field);
+      WireFormatLite::WriteTag(field->number(),
+                               WireFormatLite::WIRETYPE_START_GROUP, out);
+      m.ByteSizeLong();
+      m.SerializeWithCachedSizes(out);
+      WireFormatLite::WriteTag(field->number(),
+                               WireFormatLite::WIRETYPE_END_GROUP, out);
+      break;
+    }
+    default:
+      LOG(FATAL) << "Field " << field->full_name() << " should be packed";
+  }
+}
+
+void EncodePacked(const Rows &rows, std::string *data) {
+  StringOutputStream stream(data);
+  CodedOutputStream out(&stream);
+  for (const auto &row : rows) {
+    out.WriteVarint32(row->ByteSizeLong());
+    row->SerializeWithCachedSizes(&out);
+  }
+}
+
+void EncodeColumnar(const Descriptor *d, const Rows &rows, std::string *data) {
+  StringOutputStream stream(data);
+  CodedOutputStream out(&stream);
+  std::string packed;
+  for (int i = 0; i < d->field_count(); ++i) {
+    const FieldDescriptor *field = d->field(i);
+    if (!IsPackable(field)) {
+      for (const auto &row : rows) WriteTaggedValue(*row, field, &out);
+      continue;
+    }
+    packed.clear();
+    {
+      StringOutputStream packed_stream(&packed);
+      CodedOutputStream packed_out(&packed_stream);
+      for (const auto &row : rows) WritePackedValue(*row, field, &packed_out);
+    }
+    WireFormatLite::WriteBytes(field->number(), packed, &out);
+  }
+}
+
+}  // namespace
+
+void EncodeRows(RowEncoding encoding, const Rows &rows,
+                ExecSqlResponse *response) {
+  if (rows.empty()) return;
+  if (encoding == ANY_ROWS) {
+    for (const auto &row : rows) {
+      response->add_rows()->PackFrom(*row, std::string());
+    }
+    return;
+  }
+
+  const Descriptor *d = rows[0]->GetDescriptor();
+  if (encoding == COLUMNAR_ROWS) {
+    for (int i = 0; i < d->field_count(); ++i) {
+      if (d->field(i)->is_repeated()) {
+        encoding = PACKED_ROWS;
+        break;
+      }
+    }
+  }
+  response->set_row_encoding(encoding);
+  response->set_row_type(d->full_name());
+  response->set_packed_row_count(rows.size());
+  if (encoding == COLUMNAR_ROWS) {
+    EncodeColumnar(d, rows, response->mutable_packed_rows());
+  } else {
+    EncodePacked(rows, response->mutable_packed_rows());
+  }
+}
+
+size_t RowsPerResponse(const ExecSqlRequest &request) {
+  return request.max_rows_per_response() > 0 ? request.max_rows_per_response()
+                                             : kDefaultRowsPerResponse;
+}
+
+void SplitResponse(
+    size_t rows_per_response, ExecSqlResponse *response,
+    const std::function<bool(const ExecSqlResponse &, absl::Time)>
+        &on_response) {
+  ::google::protobuf::RepeatedPtrField<::google::protobuf::Any> rows;
+  rows.Swap(response->mutable_rows());
+  int next = 0;
+  do {
+    for (size_t i = 0; i < rows_per_response && next < rows.size();
+         ++i, ++next) {
+      response->add_rows()->Swap(rows.Mutable(next));
+    }
+    if (!on_response(*response, absl::InfiniteFuture())) break;
+    response->Clear();
+  } while (next < rows.size());
+}
+
+}  // namespace sfdb
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#ifndef SFDB_BASE_ROW_ENCODING_H_
+#define SFDB_BASE_ROW_ENCODING_H_
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "google/protobuf/message.h"
+#include "sfdb/api.pb.h"
+
+namespace sfdb {
+
+// Adds |rows|, which are all of one type, to |response| in |encoding|. See
+// RowEncoding in api.proto.
+void EncodeRows(RowEncoding encoding,
+                const std::vector<std::unique_ptr<::google::protobuf::Message>>
+                    &rows,
+                ExecSqlResponse *response);
+
+// Rows per ExecSqlStream() response, unless the request says otherwise.
+constexpr size_t kDefaultRowsPerResponse = 1024;
+
+// How many rows each ExecSqlStream() response to |request| may carry.
+size_t RowsPerResponse(const ExecSqlRequest &request);
+
+// Passes |response|, which holds a whole result, to |on_response| the way
+// ExecSqlStream() would: with at most |rows_per_response| rows per response,
+// and everything else in the first one. Packed rows stay in one response.
+// Stops early if |on_response| returns false. Takes the rows out of
+// |response|.
+void SplitResponse(
+    size_t rows_per_response, ExecSqlResponse *response,
+    const std::function<bool(const ExecSqlResponse &, absl::Time)>
+        &on_response);
+
+}  // namespace sfdb
+
+#endif  // SFDB_BASE_ROW_ENCODING_H_
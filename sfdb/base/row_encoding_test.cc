@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/base/row_encoding.h"
+
+#include <memory>
+#include <vector>
+
+#include "absl/time/time.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/message.h"
+#include "gtest/gtest.h"
+#include "sfdb/api.pb.h"
+#include "sfdb/proto/pool.h"
+
+namespace sfdb {
+namespace {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::FieldDescriptor;
+using ::google::protobuf::FieldDescriptorProto;
+using ::google::protobuf::Message;
+using ::google::protobuf::io::CodedInputStream;
+
+class RowEncodingTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    row_type_ = pool_.CreateProtoClass("Person", {
+        {"name", FieldDescriptor::TYPE_STRING},
+        {"age", FieldDescriptor::TYPE_INT64},
+        {"score", FieldDescriptor::TYPE_DOUBLE}}).ValueOrDie();
+    rows_.push_back(pool_.NewMessage(row_type_, "name: 'a' age: 1 score: 2.5"));
+    rows_.push_back(pool_.NewMessage(row_type_, "age: 300"));
+    rows_.push_back(pool_.NewMessage(row_type_, "name: 'c' score: -1"));
+  }
+
+  ProtoPool pool_;
+  const Descriptor *row_type_;
+  std::vector<std::unique_ptr<Message>> rows_;
+};
+
+TEST_F(RowEncodingTest, Any) {
+  ExecSqlResponse response;
+  EncodeRows(ANY_ROWS, rows_, &response);
+  ASSERT_EQ(3, response.rows_size());
+  EXPECT_FALSE(response.has_packed_rows());
+  std::unique_ptr<Message> row = pool_.NewMessage(row_type_);
+  ASSERT_TRUE(response.rows(1).UnpackTo(row.get()));
+  EXPECT_EQ(rows_[1]->DebugString(), row->DebugString());
+}
+
+TEST_F(RowEncodingTest, Packed) {
+  ExecSqlResponse response;
+  EncodeRows(PACKED_ROWS, rows_, &response);
+  EXPECT_EQ(0, response.rows_size());
+  EXPECT_EQ(PACKED_ROWS, response.row_encoding());
+  EXPECT_EQ("sfdb.runtime.Person", response.row_type());
+  EXPECT_EQ(3, response.packed_row_count());
+
+  CodedInputStream in(
+      reinterpret_cast<const uint8_t *>(response.packed_rows().data()),
+      response.packed_rows().size());
+  for (const auto &expected : rows_) {
+    uint32_t size;
+    ASSERT_TRUE(in.ReadVarint32(&size));
+    const auto limit = in.PushLimit(size);
+    std::unique_ptr<Message> row = pool_.NewMessage(row_type_);
+    ASSERT_TRUE(row->ParseFromCodedStream(&in));
+    in.PopLimit(limit);
+    EXPECT_EQ(expected->DebugString(), row->DebugString());
+  }
+  EXPECT_TRUE(in.ExpectAtEnd());
+}
+
+TEST_F(RowEncodingTest, Columnar) {
+  ExecSqlResponse response;
+  EncodeRows(COLUMNAR_ROWS, rows_, &response);
+  EXPECT_EQ(COLUMNAR_ROWS, response.row_encoding());
+  EXPECT_EQ(3, response.packed_row_count());
+
+  std::vector<FieldDescriptorProto> fields(row_type_->field_count());
+  for (int i = 0; i < row_type_->field_count(); ++i) {
+    row_type_->field(i)->CopyTo(&fields[i]);
+    fields[i].set_label(FieldDescriptorProto::LABEL_REPEATED);
+  }
+  const Descriptor *columns_type =
+      pool_.CreateProtoClass("PersonColumns", fields).ValueOrDie();
+  std::unique_ptr<Message> columns = pool_.NewMessage(
+      columns_type,
+      "name: ['a', '', 'c'] age: [1, 300, 0] score: [2.5, 0, -1]");
+  std::unique_ptr<Message> parsed = pool_.NewMessage(columns_type);
+  ASSERT_TRUE(parsed->ParseFromString(response.packed_rows()));
+  EXPECT_EQ(columns->DebugString(), parsed->DebugString());
+}
+
+TEST_F(RowEncodingTest, ColumnarFallsBackWithRepeatedColumns) {
+  FieldDescriptorProto tags;
+  tags.set_name("tags");
+  tags.set_number(1);
+  tags.set_label(FieldDescriptorProto::LABEL_REPEATED);
+  tags.set_type(FieldDescriptorProto::TYPE_STRING);
+  const Descriptor *d = pool_.CreateProtoClass("Tagged", {tags}).ValueOrDie();
+  std::vector<std::unique_ptr<Message>> rows;
+  rows.push_back(pool_.NewMessage(d, "tags: ['x', 'y']"));
+
+  ExecSqlResponse response;
+  EncodeRows(COLUMNAR_ROWS, rows, &response);
+  EXPECT_EQ(PACKED_ROWS, response.row_encoding());
+}
+
+TEST_F(RowEncodingTest, NoRows) {
+  ExecSqlResponse response;
+  EncodeRows(PACKED_ROWS, {}, &response);
+  EXPECT_FALSE(response.has_row_encoding());
+  EXPECT_FALSE(response.has_packed_rows());
+}
+
+TEST_F(RowEncodingTest, SplitResponse) {
+  ExecSqlRequest request;
+  EXPECT_EQ(kDefaultRowsPerResponse, RowsPerResponse(request));
+  request.set_max_rows_per_response(2);
+  EXPECT_EQ(2, RowsPerResponse(request));
+
+  ExecSqlResponse response;
+  response.set_applied_index(7);
+  EncodeRows(ANY_ROWS, rows_, &response);
+  std::vector<ExecSqlResponse> responses;
+  SplitResponse(2, &response,
+                [&responses](const ExecSqlResponse &r, absl::Time deadline) {
+                  EXPECT_EQ(absl::InfiniteFuture(), deadline);
+                  responses.push_back(r);
+                  return true;
+                });
+  ASSERT_EQ(2, responses.size());
+  EXPECT_EQ(2, responses[0].rows_size());
+  EXPECT_EQ(7, responses[0].applied_index());
+  EXPECT_EQ(1, responses[1].rows_size());
+  EXPECT_FALSE(responses[1].has_applied_index());
+  std::unique_ptr<Message> row = pool_.NewMessage(row_type_);
+  ASSERT_TRUE(responses[1].rows(0).UnpackTo(row.get()));
+  EXPECT_EQ(rows_[2]->DebugString(), row->DebugString());
+
+  // Results without rows still get a response, and stopping early works.
+  response.Clear();
+  EncodeRows(ANY_ROWS, rows_, &response);
+  int calls = 0;
+  SplitResponse(1, &response, [&calls](const ExecSqlResponse &, absl::Time) {
+    ++calls;
+    return false;
+  });
+  EXPECT_EQ(1, calls);
+  response.Clear();
+  SplitResponse(1, &response, [&calls](const ExecSqlResponse &, absl::Time) {
+    ++calls;
+    return true;
+  });
+  EXPECT_EQ(2, calls);
+}
+
+}  // namespace
+}  // namespace sfdb
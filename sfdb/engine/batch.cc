@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/engine/batch.h"
+
+#include <algorithm>
+
+#include "absl/synchronization/blocking_counter.h"
+#include "sfdb/engine/engine.h"
+#include "sfdb/engine/update.h"
+#include "sfdb/proto/pool.h"
+#include "util/task/canonical_errors.h"
+
+namespace sfdb {
+
+using ::util::AbortedError;
+
+namespace {
+
+// Returns the table that |w| writes to, or nullptr if |w| has to run alone.
+const std::string *WrittenTable(const BatchedWrite &w) {
+  if (w.needs_previous) return nullptr;
+  if (w.row_images) return &w.row_images->table_name();
+  if (w.ast->type == Ast::INSERT || w.ast->type == Ast::UPDATE) {
+    return &w.ast->table_name();
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+BatchExecutor::BatchExecutor(Db *db, int threads) : db_(db) {
+  if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 1; i < threads; ++i) {
+    workers_.emplace_back(&BatchExecutor::WorkerMain, this);
+  }
+}
+
+BatchExecutor::~BatchExecutor() {
+  {
+    absl::MutexLock lock(&mu_);
+    stopping_ = true;
+  }
+  for (std::thread &worker : workers_) worker.join();
+}
+
+void BatchExecutor::Execute(std::vector<BatchedWrite> *writes) {
+  if (writes->empty()) return;
+  // Writes don't create protobuf types of their own, so one temporary pool
+  // does for the whole batch.
+  std::unique_ptr<ProtoPool> tmp_pool = db_->pool->Branch();
+  absl::WriterMutexLock lock(&db_->mu);
+  size_t i = 0;
+  while (i < writes->size()) {
+    if (!WrittenTable((*writes)[i])) {
+      BatchedWrite *w = &(*writes)[i++];
+      if (w->needs_previous && i > 1 && !(*writes)[i - 2].status.ok()) {
+        w->status = AbortedError("A previous write failed");
+        continue;
+      }
+      RunWrite(w, tmp_pool.get());
+      continue;
+    }
+    std::map<std::string, Chain> chains;
+    for (; i < writes->size(); ++i) {
+      const std::string *table = WrittenTable((*writes)[i]);
+      if (!table) break;
+      chains[*table].push_back(&(*writes)[i]);
+    }
+    RunChains(chains, tmp_pool.get());
+  }
+}
+
+void BatchExecutor::RunChains(const std::map<std::string, Chain> &chains,
+                              ProtoPool *pool) {
+  if (chains.size() == 1 || workers_.empty()) {
+    for (const auto &chain : chains) {
+      for (BatchedWrite *w : chain.second) RunWrite(w, pool);
+    }
+    return;
+  }
+
+  // ProtoPool isn't thread-safe, so each chain gets a branch of its own.
+  // They are made here, since branching reads |pool|.
+  std::vector<std::unique_ptr<ProtoPool>> branches;
+  for (size_t i = 0; i < chains.size(); ++i) branches.push_back(pool->Branch());
+
+  absl::BlockingCounter done(chains.size());
+  {
+    absl::MutexLock lock(&mu_);
+    size_t i = 0;
+    for (const auto &chain : chains) {
+      const Chain *c = &chain.second;
+      ProtoPool *branch = branches[i++].get();
+      tasks_.push_back([this, c, branch, &done]() {
+        for (BatchedWrite *w : *c) RunWrite(w, branch);
+        done.DecrementCount();
+      });
+    }
+  }
+  // Lend a hand rather than wait.
+  std::function<void()> task;
+  while (PopTask(&task)) task();
+  done.Wait();
+}
+
+void BatchExecutor::RunWrite(BatchedWrite *w, ProtoPool *pool) {
+  if (w->row_images) {
+    w->status = ApplyRowImages(*w->row_images, db_);
+    return;
+  }
+  w->status = ExecuteWriteLocked(std::move(w->ast), pool, db_);
+}
+
+bool BatchExecutor::PopTask(std::function<void()> *task) {
+  absl::MutexLock lock(&mu_);
+  if (tasks_.empty()) return false;
+  *task = std::move(tasks_.front());
+  tasks_.pop_front();
+  return true;
+}
+
+void BatchExecutor::WorkerMain() {
+  for (;;) {
+    std::function<void()> task;
+    {
+      absl::MutexLock lock(&mu_);
+      auto ready = [this]() { return stopping_ || !tasks_.empty(); };
+      mu_.Await(absl::Condition(&ready));
+      if (tasks_.empty()) return;
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+}  // namespace sfdb
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#ifndef SFDB_ENGINE_BATCH_H_
+#define SFDB_ENGINE_BATCH_H_
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "sfdb/base/ast.h"
+#include "sfdb/base/db.h"
+#include "sfdb/engine/row_images.pb.h"
+#include "sfdb/proto/pool.h"
+#include "util/task/status.h"
+
+namespace sfdb {
+
+// A write applied as part of a batch, and its outcome.
+struct BatchedWrite {
+  // Either a mutation, or row images made by PlanWrite(), which must outlive
+  // the batch.
+  std::unique_ptr<Ast> ast;
+  const RowImages *row_images = nullptr;
+
+  // Runs only if the write before it in the batch succeeded, and fails with
+  // ABORTED otherwise. Such writes run alone.
+  bool needs_previous = false;
+
+  ::util::Status status;
+};
+
+// Applies batches of writes to a Db, leaving it as if the writes had run one
+// after another, in order.
+//
+// INSERTs, UPDATEs and row images each touch a single table, so runs of them
+// are split by table, and the writes to different tables run concurrently.
+// Writes to the same table keep their order. Any other statement runs alone,
+// after the writes before it and before the writes after it.
+//
+// Thread-safe.
+class BatchExecutor {
+ public:
+  // Runs writes on up to |threads| threads, including the caller's. 0 means
+  // one per core.
+  BatchExecutor(Db *db, int threads);
+  ~BatchExecutor();
+
+  BatchExecutor(const BatchExecutor &) = delete;
+  BatchExecutor &operator=(const BatchExecutor &) = delete;
+
+  // Applies |writes| and sets their statuses. Holds db->mu exclusively
+  // throughout, and branches one temporary protobuf pool for all of them.
+  void Execute(std::vector<BatchedWrite> *writes);
+
+ private:
+  // Writes to one table, in order.
+  using Chain = std::vector<BatchedWrite *>;
+
+  // Runs each chain in order, and different chains concurrently, each with
+  // its own branch of the temporary |pool|.
+  void RunChains(const std::map<std::string, Chain> &chains, ProtoPool *pool)
+      EXCLUSIVE_LOCKS_REQUIRED(db_->mu);
+
+  // Runs one write with a temporary |pool| no other thread is using. Execute() holds db_->mu for
+  // whichever thread this runs on.
+  void RunWrite(BatchedWrite *w, ProtoPool *pool) NO_THREAD_SAFETY_ANALYSIS;
+
+  // Pops the next task, if there is one.
+  bool PopTask(std::function<void()> *task);
+
+  void WorkerMain();
+
+  Db *const db_;
+
+  absl::Mutex mu_;
+  std::deque<std::function<void()>> tasks_ GUARDED_BY(mu_);
+  bool stopping_ GUARDED_BY(mu_) = false;
+
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace sfdb
+
+#endif  // SFDB_ENGINE_BATCH_H_
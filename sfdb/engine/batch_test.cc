@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/engine/batch.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/message.h"
+#include "sfdb/base/vars.h"
+#include "sfdb/engine/engine.h"
+#include "sfdb/proto/pool.h"
+#include "sfdb/sql/parser.h"
+#include "util/task/canonical_errors.h"
+#include "util/task/status.h"
+#include "util/task/status_matchers.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace sfdb {
+namespace {
+
+using ::google::protobuf::Message;
+
+const char *const kWrites[] = {
+    "INSERT INTO A (k, v) VALUES (1, 'a1');",
+    "INSERT INTO B (k, v) VALUES (1, 'b1');",
+    "INSERT INTO A (k, v) VALUES (2, 'a2');",
+    "UPDATE A SET v = 'a1a' WHERE k = 1;",
+    "INSERT INTO B (k, v) VALUES (2, 'b2');",
+    "INSERT INTO Missing (k, v) VALUES (1, 'm1');",
+    "UPDATE B SET v = 'b2b' WHERE k = 2;",
+    "CREATE TABLE C (k int64, v string);",
+    "INSERT INTO C (k, v) VALUES (1, 'c1');",
+    "UPDATE A SET v = 'a2a' WHERE k = 2;",
+    "INSERT INTO A (k, v) VALUES (3, 'a3');",
+    "CREATE INDEX ByK ON A (k);",
+    "INSERT INTO B (k, v) VALUES (3, 'b3');",
+    "UPDATE A SET v = 'a3a' WHERE k = 3;",
+};
+
+void CreateTables(ProtoPool *pool, Db *db) {
+  std::vector<std::unique_ptr<Message>> rows;
+  ASSERT_OK(Execute(Parse("CREATE TABLE A (k int64, v string);").ValueOrDie(),
+                    pool, db, &rows));
+  ASSERT_OK(Execute(Parse("CREATE TABLE B (k int64, v string);").ValueOrDie(),
+                    pool, db, &rows));
+}
+
+std::string Dump(const char *table, const ProtoPool &pool, Db *db) {
+  // Result types are named after the table, so every query gets its own pool.
+  std::unique_ptr<ProtoPool> tmp_pool = pool.Branch();
+  std::vector<std::unique_ptr<Message>> rows;
+  const ::util::Status s = Execute(
+      Parse(std::string("SELECT * FROM ") + table + ";").ValueOrDie(),
+      tmp_pool.get(), db, &rows);
+  if (!s.ok()) return s.ToString();
+  std::string out;
+  for (const auto &row : rows) out += row->ShortDebugString() + "; ";
+  return out;
+}
+
+TEST(BatchExecutorTest, SameAsSequential) {
+  ProtoPool pool;
+  BuiltIns vars;
+  Db sequential("Test", &vars);
+  CreateTables(&pool, &sequential);
+  std::vector<::util::Status> expected;
+  for (const char *sql : kWrites) {
+    std::unique_ptr<ProtoPool> tmp_pool = pool.Branch();
+    expected.push_back(
+        ExecuteWrite(Parse(sql).ValueOrDie(), tmp_pool.get(), &sequential));
+  }
+
+  for (int threads : {1, 4}) {
+    Db batched("Test", &vars);
+    CreateTables(&pool, &batched);
+    std::vector<BatchedWrite> writes(sizeof(kWrites) / sizeof(kWrites[0]));
+    for (size_t i = 0; i < writes.size(); ++i) {
+      writes[i].ast = Parse(kWrites[i]).ValueOrDie();
+    }
+    BatchExecutor executor(&batched, threads);
+    executor.Execute(&writes);
+
+    for (size_t i = 0; i < writes.size(); ++i) {
+      EXPECT_EQ(expected[i].ok(), writes[i].status.ok())
+          << kWrites[i] << ": " << writes[i].status;
+    }
+    for (const char *table : {"A", "B", "C"}) {
+      EXPECT_EQ(Dump(table, pool, &sequential), Dump(table, pool, &batched))
+          << table << " with " << threads << " threads";
+    }
+  }
+  EXPECT_EQ("k: 1 v: \"a1a\"; k: 2 v: \"a2a\"; k: 3 v: \"a3a\"; ",
+            Dump("A", pool, &sequential));
+}
+
+TEST(BatchExecutorTest, RowImages) {
+  ProtoPool pool;
+  BuiltIns vars;
+  Db db("Test", &vars);
+  CreateTables(&pool, &db);
+  std::vector<std::unique_ptr<Message>> rows;
+  ASSERT_OK(Execute(Parse("INSERT INTO A (k, v) VALUES (1, 'a1');")
+                        .ValueOrDie(), &pool, &db, &rows));
+  RowImages images;
+  std::unique_ptr<ProtoPool> tmp_pool = pool.Branch();
+  ASSERT_OK(PlanWrite(Parse("UPDATE A SET v = 'x' WHERE k = 1;").ValueOrDie(),
+                      tmp_pool.get(), &db, &images));
+
+  std::vector<BatchedWrite> writes(2);
+  writes[0].row_images = &images;
+  writes[1].ast = Parse("INSERT INTO B (k, v) VALUES (1, 'b1');").ValueOrDie();
+  BatchExecutor executor(&db, 2);
+  executor.Execute(&writes);
+  EXPECT_OK(writes[0].status);
+  EXPECT_OK(writes[1].status);
+  EXPECT_EQ("k: 1 v: \"x\"; ", Dump("A", pool, &db));
+  EXPECT_EQ("k: 1 v: \"b1\"; ", Dump("B", pool, &db));
+}
+
+TEST(BatchExecutorTest, NeedsPrevious) {
+  ProtoPool pool;
+  BuiltIns vars;
+  Db db("Test", &vars);
+  CreateTables(&pool, &db);
+  const char *const sqls[] = {
+      "INSERT INTO A (k, v) VALUES (1, 'a1');",
+      "INSERT INTO B (k, v) VALUES (1, 'b1');",
+      "INSERT INTO Missing (k, v) VALUES (1, 'm1');",
+      "INSERT INTO A (k, v) VALUES (2, 'a2');",
+      "INSERT INTO B (k, v) VALUES (2, 'b2');",
+  };
+  std::vector<BatchedWrite> writes(5);
+  for (size_t i = 0; i < writes.size(); ++i) {
+    writes[i].ast = Parse(sqls[i]).ValueOrDie();
+    writes[i].needs_previous = i > 0;
+  }
+  BatchExecutor executor(&db, 4);
+  executor.Execute(&writes);
+  EXPECT_OK(writes[0].status);
+  EXPECT_OK(writes[1].status);
+  EXPECT_TRUE(::util::IsNotFound(writes[2].status));
+  EXPECT_TRUE(::util::IsAborted(writes[3].status));
+  EXPECT_TRUE(::util::IsAborted(writes[4].status));
+  EXPECT_EQ("k: 1 v: \"a1\"; ", Dump("A", pool, &db));
+  EXPECT_EQ("k: 1 v: \"b1\"; ", Dump("B", pool, &db));
+}
+
+}  // namespace
+}  // namespace sfdb
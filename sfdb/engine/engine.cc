@@ -21,11 +21,16 @@
  */
 #include "sfdb/engine/engine.h"
 
+#include <algorithm>
+#include <iterator>
+#include <limits>
 #include <memory>
 #include <vector>
 
 #include "absl/strings/str_cat.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "sfdb/base/ast.h"
 #include "sfdb/base/ast_type.h"
 #include "sfdb/base/db.h"
@@ -51,6 +56,7 @@ using ::google::protobuf::Descriptor;
 using ::google::protobuf::FieldDescriptor;
 using ::google::protobuf::Message;
 using ::google::protobuf::Reflection;
+using ::util::CancelledError;
 using ::util::InternalError;
 using ::util::InvalidArgumentError;
 using ::util::NotFoundError;
@@ -78,32 +84,74 @@ StatusOr<std::unique_ptr<ProtoStream>> GetProtoStream(const TypedAst &ast,
 Status ExecuteRead(
     std::unique_ptr<Ast> &&ast, ProtoPool *pool, const Db *db,
     std::vector<std::unique_ptr<Message>> *rows) {
-  CHECK(!ast->IsMutation());
-  ::absl::ReaderMutexLock lock(&db->mu);
-
-  // Performs Ast preprocessing in given context. Basically it
-  // expands "*" in SELECT to full list of columns.
-  StatusOr<std::unique_ptr<Ast>> so = ExpandAst(
-      std::move(ast), pool, db, db->vars.get());
-
-  if (!so.ok()) return so.status();
-
-  StatusOr<std::unique_ptr<TypedAst>> so2 = InferResultTypes(
-      std::move(so.ValueOrDie()), pool, db, db->vars.get());
-  if (!so2.ok()) return so2.status();
-
-  std::unique_ptr<TypedAst> oast = Optimize(*db, std::move(so2.ValueOrDie()));
-  StatusOr<std::unique_ptr<ProtoStream>> so3 = GetProtoStream(*oast, pool, db);
+  return ExecuteReadStream(
+      std::move(ast), pool, db, std::numeric_limits<size_t>::max(),
+      ::absl::ZeroDuration(),
+      [rows](std::vector<std::unique_ptr<Message>> *chunk, ::absl::Time) {
+        rows->insert(rows->end(), std::make_move_iterator(chunk->begin()),
+                     std::make_move_iterator(chunk->end()));
+        return true;
+      });
+}
 
-  if (!so3.ok()) return so3.status();
+Status ExecuteReadStream(
+    std::unique_ptr<Ast> &&ast, ProtoPool *pool, const Db *db,
+    size_t chunk_rows, ::absl::Duration max_lock_time,
+    const ChunkCallback &on_chunk) {
+  CHECK(!ast->IsMutation());
+  CHECK_GT(chunk_rows, 0);
+  std::vector<std::unique_ptr<Message>> rows;
+  {
+    ::absl::ReaderMutexLock lock(&db->mu);
+    const ::absl::Time deadline = ::absl::Now() + max_lock_time;
+
+    // Performs Ast preprocessing in given context. Basically it
+    // expands "*" in SELECT to full list of columns.
+    StatusOr<std::unique_ptr<Ast>> so = ExpandAst(
+        std::move(ast), pool, db, db->vars.get());
+
+    if (!so.ok()) return so.status();
+
+    StatusOr<std::unique_ptr<TypedAst>> so2 = InferResultTypes(
+        std::move(so.ValueOrDie()), pool, db, db->vars.get());
+    if (!so2.ok()) return so2.status();
+
+    std::unique_ptr<TypedAst> oast =
+        Optimize(*db, std::move(so2.ValueOrDie()));
+    StatusOr<std::unique_ptr<ProtoStream>> so3 =
+        GetProtoStream(*oast, pool, db);
+
+    if (!so3.ok()) return so3.status();
+
+    ProtoStream &ps = *so3.ValueOrDie();
+    bool behind = false;
+    while (ps.ok() && !ps.Done()) {
+      rows.push_back(pool->NewMessage(ps->GetDescriptor()));
+      rows.back()->CopyFrom(*ps);
+      ++ps;
+      if (!behind && rows.size() >= chunk_rows) {
+        if (!on_chunk(&rows, deadline)) {
+          return CancelledError("Stopped reading rows");
+        }
+        rows.clear();
+        behind = ::absl::Now() >= deadline;
+      }
+    }
+    if (!ps.ok()) return ps.status();
+  }
 
-  ProtoStream &ps = *so3.ValueOrDie();
-  while (ps.ok() && !ps.Done()) {
-    rows->push_back(pool->NewMessage(ps->GetDescriptor()));
-    rows->back()->CopyFrom(*ps);
-    ++ps;
+  // The rest of the rows don't need the lock anymore.
+  std::vector<std::unique_ptr<Message>> chunk;
+  for (auto it = rows.begin(); it != rows.end();) {
+    const size_t n =
+        std::min<size_t>(chunk_rows, std::distance(it, rows.end()));
+    chunk.assign(std::make_move_iterator(it), std::make_move_iterator(it + n));
+    it += n;
+    if (!on_chunk(&chunk, ::absl::InfiniteFuture())) {
+      return CancelledError("Stopped reading rows");
+    }
   }
-  return ps.status();
+  return OkStatus();
 }
 
 Status ExecuteWriteAST(TypedAst* ast, ProtoPool *pool, Db *db) {
@@ -132,9 +180,13 @@ Status ExecuteWriteAST(TypedAst* ast, ProtoPool *pool, Db *db) {
 }
 
 Status ExecuteWrite(std::unique_ptr<Ast> &&ast, ProtoPool *pool, Db *db) {
-  CHECK(ast->IsMutation());
   ::absl::WriterMutexLock lock(&db->mu);
+  return ExecuteWriteLocked(std::move(ast), pool, db);
+}
 
+Status ExecuteWriteLocked(std::unique_ptr<Ast> &&ast, ProtoPool *pool,
+                          Db *db) {
+  CHECK(ast->IsMutation());
   StatusOr<std::unique_ptr<TypedAst>> so = InferResultTypes(
       std::move(ast), pool, db, db->vars.get());
   if (!so.ok()) return so.status();
@@ -144,6 +196,27 @@ Status ExecuteWrite(std::unique_ptr<Ast> &&ast, ProtoPool *pool, Db *db) {
   return ExecuteWriteAST(oast.get(), pool, db);
 }
 
+Status PlanWrite(std::unique_ptr<Ast> &&ast, ProtoPool *pool, const Db *db,
+                 RowImages *images) {
+  if (ast->type != Ast::UPDATE) {
+    return UnimplementedError("Only UPDATE statements can be planned");
+  }
+  ::absl::ReaderMutexLock lock(&db->mu);
+
+  StatusOr<std::unique_ptr<TypedAst>> so = InferResultTypes(
+      std::move(ast), pool, db, db->vars.get());
+  if (!so.ok()) return so.status();
+
+  std::unique_ptr<TypedAst> oast = Optimize(*db, std::move(so.ValueOrDie()));
+
+  return PlanUpdate(*oast, *db, images);
+}
+
+Status ExecuteRowImages(const RowImages &images, Db *db) {
+  ::absl::WriterMutexLock lock(&db->mu);
+  return ApplyRowImages(images, db);
+}
+
 Status Execute(
     std::unique_ptr<Ast> &&ast, ProtoPool *pool, Db *db,
     std::vector<std::unique_ptr<Message>> *rows) {
@@ -22,12 +22,16 @@
 #ifndef SFDB_ENGINE_ENGINE_H_
 #define SFDB_ENGINE_ENGINE_H_
 
+#include <functional>
 #include <memory>
 #include <vector>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/time/time.h"
 #include "google/protobuf/message.h"
 #include "sfdb/base/ast.h"
 #include "sfdb/base/db.h"
+#include "sfdb/engine/row_images.pb.h"
 #include "sfdb/proto/pool.h"
 #include "util/task/status.h"
 
@@ -42,9 +46,43 @@ namespace sfdb {
     std::unique_ptr<Ast> &&ast, ProtoPool *pool, const Db *db,
     std::vector<std::unique_ptr<::google::protobuf::Message>> *rows);
 
+// Receives rows from ExecuteReadStream(), and may take them out of the
+// vector. Returns false to stop the read. db->mu may be held until
+// |deadline|, so the callback must return by then, even if it has to hold on
+// to the rows to pass them on later.
+using ChunkCallback = std::function<bool(
+    std::vector<std::unique_ptr<::google::protobuf::Message>> *,
+    absl::Time deadline)>;
+
+// Same as ExecuteRead(), but passes the rows to |on_chunk| as they are
+// produced, up to |chunk_rows| at a time, instead of collecting all of them.
+// Returns CANCELLED if |on_chunk| stops the read. Holds db->mu shared while
+// it calls |on_chunk|, for up to |max_lock_time|. After that, reads the rest
+// of the rows at once, and passes them on once it has released db->mu, with
+// an infinite deadline, so that a slow consumer can't hold up writers.
+::util::Status ExecuteReadStream(
+    std::unique_ptr<Ast> &&ast, ProtoPool *pool, const Db *db,
+    size_t chunk_rows, absl::Duration max_lock_time,
+    const ChunkCallback &on_chunk);
+
 ::util::Status ExecuteWrite(
     std::unique_ptr<Ast> &&ast, ProtoPool *pool, Db *db);
 
+// Same as ExecuteWrite(), for callers that hold db->mu exclusively already.
+::util::Status ExecuteWriteLocked(
+    std::unique_ptr<Ast> &&ast, ProtoPool *pool, Db *db)
+    EXCLUSIVE_LOCKS_REQUIRED(db->mu);
+
+// Runs an UPDATE against a database without changing it, and fills |images|
+// with the rows it would write. Other statements are unimplemented.
+::util::Status PlanWrite(
+    std::unique_ptr<Ast> &&ast, ProtoPool *pool, const Db *db,
+    RowImages *images);
+
+// Writes rows produced by PlanWrite() into a database that is in the state
+// PlanWrite() saw.
+::util::Status ExecuteRowImages(const RowImages &images, Db *db);
+
 }  // namespace sfdb
 
 #endif  // SFDB_ENGINE_ENGINE_H_
@@ -22,9 +22,11 @@
 #include "sfdb/engine/engine.h"
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "google/protobuf/message.h"
 #include "sfdb/base/vars.h"
 #include "sfdb/proto/pool.h"
@@ -365,5 +367,121 @@ TEST(EngineTest, SelectStar) {
   EXPECT_EQ("name: \"bob\" age: 16", rows[0]->ShortDebugString());
 }
 
+TEST(EngineTest, RowImages) {
+  ProtoPool pool;
+  BuiltIns vars;
+  Db leader("Leader", &vars);
+  Db follower("Follower", &vars);
+  std::vector<std::unique_ptr<Message>> rows;
+
+  for (Db *db : {&leader, &follower}) {
+    ASSERT_OK(Execute(Parse(
+        "CREATE TABLE People (name string, age int64);")
+        .ValueOrDie(), &pool, db, &rows));
+    ASSERT_OK(Execute(Parse(
+        "CREATE INDEX ByAge ON People (age);")
+        .ValueOrDie(), &pool, db, &rows));
+    ASSERT_OK(Execute(Parse(
+        "INSERT INTO People (name, age) VALUES ('joe', 13);")
+        .ValueOrDie(), &pool, db, &rows));
+    ASSERT_OK(Execute(Parse(
+        "INSERT INTO People (name, age) VALUES ('bob', 16);")
+        .ValueOrDie(), &pool, db, &rows));
+  }
+
+  // Planning leaves the database alone.
+  RowImages images;
+  ASSERT_OK(PlanWrite(Parse(
+      "UPDATE People SET age = age + 10 WHERE name = 'bob';")
+      .ValueOrDie(), &pool, &leader, &images));
+  ASSERT_EQ(1, images.row_size());
+  EXPECT_EQ(1, images.row(0).index());
+  ASSERT_OK(Execute(Parse(
+      "SELECT name FROM People WHERE age = 16;")
+      .ValueOrDie(), &pool, &leader, &rows));
+  ASSERT_EQ(1, rows.size());
+  rows.clear();
+
+  // The images only touch the updated rows and columns, and their indices.
+  ASSERT_OK(ExecuteRowImages(images, &follower));
+  ASSERT_OK(Execute(Parse(
+      "SELECT name, age FROM People WHERE age > 15;")
+      .ValueOrDie(), &pool, &follower, &rows));
+  ASSERT_EQ(1, rows.size());
+  EXPECT_EQ("_1: \"bob\" _2: 26", rows[0]->ShortDebugString());
+  rows.clear();
+  ASSERT_OK(Execute(Parse(
+      "SELECT name FROM People WHERE age = 13;")
+      .ValueOrDie(), &pool, &follower, &rows));
+  ASSERT_EQ(1, rows.size());
+  EXPECT_EQ("_1: \"joe\"", rows[0]->ShortDebugString());
+
+  images.mutable_row(0)->set_index(2);
+  EXPECT_FALSE(ExecuteRowImages(images, &follower).ok());
+}
+
+TEST(EngineTest, ExecuteReadStream) {
+  ProtoPool pool;
+  BuiltIns vars;
+  Db db("Test", &vars);
+  std::vector<std::unique_ptr<Message>> rows;
+
+  ASSERT_OK(Execute(Parse(
+      "CREATE TABLE People (name string, age int64);")
+      .ValueOrDie(), &pool, &db, &rows));
+  for (const char *name : {"'a'", "'b'", "'c'", "'d'", "'e'"}) {
+    ASSERT_OK(Execute(Parse(
+        std::string("INSERT INTO People (name, age) VALUES (") + name +
+        ", 1);").ValueOrDie(), &pool, &db, &rows));
+  }
+
+  std::vector<std::string> chunks;
+  ASSERT_OK(ExecuteReadStream(
+      Parse("SELECT name FROM People;").ValueOrDie(), &pool, &db, 2,
+      absl::InfiniteDuration(),
+      [&chunks](std::vector<std::unique_ptr<Message>> *chunk, absl::Time) {
+        std::string s;
+        for (const auto &row : *chunk) s += row->ShortDebugString() + ";";
+        chunks.push_back(s);
+        return true;
+      }));
+  EXPECT_THAT(chunks, ::testing::ElementsAre("_1: \"a\";_1: \"b\";",
+                                             "_1: \"c\";_1: \"d\";",
+                                             "_1: \"e\";"));
+
+  int calls = 0;
+  EXPECT_EQ(::util::error::CANCELLED,
+            ExecuteReadStream(
+                Parse("SELECT name FROM People;").ValueOrDie(), &pool, &db,
+                2, absl::InfiniteDuration(),
+                [&calls](std::vector<std::unique_ptr<Message>> *, absl::Time) {
+                  ++calls;
+                  return false;
+                }).CanonicalCode());
+  EXPECT_EQ(1, calls);
+
+  // Once the lock has been held for long enough, the rest of the rows are
+  // passed on without it.
+  chunks.clear();
+  std::vector<bool> locked;
+  ASSERT_OK(ExecuteReadStream(
+      Parse("SELECT name FROM People;").ValueOrDie(), &pool, &db, 2,
+      absl::ZeroDuration(),
+      [&](std::vector<std::unique_ptr<Message>> *chunk, absl::Time deadline) {
+        std::string s;
+        for (const auto &row : *chunk) s += row->ShortDebugString() + ";";
+        chunks.push_back(s);
+        const bool held = !db.mu.TryLock();
+        if (!held) db.mu.Unlock();
+        locked.push_back(held);
+        EXPECT_EQ(held, deadline != absl::InfiniteFuture());
+        return true;
+      }));
+  EXPECT_THAT(chunks, ::testing::ElementsAre("_1: \"a\";_1: \"b\";",
+                                             "_1: \"c\";_1: \"d\";",
+                                             "_1: \"e\";"));
+  EXPECT_THAT(locked, ::testing::ElementsAre(true, false, false));
+}
+
 }  // namespace
 }  // namespace sfdb
@@ -290,6 +290,9 @@ StatusOr<AstType> InferResultType(
       return AstType::Void();
     case Ast::EXISTS:
       return AstType::Scalar(FieldDescriptor::TYPE_BOOL);
+    case Ast::PARAM:
+      return InvalidArgumentError(StrCat(
+          "No value bound to parameter $", ast.column_indices()[0] + 1));
   }
 
   return InvalidArgumentError("Wrong Ast.type passed to InferResultType");
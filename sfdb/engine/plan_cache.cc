@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/engine/plan_cache.h"
+
+#include <utility>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
+#include "sfdb/sql/parser.h"
+#include "sfdb/sql/tokenizer.h"
+#include "util/varz/varz.h"
+
+DEFINE_VARZ(int64, plan_cache_hits, 0);
+DEFINE_VARZ(int64, plan_cache_misses, 0);
+
+namespace sfdb {
+
+using ::absl::StrAppend;
+using ::util::StatusOr;
+
+bool NormalizeSql(::absl::string_view sql, std::string *normalized,
+                  std::vector<Value> *literals) {
+  StatusOr<std::vector<Token>> so = Tokenize(sql);
+  if (!so.ok()) return false;
+
+  normalized->clear();
+  bool in_by_list = false;  // after GROUP BY or ORDER BY
+  for (const Token &t : so.ValueOrDie()) {
+    if (!normalized->empty()) normalized->push_back(' ');
+    switch (t.type) {
+      case Token::PARAM:
+        return false;
+      case Token::WORD:
+        if (::absl::AsciiStrToUpper(t.word) == "BY") in_by_list = true;
+        StrAppend(normalized, t.word);
+        continue;
+      case Token::COMMA:
+        StrAppend(normalized, t.ToString());
+        continue;
+      case Token::INT64:
+        if (in_by_list) {
+          StrAppend(normalized, t.i64);
+          continue;
+        }
+        literals->push_back(Value::Int64(t.i64));
+        break;
+      case Token::DOUBLE:
+        literals->push_back(Value::Double(t.dbl));
+        break;
+      case Token::QUOTED_STRING:
+        literals->push_back(Value::String(t.str));
+        break;
+      default:
+        in_by_list = false;
+        StrAppend(normalized, t.ToString());
+        continue;
+    }
+    in_by_list = false;
+    normalized->push_back('?');
+  }
+  return true;
+}
+
+PlanCache::PlanCache(const Db *db, size_t max_plans) : plans_(db, max_plans) {}
+
+StatusOr<std::unique_ptr<Ast>> PlanCache::Parse(::absl::string_view sql) {
+  std::string normalized;
+  std::vector<Value> literals;
+  if (NormalizeSql(sql, &normalized, &literals)) {
+    bool hit = false;
+    StatusOr<std::unique_ptr<Ast>> so =
+        plans_.Bind(normalized, literals, &hit);
+    if (so.ok()) {
+      Count(hit);
+      return so;
+    }
+  }
+  // Either |sql| is wrong, which parsing it will tell, or it has literals
+  // where placeholders cannot go.
+  Count(false);
+  return ::sfdb::Parse(sql);
+}
+
+void PlanCache::Count(bool hit) {
+  if (hit) {
+    VARZ_plan_cache_hits = static_cast<int64>(++hits_);
+  } else {
+    VARZ_plan_cache_misses = static_cast<int64>(++misses_);
+  }
+}
+
+}  // namespace sfdb
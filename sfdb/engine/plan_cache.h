@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#ifndef SFDB_ENGINE_PLAN_CACHE_H_
+#define SFDB_ENGINE_PLAN_CACHE_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "sfdb/base/ast.h"
+#include "sfdb/base/db.h"
+#include "sfdb/base/value.h"
+#include "sfdb/engine/statement_cache.h"
+#include "util/task/statusor.h"
+#include "util/types/integral_types.h"
+
+namespace sfdb {
+
+// Replaces the literals in |sql| with ? placeholders, and appends their
+// values to |literals|, so that statements which differ only in their
+// literals normalize to the same text. Integers in GROUP BY and ORDER BY
+// lists are column numbers, and stay. Returns false if |sql| does not
+// tokenize, or has placeholders of its own.
+bool NormalizeSql(::absl::string_view sql, std::string *normalized,
+                  std::vector<Value> *literals);
+
+// Plans for ad-hoc SQL from clients that do not prepare their statements.
+// Each statement is parsed with its literals taken out, as if it had been
+// prepared with placeholders for them, and the plan is reused by every
+// statement that normalizes to the same text. Plans follow the schema as in
+// StatementCache.
+//
+// Hits and misses are exported as the plan_cache_hits and plan_cache_misses
+// varz.
+//
+// Thread-safe.
+class PlanCache {
+ public:
+  // Keeps up to |max_plans|, forgetting the least recently used ones.
+  PlanCache(const Db *db, size_t max_plans);
+
+  PlanCache(const PlanCache &) = delete;
+  PlanCache &operator=(const PlanCache &) = delete;
+
+  // Same as Parse(sql), but starts from the plan of an earlier statement
+  // like |sql| if there is one.
+  ::util::StatusOr<std::unique_ptr<Ast>> Parse(::absl::string_view sql);
+
+  uint64 hits() const { return hits_; }
+  uint64 misses() const { return misses_; }
+
+ private:
+  // Counts a lookup, and exports the counts.
+  void Count(bool hit);
+
+  StatementCache plans_;
+  std::atomic<uint64> hits_{0};
+  std::atomic<uint64> misses_{0};
+};
+
+}  // namespace sfdb
+
+#endif  // SFDB_ENGINE_PLAN_CACHE_H_
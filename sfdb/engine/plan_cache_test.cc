@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/engine/plan_cache.h"
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "google/protobuf/message.h"
+#include "sfdb/base/vars.h"
+#include "sfdb/engine/engine.h"
+#include "sfdb/proto/pool.h"
+#include "sfdb/sql/parser.h"
+#include "util/task/canonical_errors.h"
+#include "util/task/status_matchers.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace sfdb {
+namespace {
+
+using ::google::protobuf::Message;
+
+void RunSql(const char *sql, ProtoPool *pool, Db *db) {
+  std::unique_ptr<ProtoPool> tmp_pool = pool->Branch();
+  std::vector<std::unique_ptr<Message>> rows;
+  ASSERT_OK(Execute(Parse(sql).ValueOrDie(), tmp_pool.get(), db, &rows));
+}
+
+TEST(NormalizeSqlTest, TakesOutLiterals) {
+  std::string normalized;
+  std::vector<Value> literals;
+  ASSERT_TRUE(NormalizeSql(
+      "SELECT v, 2.5 FROM A WHERE k = 3 AND v = 'x' GROUP BY 1, v "
+      "ORDER BY 2 LIMIT 10;", &normalized, &literals));
+  EXPECT_EQ("SELECT v , ? FROM A WHERE k = ? AND v = ? GROUP BY 1 , v "
+            "ORDER BY 2 LIMIT 10 ;", normalized);
+  EXPECT_EQ(std::vector<Value>({Value::Double(2.5), Value::Int64(3),
+                                Value::String("x")}),
+            literals);
+
+  // Same text, whatever the literals and the spacing.
+  std::string other;
+  literals.clear();
+  ASSERT_TRUE(NormalizeSql(
+      "SELECT v,  7.0 FROM A WHERE k = 0 AND v = '' GROUP BY 1,v "
+      "ORDER BY 2 LIMIT 10;", &other, &literals));
+  EXPECT_EQ(normalized, other);
+
+  EXPECT_FALSE(NormalizeSql("SELECT v FROM A WHERE k = ?;", &normalized,
+                            &literals));
+  EXPECT_FALSE(NormalizeSql("SELECT 'v FROM A;", &normalized, &literals));
+}
+
+class PlanCacheTest : public ::testing::Test {
+ protected:
+  PlanCacheTest() : db_("Test", &vars_) {
+    RunSql("CREATE TABLE A (k int64, v string);", &pool_, &db_);
+  }
+
+  std::vector<std::string> Query(const char *sql, PlanCache *plans) {
+    std::unique_ptr<ProtoPool> tmp_pool = pool_.Branch();
+    std::vector<std::unique_ptr<Message>> rows;
+    CHECK_OK(ExecuteRead(plans->Parse(sql).ValueOrDie(), tmp_pool.get(),
+                         &db_, &rows));
+    std::vector<std::string> result;
+    for (const auto &row : rows) result.push_back(row->ShortDebugString());
+    return result;
+  }
+
+  ProtoPool pool_;
+  BuiltIns vars_;
+  Db db_;
+};
+
+TEST_F(PlanCacheTest, SharesPlansAcrossLiterals) {
+  RunSql("INSERT INTO A (k, v) VALUES (1, 'a');", &pool_, &db_);
+  RunSql("INSERT INTO A (k, v) VALUES (2, 'b');", &pool_, &db_);
+  PlanCache plans(&db_, 8);
+  EXPECT_EQ(std::vector<std::string>({"_1: \"a\""}),
+            Query("SELECT v FROM A WHERE k = 1;", &plans));
+  EXPECT_EQ(std::vector<std::string>({"_1: \"b\""}),
+            Query("SELECT v FROM A WHERE k = 2;", &plans));
+  EXPECT_EQ(1, plans.hits());
+  EXPECT_EQ(1, plans.misses());
+
+  // Column numbers are part of the plan.
+  ASSERT_OK(plans.Parse("SELECT k, v FROM A ORDER BY 1;").status());
+  ASSERT_OK(plans.Parse("SELECT k, v FROM A ORDER BY 2;").status());
+  EXPECT_EQ(1, plans.hits());
+  EXPECT_EQ(3, plans.misses());
+}
+
+TEST_F(PlanCacheTest, FollowsTheSchema) {
+  PlanCache plans(&db_, 8);
+  EXPECT_EQ(2, plans.Parse("SELECT * FROM A WHERE k = 1;").ValueOrDie()
+                   ->columns().size());
+  RunSql("DROP TABLE A;", &pool_, &db_);
+  RunSql("CREATE TABLE A (k int64, v string, w double);", &pool_, &db_);
+  EXPECT_EQ(std::vector<std::string>({"k", "v", "w"}),
+            plans.Parse("SELECT * FROM A WHERE k = 2;").ValueOrDie()
+                ->columns());
+  EXPECT_EQ(1, plans.hits());
+}
+
+TEST_F(PlanCacheTest, ParsesConcurrently) {
+  PlanCache plans(&db_, 8);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&plans, t]() {
+      for (int i = 0; i < 100; ++i) {
+        const int64 k = t * 100 + i;
+        std::unique_ptr<Ast> ast =
+            plans.Parse("SELECT v FROM A WHERE k = " + std::to_string(k) + ";")
+                .ValueOrDie();
+        EXPECT_EQ(Value::Int64(k), ast->rhs()->lhs()->rhs()->value());
+      }
+    });
+  }
+  for (std::thread &thread : threads) thread.join();
+  EXPECT_EQ(400, plans.hits() + plans.misses());
+  EXPECT_LE(plans.misses(), 4);
+}
+
+TEST_F(PlanCacheTest, ErrorsAreThoseOfParse) {
+  PlanCache plans(&db_, 8);
+  ::util::Status expected = Parse("SELECT FROM A WHERE k = 1;").status();
+  ASSERT_FALSE(expected.ok());
+  EXPECT_EQ(expected, plans.Parse("SELECT FROM A WHERE k = 1;").status());
+  EXPECT_EQ(0, plans.hits());
+}
+
+}  // namespace
+}  // namespace sfdb
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/engine/prepared_statements.h"
+
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "sfdb/base/value.h"
+#include "sfdb/sql/parser.h"
+#include "util/task/canonical_errors.h"
+
+namespace sfdb {
+namespace {
+
+using ::util::InvalidArgumentError;
+using ::util::OkStatus;
+using ::util::Status;
+using ::util::StatusOr;
+
+StatusOr<Value> ValueFromSqlValue(const SqlValue &v) {
+  switch (v.value_case()) {
+    case SqlValue::kBoolValue: return Value::Bool(v.bool_value());
+    case SqlValue::kInt64Value: return Value::Int64(v.int64_value());
+    case SqlValue::kDoubleValue: return Value::Double(v.double_value());
+    case SqlValue::kStringValue: return Value::String(v.string_value());
+    case SqlValue::VALUE_NOT_SET: break;
+  }
+  return InvalidArgumentError("Parameter has no value");
+}
+
+}  // namespace
+
+PreparedStatements::PreparedStatements(const Db *db, size_t max_statements,
+                                       size_t max_plans)
+    : statements_(db, max_statements),
+      plans_(max_plans > 0 ? ::absl::make_unique<PlanCache>(db, max_plans)
+                           : nullptr) {}
+
+Status PreparedStatements::Prepare(const PrepareRequest &request,
+                                   PrepareResponse *response) {
+  uint64 id;
+  int32 param_count;
+  Status s = statements_.Prepare(request.sql(), &id, &param_count);
+  if (!s.ok()) return s;
+  response->set_statement_id(id);
+  response->set_param_count(param_count);
+  return OkStatus();
+}
+
+StatusOr<std::unique_ptr<Ast>> PreparedStatements::Resolve(
+    const ExecSqlRequest &request) {
+  if (!request.has_statement_id() && request.params().empty()) {
+    return plans_ ? plans_->Parse(request.sql()) : Parse(request.sql());
+  }
+
+  std::vector<Value> params;
+  for (const SqlValue &p : request.params()) {
+    StatusOr<Value> so = ValueFromSqlValue(p);
+    if (!so.ok()) return so.status();
+    params.push_back(std::move(so.ValueOrDie()));
+  }
+  // The statement id is the fingerprint of its sql, which is kept with it;
+  // the sql is enough to find it, and to prepare it again if it is gone.
+  if (request.has_sql()) return statements_.Bind(request.sql(), params);
+  return statements_.Bind(request.statement_id(), params);
+}
+
+}  // namespace sfdb
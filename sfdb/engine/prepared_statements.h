@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#ifndef SFDB_ENGINE_PREPARED_STATEMENTS_H_
+#define SFDB_ENGINE_PREPARED_STATEMENTS_H_
+
+#include <memory>
+
+#include "sfdb/api.pb.h"
+#include "sfdb/base/ast.h"
+#include "sfdb/base/db.h"
+#include "sfdb/engine/plan_cache.h"
+#include "sfdb/engine/statement_cache.h"
+#include "util/task/status.h"
+#include "util/task/statusor.h"
+
+namespace sfdb {
+
+// Statements prepared by clients of a Db, so that running one again only
+// binds its parameters instead of parsing it, and the plans of ad-hoc
+// statements, see StatementCache and PlanCache.
+//
+// Thread-safe.
+class PreparedStatements {
+ public:
+  // Keeps up to |max_statements| prepared statements and up to |max_plans|
+  // plans, forgetting the least recently used ones. Ad-hoc statements are
+  // parsed on every run if |max_plans| is 0.
+  PreparedStatements(const Db *db, size_t max_statements, size_t max_plans);
+
+  PreparedStatements(const PreparedStatements &) = delete;
+  PreparedStatements &operator=(const PreparedStatements &) = delete;
+
+  // Parses request.sql and keeps it.
+  ::util::Status Prepare(const PrepareRequest &request,
+                         PrepareResponse *response);
+
+  // Returns the statement to run for |request|: the prepared one named by
+  // request.statement_id, with request.params bound, or else request.sql.
+  // Returns NOT_FOUND if the statement is gone and the request has no sql.
+  ::util::StatusOr<std::unique_ptr<Ast>> Resolve(const ExecSqlRequest &request);
+
+  // Null if plans are not kept.
+  const PlanCache *plans() const { return plans_.get(); }
+
+ private:
+  StatementCache statements_;
+  const std::unique_ptr<PlanCache> plans_;
+};
+
+}  // namespace sfdb
+
+#endif  // SFDB_ENGINE_PREPARED_STATEMENTS_H_
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/engine/prepared_statements.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/message.h"
+#include "sfdb/base/vars.h"
+#include "sfdb/engine/engine.h"
+#include "sfdb/proto/pool.h"
+#include "sfdb/sql/parser.h"
+#include "util/task/canonical_errors.h"
+#include "util/task/status_matchers.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace sfdb {
+namespace {
+
+using ::google::protobuf::Message;
+
+void RunSql(const char *sql, ProtoPool *pool, Db *db) {
+  std::unique_ptr<ProtoPool> tmp_pool = pool->Branch();
+  std::vector<std::unique_ptr<Message>> rows;
+  ASSERT_OK(Execute(Parse(sql).ValueOrDie(), tmp_pool.get(), db, &rows));
+}
+
+uint64 Prepare(const char *sql, PreparedStatements *statements,
+               int32 *param_count = nullptr) {
+  PrepareRequest request;
+  request.set_sql(sql);
+  PrepareResponse response;
+  CHECK_OK(statements->Prepare(request, &response));
+  if (param_count) *param_count = response.param_count();
+  return response.statement_id();
+}
+
+ExecSqlRequest ExecRequest(uint64 id, std::vector<int64> params) {
+  ExecSqlRequest request;
+  request.set_statement_id(id);
+  for (int64 p : params) request.add_params()->set_int64_value(p);
+  return request;
+}
+
+class PreparedStatementsTest : public ::testing::Test {
+ protected:
+  PreparedStatementsTest() : db_("Test", &vars_) {
+    RunSql("CREATE TABLE A (k int64, v string);", &pool_, &db_);
+  }
+
+  ProtoPool pool_;
+  BuiltIns vars_;
+  Db db_;
+};
+
+TEST_F(PreparedStatementsTest, BindsParams) {
+  PreparedStatements statements(&db_, 8, 0);
+  int32 param_count;
+  const uint64 id = Prepare("SELECT v FROM A WHERE k = ? OR k = ?;",
+                            &statements, &param_count);
+  EXPECT_EQ(2, param_count);
+
+  std::unique_ptr<Ast> ast =
+      statements.Resolve(ExecRequest(id, {3, 4})).ValueOrDie();
+  const Ast *where = ast->rhs()->lhs();
+  EXPECT_EQ(Ast::VALUE, where->lhs()->rhs()->type);
+  EXPECT_EQ(Value::Int64(3), where->lhs()->rhs()->value());
+  EXPECT_EQ(Value::Int64(4), where->rhs()->rhs()->value());
+
+  EXPECT_TRUE(::util::IsInvalidArgument(
+      statements.Resolve(ExecRequest(id, {3})).status()));
+}
+
+TEST_F(PreparedStatementsTest, UnknownStatement) {
+  PreparedStatements statements(&db_, 1, 0);
+  const uint64 id = Prepare("SELECT v FROM A WHERE k = ?;", &statements);
+  Prepare("SELECT k FROM A WHERE v = ?;", &statements);  // evicts |id|
+  EXPECT_TRUE(::util::IsNotFound(
+      statements.Resolve(ExecRequest(id, {1})).status()));
+
+  // With the sql, it is prepared again.
+  ExecSqlRequest request = ExecRequest(id, {1});
+  request.set_sql("SELECT v FROM A WHERE k = ?;");
+  EXPECT_OK(statements.Resolve(request).status());
+  EXPECT_OK(statements.Resolve(ExecRequest(id, {1})).status());
+}
+
+TEST_F(PreparedStatementsTest, SchemaChangeExpandsAgain) {
+  PreparedStatements statements(&db_, 8, 0);
+  const uint64 id = Prepare("SELECT * FROM A WHERE k = ?;", &statements);
+  EXPECT_EQ(2, statements.Resolve(ExecRequest(id, {1})).ValueOrDie()
+                   ->columns().size());
+
+  RunSql("DROP TABLE A;", &pool_, &db_);
+  EXPECT_TRUE(::util::IsNotFound(
+      statements.Resolve(ExecRequest(id, {1})).status()));
+
+  RunSql("CREATE TABLE A (k int64, v string, w double);", &pool_, &db_);
+  std::unique_ptr<Ast> ast =
+      statements.Resolve(ExecRequest(id, {1})).ValueOrDie();
+  EXPECT_EQ(std::vector<std::string>({"k", "v", "w"}), ast->columns());
+
+  // The bound statement runs like any other.
+  RunSql("INSERT INTO A (k, v, w) VALUES (1, 'a', 0.5);", &pool_, &db_);
+  std::unique_ptr<ProtoPool> tmp_pool = pool_.Branch();
+  std::vector<std::unique_ptr<Message>> rows;
+  ASSERT_OK(ExecuteRead(std::move(ast), tmp_pool.get(), &db_, &rows));
+  ASSERT_EQ(1, rows.size());
+  EXPECT_EQ("k: 1 v: \"a\" w: 0.5", rows[0]->ShortDebugString());
+}
+
+}  // namespace
+}  // namespace sfdb
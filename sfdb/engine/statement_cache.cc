@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/engine/statement_cache.h"
+
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "glog/logging.h"
+#include "sfdb/engine/infer_result_types.h"
+#include "sfdb/proto/pool.h"
+#include "sfdb/sql/parser.h"
+#include "util/hash/fingerprint.h"
+#include "util/task/canonical_errors.h"
+
+namespace sfdb {
+
+using ::absl::StrCat;
+using ::util::InvalidArgumentError;
+using ::util::NotFoundError;
+using ::util::OkStatus;
+using ::util::Status;
+using ::util::StatusOr;
+
+StatementCache::StatementCache(const Db *db, size_t max_statements)
+    : db_(db), max_statements_(max_statements) {
+  CHECK_GT(max_statements, 0);
+}
+
+Status StatementCache::Prepare(::absl::string_view sql, uint64 *id,
+                               int32 *param_count) {
+  bool hit;
+  StatusOr<std::shared_ptr<const Statement>> so = Get(sql, &hit);
+  if (!so.ok()) return so.status();
+  *id = ::util::Fingerprint64(sql);
+  *param_count = so.ValueOrDie()->param_count;
+  return OkStatus();
+}
+
+StatusOr<std::unique_ptr<Ast>> StatementCache::Bind(
+    ::absl::string_view sql, const std::vector<Value> &params, bool *hit) {
+  bool found;
+  StatusOr<std::shared_ptr<const Statement>> so = Get(sql, &found);
+  if (!so.ok()) return so.status();
+  if (hit) *hit = found;
+  return BindStatement(*so.ValueOrDie(), params);
+}
+
+StatusOr<std::unique_ptr<Ast>> StatementCache::Bind(
+    uint64 id, const std::vector<Value> &params) {
+  std::shared_ptr<const Statement> statement = Find(id);
+  if (!statement) {
+    return NotFoundError(StrCat("Unknown prepared statement ", id));
+  }
+  StatusOr<std::shared_ptr<const Statement>> so =
+      Refresh(id, std::move(statement));
+  if (!so.ok()) return so.status();
+  return BindStatement(*so.ValueOrDie(), params);
+}
+
+std::shared_ptr<const StatementCache::Statement> StatementCache::Find(
+    uint64 id) {
+  ::absl::MutexLock lock(&mu_);
+  auto it = statements_.find(id);
+  if (it == statements_.end()) return nullptr;
+  lru_.splice(lru_.begin(), lru_, it->second.lru);
+  return it->second.statement;
+}
+
+StatusOr<std::shared_ptr<const StatementCache::Statement>> StatementCache::Get(
+    ::absl::string_view sql, bool *hit) {
+  const uint64 id = ::util::Fingerprint64(sql);
+  std::shared_ptr<const Statement> statement = Find(id);
+  // On a fingerprint collision, the newer statement wins.
+  *hit = statement && statement->sql == sql;
+  if (!*hit) {
+    StatusOr<std::unique_ptr<Ast>> so = Parse(sql);
+    if (!so.ok()) return so.status();
+    auto parsed = std::make_shared<Statement>();
+    parsed->sql = std::string(sql);
+    parsed->param_count = Ast::CountParams(so.ValueOrDie().get());
+    parsed->parsed = std::move(so.ValueOrDie());
+    statement = std::move(parsed);
+  }
+  return Refresh(id, std::move(statement));
+}
+
+StatusOr<std::shared_ptr<const StatementCache::Statement>>
+StatementCache::Refresh(uint64 id, std::shared_ptr<const Statement> statement) {
+  auto refreshed = std::make_shared<Statement>();
+  {
+    ::absl::ReaderMutexLock lock(&db_->mu);
+    if (statement->expanded &&
+        statement->schema_version == db_->schema_version) {
+      return statement;
+    }
+    // Expanding only replaces * with the table's columns; it adds no types
+    // to the pool. Result types are inferred per execution.
+    StatusOr<std::unique_ptr<Ast>> so = ExpandAst(
+        Ast::Clone(statement->parsed.get()), db_->pool.get(), db_,
+        db_->vars.get());
+    if (!so.ok()) return so.status();
+    refreshed->expanded = std::move(so.ValueOrDie());
+    refreshed->schema_version = db_->schema_version;
+  }
+  refreshed->sql = statement->sql;
+  refreshed->parsed = statement->parsed;
+  refreshed->param_count = statement->param_count;
+  Store(id, refreshed);
+  return std::shared_ptr<const Statement>(std::move(refreshed));
+}
+
+void StatementCache::Store(uint64 id,
+                           std::shared_ptr<const Statement> statement) {
+  ::absl::MutexLock lock(&mu_);
+  auto it = statements_.find(id);
+  if (it != statements_.end()) {
+    Entry &entry = it->second;
+    lru_.splice(lru_.begin(), lru_, entry.lru);
+    if (entry.statement->sql != statement->sql ||
+        entry.statement->schema_version < statement->schema_version) {
+      entry.statement = std::move(statement);
+    }
+    return;
+  }
+
+  while (statements_.size() >= max_statements_) {
+    statements_.erase(lru_.back());
+    lru_.pop_back();
+  }
+  lru_.push_front(id);
+  Entry &entry = statements_[id];
+  entry.statement = std::move(statement);
+  entry.lru = lru_.begin();
+}
+
+StatusOr<std::unique_ptr<Ast>> StatementCache::BindStatement(
+    const Statement &statement, const std::vector<Value> &params) {
+  if (static_cast<int32>(params.size()) != statement.param_count) {
+    return InvalidArgumentError(StrCat(
+        "Statement takes ", statement.param_count, " parameters, got ",
+        params.size()));
+  }
+  return Ast::Bind(statement.expanded.get(), params);
+}
+
+}  // namespace sfdb
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#ifndef SFDB_ENGINE_STATEMENT_CACHE_H_
+#define SFDB_ENGINE_STATEMENT_CACHE_H_
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "sfdb/base/ast.h"
+#include "sfdb/base/db.h"
+#include "sfdb/base/value.h"
+#include "util/task/status.h"
+#include "util/task/statusor.h"
+#include "util/types/integral_types.h"
+
+namespace sfdb {
+
+// Parsed SQL statements with ? and $n placeholders, each identified by the
+// fingerprint of its text, so that running one again only binds its values.
+//
+// Each statement is kept with "SELECT *" expanded against the schema, and
+// expanded again once a table or an index has been created or dropped since.
+// Types are still inferred, and the statement optimized, on every run: the
+// optimizer turns bound values into index bounds.
+//
+// Thread-safe. Statements are parsed, expanded and bound outside of the lock,
+// which only guards the lookup.
+class StatementCache {
+ public:
+  // Keeps up to |max_statements|, forgetting the least recently used ones.
+  StatementCache(const Db *db, size_t max_statements);
+
+  StatementCache(const StatementCache &) = delete;
+  StatementCache &operator=(const StatementCache &) = delete;
+
+  // Parses |sql| and keeps it, unless it is kept already. Sets |*id| and
+  // |*param_count| to those of the statement.
+  ::util::Status Prepare(::absl::string_view sql, uint64 *id,
+                         int32 *param_count) LOCKS_EXCLUDED(mu_);
+
+  // Returns |sql| with |params| bound to its placeholders, preparing it first
+  // unless it is kept already. Sets |*hit| to whether it was, if set.
+  ::util::StatusOr<std::unique_ptr<Ast>> Bind(
+      ::absl::string_view sql, const std::vector<Value> &params,
+      bool *hit = nullptr) LOCKS_EXCLUDED(mu_);
+
+  // Same, for a statement that must be kept already. Returns NOT_FOUND if
+  // there is no statement |id|.
+  ::util::StatusOr<std::unique_ptr<Ast>> Bind(
+      uint64 id, const std::vector<Value> &params) LOCKS_EXCLUDED(mu_);
+
+ private:
+  // A parsed statement. Never modified once it is shared, so that it can be
+  // expanded and bound without holding mu_.
+  struct Statement {
+    std::string sql;
+    std::shared_ptr<const Ast> parsed;  // as parsed, with PARAM nodes
+    int32 param_count;
+    std::unique_ptr<const Ast> expanded;  // |parsed| after ExpandAst()
+    uint64 schema_version;  // of the Db that |expanded| was made for
+  };
+
+  struct Entry {
+    std::shared_ptr<const Statement> statement;
+    std::list<uint64>::iterator lru;
+  };
+
+  // Returns the statement kept under |id|, or null. Marks it as used.
+  std::shared_ptr<const Statement> Find(uint64 id) LOCKS_EXCLUDED(mu_);
+
+  // Returns |sql| expanded against the current schema, parsing it first
+  // unless it is kept already, and keeps the result. Sets |*hit| to whether
+  // it was kept.
+  ::util::StatusOr<std::shared_ptr<const Statement>> Get(
+      ::absl::string_view sql, bool *hit) LOCKS_EXCLUDED(mu_);
+
+  // Returns |statement| if it is expanded against the current schema, or a
+  // copy that is, kept under |id| in its place.
+  ::util::StatusOr<std::shared_ptr<const Statement>> Refresh(
+      uint64 id, std::shared_ptr<const Statement> statement)
+      LOCKS_EXCLUDED(mu_);
+
+  // Keeps |statement| under |id|, unless another thread has meanwhile kept
+  // the same statement for a schema at least as recent.
+  void Store(uint64 id, std::shared_ptr<const Statement> statement)
+      LOCKS_EXCLUDED(mu_);
+
+  // Returns |statement| with |params| bound.
+  static ::util::StatusOr<std::unique_ptr<Ast>> BindStatement(
+      const Statement &statement, const std::vector<Value> &params);
+
+  const Db *const db_;
+  const size_t max_statements_;
+
+  ::absl::Mutex mu_;
+  std::map<uint64, Entry> statements_ GUARDED_BY(mu_);
+  std::list<uint64> lru_ GUARDED_BY(mu_);  // most recently used first
+};
+
+}  // namespace sfdb
+
+#endif  // SFDB_ENGINE_STATEMENT_CACHE_H_
@@ -21,6 +21,8 @@
  */
 #include "sfdb/engine/update.h"
 
+#include <set>
+
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "glog/logging.h"
@@ -41,6 +43,7 @@ using ::absl::StrCat;
 using ::absl::make_unique;
 using ::google::protobuf::FieldDescriptor;
 using ::google::protobuf::Message;
+using ::util::DataLossError;
 using ::util::InternalError;
 using ::util::NotFoundError;
 using ::util::OkStatus;
@@ -64,45 +67,43 @@ std::unique_ptr<TableIndexProtoStream> MakeTableIndexProtoStream(
   return make_unique<TableIndexProtoStream>(index, begin, end);
 }
 
-}  // namespace
-
-Status ExecuteUpdate(const TypedAst &ast, Db *db) {
+// Gets the FieldDescriptor of each column to be modified.
+Status FindUpdatedFields(const TypedAst &ast, const Table &t,
+                         std::vector<const FieldDescriptor*> *fds) {
   if (ast.columns().size() != ast.values().size()) return InternalError(StrCat(
       ast.values().size(), " values for ", ast.columns().size(), " columns",
       " in an UPDATE"));
 
-  Table *t = db->FindTable(ast.table_name());
-  if (!t) return NotFoundError(StrCat(
-      "Table ", ast.table_name(), " not found in database ", db->name));
-
-  // Get the FieldDescriptor of each column to be modified.
-  std::vector<const FieldDescriptor*> fds(ast.columns().size());
+  fds->resize(ast.columns().size());
   for (size_t j = 0; j < ast.columns().size(); ++j) {
     const std::string &col = ast.columns()[j];
-    fds[j] = t->type->FindFieldByName(col);
-    if (!fds[j]) return NotFoundError(StrCat(
-        "No column named ", col, " in ", t->name));
+    (*fds)[j] = t.type->FindFieldByName(col);
+    if (!(*fds)[j]) return NotFoundError(StrCat(
+        "No column named ", col, " in ", t.name));
   }
+  return OkStatus();
+}
 
+// Scans the table to find rows that match the WHERE clause.
+Status FindRowsToUpdate(const TypedAst &ast, const Db &db, Table *t,
+                        std::vector<int> *row_indices) {
   // Determine whether to use an index.
   std::unique_ptr<ProtoStream> scan;
   if (ast.rhs() && ast.rhs()->type == Ast::INDEX_SCAN) {
-    TableIndex *index = db->FindIndex(ast.rhs()->index_name());
+    TableIndex *index = db.FindIndex(ast.rhs()->index_name());
     if (!index) return NotFoundError(StrCat(
-        "No index named ", ast.rhs()->index_name(), " in database ", db->name));
+        "No index named ", ast.rhs()->index_name(), " in database ", db.name));
     scan = MakeTableIndexProtoStream(*index, *ast.rhs());
   } else {
     scan = make_unique<TableProtoStream>(t);
   }
   CHECK(scan);
 
-  // Scan the table to find rows to update.
-  std::vector<int> row_indices_to_update;
   for (; !scan->Done(); ++*scan) {
     if (!scan->ok()) return scan->status();
     int i = scan->GetIndexInTable();
     Message *row = t->rows[i].get();
-    std::unique_ptr<Vars> vars = db->vars->Branch(row);
+    std::unique_ptr<Vars> vars = db.vars->Branch(row);
 
     // Evaluate the WHERE clause.
     StatusOr<Value> so = ExecuteExpression(*ast.lhs(), vars.get());
@@ -111,24 +112,50 @@ Status ExecuteUpdate(const TypedAst &ast, Db *db) {
     if (!so2.ok()) return so2.status();
     if (!so2.ValueOrDie().boo) continue;
 
-    row_indices_to_update.push_back(i);
+    row_indices->push_back(i);
+  }
+  return OkStatus();
+}
+
+// Sets the columns of |row| to the values of the UPDATE.
+Status SetUpdatedFields(const TypedAst &ast,
+                        const std::vector<const FieldDescriptor*> &fds,
+                        const Db &db, Message *row) {
+  std::unique_ptr<Vars> vars = db.vars->Branch(row);
+  for (size_t j = 0; j < fds.size(); ++j) {
+    StatusOr<Value> so = ExecuteExpression(*ast.value(j), vars.get());
+    if (!so.ok()) return so.status();
+    Status s = SetField(so.ValueOrDie(), fds[j], db.pool.get(), row);
+    if (!s.ok()) return s;
   }
+  return OkStatus();
+}
+
+}  // namespace
+
+Status ExecuteUpdate(const TypedAst &ast, Db *db) {
+  Table *t = db->FindTable(ast.table_name());
+  if (!t) return NotFoundError(StrCat(
+      "Table ", ast.table_name(), " not found in database ", db->name));
+
+  std::vector<const FieldDescriptor*> fds;
+  Status s = FindUpdatedFields(ast, *t, &fds);
+  if (!s.ok()) return s;
+
+  std::vector<int> row_indices_to_update;
+  s = FindRowsToUpdate(ast, *db, t, &row_indices_to_update);
+  if (!s.ok()) return s;
 
   // Update the rows.
   for (int i : row_indices_to_update) {
     Message *row = t->rows[i].get();
-    std::unique_ptr<Vars> vars = db->vars->Branch(row);
 
     // Remove the row from indices.
     for (auto idx : t->indices) CHECK(idx.second->tree.erase({row, i}));
 
     // Modify the row proto.
-    for (size_t j = 0; j < fds.size(); ++j) {
-      StatusOr<Value> so3 = ExecuteExpression(*ast.value(j), vars.get());
-      if (!so3.ok()) return so3.status();
-      Status s = SetField(so3.ValueOrDie(), fds[j], db->pool.get(), row);
-      if (!s.ok()) return s;
-    }
+    s = SetUpdatedFields(ast, fds, *db, row);
+    if (!s.ok()) return s;
 
     // Re-add the row back to indices.
     for (auto idx : t->indices) idx.second->tree.insert({row, i});
@@ -137,4 +164,82 @@ Status ExecuteUpdate(const TypedAst &ast, Db *db) {
   return OkStatus();
 }
 
+Status PlanUpdate(const TypedAst &ast, const Db &db, RowImages *images) {
+  Table *t = db.FindTable(ast.table_name());
+  if (!t) return NotFoundError(StrCat(
+      "Table ", ast.table_name(), " not found in database ", db.name));
+
+  std::vector<const FieldDescriptor*> fds;
+  Status s = FindUpdatedFields(ast, *t, &fds);
+  if (!s.ok()) return s;
+
+  std::vector<int> row_indices_to_update;
+  s = FindRowsToUpdate(ast, db, t, &row_indices_to_update);
+  if (!s.ok()) return s;
+
+  images->Clear();
+  images->set_table_name(t->name);
+  std::set<int> numbers;
+  for (const FieldDescriptor *fd : fds) numbers.insert(fd->number());
+  for (int i : row_indices_to_update) {
+    // Run the update on a copy, then strip it down to the updated fields.
+    std::unique_ptr<Message> row(t->rows[i]->New());
+    row->CopyFrom(*t->rows[i]);
+    s = SetUpdatedFields(ast, fds, db, row.get());
+    if (!s.ok()) return s;
+    for (int j = 0; j < t->type->field_count(); ++j) {
+      const FieldDescriptor *fd = t->type->field(j);
+      if (!numbers.count(fd->number())) {
+        row->GetReflection()->ClearField(row.get(), fd);
+      }
+    }
+
+    RowImages::Row *image = images->add_row();
+    image->set_index(i);
+    for (int number : numbers) image->add_field(number);
+    row->SerializeToString(image->mutable_values());
+  }
+  return OkStatus();
+}
+
+Status ApplyRowImages(const RowImages &images, Db *db) {
+  Table *t = db->FindTable(images.table_name());
+  if (!t) return NotFoundError(StrCat(
+      "Table ", images.table_name(), " not found in database ", db->name));
+
+  // Decode everything up front, so that a bad image leaves the table alone.
+  std::vector<std::unique_ptr<Message>> values;
+  std::vector<std::vector<const FieldDescriptor*>> fds;
+  for (const RowImages::Row &image : images.row()) {
+    if (image.index() < 0 ||
+        image.index() >= static_cast<int64>(t->rows.size())) {
+      return DataLossError(StrCat(
+          "Row ", image.index(), " is out of range in ", t->name));
+    }
+    fds.emplace_back();
+    for (int number : image.field()) {
+      const FieldDescriptor *fd = t->type->FindFieldByNumber(number);
+      if (!fd) return DataLossError(StrCat(
+          "No field number ", number, " in ", t->name));
+      fds.back().push_back(fd);
+    }
+    values.emplace_back(t->rows[image.index()]->New());
+    if (!values.back()->ParseFromString(image.values())) {
+      return DataLossError(StrCat("Bad row image for ", t->name));
+    }
+  }
+
+  for (int k = 0; k < images.row_size(); ++k) {
+    const int i = images.row(k).index();
+    Message *row = t->rows[i].get();
+    for (auto idx : t->indices) CHECK(idx.second->tree.erase({row, i}));
+    for (const FieldDescriptor *fd : fds[k]) {
+      row->GetReflection()->ClearField(row, fd);
+    }
+    row->MergeFrom(*values[k]);
+    for (auto idx : t->indices) idx.second->tree.insert({row, i});
+  }
+  return OkStatus();
+}
+
 }  // namespace sfdb
@@ -25,6 +25,7 @@
 #include "absl/base/thread_annotations.h"
 #include "sfdb/base/db.h"
 #include "sfdb/base/typed_ast.h"
+#include "sfdb/engine/row_images.pb.h"
 #include "util/task/status.h"
 
 namespace sfdb {
@@ -32,6 +33,16 @@ namespace sfdb {
 ::util::Status ExecuteUpdate(const TypedAst &ast, Db *db)
     EXCLUSIVE_LOCKS_REQUIRED(db->mu);
 
+// Runs an UPDATE without modifying |db|, and fills |images| with the rows it
+// would write.
+::util::Status PlanUpdate(const TypedAst &ast, const Db &db, RowImages *images)
+    SHARED_LOCKS_REQUIRED(db.mu);
+
+// Writes rows produced by PlanUpdate() into |db|. Expects |db| to be in the
+// state PlanUpdate() saw.
+::util::Status ApplyRowImages(const RowImages &images, Db *db)
+    EXCLUSIVE_LOCKS_REQUIRED(db->mu);
+
 }  // namespace sfdb
 
 #endif  // SFDB_ENGINE_UPDATE_H_
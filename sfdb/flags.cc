@@ -43,6 +43,51 @@ ABSL_FLAG(string, raft_my_target, "127.0.0.1:27910",
 ABSL_FLAG(string, raft_targets, "127.0.0.1:27910:0",
           "The list of all (or other) RAFT targets in the cluster.");
 
+ABSL_FLAG(int32, follower_read_wait_ms, 100,
+          "How long a replica waits to catch up with a READ_YOUR_WRITES read "
+          "before sending it through the RAFT log.");
+
+ABSL_FLAG(string, raft_log_dir, "",
+          "Where the built-in RAFT implementation persists its log. If empty, "
+          "the log is kept in memory only.");
+
+ABSL_FLAG(string, raft_fsync, "always",
+          "When the built-in RAFT implementation fsyncs its log. Possible values:"
+          "\talways - before acknowledging entries; concurrent writes share fsyncs"
+          "\tnever - leave it to the OS; for benchmarking only");
+
+ABSL_FLAG(int64, raft_snapshot_interval, 100000,
+          "The built-in RAFT implementation snapshots the database and drops "
+          "the log entries it covers every time this many entries have been "
+          "applied. 0 keeps the whole log.");
+
+ABSL_FLAG(bool, raft_row_images, false,
+          "With the built-in RAFT implementation, UPDATE statements are run "
+          "once by the member that receives them, and replicated as the rows "
+          "they change instead of as statements.");
+
+ABSL_FLAG(int32, raft_apply_threads, 0,
+          "The number of threads that apply committed writes to different "
+          "tables concurrently. 0 means one per core; 1 applies every write "
+          "in turn.");
+
+ABSL_FLAG(int32, prepared_statements, 1024,
+          "How many prepared statements the server keeps for its clients. "
+          "The least recently used ones are dropped first.");
+
+ABSL_FLAG(int32, plan_cache_size, 1024,
+          "How many plans of ad-hoc statements the server keeps, keyed by "
+          "their text with literals taken out. 0 parses every statement.");
+
+ABSL_FLAG(int32, braft_snapshot_interval_s, 3600,
+          "The BRAFT implementation snapshots the database and drops the log "
+          "entries it covers this often, in seconds. 0 keeps the whole log.");
+
+ABSL_FLAG(int32, stream_lock_ms, 100,
+          "How long a streamed read may hold up writes while its client takes "
+          "the rows. After that, it reads the rest of its result at once, and "
+          "sends it without holding them up.");
+
 // -----------------------------------------------------------------------------
 // Logging related flags
 // -----------------------------------------------------------------------------
@@ -33,6 +33,16 @@ ABSL_DECLARE_FLAG(int32, port);
 ABSL_DECLARE_FLAG(string, raft_impl);
 ABSL_DECLARE_FLAG(string, raft_my_target);
 ABSL_DECLARE_FLAG(string, raft_targets);
+ABSL_DECLARE_FLAG(int32, follower_read_wait_ms);
+ABSL_DECLARE_FLAG(string, raft_log_dir);
+ABSL_DECLARE_FLAG(string, raft_fsync);
+ABSL_DECLARE_FLAG(int64, raft_snapshot_interval);
+ABSL_DECLARE_FLAG(bool, raft_row_images);
+ABSL_DECLARE_FLAG(int32, raft_apply_threads);
+ABSL_DECLARE_FLAG(int32, prepared_statements);
+ABSL_DECLARE_FLAG(int32, plan_cache_size);
+ABSL_DECLARE_FLAG(int32, braft_snapshot_interval_s);
+ABSL_DECLARE_FLAG(int32, stream_lock_ms);
 
 // Logging related flags
 ABSL_DECLARE_FLAG(int32, log_v);
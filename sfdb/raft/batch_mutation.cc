@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/raft/batch_mutation.h"
+
+#include <memory>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "sfdb/base/ast.h"
+#include "sfdb/base/ast_proto.h"
+#include "util/task/canonical_errors.h"
+#include "util/task/statusor.h"
+
+namespace sfdb {
+
+using ::absl::StrCat;
+using ::util::AbortedError;
+using ::util::DataLossError;
+using ::util::InvalidArgumentError;
+using ::util::OkStatus;
+using ::util::Status;
+using ::util::StatusOr;
+
+namespace {
+
+void SetResult(const Status &s, ExecSqlBatchResponse::Result *result) {
+  result->set_code(s.CanonicalCode());
+  if (!s.ok()) result->set_error_message(s.error_message());
+}
+
+}  // namespace
+
+void MakeBatchMutation(const ExecSqlBatchRequest &request,
+                       PreparedStatements *statements, Mutation *mut,
+                       ExecSqlBatchResponse *response) {
+  mut->set_stop_on_error(request.stop_on_error());
+  bool failed = false;
+  for (const ExecSqlRequest &statement : request.statements()) {
+    ExecSqlBatchResponse::Result *result = response->add_results();
+    if (failed && request.stop_on_error()) {
+      SetResult(AbortedError("A previous statement failed"), result);
+      continue;
+    }
+    // Values are bound here, so replicas never see placeholders.
+    StatusOr<std::unique_ptr<Ast>> so = statements->Resolve(statement);
+    Status s = so.status();
+    if (s.ok() && !so.ValueOrDie()->IsMutation()) {
+      s = InvalidArgumentError("Only writes can be batched");
+    }
+    AstProto proto;
+    if (s.ok()) s = AstToProto(*so.ValueOrDie(), &proto);
+    if (s.ok()) {
+      mut->add_batch()->Swap(&proto);
+      continue;
+    }
+    SetResult(s, result);
+    failed = true;
+  }
+}
+
+Status DecodeBatchMutation(const Mutation &mut,
+                           std::vector<BatchedWrite> *writes) {
+  writes->clear();
+  for (const AstProto &proto : mut.batch()) {
+    StatusOr<std::unique_ptr<Ast>> so = AstFromProto(proto);
+    if (!so.ok()) {
+      return DataLossError(StrCat("Bad statement ", writes->size() + 1,
+                                  " in a batch: ", so.status().ToString()));
+    }
+    BatchedWrite w;
+    w.ast = std::move(so.ValueOrDie());
+    // Only the first statement of a batch that stops on error may run along
+    // with other writes.
+    w.needs_previous = mut.stop_on_error() && !writes->empty();
+    writes->push_back(std::move(w));
+  }
+  return OkStatus();
+}
+
+void SetBatchResults(const std::vector<BatchedWrite> &writes,
+                     ExecSqlBatchResponse *response) {
+  size_t next = 0;
+  for (ExecSqlBatchResponse::Result &result : *response->mutable_results()) {
+    if (result.has_code()) continue;
+    if (next == writes.size()) break;
+    SetResult(writes[next++].status, &result);
+  }
+}
+
+}  // namespace sfdb
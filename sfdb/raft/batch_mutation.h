@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#ifndef SFDB_RAFT_BATCH_MUTATION_H_
+#define SFDB_RAFT_BATCH_MUTATION_H_
+
+#include <vector>
+
+#include "sfdb/api.pb.h"
+#include "sfdb/engine/batch.h"
+#include "sfdb/engine/prepared_statements.h"
+#include "sfdb/raft/mutation.pb.h"
+#include "util/task/status.h"
+
+namespace sfdb {
+
+// Turns the statements of |request| into |mut|, which replicates them as one
+// entry. Adds a result to |response| for each statement; those that fail here
+// get their error, and are left out of |mut|, as are the ones after them with
+// stop_on_error. The results of the others stay unset until the entry is
+// applied, and SetBatchResults() fills them in.
+void MakeBatchMutation(const ExecSqlBatchRequest &request,
+                       PreparedStatements *statements, Mutation *mut,
+                       ExecSqlBatchResponse *response);
+
+// Decodes the statements of a batch entry into |writes|, to be applied with
+// BatchExecutor::Execute().
+::util::Status DecodeBatchMutation(const Mutation &mut,
+                                   std::vector<BatchedWrite> *writes);
+
+// Fills the results left unset by MakeBatchMutation() with the statuses of
+// |writes|, the applied statements of the entry.
+void SetBatchResults(const std::vector<BatchedWrite> &writes,
+                     ExecSqlBatchResponse *response);
+
+}  // namespace sfdb
+
+#endif  // SFDB_RAFT_BATCH_MUTATION_H_
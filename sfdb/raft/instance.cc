@@ -21,31 +21,44 @@
  */
 #include "sfdb/raft/instance.h"
 
+#include <algorithm>
+#include <limits>
 #include <memory>
 
 #include "absl/memory/memory.h"
 #include "absl/strings/str_split.h"
 #include "glog/logging.h"
-#include "google/protobuf/descriptor.pb.h"
 #include "google/protobuf/message.h"
 #include "sfdb/base/ast.h"
+#include "sfdb/base/ast_proto.h"
+#include "sfdb/base/result_schema.h"
+#include "sfdb/base/row_encoding.h"
 #include "sfdb/base/typed_ast.h"
+#include "sfdb/engine/batch.h"
 #include "sfdb/engine/engine.h"
 #include "sfdb/flags.h"
+#include "sfdb/raft/batch_mutation.h"
 #include "sfdb/raft/mutation.pb.h"
+#include "sfdb/snapshot/snapshot_file.h"
 #include "sfdb/sql/parser.h"
 #include "util/task/canonical_errors.h"
 
 namespace sfdb {
 
 using ::absl::GetFlag;
+using ::absl::InfiniteDuration;
+using ::absl::InfiniteFuture;
 using ::absl::make_unique;
+using ::absl::Milliseconds;
 using ::absl::SkipEmpty;
 using ::absl::string_view;
 using ::absl::StrCat;
 using ::absl::StrSplit;
+using ::absl::Time;
 using ::google::protobuf::Message;
+using ::raft::AppendedEntry;
 using ::util::Clock;
+using ::util::DataLossError;
 using ::util::InternalError;
 using ::util::OkStatus;
 using ::util::Status;
@@ -55,7 +68,14 @@ RaftInstance::RaftInstance(const std::string &raft_my_target,
                            const std::string &raft_targets, Db *db,
                            grpc::ServerBuilder *server_builder,
                            ::util::Clock *clock)
-    : server_builder_(server_builder), db_(db), clock_(clock) {
+    : server_builder_(server_builder),
+      db_(db),
+      clock_(clock),
+      executor_(make_unique<BatchExecutor>(
+          db, GetFlag(FLAGS_raft_apply_threads))),
+      statements_(make_unique<PreparedStatements>(
+          db, std::max(GetFlag(FLAGS_prepared_statements), 1),
+          std::max(GetFlag(FLAGS_plan_cache_size), 0))) {
   ::raft::Options options;
   options.my_target = raft_my_target;
 
@@ -68,10 +88,27 @@ RaftInstance::RaftInstance(const std::string &raft_my_target,
   }
 
   options.server_builder = server_builder;
-  options.on_append = [this](string_view msg, void *arg) {
-    return OnAppend(msg, arg);
+  options.on_append_batch = [this](std::vector<AppendedEntry> *entries) {
+    OnAppendBatch(entries);
   };
   options.clock = clock_;
+  options.log_dir = GetFlag(FLAGS_raft_log_dir);
+  const std::string fsync = GetFlag(FLAGS_raft_fsync);
+  if (fsync == "always") {
+    options.fsync_policy = ::raft::Options::FSYNC_ALWAYS;
+  } else if (fsync == "never") {
+    options.fsync_policy = ::raft::Options::FSYNC_NEVER;
+  } else {
+    LOG(FATAL) << "Unknown --raft_fsync value: " << fsync;
+  }
+  options.on_snapshot_save = [this](std::string *data) {
+    return SaveSnapshot(data);
+  };
+  options.on_snapshot_load = [this](string_view data) {
+    return LoadSnapshot(data);
+  };
+  options.snapshot_interval_entries =
+      std::max<int64>(GetFlag(FLAGS_raft_snapshot_interval), 0);
   raft_ = make_unique<::raft::Member>(options);
   raft_->Start();
 }
@@ -80,56 +117,250 @@ RaftInstance::~RaftInstance() { raft_->Stop(); }
 
 Status RaftInstance::ExecSql(const ExecSqlRequest &request,
                              ExecSqlResponse *response) {
-  // TODO: treat reads and writes differently.
+  StatusOr<std::unique_ptr<Ast>> ast_so = statements_->Resolve(request);
+  if (!ast_so.ok()) return ast_so.status();
+  std::unique_ptr<Ast> ast = std::move(ast_so.ValueOrDie());
+  if (!ast->IsMutation()) {
+    const Status s = ReadBarrier(request.consistency());
+    if (s.ok()) {
+      response->set_applied_index(raft_->AppliedIndex());
+      return ExecuteReadInto(request, std::move(ast), response);
+    }
+    VLOG(2) << "Sending read through the RAFT log: " << s;
+  }
+  return ExecThroughLog(request, std::move(ast), response);
+}
+
+Status RaftInstance::Prepare(const PrepareRequest &request,
+                             PrepareResponse *response) {
+  return statements_->Prepare(request, response);
+}
+
+Status RaftInstance::ExecSqlBatch(const ExecSqlBatchRequest &request,
+                                  ExecSqlBatchResponse *response) {
   Mutation mut;
   mut.set_time_nanos(ToUnixNanos(clock_->TimeNow()));
-  mut.set_sql(request.sql());
-  std::pair<const ExecSqlRequest *, ExecSqlResponse *> p{&request, response};
-  return raft_->Write(mut.SerializeAsString(), (void *)&p);
+  MakeBatchMutation(request, statements_.get(), &mut, response);
+  // Every statement failed already.
+  if (mut.batch_size() == 0) return OkStatus();
+  uint64 index = 0;
+  Status s = raft_->Write(mut.SerializeAsString(), (void *)response, &index);
+  response->set_applied_index(index);
+  return s;
+}
+
+Status RaftInstance::ExecSqlStream(const ExecSqlRequest &request,
+                                   const ResponseCallback &on_response) {
+  const size_t chunk_rows = RowsPerResponse(request);
+  StatusOr<std::unique_ptr<Ast>> ast_so = statements_->Resolve(request);
+  if (!ast_so.ok()) return ast_so.status();
+  std::unique_ptr<Ast> ast = std::move(ast_so.ValueOrDie());
+
+  ExecSqlResponse response;
+  if (!ast->IsMutation()) {
+    const Status s = ReadBarrier(request.consistency());
+    if (s.ok()) {
+      response.set_applied_index(raft_->AppliedIndex());
+      return StreamRead(request, std::move(ast), chunk_rows, &response,
+                        on_response);
+    }
+    VLOG(2) << "Sending read through the RAFT log: " << s;
+  }
+
+  // Reads that go through the log are applied all at once, so their result
+  // is only split up on the way out.
+  Status s = ExecThroughLog(request, std::move(ast), &response);
+  if (!s.ok()) return s;
+  SplitResponse(chunk_rows, &response, on_response);
+  return OkStatus();
 }
 
-Status RaftInstance::OnAppend(string_view msg, void *arg) {
+Status RaftInstance::StreamRead(const ExecSqlRequest &request,
+                                std::unique_ptr<Ast> ast, size_t chunk_rows,
+                                ExecSqlResponse *first,
+                                const ResponseCallback &on_response) {
+  std::unique_ptr<ProtoPool> tmp_pool = db_->pool->Branch();
+  ExecSqlResponse *response = first;
+  ExecSqlResponse chunk;
+  Status error;
+  Status s = ExecuteReadStream(
+      std::move(ast), tmp_pool.get(), db_, chunk_rows,
+      Milliseconds(std::max(GetFlag(FLAGS_stream_lock_ms), 0)),
+      [&](std::vector<std::unique_ptr<Message>> *rows, Time deadline) {
+        if (response == first) {
+          error = FillSchema(*tmp_pool, *(*rows)[0], response);
+          if (!error.ok()) return false;
+          StripKnownSchema(request, response);
+        }
+        EncodeRows(request.row_encoding(), *rows, response);
+        const bool more = on_response(*response, deadline);
+        response = &chunk;
+        response->Clear();
+        return more;
+      });
+  if (!error.ok()) return error;
+  if (s.CanonicalCode() == ::util::error::CANCELLED) return OkStatus();
+  if (!s.ok()) return s;
+  // Empty results still get a response, for the applied index.
+  if (response == first) on_response(*first, InfiniteFuture());
+  return OkStatus();
+}
+
+Status RaftInstance::ExecThroughLog(const ExecSqlRequest &request,
+                                    std::unique_ptr<Ast> ast,
+                                    ExecSqlResponse *response) {
   Mutation mut;
-  if (!mut.ParseFromString(string(msg))) {
-    LOG(ERROR) << "Massive fail parsing Mutation proto!";
-    return InternalError("oopsie");
+  mut.set_time_nanos(ToUnixNanos(clock_->TimeNow()));
+  Status s = AstToProto(*ast, mut.mutable_ast());
+  if (!s.ok()) return s;
+  if (GetFlag(FLAGS_raft_row_images) && ast->type == Ast::UPDATE) {
+    PlanRowImages(std::move(ast), &mut);
   }
+  std::pair<const ExecSqlRequest *, ExecSqlResponse *> p{&request, response};
+  uint64 index = 0;
+  s = raft_->Write(mut.SerializeAsString(), (void *)&p, &index);
+  response->set_applied_index(index);
+  return s;
+}
 
-  VLOG(2) << "Executing SQL statement @" << mut.time_nanos();
-  StatusOr<std::unique_ptr<Ast>> ast_so = Parse(mut.sql());
-  if (!ast_so.ok()) return ast_so.status();
-  std::unique_ptr<Ast> ast = std::move(ast_so.ValueOrDie());
+void RaftInstance::PlanRowImages(std::unique_ptr<Ast> ast, Mutation *mut) {
+  // Read before planning: if more writes make it into the plan, replicas see
+  // them as applied after |base_index| and run the statement instead.
+  const uint64 base_index = raft_->AppliedIndex();
   std::unique_ptr<ProtoPool> tmp_pool = db_->pool->Branch();
-  if (ast->IsMutation()) {
-    return ExecuteWrite(std::move(ast), tmp_pool.get(), db_);
-  } else {
-    std::vector<std::unique_ptr<Message>> rows;
-    Status s = ExecuteRead(std::move(ast), tmp_pool.get(), db_, &rows);
-    if (!s.ok() || !arg) return s;
-
-    // If this replica is the original recipient of the RPC, respond.
-    auto p = (std::pair<const ExecSqlRequest *, ExecSqlResponse *> *)arg;
-    const ExecSqlRequest &request = *(p->first);
-    ExecSqlResponse *response = p->second;
-
-    if (!rows.empty()) {
-      // Fill metadata info
-      auto file_descriptor = tmp_pool->FindProtoFile(rows[0]->GetDescriptor()->name());
-      if (!file_descriptor)
-        return InternalError("Descriptor not found");
-
-      google::protobuf::FileDescriptorSet* file_desc_set = new google::protobuf::FileDescriptorSet();
-      if (!file_desc_set)
-        return InternalError("Descriptor set not found");
-
-      file_descriptor->CopyTo(file_desc_set->add_file());
-      response->set_allocated_descriptors(file_desc_set);
-      for (size_t i = 0; i < rows.size(); ++i) {
-        response->add_rows()->PackFrom(*rows[i], std::string());
+  const Status s =
+      PlanWrite(std::move(ast), tmp_pool.get(), db_, mut->mutable_row_images());
+  if (!s.ok()) {
+    // Replicas run the statement, and the error surfaces there.
+    VLOG(2) << "Replicating an UPDATE as a statement: " << s;
+    mut->clear_row_images();
+    return;
+  }
+  mut->set_base_index(base_index);
+}
+
+Status RaftInstance::ReadBarrier(const ReadConsistency &consistency) {
+  switch (consistency.level()) {
+    case ReadConsistency::BOUNDED_STALENESS:
+      return raft_->StaleReadBarrier(
+          consistency.has_max_staleness_ms()
+              ? Milliseconds(consistency.max_staleness_ms())
+              : InfiniteDuration(),
+          consistency.has_max_lag_entries()
+              ? std::max<int64>(consistency.max_lag_entries(), 0)
+              : std::numeric_limits<uint64>::max());
+    case ReadConsistency::READ_YOUR_WRITES:
+      return raft_->AppliedBarrier(
+          consistency.min_applied_index(),
+          Milliseconds(GetFlag(FLAGS_follower_read_wait_ms)));
+    default:
+      return raft_->ReadBarrier();
+  }
+}
+
+Status RaftInstance::SaveSnapshot(std::string *data) {
+  EncodeDbSnapshot(*db_, SnapshotFileOptions(), data);
+  return OkStatus();
+}
+
+Status RaftInstance::LoadSnapshot(string_view data) {
+  // The next OnAppendBatch() finds out where the snapshot ends.
+  last_write_index_ = std::numeric_limits<uint64>::max();
+  return DecodeDbSnapshot(data, SnapshotFileOptions(), db_);
+}
+
+void RaftInstance::OnAppendBatch(std::vector<AppendedEntry> *entries) {
+  // The row images in |writes| point into |muts|.
+  std::vector<Mutation> muts(entries->size());
+  std::vector<BatchedWrite> writes;
+  std::vector<AppendedEntry *> writers;
+  auto flush = [&]() {
+    executor_->Execute(&writes);
+    for (size_t i = 0; i < writes.size(); ++i) {
+      writers[i]->status = writes[i].status;
+    }
+    writes.clear();
+    writers.clear();
+  };
+
+  for (size_t i = 0; i < entries->size(); ++i) {
+    AppendedEntry &e = (*entries)[i];
+    Mutation &mut = muts[i];
+    if (!mut.ParseFromString(string(e.msg))) {
+      LOG(ERROR) << "Massive fail parsing Mutation proto!";
+      e.status = InternalError("oopsie");
+      continue;
+    }
+    if (last_write_index_ > e.index) last_write_index_ = e.index - 1;
+
+    if (mut.batch_size() > 0) {
+      last_write_index_ = e.index;
+      flush();
+      std::vector<BatchedWrite> batch;
+      e.status = DecodeBatchMutation(mut, &batch);
+      if (!e.status.ok()) continue;
+      executor_->Execute(&batch);
+      if (e.arg) SetBatchResults(batch, (ExecSqlBatchResponse *)e.arg);
+      continue;
+    }
+
+    BatchedWrite w;
+    if (mut.has_row_images()) {
+      // The images are only valid against the state they were planned on.
+      const bool fresh = mut.base_index() >= last_write_index_;
+      last_write_index_ = e.index;
+      if (fresh) {
+        VLOG(2) << "Applying " << mut.row_images().row_size()
+                << " row images @" << mut.time_nanos();
+        w.row_images = &mut.row_images();
+        writes.push_back(std::move(w));
+        writers.push_back(&e);
+        continue;
       }
     }
-    return OkStatus();
+
+    VLOG(2) << "Executing SQL statement @" << mut.time_nanos();
+    StatusOr<std::unique_ptr<Ast>> ast_so =
+        mut.has_ast() ? AstFromProto(mut.ast()) : Parse(mut.sql());
+    if (!ast_so.ok()) {
+      e.status = ast_so.status();
+      continue;
+    }
+    std::unique_ptr<Ast> ast = std::move(ast_so.ValueOrDie());
+    if (ast->IsMutation()) {
+      last_write_index_ = e.index;
+      w.ast = std::move(ast);
+      writes.push_back(std::move(w));
+      writers.push_back(&e);
+      continue;
+    }
+
+    // Reads only need to run on the replica that is the original recipient of
+    // the RPC; they don't change the state of the others. They see the writes
+    // before them, and none after.
+    if (!e.arg) continue;
+    flush();
+    auto p = (std::pair<const ExecSqlRequest *, ExecSqlResponse *> *)e.arg;
+    e.status = ExecuteReadInto(*p->first, std::move(ast), p->second);
+  }
+  flush();
+}
+
+Status RaftInstance::ExecuteReadInto(const ExecSqlRequest &request,
+                                     std::unique_ptr<Ast> ast,
+                                     ExecSqlResponse *response) {
+  std::unique_ptr<ProtoPool> tmp_pool = db_->pool->Branch();
+  std::vector<std::unique_ptr<Message>> rows;
+  Status s = ExecuteRead(std::move(ast), tmp_pool.get(), db_, &rows);
+  if (!s.ok()) return s;
+
+  if (!rows.empty()) {
+    s = FillSchema(*tmp_pool, *rows[0], response);
+    if (!s.ok()) return s;
+    StripKnownSchema(request, response);
+    EncodeRows(request.row_encoding(), rows, response);
   }
+  return OkStatus();
 }
 
 }  // namespace sfdb
@@ -22,16 +22,24 @@
 #ifndef SFDB_RAFT_INSTANCE_H_
 #define SFDB_RAFT_INSTANCE_H_
 
+#include <memory>
+#include <vector>
+
 #include "absl/strings/string_view.h"
 #include "raft/raft.h"
 #include "sfdb/api.pb.h"
+#include "sfdb/base/ast.h"
 #include "sfdb/base/db.h"
 #include "sfdb/base/replicated_db.h"
+#include "sfdb/engine/batch.h"
+#include "sfdb/engine/prepared_statements.h"
 #include "util/task/status.h"
 #include "util/time/clock.h"
 
 namespace sfdb {
 
+class Mutation;
+
 // An instance of RAFT that wraps a Db object.
 //
 // Thread-safe.
@@ -46,16 +54,77 @@ public:
   RaftInstance &operator=(const RaftInstance &) = delete;
 
   // Executes a SQL statement on the leader. Blocking.
+  //
+  // Reads are served from local state when this replica is up to date enough
+  // for the requested consistency: strong reads only on a leader that can
+  // confirm its leadership, weaker ones on followers as well. Other reads go
+  // through the RAFT log.
   ::util::Status ExecSql(const ExecSqlRequest &request,
                          ExecSqlResponse *response);
 
+  // Same as ExecSql(), but reads served from local state are streamed to
+  // |on_response| as they are produced.
+  ::util::Status ExecSqlStream(const ExecSqlRequest &request,
+                               const ResponseCallback &on_response);
+
+  ::util::Status Prepare(const PrepareRequest &request,
+                         PrepareResponse *response);
+
+  // Sends the writes of |request| through the RAFT log as one entry, and
+  // fills |response| with their results once it has been applied here.
+  ::util::Status ExecSqlBatch(const ExecSqlBatchRequest &request,
+                              ExecSqlBatchResponse *response);
+
 private:
-  ::util::Status OnAppend(absl::string_view msg, void *arg);
+  // Applies committed entries in log order. Writes go through executor_, so
+  // that those to different tables run concurrently. Batches are applied on
+  // their own.
+  void OnAppendBatch(std::vector<::raft::AppendedEntry> *entries);
+
+  // Runs an UPDATE against db_ without changing it, and stores the rows it
+  // changes in |mut|, so that replicas don't have to run it. Leaves |mut|
+  // alone if that fails.
+  void PlanRowImages(std::unique_ptr<Ast> ast, Mutation *mut);
+
+  // Serializes db_ into |data|, and replaces db_ with such a serialization.
+  ::util::Status SaveSnapshot(std::string *data);
+  ::util::Status LoadSnapshot(absl::string_view data);
+
+  // Blocks until this replica may serve a read with |consistency| from its
+  // local state. On failure, the read has to go through the RAFT log.
+  ::util::Status ReadBarrier(const ReadConsistency &consistency);
+
+  // Sends |ast| through the RAFT log, and fills |response| with its result
+  // once it has been applied here.
+  ::util::Status ExecThroughLog(const ExecSqlRequest &request,
+                                std::unique_ptr<Ast> ast,
+                                ExecSqlResponse *response);
+
+  // Runs a read-only statement against db_ and fills |response| with its
+  // result, for |request|.
+  ::util::Status ExecuteReadInto(const ExecSqlRequest &request,
+                                 std::unique_ptr<Ast> ast,
+                                 ExecSqlResponse *response);
+
+  // Runs a read-only statement against db_ and passes its rows to
+  // |on_response|, |chunk_rows| at a time. The first response is |first|,
+  // which goes out even if there are no rows.
+  ::util::Status StreamRead(const ExecSqlRequest &request,
+                            std::unique_ptr<Ast> ast, size_t chunk_rows,
+                            ExecSqlResponse *first,
+                            const ResponseCallback &on_response);
 
   grpc::ServerBuilder *server_builder_;
   Db *const db_;
   ::util::Clock *const clock_;
+  std::unique_ptr<BatchExecutor> executor_;
+  std::unique_ptr<PreparedStatements> statements_;
   std::unique_ptr<::raft::Member> raft_;
+
+  // The log index of the last applied entry that may have changed db_. Only
+  // touched by OnAppendBatch() and LoadSnapshot(), which RAFT runs on one
+  // thread.
+  uint64 last_write_index_ = 0;
 };
 
 } // namespace sfdb
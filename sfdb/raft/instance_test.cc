@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/raft/instance.h"
+
+#include <memory>
+#include <string>
+
+#include "absl/flags/flag.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "grpcpp/grpcpp.h"
+#include "sfdb/api.pb.h"
+#include "sfdb/base/db.h"
+#include "sfdb/base/vars.h"
+#include "sfdb/flags.h"
+#include "util/net/port.h"
+#include "util/task/status.h"
+#include "util/task/status_matchers.h"
+#include "util/time/clock.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace sfdb {
+namespace {
+
+// Runs a single-member cluster, which elects itself.
+class RaftInstanceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    const std::string target =
+        absl::StrFormat("127.0.0.1:%d", PickUpFreeLocalPort());
+    builder_.AddListeningPort(target, ::grpc::InsecureServerCredentials());
+    instance_ = absl::make_unique<RaftInstance>(
+        target, target, &db_, &builder_, ::util::Clock::RealClock());
+    server_ = builder_.BuildAndStart();
+  }
+
+  void TearDown() override {
+    server_->Shutdown(absl::ToChronoTime(absl::Now()));
+    instance_.reset();
+  }
+
+  ::util::Status Exec(const std::string &sql,
+                      const ReadConsistency &consistency,
+                      ExecSqlResponse *response) {
+    ExecSqlRequest request;
+    request.set_sql(sql);
+    *request.mutable_consistency() = consistency;
+    response->Clear();
+    return instance_->ExecSql(request, response);
+  }
+
+  BuiltIns vars_;
+  Db db_{"Test", &vars_};
+  ::grpc::ServerBuilder builder_;
+  std::unique_ptr<RaftInstance> instance_;
+  std::unique_ptr<::grpc::Server> server_;
+};
+
+TEST_F(RaftInstanceTest, ReadsThroughTheLogWhenNotCaughtUp) {
+  absl::SetFlag(&FLAGS_follower_read_wait_ms, 100);
+  ReadConsistency consistency;
+  ExecSqlResponse response;
+  ASSERT_OK(Exec("CREATE TABLE T (a int64);", consistency, &response));
+  ASSERT_OK(Exec("INSERT INTO T (a) VALUES (1);", consistency, &response));
+  const uint64 written = response.applied_index();
+  ASSERT_GT(written, 0);
+
+  // The write has been applied, so the read is served locally.
+  consistency.set_level(ReadConsistency::READ_YOUR_WRITES);
+  consistency.set_min_applied_index(written);
+  ASSERT_OK(Exec("SELECT a FROM T;", consistency, &response));
+  EXPECT_EQ(1, response.rows_size());
+  EXPECT_EQ(written, response.applied_index());
+
+  // Nothing has been applied at a later index. After waiting for up to
+  // --follower_read_wait_ms, the read goes through the log, which creates
+  // that index.
+  consistency.set_min_applied_index(written + 1);
+  const absl::Time start = absl::Now();
+  ASSERT_OK(Exec("SELECT a FROM T;", consistency, &response));
+  EXPECT_GE(absl::Now() - start, absl::Milliseconds(100));
+  EXPECT_EQ(1, response.rows_size());
+  EXPECT_EQ(written + 1, response.applied_index());
+}
+
+}  // namespace
+}  // namespace sfdb
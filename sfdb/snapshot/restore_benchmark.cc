@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+// Times restoring a large Db from a snapshot file.
+// Run with:
+//   bazel test -c opt //sfdb/snapshot:restore_benchmark --test_output=all
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include "absl/flags/flag.h"
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "glog/logging.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+#include "sfdb/base/vars.h"
+#include "sfdb/engine/engine.h"
+#include "sfdb/proto/pool.h"
+#include "sfdb/snapshot/snapshot_file.h"
+#include "sfdb/sql/parser.h"
+#include "util/task/status_matchers.h"
+#include "gtest/gtest.h"
+
+ABSL_FLAG(int32, restore_benchmark_rows, 10000000,
+          "Rows in the database the benchmark restores.");
+
+namespace sfdb {
+namespace {
+
+using ::absl::GetFlag;
+using ::absl::Now;
+using ::absl::StrFormat;
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::Message;
+using ::google::protobuf::Reflection;
+
+class RestoreBenchmark : public ::testing::Test {
+ protected:
+  RestoreBenchmark() : db_("Test", &vars_), other_db_("Other", &vars_) {}
+
+  void SetUp() override {
+    std::vector<std::unique_ptr<Message>> rows;
+    ASSERT_OK(Execute(
+        Parse("CREATE TABLE People (id int64, name string, age int64);")
+            .ValueOrDie(),
+        &pool_, &db_, &rows));
+    const int n = GetFlag(FLAGS_restore_benchmark_rows);
+    ::absl::WriterMutexLock lock(&db_.mu);
+    Table *t = db_.FindTable("People");
+    const Descriptor *d = t->type;
+    for (int i = 0; i < n; ++i) {
+      std::unique_ptr<Message> row = t->pool->NewMessage(d);
+      const Reflection *r = row->GetReflection();
+      r->SetInt64(row.get(), d->FindFieldByName("id"), i);
+      r->SetString(row.get(), d->FindFieldByName("name"),
+                   StrFormat("Bob_%d", i * 7919LL % n));
+      r->SetInt64(row.get(), d->FindFieldByName("age"), i % 97);
+      t->rows.push_back(std::move(row));
+    }
+    db_.PutIndex(t, "ByName", {d->FindFieldByName("name")});
+    db_.PutIndex(t, "ByAge", {d->FindFieldByName("age"),
+                              d->FindFieldByName("id")});
+  }
+
+  void ExpectRestored() {
+    ::absl::ReaderMutexLock lock(&other_db_.mu);
+    const Table *t = other_db_.FindTable("People");
+    ASSERT_TRUE(t);
+    EXPECT_EQ(GetFlag(FLAGS_restore_benchmark_rows), t->rows.size());
+    EXPECT_EQ(t->rows.size(), other_db_.FindIndex("ByName")->tree.size());
+    EXPECT_EQ(t->rows.size(), other_db_.FindIndex("ByAge")->tree.size());
+  }
+
+  ProtoPool pool_;
+  BuiltIns vars_;
+  Db db_;
+  Db other_db_;
+};
+
+TEST_F(RestoreBenchmark, SnapshotFile) {
+  absl::Time start = Now();
+  std::string data;
+  EncodeDbSnapshot(db_, SnapshotFileOptions(), &data);
+  LOG(INFO) << "Encoded " << data.size() << " bytes in " << Now() - start;
+
+  // Restore from a file whose pages have been dropped from the page cache,
+  // as after a restart, so that reading it in is part of the time.
+  const std::string path = ::testing::TempDir() + "/restore_benchmark";
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ASSERT_GE(fd, 0);
+  for (size_t done = 0; done < data.size();) {
+    const ssize_t n = write(fd, data.data() + done, data.size() - done);
+    ASSERT_GT(n, 0);
+    done += n;
+  }
+  ASSERT_EQ(0, fsync(fd));
+  ASSERT_EQ(0, posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED));
+  ASSERT_EQ(0, close(fd));
+  std::string().swap(data);
+
+  start = Now();
+  ASSERT_OK(ReadDbSnapshotFile(path, SnapshotFileOptions(), &other_db_));
+  LOG(INFO) << "Restored from " << path << " in " << Now() - start;
+  ExpectRestored();
+  unlink(path.c_str());
+}
+
+}  // namespace
+}  // namespace sfdb
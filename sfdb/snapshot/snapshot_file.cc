@@ -0,0 +1,483 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/snapshot/snapshot_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "glog/logging.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/message.h"
+#include "sfdb/proto/pool.h"
+#include "sfdb/snapshot/snapshot.pb.h"
+#include "util/hash/crc32c.h"
+#include "util/task/canonical_errors.h"
+#include "util/task/statusor.h"
+#include "util/types/integral_types.h"
+
+namespace sfdb {
+namespace {
+
+using ::absl::make_unique;
+using ::absl::StrCat;
+using ::absl::string_view;
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::FieldDescriptor;
+using ::google::protobuf::FileDescriptorProto;
+using ::google::protobuf::Message;
+using ::google::protobuf::io::CodedInputStream;
+using ::google::protobuf::io::CodedOutputStream;
+using ::util::Crc32c;
+using ::util::DataLossError;
+using ::util::InternalError;
+using ::util::InvalidArgumentError;
+using ::util::OkStatus;
+using ::util::Status;
+using ::util::StatusOr;
+
+constexpr char kMagic[] = "SFDBSNP1";
+constexpr size_t kMagicSize = 8;
+constexpr size_t kPreambleSize = kMagicSize + 8 + 4;
+
+void PutVarint(uint64 v, std::string *out) {
+  while (v >= 0x80) {
+    out->push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  out->push_back(static_cast<char>(v));
+}
+
+// Consumes a varint from the front of |in|. Returns false if there is none.
+bool GetVarint(string_view *in, uint64 *v) {
+  *v = 0;
+  for (int shift = 0; shift < 64 && !in->empty(); shift += 7) {
+    const uint8 b = static_cast<uint8>(in->front());
+    in->remove_prefix(1);
+    *v |= static_cast<uint64>(b & 0x7f) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+int NumThreads(const SnapshotFileOptions &options) {
+  if (options.threads > 0) return options.threads;
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Calls fn(0), ..., fn(n - 1) from up to |threads| threads.
+void ParallelFor(int n, int threads, const std::function<void(int)> &fn) {
+  threads = std::min(threads, n);
+  if (threads <= 1) {
+    for (int i = 0; i < n; ++i) fn(i);
+    return;
+  }
+  std::atomic<int> next(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&] {
+      for (int i = next++; i < n; i = next++) fn(i);
+    });
+  }
+  for (std::thread &worker : workers) worker.join();
+}
+
+// A block being captured: either the rows [begin, end) of |table|, or the
+// run of |index|.
+struct CaptureJob {
+  const Table *table;
+  size_t begin;
+  size_t end;
+  const TableIndex *index;
+  SnapshotFileHeader::Block *block;
+  std::string *bytes;
+};
+
+// A table being decoded, before it is put into the Db.
+struct DecodedTable {
+  std::unique_ptr<ProtoPool> pool;
+  const Descriptor *type;
+  std::unique_ptr<Message> prototype;
+  std::vector<std::unique_ptr<Message>> rows;
+};
+
+// An index being decoded.
+struct DecodedIndex {
+  int table;
+  std::vector<const FieldDescriptor*> columns;
+  std::vector<int> order;  // Row positions, in index order.
+};
+
+// Returns the bytes of |block| within |data|, once they check out.
+StatusOr<string_view> BlockBytes(string_view data,
+                                 const SnapshotFileHeader::Block &block) {
+  if (block.offset() > data.size() ||
+      block.size() > data.size() - block.offset()) {
+    return DataLossError("Snapshot block is out of bounds");
+  }
+  const string_view bytes = data.substr(block.offset(), block.size());
+  if (Crc32c(bytes) != block.crc32c()) {
+    return DataLossError("Snapshot block checksum mismatch");
+  }
+  return bytes;
+}
+
+Status DecodeRows(string_view data, const SnapshotFileHeader::Block &block,
+                  const Message &prototype,
+                  std::unique_ptr<Message> *rows) {
+  StatusOr<string_view> so = BlockBytes(data, block);
+  if (!so.ok()) return so.status();
+  string_view bytes = so.ValueOrDie();
+  for (uint64 i = 0; i < block.count(); ++i) {
+    uint64 size;
+    if (!GetVarint(&bytes, &size) || size > bytes.size()) {
+      return DataLossError("Truncated row in snapshot block");
+    }
+    rows[i].reset(prototype.New());
+    if (!rows[i]->ParseFromArray(bytes.data(), size)) {
+      return DataLossError("Corrupt row in snapshot block");
+    }
+    bytes.remove_prefix(size);
+  }
+  if (!bytes.empty()) return DataLossError("Extra bytes in snapshot block");
+  return OkStatus();
+}
+
+Status DecodeRun(string_view data, const SnapshotFileHeader::Block &run,
+                 std::vector<int> *order) {
+  StatusOr<string_view> so = BlockBytes(data, run);
+  if (!so.ok()) return so.status();
+  string_view bytes = so.ValueOrDie();
+  std::vector<bool> seen(order->size());
+  for (size_t i = 0; i < order->size(); ++i) {
+    uint64 pos;
+    if (!GetVarint(&bytes, &pos) || pos >= seen.size() || seen[pos]) {
+      return DataLossError("Corrupt index run in snapshot");
+    }
+    seen[pos] = true;
+    (*order)[i] = pos;
+  }
+  if (!bytes.empty()) return DataLossError("Extra bytes in index run");
+  return OkStatus();
+}
+
+}  // namespace
+
+void CaptureDb(const Db &db, const SnapshotFileOptions &options,
+               DbCapture *capture) {
+  CHECK_GT(options.rows_per_block, 0);
+  SnapshotFileHeader *header = &capture->header;
+  header->Clear();
+  capture->blocks.clear();
+  std::vector<CaptureJob> jobs;
+  ::absl::ReaderMutexLock lock(&db.mu);
+  for (const auto &i : db.tables) {
+    const Table &t = *i.second;
+    SnapshotFileHeader::Table *table = header->add_table();
+    table->set_name(t.name);
+    table->set_schema(header->schemas().file_size());
+    t.type->file()->CopyTo(header->mutable_schemas()->add_file());
+    for (size_t begin = 0; begin < t.rows.size();
+         begin += options.rows_per_block) {
+      const size_t end =
+          std::min(t.rows.size(), begin + options.rows_per_block);
+      jobs.push_back({&t, begin, end, nullptr, table->add_block(), nullptr});
+    }
+  }
+  for (const auto &i : db.table_indices) {
+    const TableIndex &ti = *i.second;
+    SnapshotFileHeader::Index *index = header->add_index();
+    index->set_name(ti.name);
+    index->set_table_name(ti.t->name);
+    for (const FieldDescriptor *fd : ti.columns) {
+      index->add_column(fd->name());
+    }
+    jobs.push_back({ti.t, 0, 0, &ti, index->mutable_run(), nullptr});
+  }
+  capture->blocks.resize(jobs.size());
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    jobs[i].bytes = &capture->blocks[i];
+  }
+
+  ParallelFor(jobs.size(), NumThreads(options), [&jobs](int i) {
+    CaptureJob &job = jobs[i];
+    if (job.index) {
+      for (const auto &entry : job.index->tree) {
+        PutVarint(entry.second, job.bytes);
+      }
+      job.block->set_count(job.index->tree.size());
+    } else {
+      std::string row;
+      for (size_t r = job.begin; r < job.end; ++r) {
+        job.table->rows[r]->SerializeToString(&row);
+        PutVarint(row.size(), job.bytes);
+        job.bytes->append(row);
+      }
+      job.block->set_count(job.end - job.begin);
+    }
+  });
+}
+
+void EncodeDbCapture(const SnapshotFileOptions &options, DbCapture *capture,
+                     std::string *data) {
+  SnapshotFileHeader *header = &capture->header;
+  std::vector<SnapshotFileHeader::Block*> blocks;
+  for (SnapshotFileHeader::Table &table : *header->mutable_table()) {
+    for (SnapshotFileHeader::Block &block : *table.mutable_block()) {
+      blocks.push_back(&block);
+    }
+  }
+  for (SnapshotFileHeader::Index &index : *header->mutable_index()) {
+    blocks.push_back(index.mutable_run());
+  }
+  CHECK_EQ(blocks.size(), capture->blocks.size());
+
+  const std::vector<std::string> &bytes = capture->blocks;
+  ParallelFor(blocks.size(), NumThreads(options), [&blocks, &bytes](int i) {
+    blocks[i]->set_size(bytes[i].size());
+    blocks[i]->set_crc32c(Crc32c(bytes[i]));
+  });
+  uint64 offset = 0;
+  for (SnapshotFileHeader::Block *block : blocks) {
+    block->set_offset(offset);
+    offset += block->size();
+  }
+  const std::string header_bytes = header->SerializeAsString();
+  uint8 preamble[kPreambleSize];
+  memcpy(preamble, kMagic, kMagicSize);
+  CodedOutputStream::WriteLittleEndian64ToArray(header_bytes.size(),
+                                                preamble + kMagicSize);
+  CodedOutputStream::WriteLittleEndian32ToArray(Crc32c(header_bytes),
+                                                preamble + kMagicSize + 8);
+
+  data->clear();
+  data->reserve(kPreambleSize + header_bytes.size() + offset);
+  data->append(reinterpret_cast<const char*>(preamble), kPreambleSize);
+  data->append(header_bytes);
+  for (std::string &block : capture->blocks) {
+    data->append(block);
+    std::string().swap(block);
+  }
+  capture->blocks.clear();
+  header->Clear();
+}
+
+void EncodeDbSnapshot(const Db &db, const SnapshotFileOptions &options,
+                      std::string *data) {
+  DbCapture capture;
+  CaptureDb(db, options, &capture);
+  EncodeDbCapture(options, &capture, data);
+}
+
+Status DecodeDbSnapshot(string_view data, const SnapshotFileOptions &options,
+                        Db *db) {
+  if (data.size() < kPreambleSize ||
+      data.substr(0, kMagicSize) != string_view(kMagic, kMagicSize)) {
+    return DataLossError("Not a snapshot file");
+  }
+  const uint8 *preamble = reinterpret_cast<const uint8*>(data.data());
+  ::google::protobuf::uint64 header_size;
+  ::google::protobuf::uint32 header_crc;
+  CodedInputStream::ReadLittleEndian64FromArray(preamble + kMagicSize,
+                                                &header_size);
+  CodedInputStream::ReadLittleEndian32FromArray(preamble + kMagicSize + 8,
+                                                &header_crc);
+  data.remove_prefix(kPreambleSize);
+  if (header_size > data.size()) {
+    return DataLossError("Truncated snapshot header");
+  }
+  const string_view header_bytes = data.substr(0, header_size);
+  SnapshotFileHeader header;
+  if (Crc32c(header_bytes) != header_crc ||
+      !header.ParseFromArray(header_bytes.data(), header_bytes.size())) {
+    return DataLossError("Corrupt snapshot header");
+  }
+  data.remove_prefix(header_size);
+
+  // Check the header and create the row types first, so that a bad snapshot
+  // is caught before any real work.
+  std::vector<DecodedTable> tables(header.table_size());
+  std::map<std::string, int> table_by_name;
+  std::vector<std::function<Status()>> jobs;
+  for (int i = 0; i < header.table_size(); ++i) {
+    const SnapshotFileHeader::Table &table = header.table(i);
+    if (!table_by_name.emplace(table.name(), i).second) {
+      return InvalidArgumentError(
+          StrCat("Duplicate table ", table.name(), " in snapshot"));
+    }
+    if (table.schema() < 0 || table.schema() >= header.schemas().file_size()) {
+      return DataLossError(
+          StrCat("Snapshot of table ", table.name(), " has no schema"));
+    }
+    DecodedTable &t = tables[i];
+    t.pool = db->pool->Branch();
+    StatusOr<const Descriptor*> so = t.pool->CreateProtoClass(
+        make_unique<FileDescriptorProto>(
+            header.schemas().file(table.schema())));
+    if (!so.ok()) return so.status();
+    t.type = so.ValueOrDie();
+    t.prototype = t.pool->NewMessage(t.type);
+
+    uint64 num_rows = 0;
+    for (const SnapshotFileHeader::Block &block : table.block()) {
+      num_rows += block.count();
+    }
+    if (num_rows > static_cast<uint64>(std::numeric_limits<int>::max())) {
+      return DataLossError(
+          StrCat("Snapshot of table ", table.name(), " has too many rows"));
+    }
+    t.rows.resize(num_rows);
+    std::unique_ptr<Message> *rows = t.rows.data();
+    for (const SnapshotFileHeader::Block &block : table.block()) {
+      const Message *prototype = t.prototype.get();
+      jobs.push_back([data, &block, prototype, rows] {
+        return DecodeRows(data, block, *prototype, rows);
+      });
+      rows += block.count();
+    }
+  }
+
+  std::vector<DecodedIndex> indices(header.index_size());
+  std::set<std::string> index_names;
+  for (int i = 0; i < header.index_size(); ++i) {
+    const SnapshotFileHeader::Index &index = header.index(i);
+    if (!index_names.insert(index.name()).second) {
+      return InvalidArgumentError(
+          StrCat("Duplicate index ", index.name(), " in snapshot"));
+    }
+    auto t = table_by_name.find(index.table_name());
+    if (t == table_by_name.end()) {
+      return InvalidArgumentError(
+          StrCat("Snapshot of index ", index.name(),
+                 " refers to missing table ", index.table_name()));
+    }
+    DecodedIndex &ti = indices[i];
+    ti.table = t->second;
+    for (const std::string &column : index.column()) {
+      const FieldDescriptor *fd =
+          tables[ti.table].type->FindFieldByName(column);
+      if (!fd) {
+        return InvalidArgumentError(
+            StrCat("Snapshot of index ", index.name(),
+                   " refers to missing column ", column));
+      }
+      ti.columns.push_back(fd);
+    }
+    if (index.run().count() != tables[ti.table].rows.size()) {
+      return DataLossError(
+          StrCat("Snapshot of index ", index.name(), " misses rows"));
+    }
+    ti.order.resize(index.run().count());
+    std::vector<int> *order = &ti.order;
+    jobs.push_back([data, &index, order] {
+      return DecodeRun(data, index.run(), order);
+    });
+  }
+
+  std::vector<Status> statuses(jobs.size());
+  ParallelFor(jobs.size(), NumThreads(options),
+              [&jobs, &statuses](int i) { statuses[i] = jobs[i](); });
+  for (const Status &s : statuses) {
+    if (!s.ok()) return s;
+  }
+
+  ::absl::WriterMutexLock lock(&db->mu);
+  while (!db->tables.empty()) db->DropTable(db->tables.begin()->first);
+  std::vector<Table*> new_tables;
+  for (int i = 0; i < header.table_size(); ++i) {
+    DecodedTable &t = tables[i];
+    new_tables.push_back(
+        db->PutTable(header.table(i).name(), std::move(t.pool), t.type));
+  }
+  // The indices are put in while their tables are still empty, so that
+  // PutIndex() has nothing to sort. The runs are in index order already, so
+  // each row goes in at the end of its tree.
+  std::vector<TableIndex*> new_indices;
+  for (int i = 0; i < header.index_size(); ++i) {
+    new_indices.push_back(db->PutIndex(new_tables[indices[i].table],
+                                       header.index(i).name(),
+                                       std::move(indices[i].columns)));
+  }
+  for (size_t i = 0; i < tables.size(); ++i) {
+    new_tables[i]->rows = std::move(tables[i].rows);
+  }
+  ParallelFor(indices.size(), NumThreads(options), [&](int i) {
+    TableIndex *index = new_indices[i];
+    const auto &rows = index->t->rows;
+    for (int pos : indices[i].order) {
+      index->tree.insert(index->tree.end(), {rows[pos].get(), pos});
+    }
+  });
+  return OkStatus();
+}
+
+Status ReadDbSnapshotFile(const std::string &path,
+                          const SnapshotFileOptions &options, Db *db) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return InternalError(
+        StrCat("Failed to open ", path, ": ", strerror(errno)));
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    const Status s =
+        InternalError(StrCat("Failed to stat ", path, ": ", strerror(errno)));
+    close(fd);
+    return s;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return DataLossError(StrCat("Empty snapshot file ", path));
+  }
+  void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return InternalError(StrCat("Failed to map ", path, ": ", strerror(errno)));
+  }
+  // Blocks are decoded in parallel, in no particular order.
+  madvise(addr, st.st_size, MADV_WILLNEED);
+  const Status s = DecodeDbSnapshot(
+      string_view(static_cast<const char*>(addr), st.st_size), options, db);
+  munmap(addr, st.st_size);
+  return s;
+}
+
+}  // namespace sfdb
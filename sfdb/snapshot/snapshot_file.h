@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#ifndef SFDB_SNAPSHOT_SNAPSHOT_FILE_H_
+#define SFDB_SNAPSHOT_SNAPSHOT_FILE_H_
+
+// A binary snapshot format that restores quickly.
+//
+// Layout:
+//   "SFDBSNP1"                   8-byte magic
+//   header size                  fixed64, little-endian
+//   header CRC-32C               fixed32, little-endian
+//   SnapshotFileHeader           serialized
+//   data                         row blocks and index runs
+//
+// The header lists every block with its offset, size and checksum, so blocks
+// can be checked and decoded independently and in parallel. Index runs hold
+// row positions already in index order, so indices are rebuilt without
+// comparing rows against each other.
+
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "sfdb/base/db.h"
+#include "sfdb/snapshot/snapshot.pb.h"
+#include "util/task/status.h"
+
+namespace sfdb {
+
+struct SnapshotFileOptions {
+  // Rows per row block. Blocks are the unit of parallelism.
+  int rows_per_block = 4096;
+
+  // Threads that encode or decode blocks. 0 uses one per CPU.
+  int threads = 0;
+};
+
+// The tables, rows and indices of a Db at one point in time, serialized but
+// not yet put together into a snapshot.
+struct DbCapture {
+  // Has the counts of the blocks, but not their offsets, sizes or checksums.
+  SnapshotFileHeader header;
+
+  // The bytes of every row block in the order of the header's tables, then
+  // of every index run in the order of its indices.
+  std::vector<std::string> blocks;
+};
+
+// Serializes the tables, rows and indices of |db| into |capture|. Locks
+// db->mu for reading.
+//
+// Rows have to be serialized under the lock, since the row types go away with
+// their table. Everything else is left to EncodeDbCapture().
+void CaptureDb(const Db &db, const SnapshotFileOptions &options,
+               DbCapture *capture);
+
+// Puts |capture| together into a snapshot in |data|, computing the checksums.
+// Takes no locks, and leaves |capture| empty.
+void EncodeDbCapture(const SnapshotFileOptions &options, DbCapture *capture,
+                     std::string *data);
+
+// Encodes the tables, rows and indices of |db| into |data|.
+// Locks db->mu for reading. Same as CaptureDb() and then EncodeDbCapture().
+void EncodeDbSnapshot(const Db &db, const SnapshotFileOptions &options,
+                      std::string *data);
+
+// Replaces the tables, rows and indices of |db| with those encoded in |data|.
+// Locks db->mu for writing, but only once |data| has been fully decoded and
+// checked. Leaves |db| untouched if |data| is invalid or corrupt.
+::util::Status DecodeDbSnapshot(::absl::string_view data,
+                                const SnapshotFileOptions &options, Db *db);
+
+// Like DecodeDbSnapshot(), but maps the file at |path| into memory instead of
+// reading it.
+::util::Status ReadDbSnapshotFile(const std::string &path,
+                                  const SnapshotFileOptions &options, Db *db);
+
+}  // namespace sfdb
+
+#endif  // SFDB_SNAPSHOT_SNAPSHOT_FILE_H_
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "sfdb/snapshot/snapshot_file.h"
+
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "google/protobuf/message.h"
+#include "sfdb/base/vars.h"
+#include "sfdb/engine/engine.h"
+#include "sfdb/proto/pool.h"
+#include "sfdb/sql/parser.h"
+#include "util/task/status.h"
+#include "util/task/status_matchers.h"
+#include "gtest/gtest.h"
+
+namespace sfdb {
+namespace {
+
+using ::google::protobuf::Message;
+
+class SnapshotFileTest : public ::testing::Test {
+ protected:
+  SnapshotFileTest() : db_("Test", &vars_), other_db_("Other", &vars_) {
+    // One row per block, to exercise the parallel paths.
+    options_.rows_per_block = 1;
+    options_.threads = 4;
+  }
+
+  ::util::Status Exec(const char *sql, Db *db) {
+    rows_.clear();
+    return Execute(Parse(sql).ValueOrDie(), &pool_, db, &rows_);
+  }
+
+  void Populate() {
+    ASSERT_OK(Exec("CREATE TABLE People (name string, age int64);", &db_));
+    ASSERT_OK(Exec("INSERT INTO People (name, age) VALUES ('joe', 13);", &db_));
+    ASSERT_OK(Exec("INSERT INTO People (name, age) VALUES ('bob', 16);", &db_));
+    ASSERT_OK(Exec("INSERT INTO People (name, age) VALUES ('ann', 7);", &db_));
+    ASSERT_OK(Exec("CREATE INDEX ByAge ON People (age);", &db_));
+    ASSERT_OK(Exec("CREATE INDEX ByName ON People (name);", &db_));
+    ASSERT_OK(Exec("CREATE TABLE Empty (x double);", &db_));
+    ASSERT_OK(Exec("CREATE TABLE Stale (y int64);", &other_db_));
+  }
+
+  // Returns the rows of |index_name| in |db|, in index order.
+  std::vector<std::string> IndexOrder(const Db &db,
+                                      const std::string &index_name) {
+    ::absl::ReaderMutexLock lock(&db.mu);
+    std::vector<std::string> order;
+    const TableIndex *index = db.FindIndex(index_name);
+    if (!index) return order;
+    for (const auto &entry : index->tree) {
+      order.push_back(entry.first->ShortDebugString());
+    }
+    return order;
+  }
+
+  SnapshotFileOptions options_;
+  ProtoPool pool_;
+  BuiltIns vars_;
+  Db db_;
+  Db other_db_;
+  std::vector<std::unique_ptr<Message>> rows_;
+};
+
+TEST_F(SnapshotFileTest, RoundTrip) {
+  Populate();
+  std::string data;
+  EncodeDbSnapshot(db_, options_, &data);
+  ASSERT_OK(DecodeDbSnapshot(data, options_, &other_db_));
+
+  {
+    ::absl::ReaderMutexLock lock(&other_db_.mu);
+    EXPECT_EQ(2, other_db_.tables.size());
+    EXPECT_FALSE(other_db_.FindTable("Stale"));
+    const Table *t = other_db_.FindTable("People");
+    ASSERT_TRUE(t);
+    ASSERT_EQ(3, t->rows.size());
+    EXPECT_EQ("name: \"bob\" age: 16", t->rows[1]->ShortDebugString());
+    ASSERT_TRUE(other_db_.FindIndex("ByAge"));
+    EXPECT_EQ(t, other_db_.FindIndex("ByAge")->t);
+  }
+  EXPECT_EQ(IndexOrder(db_, "ByAge"), IndexOrder(other_db_, "ByAge"));
+  EXPECT_EQ(IndexOrder(db_, "ByName"), IndexOrder(other_db_, "ByName"));
+  EXPECT_EQ(3, IndexOrder(other_db_, "ByName").size());
+
+  // The restored Db keeps working like the original.
+  ASSERT_OK(Exec("INSERT INTO People (name, age) VALUES ('cat', 5);",
+                 &other_db_));
+  ASSERT_OK(Exec("SELECT name FROM People WHERE age < 15;", &other_db_));
+  ASSERT_EQ(3, rows_.size());
+  EXPECT_EQ("name: \"ann\" age: 7", IndexOrder(other_db_, "ByAge")[1]);
+}
+
+TEST_F(SnapshotFileTest, EncodesCaptureAsOfCaptureTime) {
+  Populate();
+  std::string expected;
+  EncodeDbSnapshot(db_, options_, &expected);
+
+  DbCapture capture;
+  CaptureDb(db_, options_, &capture);
+  // Neither a write nor a dropped table affects the capture.
+  ASSERT_OK(Exec("INSERT INTO People (name, age) VALUES ('cat', 5);", &db_));
+  ASSERT_OK(Exec("DROP TABLE Empty;", &db_));
+  std::string data;
+  EncodeDbCapture(options_, &capture, &data);
+  EXPECT_EQ(expected, data);
+  EXPECT_TRUE(capture.blocks.empty());
+}
+
+TEST_F(SnapshotFileTest, CorruptSnapshotLeavesDbAlone) {
+  Populate();
+  std::string data;
+  EncodeDbSnapshot(db_, options_, &data);
+
+  std::string corrupt = data;
+  corrupt[corrupt.size() - 1] ^= 1;
+  EXPECT_FALSE(DecodeDbSnapshot(corrupt, options_, &other_db_).ok());
+  EXPECT_FALSE(
+      DecodeDbSnapshot(data.substr(0, data.size() - 1), options_, &other_db_)
+          .ok());
+  EXPECT_FALSE(DecodeDbSnapshot("", options_, &other_db_).ok());
+
+  ::absl::ReaderMutexLock lock(&other_db_.mu);
+  EXPECT_TRUE(other_db_.FindTable("Stale"));
+  EXPECT_FALSE(other_db_.FindTable("People"));
+}
+
+TEST_F(SnapshotFileTest, ReadsFile) {
+  Populate();
+  std::string data;
+  EncodeDbSnapshot(db_, options_, &data);
+  const std::string path = ::testing::TempDir() + "/snapshot_file_test";
+  FILE *f = fopen(path.c_str(), "w");
+  ASSERT_TRUE(f);
+  ASSERT_EQ(data.size(), fwrite(data.data(), 1, data.size(), f));
+  ASSERT_EQ(0, fclose(f));
+
+  ASSERT_OK(ReadDbSnapshotFile(path, SnapshotFileOptions(), &other_db_));
+  EXPECT_EQ(IndexOrder(db_, "ByName"), IndexOrder(other_db_, "ByName"));
+  EXPECT_FALSE(
+      ReadDbSnapshotFile(path + ".missing", options_, &other_db_).ok());
+}
+
+}  // namespace
+}  // namespace sfdb
@@ -52,6 +52,10 @@ struct Parser {
   const std::vector<Token> tokens;
   uint32 i;
 
+  // Placeholders seen so far. A statement uses either ? or $n, not both.
+  int32 positional_params = 0;
+  bool numbered_params = false;
+
   inline const Token &LastToken() const { return tokens[i - 1]; }
   inline std::string LastTokenStr() const { return LastToken().ToString(); }
 
@@ -293,6 +297,17 @@ StatusOr<std::unique_ptr<Ast>> ParseValue(Parser *p) {
     // Quoted string.
     return Ast::QuotedString(p->tokens[p->i++].str);
   }
+  if (p->NextTokenIs(Token::PARAM)) {
+    // Placeholder: ? takes the next parameter, $n takes the n-th one.
+    const int64 n = p->tokens[p->i++].i64;
+    if (n ? p->positional_params : p->numbered_params)
+      return Err(p, "Cannot mix ? and $n placeholders");
+    if (n) {
+      p->numbered_params = true;
+      return Ast::Param(static_cast<int32>(n - 1));
+    }
+    return Ast::Param(p->positional_params++);
+  }
   if (p->NextTokenIs(Token::WORD)) {
     // Variable or function call.
     const std::string &var = p->tokens[p->i++].word;
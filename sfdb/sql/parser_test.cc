@@ -302,5 +302,43 @@ TEST(ParserTest, SelectFromWhere) {
   EXPECT_EQ(Value::Int64(21), ast->rhs()->lhs()->rhs()->value());
 }
 
+TEST(ParserTest, PositionalParams) {
+  std::unique_ptr<Ast> ast = Parse(
+      "SELECT name FROM People WHERE age >= ? AND name <> ?;").ValueOrDie();
+  const Ast *where = ast->rhs()->lhs();
+  EXPECT_EQ(Ast::OP_AND, where->type);
+  EXPECT_EQ(Ast::PARAM, where->lhs()->rhs()->type);
+  EXPECT_EQ(std::vector<int32>({0}), where->lhs()->rhs()->column_indices());
+  EXPECT_EQ(Ast::PARAM, where->rhs()->rhs()->type);
+  EXPECT_EQ(std::vector<int32>({1}), where->rhs()->rhs()->column_indices());
+  EXPECT_EQ(2, Ast::CountParams(ast.get()));
+}
+
+TEST(ParserTest, NumberedParams) {
+  std::unique_ptr<Ast> ast = Parse(
+      "INSERT INTO People (name, age) VALUES ($2, $1);").ValueOrDie();
+  EXPECT_EQ(Ast::PARAM, ast->values()[0]->type);
+  EXPECT_EQ(std::vector<int32>({1}), ast->values()[0]->column_indices());
+  EXPECT_EQ(Ast::PARAM, ast->values()[1]->type);
+  EXPECT_EQ(std::vector<int32>({0}), ast->values()[1]->column_indices());
+  EXPECT_EQ(2, Ast::CountParams(ast.get()));
+
+  std::unique_ptr<Ast> bound = Ast::Bind(
+      ast.get(), {Value::Int64(7), Value::String("dude")}).ValueOrDie();
+  EXPECT_EQ(Ast::VALUE, bound->values()[0]->type);
+  EXPECT_EQ(Value::String("dude"), bound->values()[0]->value());
+  EXPECT_EQ(Value::Int64(7), bound->values()[1]->value());
+  EXPECT_EQ(0, Ast::CountParams(bound.get()));
+
+  EXPECT_TRUE(IsInvalidArgument(
+      Ast::Bind(ast.get(), {Value::Int64(7)}).status()));
+}
+
+TEST(ParserTest, MixedParams) {
+  StatusOr<std::unique_ptr<Ast>> so = Parse("SELECT ?, $1;");
+  EXPECT_TRUE(IsInvalidArgument(so.status()));
+  EXPECT_THAT(so.status().error_message(), HasSubstr("Cannot mix"));
+}
+
 }  // namespace
 }  // namespace sfdb
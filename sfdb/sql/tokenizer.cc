@@ -150,6 +150,23 @@ Token ParseNumber(string_view sql, uint32 *i) {
   return Token::Int64(j, *i - j, static_cast<int64>(value));
 }
 
+// Invariant: sql[*i] is $.
+Token ParseNumberedParam(string_view sql, uint32 *i) {
+  const uint32 j = *i;
+  while (++*i < sql.size() && isdigit(sql[*i])) {}
+  if (*i == j + 1) return {Token::ERROR, j, 1, "Expected a number after '$'"};
+  if (*i < sql.size() && IsWordChar(sql[*i])) {
+    return {Token::ERROR, *i, 1, StrCat(
+        "Unexpected '", sql.substr(*i, 1), "'")};
+  }
+  uint64_t value;
+  if (!safe_strtou64_base(sql.substr(j + 1, *i - j - 1), &value, 10) ||
+      value == 0 || value > 0xFFFF) {
+    return {Token::ERROR, j, *i - j, "Bad parameter number"};
+  }
+  return Token::Param(j, *i - j, static_cast<int64>(value));
+}
+
 // Invariant: sql[*i] is ' or ".
 Token ParseQuotedString(string_view sql, uint32 *i) {
   const uint32 j = *i;
@@ -199,6 +216,8 @@ Token ParseToken(string_view sql, uint32 *i) {
   if (c == '^') return {Token::CARET, (*i)++, 1};
   if (c == '/') return {Token::SLASH, (*i)++, 1};
   if (c == '%') return {Token::PERCENT, (*i)++, 1};
+  if (c == '?') return Token::Param((*i)++, 1, 0);
+  if (c == '$') return ParseNumberedParam(sql, i);
   if (c == '<') {
     if (*i + 1 < sql.size()) {
       if (sql[*i + 1] == '=') {
@@ -245,6 +264,11 @@ Token Token::Double(uint32 offset, uint32 len, double value) {
   return {Token::DOUBLE, offset, len, "", "", "", 0, value};
 }
 
+// static
+Token Token::Param(uint32 offset, uint32 len, int64 number) {
+  return {Token::PARAM, offset, len, "", "", "", number};
+}
+
 bool operator==(const Token &a, const Token &b) {
   return a.type == b.type
       && a.offset == b.offset
@@ -296,6 +320,7 @@ std::string Token::ToString() const {
     case Token::CARET: return "^";
     case Token::SLASH: return "/";
     case Token::PERCENT: return "%";
+    case Token::PARAM: return i64 ? StrCat("$", i64) : "?";
     default: LOG(FATAL) << "Invalid toke type " << type
       << " in Token::ToString()";
   }
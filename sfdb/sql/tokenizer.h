@@ -64,6 +64,7 @@ struct Token {
     CARET,  // ^
     SLASH,  // /
     PERCENT,  // %
+    PARAM,  // ?, $1
   };
 
   // these are always set
@@ -76,13 +77,14 @@ struct Token {
   const std::string error;  // when type is ERROR
   const std::string word;   // when type is WORD
   const std::string str;    // the unescaped QUOTED_STRING
-  const int64 i64;     // the INT64 value
+  const int64 i64;     // the INT64 value, or the $n of a PARAM (0 for ?)
   const double dbl;    // the DOUBLE value
 
   static Token Word(uint32 offset, uint32 len, ::absl::string_view full_sql);
   static Token QuotedString(uint32 offset, uint32 len, ::absl::string_view str);
   static Token Int64(uint32 offset, uint32 len, int64 value);
   static Token Double(uint32 offset, uint32 len, double value);
+  static Token Param(uint32 offset, uint32 len, int64 number);
 
   Token() = delete;
 
@@ -255,6 +255,29 @@ TEST(TokenizeTest, Update) {
       }), Go(sql));
 }
 
+TEST(TokenizerTest, Params) {
+  const char *sql = "SELECT * FROM People WHERE age > ? AND id = $12;";
+  EXPECT_EQ(Tokens({
+      Token::Word(0, 6, sql),      // SELECT
+      {Token::STAR, 7, 1},         // *
+      Token::Word(9, 4, sql),      // FROM
+      Token::Word(14, 6, sql),     // People
+      Token::Word(21, 5, sql),     // WHERE
+      Token::Word(27, 3, sql),     // age
+      {Token::GT, 31, 1},          // >
+      Token::Param(33, 1, 0),      // ?
+      Token::Word(35, 3, sql),     // AND
+      Token::Word(39, 2, sql),     // id
+      {Token::EQ, 42, 1},          // =
+      Token::Param(44, 3, 12),     // $12
+      {Token::SEMICOLON, 47, 1}    // ;
+      }), Go(sql));
+
+  EXPECT_THAT(Err("$"), HasSubstr("Expected a number after '$'"));
+  EXPECT_THAT(Err("$0"), HasSubstr("Bad parameter number"));
+  EXPECT_THAT(Err("$1a"), HasSubstr("Unexpected 'a'"));
+}
+
 }  // namespace
 }  // namespace sfdb
 
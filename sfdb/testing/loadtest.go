@@ -20,6 +20,7 @@ var (
 	numRows      = flag.Int("num_rows", 1000, "Number of rows to create in the load test table")
 	insertQPS    = flag.Int("insert_qps", 50, "Number of row insertions per second")
 	heartbeatQPS = flag.Int("heartbeat_qps", -1, "Number of heartbeats per second")
+	batchSize    = flag.Int("batch_size", 1, "Most statements per RPC; above 1, statements that queue up are sent together with ExecSqlBatch")
 )
 
 func execSql(stub api_service.SfdbServiceClient, sql string, done chan error) {
@@ -44,6 +45,27 @@ func execSqlOrDie(stub api_service.SfdbServiceClient, sql string, choke chan int
 	}
 }
 
+func execBatchOrDie(stub api_service.SfdbServiceClient, sqls []string, choke chan interface{}) {
+	req := &api.ExecSqlBatchRequest{}
+	for i := range sqls {
+		req.Statements = append(req.Statements, &api.ExecSqlRequest{Sql: &sqls[i]})
+	}
+	resp, err := stub.ExecSqlBatch(context.Background(), req)
+	if err == nil {
+		for i, result := range resp.GetResults() {
+			if result.GetCode() != 0 {
+				err = fmt.Errorf("%s: %s", sqls[i], result.GetErrorMessage())
+				break
+			}
+		}
+	}
+	if err != nil {
+		log.Error("ExecSqlBatch of ", len(sqls), " statements failed with ", err)
+		os.Exit(1)
+	}
+	<-choke
+}
+
 func vmID(i int) string {
 	return fmt.Sprintf("edge/sfo-shard-%d/%08x", i%4, i^0xdeadbeef)
 }
@@ -72,6 +94,7 @@ func streamHeartbeats(sqls chan string) {
 func execSqls(stub api_service.SfdbServiceClient, sqls chan string) {
 	lastCheckpoint := time.Now()
 	rpcsSinceLastCheckpoint := 0
+	statementsSinceLastCheckpoint := 0
 
 	choke := make(chan interface{}, 20) // max number of concurrent RPCs
 	for {
@@ -79,17 +102,37 @@ func execSqls(stub api_service.SfdbServiceClient, sqls chan string) {
 		if !more {
 			break
 		}
+		batch := []string{sql}
 		choke <- nil
-		go execSqlOrDie(stub, sql, choke)
+		// Whatever queued up while waiting goes along.
+	fill:
+		for len(batch) < *batchSize {
+			select {
+			case sql, more := <-sqls:
+				if !more {
+					break fill
+				}
+				batch = append(batch, sql)
+			default:
+				break fill
+			}
+		}
+		if len(batch) == 1 {
+			go execSqlOrDie(stub, batch[0], choke)
+		} else {
+			go execBatchOrDie(stub, batch, choke)
+		}
 
 		// Print some stats
+		statementsSinceLastCheckpoint += len(batch)
 		rpcsSinceLastCheckpoint += 1
 		now := time.Now()
 		if now.Sub(lastCheckpoint) >= time.Second {
 			seconds := int(now.Sub(lastCheckpoint)/time.Millisecond) / 1000.0
-			log.Infof("%v QPS; %v in flight", rpcsSinceLastCheckpoint/seconds, len(choke))
+			log.Infof("%v QPS; %v statements/s; %v in flight", rpcsSinceLastCheckpoint/seconds, statementsSinceLastCheckpoint/seconds, len(choke))
 			lastCheckpoint = now
 			rpcsSinceLastCheckpoint = 0
+			statementsSinceLastCheckpoint = 0
 		}
 	}
 }
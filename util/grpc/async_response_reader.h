@@ -28,6 +28,7 @@
 
 #include "absl/memory/memory.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "glog/logging.h"
 #include "google/protobuf/message.h"
@@ -36,6 +37,7 @@
 namespace util {
 
 struct RequestOptions {
+  // Relative deadline of the call; zero means no deadline.
   absl::Duration deadline;
   bool delete_after_completion = true;
 };
@@ -52,8 +54,9 @@ struct AsyncResponseReader : public CompletionCallbackIntf {
   AsyncResponseReader(const RequestOptions &opts)
       : started_(false), completed_(false), opts_(opts),
         context_(absl::make_unique<ContextType>()) {
-    // TODO: implement
-    // context_->set_deadline(opts_.deadline);
+    if (opts_.deadline > absl::ZeroDuration()) {
+      context_->set_deadline(absl::ToChronoTime(absl::Now() + opts_.deadline));
+    }
   }
 
   ContextType *context() { return context_.get(); }
@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#ifndef UTIL_GRPC_ASYNC_STREAM_H_
+#define UTIL_GRPC_ASYNC_STREAM_H_
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "glog/logging.h"
+#include "grpcpp/alarm.h"
+#include "grpcpp/client_context.h"
+#include "grpcpp/completion_queue.h"
+#include "grpcpp/generic/generic_stub.h"
+#include "grpcpp/impl/codegen/proto_utils.h"
+#include "grpcpp/support/byte_buffer.h"
+#include "util/grpc/completion_callback.h"
+
+namespace util {
+
+// A long-lived bidirectional streaming call that carries many requests, each
+// of which gets exactly one response, in order. Saves setting up a call for
+// every request, and lets several requests be in flight at once.
+//
+// The stream fails as a whole: when the call ends, or a request gets no
+// response within the timeout, every request still waiting fails. Open a new
+// stream to carry on.
+//
+// The call itself carries serialized messages, as opened through a
+// grpc::GenericStub. Requests are serialized as they are sent, so those that
+// wait for an earlier write only hold on to their bytes.
+//
+// Thread-safe. Deletes itself once it has been closed and all of its
+// operations have completed, so call Close() instead of deleting it.
+template <typename Request, typename Response>
+class GRPCAsyncStream {
+ public:
+  using ReaderWriterType = grpc::GenericClientAsyncReaderWriter;
+  using ResponseCallback = std::function<void(const Response &)>;
+  using FailureCallback = std::function<void()>;
+
+  // Requests that go |timeout| without a response fail the stream.
+  GRPCAsyncStream(absl::Duration timeout, grpc::CompletionQueue *cq)
+      : timeout_(timeout),
+        cq_(cq),
+        start_tag_(this, &GRPCAsyncStream::OnStart),
+        read_tag_(this, &GRPCAsyncStream::OnRead),
+        write_tag_(this, &GRPCAsyncStream::OnWrite),
+        alarm_tag_(this, &GRPCAsyncStream::OnAlarm),
+        finish_tag_(this, &GRPCAsyncStream::OnFinish) {}
+
+  GRPCAsyncStream(const GRPCAsyncStream &) = delete;
+  GRPCAsyncStream &operator=(const GRPCAsyncStream &) = delete;
+
+  grpc::ClientContext *context() { return &context_; }
+
+  void Start(std::unique_ptr<ReaderWriterType> &&stream) {
+    absl::MutexLock l(&mu_);
+    stream_ = std::move(stream);
+    ++pending_ops_;
+    stream_->StartCall(&start_tag_);
+  }
+
+  // Sends |request|, which is serialized before this returns and no longer
+  // needed then. Returns false if the stream has failed; neither callback is
+  // called then. Otherwise, calls exactly one of them later, on a dispatch
+  // thread.
+  bool Send(const Request &request, ResponseCallback on_response,
+            FailureCallback on_failure) {
+    grpc::ByteBuffer bytes;
+    bool own_buffer;
+    if (!grpc::SerializationTraits<Request>::Serialize(request, &bytes,
+                                                       &own_buffer)
+             .ok()) {
+      LOG(ERROR) << "Failed to serialize a request on a stream";
+      return false;
+    }
+    absl::MutexLock l(&mu_);
+    if (failed_) return false;
+    waiting_.push_back({absl::Now() + timeout_, std::move(on_response),
+                        std::move(on_failure)});
+    if (started_ && !writing_) {
+      Write(bytes);
+    } else {
+      unsent_.emplace_back();
+      unsent_.back().Swap(&bytes);
+    }
+    if (!alarm_set_) SetAlarm(waiting_.front().deadline);
+    return true;
+  }
+
+  // Whether Send() would fail. The stream may still fail right after this
+  // returns false.
+  bool failed() const {
+    absl::MutexLock l(&mu_);
+    return failed_;
+  }
+
+  // The status the call ended with, once it has.
+  grpc::Status status() const {
+    absl::MutexLock l(&mu_);
+    return status_;
+  }
+
+  // Cancels the call, unless it has already failed, and lets the stream delete
+  // itself. Drops the callbacks of requests still waiting without calling
+  // them.
+  void Close() {
+    bool done;
+    {
+      absl::MutexLock l(&mu_);
+      closed_ = true;
+      Fail();
+      done = !pending_ops_;
+    }
+    if (done) delete this;
+  }
+
+ private:
+  // Routes a completion queue event to one of the stream's handlers.
+  struct Tag : public CompletionCallbackIntf {
+    GRPCAsyncStream *const stream;
+    void (GRPCAsyncStream::*const handler)(bool ok);
+
+    Tag(GRPCAsyncStream *stream, void (GRPCAsyncStream::*handler)(bool ok))
+        : stream(stream), handler(handler) {}
+
+    void HandleRequestComplete() override { HandleCompletion(true); }
+
+    void HandleCompletion(bool ok) override {
+      // The handlers run under mu_, and only collect callbacks, which run
+      // afterwards, so that they may call Send().
+      std::vector<FailureCallback> failed;
+      std::function<void()> respond;
+      bool done;
+      {
+        absl::MutexLock l(&stream->mu_);
+        --stream->pending_ops_;
+        (stream->*handler)(ok);
+        failed.swap(stream->failed_callbacks_);
+        respond.swap(stream->respond_);
+        done = stream->closed_ && !stream->pending_ops_;
+      }
+      if (respond) respond();
+      RunFailureCallbacks(failed);
+      if (done) delete stream;
+    }
+  };
+
+  // A request waiting for its response.
+  struct Waiting {
+    absl::Time deadline;
+    ResponseCallback on_response;
+    FailureCallback on_failure;
+  };
+
+  ~GRPCAsyncStream() = default;
+
+  static void RunFailureCallbacks(const std::vector<FailureCallback> &v) {
+    for (const FailureCallback &on_failure : v) {
+      if (on_failure) on_failure();
+    }
+  }
+
+  // Once closed, the stream starts no more operations: the completion queue
+  // may be shutting down. Dropping the cancelled call without Finish() is fine.
+  void Read() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    if (closed_) return;
+    ++pending_ops_;
+    stream_->Read(&response_, &read_tag_);
+  }
+
+  // Writing a ByteBuffer only takes references to its slices.
+  void Write(const grpc::ByteBuffer &bytes) EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    writing_ = true;
+    ++pending_ops_;
+    stream_->Write(bytes, &write_tag_);
+  }
+
+  void SetAlarm(absl::Time deadline) EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    alarm_set_ = true;
+    ++pending_ops_;
+    alarm_.Set(cq_, absl::ToChronoTime(deadline), &alarm_tag_);
+  }
+
+  // Unless the stream has failed already, returns the failure callbacks of all
+  // requests still waiting, and cancels the call if it hasn't ended yet, so
+  // that the pending operations complete soon.
+  std::vector<FailureCallback> Fail(bool ended = false)
+      EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    std::vector<FailureCallback> failed;
+    if (failed_) return failed;
+    failed_ = true;
+    if (!ended) context_.TryCancel();
+    if (alarm_set_) alarm_.Cancel();
+    for (Waiting &w : waiting_) failed.push_back(std::move(w.on_failure));
+    waiting_.clear();
+    unsent_.clear();
+    return failed;
+  }
+
+  void OnStart(bool ok) EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    if (!ok || failed_) {
+      failed_callbacks_ = Fail(/*ended=*/!ok);
+      Finish();
+      return;
+    }
+    started_ = true;
+    // A read is always outstanding; it only fails when the call ends.
+    Read();
+    if (!unsent_.empty()) {
+      Write(unsent_.front());
+      unsent_.pop_front();
+    }
+  }
+
+  void OnRead(bool ok) EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    if (!ok) {
+      failed_callbacks_ = Fail(/*ended=*/true);
+      Finish();
+      return;
+    }
+    if (!failed_) {
+      if (waiting_.empty()) {
+        LOG(ERROR) << "Unexpected response on a stream";
+        failed_callbacks_ = Fail();
+      } else {
+        // The response is parsed outside of mu_, by respond_.
+        auto bytes = std::make_shared<grpc::ByteBuffer>();
+        bytes->Swap(&response_);
+        ResponseCallback on_response = std::move(waiting_.front().on_response);
+        FailureCallback on_failure = std::move(waiting_.front().on_failure);
+        waiting_.pop_front();
+        respond_ = [on_response, on_failure, bytes]() {
+          Response response;
+          if (grpc::SerializationTraits<Response>::Deserialize(bytes.get(),
+                                                               &response)
+                  .ok()) {
+            on_response(response);
+          } else {
+            LOG(ERROR) << "Failed to parse a response on a stream";
+            if (on_failure) on_failure();
+          }
+        };
+      }
+    }
+    // Once cancelled, this read fails right away.
+    Read();
+  }
+
+  void OnWrite(bool ok) EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    writing_ = false;
+    if (!ok) {
+      failed_callbacks_ = Fail();
+      return;
+    }
+    if (!failed_ && !unsent_.empty()) {
+      Write(unsent_.front());
+      unsent_.pop_front();
+    }
+  }
+
+  void OnAlarm(bool ok) EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    alarm_set_ = false;
+    if (!ok || failed_ || waiting_.empty()) return;
+    if (waiting_.front().deadline <= absl::Now()) {
+      LOG(WARNING) << "A request on a stream has timed out";
+      failed_callbacks_ = Fail();
+      return;
+    }
+    SetAlarm(waiting_.front().deadline);
+  }
+
+  void Finish() EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    if (closed_) return;
+    ++pending_ops_;
+    stream_->Finish(&status_, &finish_tag_);
+  }
+
+  void OnFinish(bool ok) EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    VLOG(1) << "A stream has ended: " << status_.error_message();
+  }
+
+  const absl::Duration timeout_;
+  grpc::CompletionQueue *const cq_;
+  grpc::ClientContext context_;
+
+  Tag start_tag_;
+  Tag read_tag_;
+  Tag write_tag_;
+  Tag alarm_tag_;
+  Tag finish_tag_;
+
+  mutable absl::Mutex mu_;
+  std::unique_ptr<ReaderWriterType> stream_ GUARDED_BY(mu_);
+  grpc::Alarm alarm_ GUARDED_BY(mu_);
+  grpc::ByteBuffer response_ GUARDED_BY(mu_);
+  grpc::Status status_ GUARDED_BY(mu_);
+
+  // Operations started on the call, or the alarm, that haven't completed.
+  int pending_ops_ GUARDED_BY(mu_) = 0;
+  bool started_ GUARDED_BY(mu_) = false;
+  bool writing_ GUARDED_BY(mu_) = false;
+  bool alarm_set_ GUARDED_BY(mu_) = false;
+  bool failed_ GUARDED_BY(mu_) = false;
+  bool closed_ GUARDED_BY(mu_) = false;
+
+  // Requests that have been sent, oldest first, and the serialized ones among
+  // them that wait for an earlier write to complete.
+  std::deque<Waiting> waiting_ GUARDED_BY(mu_);
+  std::deque<grpc::ByteBuffer> unsent_ GUARDED_BY(mu_);
+
+  // What the current handler leaves for Tag to run outside of mu_.
+  std::vector<FailureCallback> failed_callbacks_ GUARDED_BY(mu_);
+  std::function<void()> respond_ GUARDED_BY(mu_);
+};
+
+}  // namespace util
+
+#endif  // UTIL_GRPC_ASYNC_STREAM_H_
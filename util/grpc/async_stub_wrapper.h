@@ -26,6 +26,7 @@
 
 #include <functional>
 #include <memory>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -35,8 +36,11 @@
 #include "absl/time/time.h"
 #include "glog/logging.h"
 #include "google/protobuf/message.h"
+#include "grpcpp/channel.h"
 #include "grpcpp/completion_queue.h"
+#include "grpcpp/generic/generic_stub.h"
 #include "util/grpc/async_response_reader.h"
+#include "util/grpc/async_stream.h"
 
 namespace util {
 #define STRINGIFY(x) #x
@@ -46,10 +50,11 @@ namespace util {
 // async calls.
 #define DEFINE_ASYNC_GRPC_CALL(call_name, req_type, response_type)             \
   std::unique_ptr<::util::GRPCAsyncResponseReader<response_type>> call_name(   \
-      const req_type &req, ::util::ResponseCallback cb) {                      \
+      const req_type &req, ::util::ResponseCallback cb,                        \
+      const ::util::RequestOptions &opts = ::util::RequestOptions()) {         \
     auto rpc =                                                                 \
         absl::make_unique<::util::GRPCAsyncResponseReader<response_type>>(     \
-            ::util::RequestOptions(), cb);                                     \
+            opts, cb);                                                         \
     VLOG(5) << absl::StrFormat(                                                \
         "New async request " TOSTRING(call_name) "(%" PRId64 ")",              \
         reinterpret_cast<uint64_t>(rpc.get()));                                \
@@ -72,29 +77,61 @@ namespace util {
     return rpc;                                                                \
   }
 
+// Macro to open a GRPCAsyncStream for a bidirectional streaming call of
+// |service|. Returns null if the wrapper has no channel to open it on.
+#define DEFINE_ASYNC_GRPC_STREAM(service, call_name, req_type, response_type)  \
+  ::util::GRPCAsyncStream<req_type, response_type> *call_name(                 \
+      absl::Duration timeout) {                                                \
+    if (!generic_stub_) return nullptr;                                        \
+    auto rpc = new ::util::GRPCAsyncStream<req_type, response_type>(           \
+        timeout, &cq_);                                                        \
+    VLOG(5) << absl::StrFormat(                                                \
+        "New stream " TOSTRING(call_name) "(%" PRId64 ")",                     \
+        reinterpret_cast<uint64_t>(rpc));                                      \
+    rpc->Start(generic_stub_->PrepareCall(                                     \
+        rpc->context(),                                                        \
+        std::string("/") + service::service_full_name() +                      \
+            "/" TOSTRING(call_name),                                           \
+        &cq_));                                                                \
+    return rpc;                                                                \
+  }
+
 template <typename T> class AsyncStubWrapper {
 public:
-  AsyncStubWrapper(std::unique_ptr<T> &&stub, size_t num_dispatch_threads = 1)
-      : stub_(std::move(stub)) {
+  // Streams are opened on |channel|, if set, which must be the one |stub|
+  // uses.
+  AsyncStubWrapper(std::unique_ptr<T> &&stub, size_t num_dispatch_threads = 1,
+                   std::shared_ptr<grpc::Channel> channel = nullptr)
+      : stub_(std::move(stub)),
+        generic_stub_(channel ? absl::make_unique<grpc::GenericStub>(channel)
+                              : nullptr) {
     for (size_t i = 0; i < num_dispatch_threads; ++i) {
       dispatch_threads_.emplace_back(&AsyncStubWrapper<T>::DispatchThreaMain,
                                      this);
     }
   }
 
-  virtual ~AsyncStubWrapper() {
+  virtual ~AsyncStubWrapper() { Shutdown(); };
+
+  // Blocks until the completions of all calls in flight have been handled.
+  // No calls may be started afterwards.
+  void Shutdown() {
+    if (shut_down_) return;
+    shut_down_ = true;
     cq_.Shutdown();
     for (auto &t : dispatch_threads_) {
       if (t.joinable()) {
         t.join();
       }
     }
-  };
+  }
 
 protected:
   std::unique_ptr<T> stub_;
+  std::unique_ptr<grpc::GenericStub> generic_stub_;
   grpc::CompletionQueue cq_;
   std::vector<std::thread> dispatch_threads_;
+  bool shut_down_ = false;
 
   static void DispatchThreaMain(void *arg);
 };
@@ -110,14 +147,12 @@ template <typename T> void AsyncStubWrapper<T>::DispatchThreaMain(void *arg) {
     // TODO: this is not portable, works only on 64bit systems
     VLOG(5) << absl::StrFormat("Got response %" PRId64,
                                reinterpret_cast<uint64_t>(got_tag));
-    GPR_ASSERT(ok);
-
     // The tag in this example is the memory location of the call object
     auto rpc = static_cast<CompletionCallbackIntf *>(got_tag);
     CHECK(rpc);
 
     // Let call object manage itself.
-    rpc->HandleRequestComplete();
+    rpc->HandleCompletion(ok);
   }
 }
 
@@ -22,6 +22,8 @@
 #ifndef UTIL_GRPC_COMPLETION_CALLBACK_H_
 #define UTIL_GRPC_COMPLETION_CALLBACK_H_
 
+#include "grpc/support/log.h"
+
 namespace util {
 // Callback class for async requests which rely on callback mechanics of passing
 // response. RPC response will be provided to callback.
@@ -29,6 +31,14 @@ struct CompletionCallbackIntf {
   // Should be called by child class upon request completion.
   virtual void HandleRequestComplete() = 0;
 
+  // Called by the dispatch thread with the |ok| flag of the completion queue.
+  // Operations that may fail without the whole call failing, such as reads and
+  // writes on streams, override this instead.
+  virtual void HandleCompletion(bool ok) {
+    GPR_ASSERT(ok);
+    HandleRequestComplete();
+  }
+
   // Virtual destructor.
   virtual ~CompletionCallbackIntf() = default;
 };
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "util/hash/crc32c.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+namespace util {
+namespace {
+
+#if !defined(__SSE4_2__)
+// Reflected CRC-32C polynomial.
+constexpr uint32 kPoly = 0x82f63b78;
+
+std::array<uint32, 256> MakeTable() {
+  std::array<uint32, 256> table;
+  for (uint32 i = 0; i < 256; ++i) {
+    uint32 c = i;
+    for (int k = 0; k < 8; ++k) c = (c & 1) ? (c >> 1) ^ kPoly : c >> 1;
+    table[i] = c;
+  }
+  return table;
+}
+#endif
+
+}  // namespace
+
+uint32 Crc32c(absl::string_view data, uint32 crc) {
+  const char *p = data.data();
+  size_t n = data.size();
+  crc = ~crc;
+#if defined(__SSE4_2__)
+  for (; n >= 8; p += 8, n -= 8) {
+    uint64 word;
+    memcpy(&word, p, sizeof(word));
+    crc = static_cast<uint32>(_mm_crc32_u64(crc, word));
+  }
+  for (; n; ++p, --n) crc = _mm_crc32_u8(crc, static_cast<uint8>(*p));
+#else
+  static const std::array<uint32, 256> table = MakeTable();
+  for (; n; ++p, --n) crc = table[(crc ^ static_cast<uint8>(*p)) & 0xff] ^ (crc >> 8);
+#endif
+  return ~crc;
+}
+
+}  // namespace util
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#ifndef UTIL_HASH_CRC32C_H_
+#define UTIL_HASH_CRC32C_H_
+
+#include "absl/strings/string_view.h"
+#include "util/types/integral_types.h"
+
+namespace util {
+
+// Returns the CRC-32C (Castagnoli) checksum of |data|. To checksum data that
+// arrives in pieces, pass the checksum of the preceding pieces as |crc|.
+uint32 Crc32c(absl::string_view data, uint32 crc = 0);
+
+}  // namespace util
+
+#endif  // UTIL_HASH_CRC32C_H_
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "util/hash/fingerprint.h"
+
+namespace util {
+namespace {
+
+constexpr uint64 kOffsetBasis = 0xcbf29ce484222325ULL;
+constexpr uint64 kPrime = 0x100000001b3ULL;
+
+}  // namespace
+
+uint64 Fingerprint64(absl::string_view data) {
+  uint64 h = kOffsetBasis;
+  for (const char c : data) {
+    h ^= static_cast<unsigned char>(c);
+    h *= kPrime;
+  }
+  return h;
+}
+
+}  // namespace util
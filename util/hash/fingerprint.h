@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2019 Google LLC.
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#ifndef UTIL_HASH_FINGERPRINT_H_
+#define UTIL_HASH_FINGERPRINT_H_
+
+#include "absl/strings/string_view.h"
+#include "util/types/integral_types.h"
+
+namespace util {
+
+// Returns a 64-bit fingerprint (FNV-1a) of |data|. Stable across processes
+// and builds, so fingerprints can be stored and sent over the wire. Not
+// meant to resist deliberate collisions.
+uint64 Fingerprint64(absl::string_view data);
+
+}  // namespace util
+
+#endif  // UTIL_HASH_FINGERPRINT_H_